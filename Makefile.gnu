@@ -1,19 +1,84 @@
 CC=gcc
 CFLAGS=-ansi -Wall -pedantic -O3 -DNDEBUG
+LDLIBS=-lpthread -lm
 
-.PHONY: clean all
+.PHONY: clean all bench bench-sim
 
-all: fnmib fnmspioi
+all: fnmib fnmspioi fanimaed fnmmp fnmquery fnmpairs
 
-fnmspioi: fnmspioi.o oakpark.o
+fnmspioi: fnmspioi.o fnmpioi.o fnmseq.o oakpark.o
 
-fnmib: fnmib.o oakpark.o
+fnmib: fnmib.o fnmingest.o fnmmanifest.o fnmmidi.o fnmseq.o fnmlsh.o \
+       oakpark.o
 
-fnmspioi.o: fnmspioi.c oakpark.h
+fnmmp: fnmmp.o fnmingest.o fnmmanifest.o fnmmidi.o
 
-fnmib.o: fnmib.c oakpark.h
+fanimaed: fanimaed.o fnmpioi.o fnmngr5.o fnmseq.o fnmlsh.o fnmfm.o \
+          oakpark.o
 
+fnmquery: fnmquery.o fnmpioi.o fnmngr5.o fnmingest.o fnmmanifest.o \
+          fnmmidi.o fnmseq.o fnmlsh.o fnmfm.o oakpark.o
+
+fnmpairs: fnmpairs.o fnmpioi.o fnmseq.o oakpark.o
+
+fnmbench: fnmbench.o fnmpioi.o fnmngr5.o fnmseq.o fnmlsh.o fnmfm.o \
+          fnmmidi.o oakpark.o
+
+fnmspioi.o: fnmspioi.c fnmpioi.h oakpark.h
+
+fnmib.o: fnmib.c fanimae.h oakpark.h fnmingest.h fnmmidi.h fnmmanifest.h \
+         fnmseq.h fnmlsh.h fnmfm.h
+
+fnmmp.o: fnmmp.c fanimae.h fnmmidi.h fnmingest.h fnmmanifest.h
+
+fnmingest.o: fnmingest.c fnmingest.h fnmmidi.h fnmmanifest.h
+
+fnmmanifest.o: fnmmanifest.c fnmmanifest.h
+
+fnmmidi.o: fnmmidi.c fnmmidi.h
+
+fanimaed.o: fanimaed.c fanimae.h fnmpioi.h fnmngr5.h fnmseq.h fnmlsh.h \
+            fnmfm.h oakpark.h
+
+fnmquery.o: fnmquery.c fanimae.h fnmpioi.h fnmngr5.h fnmmidi.h \
+            fnmingest.h fnmmanifest.h fnmseq.h fnmlsh.h fnmfm.h \
+            oakpark.h
+
+fnmpairs.o: fnmpairs.c fanimae.h fnmpioi.h oakpark.h
+
+fnmbench.o: fnmbench.c fanimae.h fnmpioi.h fnmngr5.h fnmseq.h fnmlsh.h \
+            fnmfm.h fnmmidi.h oakpark.h
+
+fnmpioi.o: fnmpioi.c fanimae.h fnmpioi.h fnmseq.h oakpark.h
+
+fnmngr5.o: CPPFLAGS += -DNGR5_USE_MMAP
+fnmngr5.o: fnmngr5.c fnmngr5.h fanimae.h fnmpioi.h fnmseq.h fnmlsh.h \
+           fnmfm.h oakpark.h
+
+fnmseq.o: fnmseq.c fnmseq.h fanimae.h oakpark.h
+
+fnmlsh.o: fnmlsh.c fnmlsh.h fanimae.h oakpark.h
+
+fnmfm.o: fnmfm.c fnmfm.h fanimae.h
+
+oakpark.o: CPPFLAGS += -DOAKPARK_USE_MMAP
 oakpark.o: oakpark.c oakpark.h
 
+# FNM_BENCH_NUM_OF_TRACKS, FNM_BENCH_NUM_OF_QUERIES, FNM_BENCH_SEED
+# and FNM_BENCH_THREADS size the benchmarks
+BENCH_DIR=bench.d
+
+bench: fnmbench fnmib
+	mkdir -p $(BENCH_DIR)
+	./fnmbench gen $(BENCH_DIR)/coll.seq $(BENCH_DIR)/query.seq
+	./fnmbench build $(BENCH_DIR)/idx $(BENCH_DIR)/coll.seq
+	./fnmbench query ngr5 $(BENCH_DIR)/idx $(BENCH_DIR)/query.seq
+	./fnmbench query pioi $(BENCH_DIR)/coll.seq $(BENCH_DIR)/query.seq
+
+bench-sim: fnmbench
+	./fnmbench sim
+
 clean:
-	rm -f *.o fnmib fnmspioi
+	rm -f *.o fnmib fnmspioi fanimaed fnmmp fnmquery fnmpairs \
+	      fnmbench
+	rm -rf $(BENCH_DIR)
@@ -13,6 +13,22 @@
 #define P_INVLIST_SUFFIX_LEN strlen(P_INVLIST_SUFFIX)
 #define DOCLOOKUP_SUFFIX ".fdl"
 #define DOCLOOKUP_SUFFIX_LEN strlen(DOCLOOKUP_SUFFIX)
+/* the titles of the document lookup, to look one up without
+ * reading the others: DOCTITLES_MAGIC, the number of documents,
+ * the position in the file of the title of every document and
+ * the size of the file, as 4-byte little-endian integers, then
+ * the titles, each ending with a '\0' in place of the '\n'
+ */
+#define DOCTITLES_SUFFIX ".fdt"
+#define DOCTITLES_MAGIC "FDTI"
+#define DOCTITLES_HDR_SIZE 8
+/* the titles of the documents whose pitch sequences are those of
+ * an earlier document, which stands for them in the index: a
+ * "number title" line per title, the number being that of the
+ * earlier document
+ */
+#define DOCDUPS_SUFFIX ".fdd"
+#define DOCDUPS_SUFFIX_LEN strlen(DOCDUPS_SUFFIX)
 #define P_DM12_ALPHABET "abcdefghijklmnopqrstuvwxy"
 #define P_DM12_ALPHABET_SIZE strlen(P_DM12_ALPHABET)
 #define NUM_OF_GRAMS 5
@@ -0,0 +1,1317 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * Search daemon
+ *
+ * Copyright 2010 by RMIT MIRT Project.
+ * Copyright 2010 by Iman S. H. Suyoto.
+ *
+ * fanimaed loads an ngr5 index and a pioi collection once and
+ * answers queries over a Unix-domain stream socket.
+ *
+ * Protocol: every message in either direction is a frame made
+ * of a 4-byte big-endian payload length followed by the
+ * payload. A request payload is the algorithm name ("ngr5",
+ * "lsh", "exact", "pioi" or "seed"), a space, and a Fanimae
+ * sequence line ("pi:title***pitch***ioi"). The response payload
+ * is the query title followed by the answers, each preceded by a
+ * space, as printed by the command-line searchers with "q". A
+ * response payload starting with '!' is an error message. A
+ * client may send any number of requests on one connection.
+ *
+ * The workers take requests rather than connections: idle
+ * connections are polled by the main thread, which queues those
+ * with a request for the next free worker, so any number of
+ * clients may keep a connection open. A read or write that blocks
+ * for FNM_IO_TIMEOUT seconds drops the connection.
+ *
+ * With "+scores" appended to the algorithm name (e.g.
+ * "pioi+scores"), the answers are sorted best first and each is
+ * put on a line of its own after its score, so that the
+ * answers of several daemons can be merged.
+ *
+ * With -c, fanimaed is a coordinator: it loads nothing, sends
+ * every request with "+scores" to the fanimaed processes serving
+ * the shards of a collection, and answers with the best of their
+ * answers. A shard being restarted is reconnected to.
+ *
+ * Before answering a request, fanimaed checks whether the index
+ * or the collection file has been replaced (e.g. by publishing a
+ * new index generation) and, if so, loads the new one. Requests
+ * being answered keep using the generation they started with,
+ * which is released once the last of them is done.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "fanimae.h"
+#include "fnmpioi.h"
+#include "fnmngr5.h"
+
+#define DEFAULT_NUM_OF_ANSWERS 10
+#define DEFAULT_NUM_OF_THREADS 4
+#define MAX_FRAME_SIZE (1024 * 1024UL)
+#define CONN_QUEUE_SIZE 64
+#define LISTEN_BACKLOG 64
+#define DEFAULT_IO_TIMEOUT 60
+/* appended to the algorithm name to ask for scored answers */
+#define SCORES_OPTION "+scores"
+#define SCORES_OPTION_LEN (sizeof SCORES_OPTION - 1)
+
+/* identity of a file, to notice when it is replaced */
+struct file_sig {
+    int exists;
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    off_t size;
+};
+
+/* a loaded index and collection, shared read-only by the
+ * requests using it
+ */
+struct generation {
+    struct ngr5_idx *idx;
+    struct coll_block coll;
+    /* positional index of coll, NULL unless FNM_SEED_LEN is set */
+    struct seed_idx *seeds;
+    struct file_sig idx_sig;
+    struct file_sig coll_sig;
+    unsigned long serial;
+    /* requests using the generation, plus one while current */
+    size_t refs;
+};
+
+struct searchers {
+    const char *idx_fn;
+    const char *coll_fn;
+    pthread_mutex_t lock;
+    struct generation *current;
+    unsigned long num_of_generations;
+    int is_loading;
+    /* files that failed to load, not to be retried */
+    struct file_sig failed_idx_sig;
+    struct file_sig failed_coll_sig;
+    unsigned short num_of_answers;
+};
+
+/* connections with a request waiting for a worker, and those
+ * whose request has been answered, waiting to be polled again
+ */
+struct conn_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    int fds[CONN_QUEUE_SIZE];
+    size_t head;
+    size_t num_of_fds;
+    int *idle_fds;
+    size_t num_of_idle_fds;
+    size_t max_num_of_idle_fds;
+    /* a byte written to wake_fds[1] wakes the poller up */
+    int wake_fds[2];
+};
+
+/* a growable response buffer */
+struct out_buf {
+    char *s;
+    size_t len;
+    size_t size;
+};
+
+/* the workers answering for the shards of a collection */
+struct shards {
+    char **sock_fns;
+    size_t num_of_shards;
+    unsigned short num_of_answers;
+};
+
+/* the connection of a coordinator worker to a shard, and the
+ * last response received on it
+ */
+struct shard_conn {
+    int fd;
+    char *buf;
+    size_t buf_size;
+    size_t len;
+};
+
+/* an answer from a shard, to be merged */
+struct shard_answer {
+    double score;
+    const char *title;
+    size_t rank;
+    size_t shard;
+};
+
+/* the answers of all the shards to a request */
+struct merge {
+    struct shard_answer *items;
+    size_t len;
+    size_t size;
+};
+
+static struct searchers searchers;
+static struct shards shards;
+static struct conn_queue conn_queue;
+/* longest a read or write on a connection may block */
+static struct timeval io_timeout;
+static volatile sig_atomic_t is_stopping = 0;
+
+/* signal handler to stop accepting connections */
+static void stop(int sig)
+{
+    (void)sig;
+    is_stopping = 1;
+}
+
+/* read exactly len bytes; return 0 on end of stream or error */
+static int read_full(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/* write exactly len bytes; return 0 on error */
+static int write_full(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 0;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/* send a frame */
+static int write_frame(int fd, const char *payload, size_t len)
+{
+    unsigned char hdr[4];
+
+    hdr[0] = (len >> 24) & 0xff;
+    hdr[1] = (len >> 16) & 0xff;
+    hdr[2] = (len >> 8) & 0xff;
+    hdr[3] = len & 0xff;
+    return write_full(fd, hdr, sizeof hdr) &&
+           write_full(fd, payload, len);
+}
+
+/* receive a frame into *buf, growing it as needed
+ * return: 1 on success, 0 on end of stream or error
+ */
+static int read_frame(int fd, char **buf, size_t *buf_size,
+                      size_t *len)
+{
+    unsigned char hdr[4];
+
+    if (!read_full(fd, hdr, sizeof hdr)) {
+        return 0;
+    }
+    *len = ((unsigned long)hdr[0] << 24) |
+           ((unsigned long)hdr[1] << 16) |
+           ((unsigned long)hdr[2] << 8) |
+           (unsigned long)hdr[3];
+    if (*len > MAX_FRAME_SIZE) {
+        return 0;
+    }
+    if (*len + 1 > *buf_size) {
+        void *tmp = realloc(*buf, *len + 1);
+
+        if (!tmp) {
+            return 0;
+        }
+        *buf = tmp;
+        *buf_size = *len + 1;
+    }
+    if (!read_full(fd, *buf, *len)) {
+        return 0;
+    }
+    (*buf)[*len] = '\0';
+    return 1;
+}
+
+/* append a string to a response */
+static int append(struct out_buf *out, const char *s)
+{
+    size_t len = strlen(s);
+
+    if (out->len + len + 1 > out->size) {
+        size_t size = out->size ? out->size : 256;
+        void *tmp = NULL;
+
+        while (out->len + len + 1 > size) {
+            size *= 2;
+        }
+        if (!(tmp = realloc(out->s, size))) {
+            return 0;
+        }
+        out->s = tmp;
+        out->size = size;
+    }
+    memcpy(out->s + out->len, s, len + 1);
+    out->len += len;
+    return 1;
+}
+
+/* format answers the way the command-line searchers do */
+static int format_answers(struct out_buf *out, const char *title,
+                          const struct answers *answers)
+{
+    const struct answer *curr = answers->items +
+                                answers->num_of_answers;
+
+    if (!append(out, title)) {
+        return 0;
+    }
+    while (curr != answers->items) {
+        if (!append(out, " ") || !append(out, (--curr)->title)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* format answers best first, each on a line of its own after its
+ * score, for a coordinator to merge
+ */
+static int format_scored_answers(struct out_buf *out,
+                                 const char *title,
+                                 struct answers *answers)
+{
+    const struct answer *curr = NULL;
+    char score[32];
+
+    sort_answers(answers);
+    curr = answers->items + answers->num_of_answers;
+    if (!append(out, title)) {
+        return 0;
+    }
+    while (curr != answers->items) {
+        /* enough digits for the score to survive the round
+         * trip unchanged
+         */
+        sprintf(score, "\n%.17g ", (--curr)->score);
+        if (!append(out, score) || !append(out, curr->title)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* strip the scores option from an algorithm name
+ * return: 1 if the option was given
+ *         0 otherwise
+ */
+static int strip_scores_option(char *algo)
+{
+    size_t len = strlen(algo);
+
+    if (len > SCORES_OPTION_LEN &&
+        strcmp(algo + len - SCORES_OPTION_LEN,
+               SCORES_OPTION) == 0) {
+        algo[len - SCORES_OPTION_LEN] = '\0';
+        return 1;
+    }
+    return 0;
+}
+
+/* answer a request payload */
+static int answer_request(char *payload,
+                          const struct generation *gen,
+                          struct answers *answers,
+                          struct ngr5_scratch *scratch,
+                          struct out_buf *out)
+{
+    char *line = strchr(payload, ' ');
+    struct query query;
+    int is_scored = 0;
+
+    out->len = 0;
+    if (!line) {
+        return append(out, "!Missing algorithm");
+    }
+    *line++ = '\0';
+    is_scored = strip_scores_option(payload);
+    query.line = line;
+    query.answers = answers;
+    query.stats = NULL;
+    if (!parse_seq(line, &query.title,
+                   &query.pitch_seq, &query.ioi_seq)) {
+        return append(out, "!Invalid query");
+    }
+
+    clear_answers(answers);
+    if (strcmp(payload, "ngr5") == 0) {
+        if (!gen->idx) {
+            return append(out, "!No ngr5 index loaded");
+        }
+        if (!scratch) {
+            return append(out, "!Out of memory");
+        }
+        if (!ngr5_query(gen->idx, scratch,
+                        query.pitch_seq, answers)) {
+            return append(out, "!Erratic query");
+        }
+    } else if (strcmp(payload, "lsh") == 0) {
+        if (!gen->idx || !gen->idx->sketch) {
+            return append(out, "!No sketch index loaded");
+        }
+        if (!scratch) {
+            return append(out, "!Out of memory");
+        }
+        if (!ngr5_lsh_query(gen->idx, scratch,
+                            query.pitch_seq, answers)) {
+            return append(out, "!Erratic query");
+        }
+    } else if (strcmp(payload, "exact") == 0) {
+        if (!gen->idx || !gen->idx->fm) {
+            return append(out, "!No FM-index loaded");
+        }
+        if (!scratch) {
+            return append(out, "!Out of memory");
+        }
+        if (!ngr5_exact_query(gen->idx, scratch,
+                              query.pitch_seq, answers)) {
+            return append(out, "!Erratic query");
+        }
+    } else if (strcmp(payload, "pioi") == 0) {
+        if (!gen->coll.docs) {
+            return append(out, "!No pioi collection loaded");
+        }
+        if (!align_coll_block(&gen->coll, &query, 1)) {
+            return append(out, "!Query failed");
+        }
+    } else if (strcmp(payload, "seed") == 0) {
+        if (!gen->seeds) {
+            return append(out, "!No positional index loaded");
+        }
+        if (!seed_coll_block(gen->seeds, &query, 1)) {
+            return append(out, "!Query failed");
+        }
+    } else {
+        return append(out, "!Invalid algorithm");
+    }
+    return is_scored ?
+           format_scored_answers(out, query.title, answers) :
+           format_answers(out, query.title, answers);
+}
+
+/* take the next connection from the queue */
+static int pop_conn(void)
+{
+    int fd;
+
+    pthread_mutex_lock(&conn_queue.lock);
+    while (conn_queue.num_of_fds == 0) {
+        pthread_cond_wait(&conn_queue.not_empty, &conn_queue.lock);
+    }
+    fd = conn_queue.fds[conn_queue.head];
+    conn_queue.head = (conn_queue.head + 1) % CONN_QUEUE_SIZE;
+    conn_queue.num_of_fds--;
+    pthread_cond_signal(&conn_queue.not_full);
+    pthread_mutex_unlock(&conn_queue.lock);
+    return fd;
+}
+
+/* put a connection on the queue, waiting for room */
+static void push_conn(int fd)
+{
+    pthread_mutex_lock(&conn_queue.lock);
+    while (conn_queue.num_of_fds == CONN_QUEUE_SIZE) {
+        pthread_cond_wait(&conn_queue.not_full, &conn_queue.lock);
+    }
+    conn_queue.fds[(conn_queue.head + conn_queue.num_of_fds) %
+                   CONN_QUEUE_SIZE] = fd;
+    conn_queue.num_of_fds++;
+    pthread_cond_signal(&conn_queue.not_empty);
+    pthread_mutex_unlock(&conn_queue.lock);
+}
+
+/* hand a connection whose request has been answered back to the
+ * poller, or close it if it can't be
+ */
+static void return_conn(int fd)
+{
+    int is_returned = 1;
+
+    pthread_mutex_lock(&conn_queue.lock);
+    if (conn_queue.num_of_idle_fds == conn_queue.max_num_of_idle_fds) {
+        size_t n = conn_queue.max_num_of_idle_fds ?
+                   conn_queue.max_num_of_idle_fds * 2 : 16;
+        void *tmp = realloc(conn_queue.idle_fds,
+                            n * sizeof *conn_queue.idle_fds);
+
+        if (tmp) {
+            conn_queue.idle_fds = tmp;
+            conn_queue.max_num_of_idle_fds = n;
+        } else {
+            is_returned = 0;
+        }
+    }
+    if (is_returned) {
+        conn_queue.idle_fds[conn_queue.num_of_idle_fds++] = fd;
+    }
+    pthread_mutex_unlock(&conn_queue.lock);
+    if (!is_returned) {
+        close(fd);
+        return;
+    }
+    /* the pipe is only full if the poller has yet to wake up */
+    while (write(conn_queue.wake_fds[1], "", 1) < 0 &&
+           errno == EINTR) {
+    }
+}
+
+/* bound the time a read or write on a connection may block */
+static void set_io_timeout(int fd)
+{
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &io_timeout,
+               sizeof io_timeout);
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &io_timeout,
+               sizeof io_timeout);
+}
+
+/*
+ * function: resolve_fn
+ * param: fn: index or collection filename, or "-"
+ *        path: space for FILENAME_MAX characters
+ * return: 1 on success
+ *         0 if the directory of fn can't be resolved
+ * purpose: resolves the directory of fn through symbolic links,
+ *          e.g. the .fnm/current link to an index generation, so
+ *          that every file of a load is taken from the same
+ *          directory even if the link is replaced meanwhile
+ */
+static int resolve_fn(const char *fn, char *path)
+{
+    const char *base = strrchr(fn, '/');
+    char dir_name[FILENAME_MAX];
+    char *dir = NULL;
+    int result = 0;
+
+    if (strcmp(fn, "-") == 0) {
+        strcpy(path, fn);
+        return 1;
+    }
+    if (!base) {
+        strcpy(dir_name, ".");
+        base = fn;
+    } else if ((size_t)(base - fn) >= sizeof dir_name) {
+        return 0;
+    } else {
+        /* the directory of "/fn" is the root */
+        memcpy(dir_name, fn, base > fn ? base - fn : 1);
+        dir_name[base > fn ? base - fn : 1] = '\0';
+        ++base;
+    }
+    if ((dir = realpath(dir_name, NULL)) != NULL &&
+        strlen(dir) + strlen(base) + 2 <= FILENAME_MAX) {
+        sprintf(path, "%s/%s", dir, base);
+        result = 1;
+    }
+    free(dir);
+    return result;
+}
+
+/* get the identity of a file; fn may be "-" */
+static void get_file_sig(const char *fn, const char *suffix,
+                         struct file_sig *sig)
+{
+    char path[FILENAME_MAX];
+    struct stat st;
+
+    memset(sig, 0, sizeof *sig);
+    if (strcmp(fn, "-") == 0 ||
+        strlen(fn) + strlen(suffix) >= sizeof path) {
+        return;
+    }
+    sprintf(path, "%s%s", fn, suffix);
+    if (stat(path, &st) == 0) {
+        sig->exists = 1;
+        sig->dev = st.st_dev;
+        sig->ino = st.st_ino;
+        sig->mtime = st.st_mtime;
+        sig->size = st.st_size;
+    }
+}
+
+static int is_same_file_sig(const struct file_sig *a,
+                            const struct file_sig *b)
+{
+    return a->exists == b->exists && a->dev == b->dev &&
+           a->ino == b->ino && a->mtime == b->mtime &&
+           a->size == b->size;
+}
+
+/* release a generation */
+static void destroy_generation(struct generation *gen)
+{
+    if (gen) {
+        ngr5_close(gen->idx);
+        destroy_seed_idx(gen->seeds);
+        destroy_coll_block(&gen->coll);
+        free(gen);
+    }
+}
+
+/* load the index and the collection as a new generation, from
+ * the paths resolved by resolve_fn()
+ */
+static struct generation *load_generation(const char *idx_fn,
+                                          const char *coll_fn,
+                                          const struct file_sig
+                                          *idx_sig,
+                                          const struct file_sig
+                                          *coll_sig)
+{
+    struct generation *gen = calloc(1, sizeof *gen);
+
+    if (!gen) {
+        return NULL;
+    }
+    gen->idx_sig = *idx_sig;
+    gen->coll_sig = *coll_sig;
+    gen->refs = 1;
+    if (strcmp(idx_fn, "-") != 0) {
+        fprintf(stderr, "Loading index %s...\n", idx_fn);
+        if (!(gen->idx = ngr5_open(idx_fn))) {
+            destroy_generation(gen);
+            return NULL;
+        }
+    }
+    if (strcmp(coll_fn, "-") != 0) {
+        FILE *coll_fp = fopen(coll_fn, "r");
+        struct oakpark_reader *coll_reader = NULL;
+        int failed = 0;
+
+        fprintf(stderr, "Loading collection %s...\n", coll_fn);
+        if (!coll_fp) {
+            fprintf(stderr, "Can't open ");
+            perror(coll_fn);
+            destroy_generation(gen);
+            return NULL;
+        }
+        if (!(coll_reader = oakpark_open_reader(coll_fp))) {
+            fclose(coll_fp);
+            destroy_generation(gen);
+            return NULL;
+        }
+        read_coll_block(coll_reader, &gen->coll, (size_t)-1,
+                        &failed);
+        oakpark_close_reader(coll_reader);
+        fclose(coll_fp);
+        if (failed ||
+            (getenv("FNM_SEED_LEN") &&
+             !(gen->seeds = create_seed_idx(&gen->coll)))) {
+            destroy_generation(gen);
+            return NULL;
+        }
+    }
+    return gen;
+}
+
+/* drop a reference to a generation; call with the lock held */
+static void unref_generation(struct generation *gen)
+{
+    if (--gen->refs == 0) {
+        destroy_generation(gen);
+    }
+}
+
+/*
+ * take a reference to the current generation, loading a new one
+ * first if the index or the collection has been replaced. Other
+ * workers keep answering with the current generation while it is
+ * loaded.
+ */
+static struct generation *acquire_generation(void)
+{
+    char idx_fn[FILENAME_MAX];
+    char coll_fn[FILENAME_MAX];
+    struct file_sig idx_sig;
+    struct file_sig coll_sig;
+    struct generation *gen = NULL;
+    /* a link being replaced is resolved again by a later request */
+    int is_resolved = resolve_fn(searchers.idx_fn, idx_fn) &&
+                      resolve_fn(searchers.coll_fn, coll_fn);
+
+    if (is_resolved) {
+        get_file_sig(idx_fn, P_INVLISTPTR_SUFFIX, &idx_sig);
+        get_file_sig(coll_fn, "", &coll_sig);
+    }
+
+    pthread_mutex_lock(&searchers.lock);
+    if (is_resolved && !searchers.is_loading &&
+        (!is_same_file_sig(&idx_sig,
+                           &searchers.current->idx_sig) ||
+         !is_same_file_sig(&coll_sig,
+                           &searchers.current->coll_sig)) &&
+        !(is_same_file_sig(&idx_sig, &searchers.failed_idx_sig) &&
+          is_same_file_sig(&coll_sig,
+                           &searchers.failed_coll_sig))) {
+        struct generation *loaded = NULL;
+
+        searchers.is_loading = 1;
+        pthread_mutex_unlock(&searchers.lock);
+        loaded = load_generation(idx_fn, coll_fn, &idx_sig,
+                                 &coll_sig);
+        pthread_mutex_lock(&searchers.lock);
+        searchers.is_loading = 0;
+        if (loaded) {
+            loaded->serial = ++searchers.num_of_generations;
+            unref_generation(searchers.current);
+            searchers.current = loaded;
+            fprintf(stderr, "Serving generation %lu\n",
+                    loaded->serial);
+        } else {
+            fprintf(stderr, "Keeping generation %lu\n",
+                    searchers.current->serial);
+            searchers.failed_idx_sig = idx_sig;
+            searchers.failed_coll_sig = coll_sig;
+        }
+    }
+    gen = searchers.current;
+    gen->refs++;
+    pthread_mutex_unlock(&searchers.lock);
+    return gen;
+}
+
+/* drop a reference taken by acquire_generation() */
+static void release_generation(struct generation *gen)
+{
+    pthread_mutex_lock(&searchers.lock);
+    unref_generation(gen);
+    pthread_mutex_unlock(&searchers.lock);
+}
+
+/* worker thread: answer requests one at a time */
+static void *serve(void *arg)
+{
+    struct answers *answers = create_answers
+                              (searchers.num_of_answers);
+    /* scratch space for the index of a generation */
+    struct ngr5_scratch *scratch = NULL;
+    unsigned long scratch_serial = 0;
+    struct out_buf out = { NULL, 0, 0 };
+    char *buf = NULL;
+    size_t buf_size = 0;
+
+    (void)arg;
+    if (!answers) {
+        fprintf(stderr, "Can't allocate memory for a worker "
+                        "in %s:%d\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    for (;;) {
+        int fd = pop_conn();
+        size_t len = 0;
+        struct generation *gen = NULL;
+        int is_answered;
+
+        if (!read_frame(fd, &buf, &buf_size, &len)) {
+            close(fd);
+            continue;
+        }
+        gen = acquire_generation();
+        if (gen->idx && (!scratch ||
+                         scratch_serial != gen->serial)) {
+            ngr5_destroy_scratch(scratch);
+            scratch = ngr5_create_scratch(gen->idx);
+            scratch_serial = gen->serial;
+        }
+        is_answered = answer_request(buf, gen, answers,
+                                     scratch, &out);
+        release_generation(gen);
+        if (!is_answered) {
+            out.len = 0;
+            is_answered = append(&out, "!Out of memory");
+        }
+        if (is_answered && write_frame(fd, out.s, out.len)) {
+            return_conn(fd);
+        } else {
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+/* connect to a shard; return -1 on failure */
+static int connect_to(const char *sock_fn)
+{
+    struct sockaddr_un addr;
+    int fd = -1;
+
+    if (strlen(sock_fn) >= sizeof addr.sun_path) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sock_fn);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+        close(fd);
+        return -1;
+    }
+    set_io_timeout(fd);
+    return fd;
+}
+
+/* forget a connection to a shard */
+static void disconnect_shard(struct shard_conn *conn)
+{
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+}
+
+/* send a request to a shard, connecting first if needed */
+static int send_to_shard(struct shard_conn *conn, size_t shard,
+                         const struct out_buf *request)
+{
+    if (conn->fd < 0 &&
+        (conn->fd = connect_to(shards.sock_fns[shard])) < 0) {
+        return 0;
+    }
+    if (!write_frame(conn->fd, request->s, request->len)) {
+        disconnect_shard(conn);
+        return 0;
+    }
+    return 1;
+}
+
+/* receive the response of a shard to a request sent by
+ * send_to_shard(). A connection the shard has closed since the
+ * previous request, e.g. because it was restarted, is replaced
+ * and the request sent again; one that timed out isn't, as the
+ * shard is still busy with the request.
+ */
+static int receive_from_shard(struct shard_conn *conn, size_t shard,
+                              const struct out_buf *request,
+                              int is_sent)
+{
+    errno = 0;
+    if (is_sent &&
+        read_frame(conn->fd, &conn->buf, &conn->buf_size,
+                   &conn->len)) {
+        return 1;
+    }
+    disconnect_shard(conn);
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return 0;
+    }
+    if (send_to_shard(conn, shard, request) &&
+        read_frame(conn->fd, &conn->buf, &conn->buf_size,
+                   &conn->len)) {
+        return 1;
+    }
+    disconnect_shard(conn);
+    return 0;
+}
+
+/*
+ * function: add_shard_answers
+ * param: merge: answers of the shards so far
+ *        conn: connection holding the scored response of a shard
+ *        shard: shard number
+ * return: NULL if the response is malformed or out of memory
+ *         the query title in the response otherwise
+ * purpose: adds the answers of a shard to the merge. The titles
+ *          are terminated in place in the response buffer.
+ */
+static const char *add_shard_answers(struct merge *merge,
+                                     struct shard_conn *conn,
+                                     size_t shard)
+{
+    char *title = conn->buf;
+    char *line = strchr(title, '\n');
+    size_t rank = 0;
+
+    while (line) {
+        struct shard_answer *answer = NULL;
+        char *end = NULL;
+
+        *line++ = '\0';
+        if (merge->len == merge->size) {
+            size_t size = merge->size ? 2 * merge->size : 64;
+            void *tmp = realloc(merge->items,
+                                size * sizeof *merge->items);
+
+            if (!tmp) {
+                return NULL;
+            }
+            merge->items = tmp;
+            merge->size = size;
+        }
+        answer = merge->items + merge->len++;
+        answer->score = strtod(line, &end);
+        if (end == line || *end != ' ') {
+            return NULL;
+        }
+        answer->title = end + 1;
+        answer->rank = rank++;
+        answer->shard = shard;
+        line = strchr(end + 1, '\n');
+    }
+    return title;
+}
+
+/* best score first; ties in the order of the shard rankings,
+ * then of the shards
+ */
+static int cmp_shard_answer(const void *a_v, const void *b_v)
+{
+    const struct shard_answer *a = a_v;
+    const struct shard_answer *b = b_v;
+
+    if (a->score != b->score) {
+        return a->score > b->score ? -1 : 1;
+    }
+    if (a->rank != b->rank) {
+        return a->rank < b->rank ? -1 : 1;
+    }
+    return a->shard < b->shard ? -1 : a->shard > b->shard;
+}
+
+/* answer a request payload by sending it to every shard and
+ * merging the scored answers
+ */
+static int answer_sharded_request(char *payload,
+                                  struct shard_conn *conns,
+                                  struct merge *merge,
+                                  struct out_buf *request,
+                                  struct out_buf *out)
+{
+    char *line = strchr(payload, ' ');
+    const char *title = NULL;
+    char score[32];
+    int is_scored = 0;
+    int *is_sent = NULL;
+    /* first shard that failed to respond, if any */
+    size_t failed = shards.num_of_shards;
+    size_t s;
+    size_t a;
+
+    out->len = 0;
+    if (!line) {
+        return append(out, "!Missing algorithm");
+    }
+    *line++ = '\0';
+    is_scored = strip_scores_option(payload);
+    request->len = 0;
+    if (!append(request, payload) ||
+        !append(request, SCORES_OPTION " ") ||
+        !append(request, line) ||
+        !(is_sent = malloc(shards.num_of_shards * sizeof *is_sent))) {
+        return 0;
+    }
+
+    /* all the shards search at the same time */
+    for (s = 0; s < shards.num_of_shards; ++s) {
+        is_sent[s] = send_to_shard(conns + s, s, request);
+    }
+    merge->len = 0;
+    /* every response is read, even after a failure, so that none
+     * is left on a connection to be taken for the next request's
+     */
+    for (s = 0; s < shards.num_of_shards; ++s) {
+        if (!receive_from_shard(conns + s, s, request, is_sent[s]) &&
+            failed == shards.num_of_shards) {
+            failed = s;
+        }
+    }
+    free(is_sent);
+    if (failed < shards.num_of_shards) {
+        return append(out, "!Shard unavailable: ") &&
+               append(out, shards.sock_fns[failed]);
+    }
+    for (s = 0; s < shards.num_of_shards; ++s) {
+        if (conns[s].buf[0] == '!') {
+            return append(out, conns[s].buf);
+        }
+        if (!(title = add_shard_answers(merge, conns + s, s))) {
+            return append(out, "!Invalid shard response from ") &&
+                   append(out, shards.sock_fns[s]);
+        }
+    }
+
+    qsort(merge->items, merge->len, sizeof *merge->items,
+          cmp_shard_answer);
+    if (merge->len > shards.num_of_answers) {
+        merge->len = shards.num_of_answers;
+    }
+    if (!append(out, title)) {
+        return 0;
+    }
+    for (a = 0; a < merge->len; ++a) {
+        if (is_scored) {
+            sprintf(score, "\n%.17g ", merge->items[a].score);
+        }
+        if (!append(out, is_scored ? score : " ") ||
+            !append(out, merge->items[a].title)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* coordinator worker thread: answer requests one at a time,
+ * keeping a connection to every shard
+ */
+static void *serve_shards(void *arg)
+{
+    struct shard_conn *conns = calloc(shards.num_of_shards,
+                                      sizeof *conns);
+    struct merge merge = { NULL, 0, 0 };
+    struct out_buf request = { NULL, 0, 0 };
+    struct out_buf out = { NULL, 0, 0 };
+    char *buf = NULL;
+    size_t buf_size = 0;
+    size_t s;
+
+    (void)arg;
+    if (!conns) {
+        fprintf(stderr, "Can't allocate memory for a worker "
+                        "in %s:%d\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    for (s = 0; s < shards.num_of_shards; ++s) {
+        conns[s].fd = -1;
+    }
+    for (;;) {
+        int fd = pop_conn();
+        size_t len = 0;
+        int is_answered;
+
+        if (!read_frame(fd, &buf, &buf_size, &len)) {
+            close(fd);
+            continue;
+        }
+        if (!(is_answered = answer_sharded_request(buf, conns, &merge,
+                                                   &request, &out))) {
+            out.len = 0;
+            is_answered = append(&out, "!Out of memory");
+        }
+        if (is_answered && write_frame(fd, out.s, out.len)) {
+            return_conn(fd);
+        } else {
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+/* create the listening socket, replacing a stale one */
+static int listen_on(const char *sock_fn)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd = -1;
+
+    if (strlen(sock_fn) >= sizeof addr.sun_path) {
+        fprintf(stderr, "Socket path too long: %s\n", sock_fn);
+        return -1;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, sock_fn);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        return -1;
+    }
+    /* a socket nobody listens on is left by a previous run */
+    if (stat(sock_fn, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (connect(fd, (struct sockaddr *)&addr,
+                    sizeof addr) == 0) {
+            fprintf(stderr, "%s is in use\n", sock_fn);
+            close(fd);
+            return -1;
+        }
+        unlink(sock_fn);
+        close(fd);
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+            perror("socket");
+            return -1;
+        }
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof addr) < 0 ||
+        listen(fd, LISTEN_BACKLOG) < 0) {
+        perror(sock_fn);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* add a connection to the polled ones; return 0 on failure */
+static int add_pollfd(struct pollfd **pfds, size_t *num_of_pfds,
+                      size_t *max_num_of_pfds, int fd)
+{
+    if (*num_of_pfds == *max_num_of_pfds) {
+        size_t n = *max_num_of_pfds * 2;
+        void *tmp = realloc(*pfds, n * sizeof **pfds);
+
+        if (!tmp) {
+            return 0;
+        }
+        *pfds = tmp;
+        *max_num_of_pfds = n;
+    }
+    (*pfds)[*num_of_pfds].fd = fd;
+    (*pfds)[*num_of_pfds].events = POLLIN;
+    (*pfds)[*num_of_pfds].revents = 0;
+    ++*num_of_pfds;
+    return 1;
+}
+
+/*
+ * function: poll_conns
+ * param: listen_fd: listening socket
+ * return: 1 when stopped
+ *         0 on failure
+ * purpose: accepts connections and polls the idle ones, queuing
+ *          every connection with a request for the workers. A
+ *          connection isn't polled while a worker has it.
+ */
+static int poll_conns(int listen_fd)
+{
+    /* the listening socket, the wake-up pipe, then the idle
+     * connections
+     */
+    size_t max_num_of_pfds = 64;
+    struct pollfd *pfds = malloc(max_num_of_pfds * sizeof *pfds);
+    size_t num_of_pfds = 0;
+    int result = 1;
+
+    if (!pfds) {
+        fprintf(stderr, "Can't allocate memory for polling "
+                        "in %s:%d\n", __FILE__, __LINE__);
+        return 0;
+    }
+    add_pollfd(&pfds, &num_of_pfds, &max_num_of_pfds, listen_fd);
+    add_pollfd(&pfds, &num_of_pfds, &max_num_of_pfds,
+               conn_queue.wake_fds[0]);
+    while (!is_stopping) {
+        char drain[64];
+        size_t i;
+
+        if (poll(pfds, num_of_pfds, -1) < 0) {
+            if (errno != EINTR) {
+                perror("poll");
+                result = 0;
+                break;
+            }
+            continue;
+        }
+
+        /* a connection with a request, or closed, goes to a
+         * worker
+         */
+        for (i = 2; i < num_of_pfds; ) {
+            if (pfds[i].revents) {
+                push_conn(pfds[i].fd);
+                pfds[i] = pfds[--num_of_pfds];
+            } else {
+                ++i;
+            }
+        }
+
+        /* connections answered by the workers are polled again */
+        if (pfds[1].revents) {
+            while (read(conn_queue.wake_fds[0], drain,
+                        sizeof drain) > 0) {
+            }
+            pthread_mutex_lock(&conn_queue.lock);
+            for (i = 0; i < conn_queue.num_of_idle_fds; ++i) {
+                int fd = conn_queue.idle_fds[i];
+
+                if (!add_pollfd(&pfds, &num_of_pfds,
+                                &max_num_of_pfds, fd)) {
+                    close(fd);
+                }
+            }
+            conn_queue.num_of_idle_fds = 0;
+            pthread_mutex_unlock(&conn_queue.lock);
+        }
+
+        if (pfds[0].revents) {
+            int fd = accept(listen_fd, NULL, NULL);
+
+            if (fd < 0) {
+                if (errno != EINTR && errno != ECONNABORTED) {
+                    perror("accept");
+                    result = 0;
+                    break;
+                }
+                continue;
+            }
+            set_io_timeout(fd);
+            if (!add_pollfd(&pfds, &num_of_pfds, &max_num_of_pfds,
+                            fd)) {
+                close(fd);
+            }
+        }
+    }
+    free(pfds);
+    return result;
+}
+
+/* program entry point */
+int main(int argc, char **argv)
+{
+    int result = EXIT_FAILURE;
+    unsigned long n = oakpark_get_env_ulong("FNM_NUM_OF_ANSWERS",
+                                            DEFAULT_NUM_OF_ANSWERS);
+    size_t num_of_threads =
+           oakpark_get_env_ulong("FNM_NUM_OF_THREADS",
+                                 DEFAULT_NUM_OF_THREADS);
+    unsigned long io_timeout_secs =
+                  oakpark_get_env_ulong("FNM_IO_TIMEOUT",
+                                        DEFAULT_IO_TIMEOUT);
+    int is_coordinator = argc > 1 && strcmp(argv[1], "-c") == 0;
+    const char *sock_fn = NULL;
+    struct sigaction sa;
+    char idx_fn[FILENAME_MAX];
+    char coll_fn[FILENAME_MAX];
+    struct file_sig idx_sig;
+    struct file_sig coll_sig;
+    int listen_fd = -1;
+    size_t t;
+
+    if (argc < 4) {
+        fprintf(stderr,
+                "Fanimae " FANIMAE_VERSION "\n"
+                "Search daemon\n\n"
+                "Usage:\n"
+                "%s socket idx coll-seq\n"
+                "%s -c socket shard-socket...\n\n"
+                "Use \"-\" for idx or coll-seq to serve only "
+                "pioi or only ngr5\n"
+                "With -c, answer by merging the answers of the "
+                "fanimaed\n"
+                "processes serving the shards of a collection\n\n",
+                argv[0], argv[0]);
+        goto bail_out;
+    }
+    if (is_coordinator) {
+        sock_fn = argv[2];
+        shards.sock_fns = argv + 3;
+        shards.num_of_shards = argc - 3;
+        shards.num_of_answers = (n > USHRT_MAX) ? USHRT_MAX : n;
+    } else {
+        sock_fn = argv[1];
+        init_wavefront();
+        searchers.num_of_answers = (n > USHRT_MAX) ? USHRT_MAX : n;
+        searchers.idx_fn = argv[2];
+        searchers.coll_fn = argv[3];
+        if (!resolve_fn(searchers.idx_fn, idx_fn) ||
+            !resolve_fn(searchers.coll_fn, coll_fn)) {
+            fprintf(stderr, "Can't resolve %s or %s\n",
+                    searchers.idx_fn, searchers.coll_fn);
+            goto bail_out;
+        }
+        get_file_sig(idx_fn, P_INVLISTPTR_SUFFIX, &idx_sig);
+        get_file_sig(coll_fn, "", &coll_sig);
+        if (!(searchers.current = load_generation(idx_fn, coll_fn,
+                                                  &idx_sig,
+                                                  &coll_sig))) {
+            goto bail_out;
+        }
+        searchers.current->serial = ++searchers.num_of_generations;
+        pthread_mutex_init(&searchers.lock, NULL);
+    }
+
+    memset(&sa, 0, sizeof sa);
+    sigemptyset(&sa.sa_mask);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+    sa.sa_handler = stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if ((listen_fd = listen_on(sock_fn)) < 0) {
+        goto bail_out;
+    }
+    io_timeout.tv_sec = io_timeout_secs;
+    io_timeout.tv_usec = 0;
+    if (pipe(conn_queue.wake_fds) != 0) {
+        perror("pipe");
+        goto bail_out;
+    }
+    fcntl(conn_queue.wake_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(conn_queue.wake_fds[1], F_SETFL, O_NONBLOCK);
+
+    pthread_mutex_init(&conn_queue.lock, NULL);
+    pthread_cond_init(&conn_queue.not_empty, NULL);
+    pthread_cond_init(&conn_queue.not_full, NULL);
+    for (t = 0; t < num_of_threads; ++t) {
+        pthread_t thread;
+
+        if (pthread_create(&thread, NULL,
+                           is_coordinator ? serve_shards : serve,
+                           NULL) != 0) {
+            fprintf(stderr, "Can't create worker thread\n");
+            goto bail_out;
+        }
+        pthread_detach(thread);
+    }
+    if (is_coordinator) {
+        fprintf(stderr, "Coordinating %lu shards\n",
+                (unsigned long)shards.num_of_shards);
+    }
+    fprintf(stderr, "Listening on %s with %lu threads\n",
+            sock_fn, (unsigned long)num_of_threads);
+
+    if (poll_conns(listen_fd)) {
+        result = EXIT_SUCCESS;
+    }
+
+bail_out:
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(sock_fn);
+    }
+    return result;
+}
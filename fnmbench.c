@@ -0,0 +1,878 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * Benchmarks
+ *
+ * Copyright 2010 by RMIT MIRT Project.
+ * Copyright 2010 by Iman S. H. Suyoto.
+ *
+ * fnmbench generates a reproducible synthetic collection and
+ * query set, and measures the index builder and the two search
+ * engines on them:
+ *
+ *   fnmbench gen coll-seq query-seq
+ *   fnmbench build idx coll-seq
+ *   fnmbench query {ngr5|lsh|exact|pioi|seed} idx-or-coll-seq
+ *                  query-seq
+ *
+ * fnmbench sim cross-checks the calc_sim() alignment kernels and
+ * measures each of them on its own.
+ *
+ * Tracks are random walks over realistic melodic intervals and
+ * note values, converted to symbols the way fnmmp does. Queries
+ * are short excerpts of collection tracks with some symbols
+ * replaced, as a sung query would be. The same seed and sizes
+ * always give the same files.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "fanimae.h"
+#include "fnmpioi.h"
+#include "fnmngr5.h"
+#include "fnmmidi.h"
+
+#define DEFAULT_SEED 1
+#define DEFAULT_NUM_OF_TRACKS 10000
+#define DEFAULT_NUM_OF_QUERIES 100
+#define DEFAULT_THREADS "1 2 4"
+#define DEFAULT_FNMIB "./fnmib"
+#define DEFAULT_NUM_OF_ANSWERS 10
+#define MAX_NUM_OF_NOTES 400
+#define MIN_QUERY_LEN 8
+#define MAX_QUERY_LEN 24
+/* one query symbol in QUERY_ERROR_RATE is replaced */
+#define QUERY_ERROR_RATE 10
+#define LOWEST_PITCH 36
+#define HIGHEST_PITCH 96
+#define DEFAULT_SIM_PAIRS 20000
+#define DEFAULT_SIM_CELLS 20000000
+
+/* a 32-bit xorshift generator, so that the files don't depend on
+ * the C library's rand()
+ */
+static unsigned long next_random(unsigned long *state)
+{
+    unsigned long x = *state;
+
+    x ^= (x << 13) & 0xffffffffUL;
+    x ^= x >> 17;
+    x ^= (x << 5) & 0xffffffffUL;
+    return *state = x;
+}
+
+/* a random number in [0, n) */
+static unsigned long random_below(unsigned long *state,
+                                  unsigned long n)
+{
+    return next_random(state) % n;
+}
+
+/* seconds elapsed since start */
+static double elapsed(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) +
+           (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * function: gen_track
+ * param: state: random generator state
+ *        pitch_seq: space for MAX_NUM_OF_NOTES symbols
+ *        ioi_seq: space for MAX_NUM_OF_NOTES symbols
+ * return: number of symbols of each sequence
+ * purpose: generates a track. Most tracks are melodies of a few
+ *          dozen notes, some are long, and some are accompaniment
+ *          or drum tracks without a melody.
+ */
+static size_t gen_track(unsigned long *state,
+                        char *pitch_seq, char *ioi_seq)
+{
+    /* steps and repeated notes dominate, leaps are rarer */
+    static const int intervals[] = {
+        0, 0, 0, 1, -1, 1, -1, 2, -2, 2, -2, 2, -2,
+        3, -3, 4, -4, 5, -5, 7, -7, 12, -12
+    };
+    static const long durations[] = { 60, 120, 240, 480, 960 };
+    const size_t num_of_intervals = sizeof intervals /
+                                    sizeof *intervals;
+    const size_t num_of_durations = sizeof durations /
+                                    sizeof *durations;
+    size_t num_of_notes;
+    long pitch = 60 + (long)random_below(state, 12);
+    long ioi = durations[random_below(state, num_of_durations)];
+    size_t n;
+
+    if (random_below(state, 4) == 0) {
+        num_of_notes = random_below(state, 2);
+    } else {
+        num_of_notes = 2 + random_below(state, 60);
+        if (random_below(state, 5) == 0) {
+            num_of_notes += random_below(state, MAX_NUM_OF_NOTES -
+                                                61);
+        }
+    }
+    for (n = 1; n < num_of_notes; ++n) {
+        long next_pitch = pitch +
+                          intervals[random_below(state,
+                                                 num_of_intervals)];
+        long next_ioi = ioi;
+
+        if (next_pitch < LOWEST_PITCH ||
+            next_pitch > HIGHEST_PITCH) {
+            next_pitch = 2 * pitch - next_pitch;
+        }
+        if (random_below(state, 2) == 0) {
+            next_ioi = durations[random_below(state,
+                                              num_of_durations)];
+        }
+        pitch_seq[n - 1] = directed_mod_12(pitch, next_pitch);
+        ioi_seq[n - 1] = ioi_ext_contour(ioi, next_ioi);
+        pitch = next_pitch;
+        ioi = next_ioi;
+    }
+    return num_of_notes > 0 ? num_of_notes - 1 : 0;
+}
+
+/*
+ * function: write_query
+ * param: state: random generator state of the queries
+ *        fp: output stream
+ *        query_num: number of the query
+ *        pitch_seq, ioi_seq: sequences of the track
+ *        len: length of the sequences
+ * return: 1 on success
+ *         0 on failure
+ * purpose: writes an excerpt of a track, with some symbols
+ *          replaced, as a query
+ */
+static int write_query(unsigned long *state, FILE *fp,
+                       unsigned long query_num,
+                       const char *pitch_seq, const char *ioi_seq,
+                       size_t len)
+{
+    static const char symbols[] = P_DM12_ALPHABET;
+    static const char ioi_symbols[] = IOI_SYMBOLS;
+    char pitch_query[MAX_QUERY_LEN];
+    char ioi_query[MAX_QUERY_LEN];
+    size_t query_len = MIN_QUERY_LEN +
+                       random_below(state, MAX_QUERY_LEN -
+                                           MIN_QUERY_LEN + 1);
+    size_t start;
+    size_t n;
+
+    if (query_len > len) {
+        query_len = len;
+    }
+    start = random_below(state, len - query_len + 1);
+    for (n = 0; n < query_len; ++n) {
+        pitch_query[n] = pitch_seq[start + n];
+        ioi_query[n] = ioi_seq[start + n];
+        if (random_below(state, QUERY_ERROR_RATE) == 0) {
+            pitch_query[n] = symbols[random_below
+                                     (state, sizeof symbols - 1)];
+        }
+        if (random_below(state, QUERY_ERROR_RATE) == 0) {
+            ioi_query[n] = ioi_symbols[random_below
+                                       (state,
+                                        sizeof ioi_symbols - 1)];
+        }
+    }
+    return fprintf(fp, "pi:q%06lu.mid|0***%.*s***%.*s\n",
+                   query_num, (int)query_len, pitch_query,
+                   (int)query_len, ioi_query) > 0;
+}
+
+/*
+ * function: gen
+ * return: 1 on success
+ *         0 on failure
+ * purpose: generates FNM_BENCH_NUM_OF_TRACKS tracks and
+ *          FNM_BENCH_NUM_OF_QUERIES queries from
+ *          FNM_BENCH_SEED
+ */
+static int gen(const char *coll_fn, const char *query_fn)
+{
+    unsigned long seed = oakpark_get_env_ulong("FNM_BENCH_SEED",
+                                               DEFAULT_SEED);
+    unsigned long num_of_tracks = oakpark_get_env_ulong
+                                  ("FNM_BENCH_NUM_OF_TRACKS",
+                                   DEFAULT_NUM_OF_TRACKS);
+    unsigned long num_of_queries = oakpark_get_env_ulong
+                                   ("FNM_BENCH_NUM_OF_QUERIES",
+                                    DEFAULT_NUM_OF_QUERIES);
+    /* separate streams, so that the collection doesn't depend on
+     * the number of queries
+     */
+    unsigned long coll_state = (seed & 0xffffffffUL) | 1;
+    unsigned long query_state = ((seed * 2654435761UL) &
+                                 0xffffffffUL) | 2;
+    unsigned long queries_left = num_of_queries;
+    unsigned long queries_pending = 0;
+    unsigned long t = 0;
+    unsigned long file_num = 0;
+    char pitch_seq[MAX_NUM_OF_NOTES];
+    char ioi_seq[MAX_NUM_OF_NOTES];
+    FILE *coll_fp = fopen(coll_fn, "w");
+    FILE *query_fp = fopen(query_fn, "w");
+    int result = coll_fp && query_fp;
+
+    while (result && t < num_of_tracks) {
+        unsigned long num_of_file_tracks = 1 +
+                                           random_below(&coll_state,
+                                                        4);
+        unsigned long ft;
+
+        for (ft = 0; result && ft < num_of_file_tracks &&
+                     t < num_of_tracks; ++ft, ++t) {
+            size_t len = gen_track(&coll_state, pitch_seq, ioi_seq);
+
+            if (fprintf(coll_fp, "pi:b%07lu.mid|%lu***%.*s***%.*s\n",
+                        file_num, ft, (int)len, pitch_seq,
+                        (int)len, ioi_seq) < 0) {
+                result = 0;
+            }
+            /* pick the queries evenly from the tracks, each from
+             * the first melody long enough at or after its track
+             */
+            if (queries_left > 0 &&
+                random_below(&query_state, num_of_tracks - t) <
+                queries_left) {
+                --queries_left;
+                ++queries_pending;
+            }
+            if (result && queries_pending > 0 &&
+                len >= MIN_QUERY_LEN) {
+                result = write_query(&query_state, query_fp,
+                                     num_of_queries - queries_left -
+                                     queries_pending,
+                                     pitch_seq, ioi_seq, len);
+                --queries_pending;
+            }
+        }
+        ++file_num;
+    }
+    if (coll_fp && fclose(coll_fp) != 0) {
+        result = 0;
+    }
+    if (query_fp && fclose(query_fp) != 0) {
+        result = 0;
+    }
+    if (!result) {
+        fprintf(stderr, "Can't write %s or %s\n", coll_fn, query_fn);
+        return 0;
+    }
+    printf("gen: %lu tracks, %lu queries, seed %lu\n",
+           num_of_tracks,
+           num_of_queries - queries_left - queries_pending, seed);
+    return 1;
+}
+
+/*
+ * function: build
+ * return: 1 on success
+ *         0 on failure
+ * purpose: runs FNM_BENCH_FNMIB (./fnmib by default) and reports
+ *          its wall-clock time and peak resident set size
+ */
+static int build(const char *idx_fn, const char *coll_fn)
+{
+    const char *fnmib = getenv("FNM_BENCH_FNMIB");
+    struct timespec start;
+    struct rusage usage;
+    int status = 0;
+    pid_t pid;
+    double t;
+
+    if (!fnmib || !*fnmib) {
+        fnmib = DEFAULT_FNMIB;
+    }
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if ((pid = fork()) < 0) {
+        perror("fork");
+        return 0;
+    }
+    if (pid == 0) {
+        /* keep the progress marks out of the report */
+        int fd = open("/dev/null", O_WRONLY);
+
+        if (fd >= 0) {
+            dup2(fd, STDERR_FILENO);
+        }
+        execl(fnmib, fnmib, idx_fn, coll_fn, (char *)NULL);
+        _exit(127);
+    }
+    if (waitpid(pid, &status, 0) != pid) {
+        perror("waitpid");
+        return 0;
+    }
+    t = elapsed(&start);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s %s %s failed\n", fnmib, idx_fn, coll_fn);
+        return 0;
+    }
+    getrusage(RUSAGE_CHILDREN, &usage);
+    printf("build: %.3f s, peak RSS %ld KiB\n", t, usage.ru_maxrss);
+    return 1;
+}
+
+/* the searcher being measured and its queries */
+struct bench {
+    struct ngr5_idx *idx;
+    /* the search of idx, and its name */
+    int (*search)(const struct ngr5_idx *, struct ngr5_scratch *,
+                  const char *, struct answers *);
+    const char *algo;
+    struct coll_block coll;
+    /* positional index of coll for seed, NULL for pioi */
+    struct seed_idx *seeds;
+    struct query *queries;
+    size_t num_of_queries;
+    /* latency of every query, in seconds */
+    double *latencies;
+    pthread_mutex_t lock;
+    size_t next_query;
+    int failed;
+};
+
+/* worker thread: answer queries until there are none left */
+static void *answer_queries(void *arg)
+{
+    struct bench *bench = arg;
+    struct ngr5_scratch *scratch = NULL;
+
+    if (bench->idx && !(scratch = ngr5_create_scratch(bench->idx))) {
+        pthread_mutex_lock(&bench->lock);
+        bench->failed = 1;
+        pthread_mutex_unlock(&bench->lock);
+        return NULL;
+    }
+    for (;;) {
+        struct query *query = NULL;
+        struct timespec start;
+        size_t q;
+        int is_ok;
+
+        pthread_mutex_lock(&bench->lock);
+        q = bench->next_query++;
+        pthread_mutex_unlock(&bench->lock);
+        if (q >= bench->num_of_queries) {
+            break;
+        }
+        query = bench->queries + q;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        clear_answers(query->answers);
+        is_ok = bench->idx ?
+                bench->search(bench->idx, scratch, query->pitch_seq,
+                              query->answers) :
+                bench->seeds ?
+                seed_coll_block(bench->seeds, query, 1) :
+                align_coll_block(&bench->coll, query, 1);
+        bench->latencies[q] = elapsed(&start);
+        if (!is_ok) {
+            pthread_mutex_lock(&bench->lock);
+            bench->failed = 1;
+            pthread_mutex_unlock(&bench->lock);
+        }
+    }
+    ngr5_destroy_scratch(scratch);
+    return NULL;
+}
+
+static int cmp_latency(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* latency at percentile p of the sorted latencies, in ms */
+static double percentile(const double *latencies, size_t n, int p)
+{
+    size_t rank = (n * p + 99) / 100;
+
+    return 1000 * latencies[rank > 0 ? rank - 1 : 0];
+}
+
+/*
+ * function: run
+ * param: bench: bench
+ *        num_of_threads: number of threads
+ * return: 1 on success
+ *         0 on failure
+ * purpose: answers all queries on num_of_threads threads and
+ *          reports the throughput and the latency percentiles
+ */
+static int run(struct bench *bench, size_t num_of_threads)
+{
+    pthread_t *threads = malloc(num_of_threads * sizeof *threads);
+    struct timespec start;
+    size_t num_of_started = 0;
+    size_t t;
+    double wall;
+
+    if (!threads) {
+        return 0;
+    }
+    bench->next_query = 0;
+    bench->failed = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (t = 0; t < num_of_threads; ++t) {
+        if (pthread_create(threads + t, NULL, answer_queries,
+                           bench) != 0) {
+            bench->failed = 1;
+            break;
+        }
+        num_of_started++;
+    }
+    for (t = 0; t < num_of_started; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+    wall = elapsed(&start);
+    free(threads);
+    if (bench->failed) {
+        fprintf(stderr, "Query failed\n");
+        return 0;
+    }
+
+    qsort(bench->latencies, bench->num_of_queries,
+          sizeof *bench->latencies, cmp_latency);
+    printf("%-6s %7lu %8lu %10.1f %9.3f %9.3f %9.3f\n",
+           bench->algo,
+           (unsigned long)num_of_threads,
+           (unsigned long)bench->num_of_queries,
+           bench->num_of_queries / wall,
+           percentile(bench->latencies, bench->num_of_queries, 50),
+           percentile(bench->latencies, bench->num_of_queries, 95),
+           percentile(bench->latencies, bench->num_of_queries, 99));
+    return 1;
+}
+
+/*
+ * function: load_queries
+ * return: 1 on success
+ *         0 on failure
+ * purpose: reads the queries of a sequence file
+ */
+static int load_queries(struct bench *bench, const char *query_fn)
+{
+    FILE *fp = fopen(query_fn, "r");
+    struct oakpark_reader *reader = NULL;
+    size_t max_num_of_queries = 0;
+    char *line = NULL;
+    size_t line_len = 0;
+    int result = 1;
+
+    if (!fp) {
+        fprintf(stderr, "Can't open ");
+        perror(query_fn);
+        return 0;
+    }
+    if (!(reader = oakpark_open_reader(fp))) {
+        fclose(fp);
+        return 0;
+    }
+    while (result && (line = oakpark_read_line(reader, &line_len))) {
+        struct query *query = NULL;
+
+        if (bench->num_of_queries == max_num_of_queries) {
+            size_t n = max_num_of_queries ?
+                       max_num_of_queries * 2 : 64;
+            void *tmp = realloc(bench->queries,
+                                n * sizeof *bench->queries);
+
+            if (!tmp) {
+                result = 0;
+                break;
+            }
+            bench->queries = tmp;
+            max_num_of_queries = n;
+        }
+        query = bench->queries + bench->num_of_queries;
+        memset(query, 0, sizeof *query);
+        if (line[line_len - 1] == '\n') {
+            line[--line_len] = '\0';
+        }
+        if (!(query->line = malloc(line_len + 1)) ||
+            !(query->answers =
+              create_answers(DEFAULT_NUM_OF_ANSWERS))) {
+            free(query->line);
+            result = 0;
+            break;
+        }
+        memcpy(query->line, line, line_len + 1);
+        bench->num_of_queries++;
+        if (!parse_seq(query->line, &query->title,
+                       &query->pitch_seq, &query->ioi_seq)) {
+            fprintf(stderr, "Invalid query: %s\n", query->line);
+            result = 0;
+        }
+    }
+    oakpark_close_reader(reader);
+    fclose(fp);
+    if (result && bench->num_of_queries == 0) {
+        fprintf(stderr, "No queries in %s\n", query_fn);
+        result = 0;
+    }
+    if (result && !(bench->latencies =
+                    malloc(bench->num_of_queries *
+                           sizeof *bench->latencies))) {
+        result = 0;
+    }
+    return result;
+}
+
+/*
+ * function: load_searcher
+ * return: 1 on success
+ *         0 on failure
+ * purpose: loads the searcher for algo and reports the time it
+ *          took
+ */
+static int load_searcher(struct bench *bench, const char *algo,
+                         const char *fn)
+{
+    struct timespec start;
+    int result = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bench->algo = algo;
+    if (strcmp(algo, "ngr5") == 0 || strcmp(algo, "lsh") == 0 ||
+        strcmp(algo, "exact") == 0) {
+        bench->search = strcmp(algo, "lsh") == 0 ? ngr5_lsh_query :
+                        strcmp(algo, "exact") == 0 ?
+                        ngr5_exact_query : ngr5_query;
+        if (!(bench->idx = ngr5_open(fn))) {
+            result = 0;
+        } else if (bench->search == ngr5_lsh_query &&
+                   !bench->idx->sketch) {
+            fprintf(stderr, "No sketch index %s" LSH_SUFFIX "\n", fn);
+        } else if (bench->search == ngr5_exact_query &&
+                   !bench->idx->fm) {
+            fprintf(stderr, "No FM-index %s" FM_SUFFIX "\n", fn);
+        } else {
+            result = 1;
+        }
+    } else if (strcmp(algo, "pioi") == 0 ||
+               strcmp(algo, "seed") == 0) {
+        FILE *fp = fopen(fn, "r");
+        struct oakpark_reader *reader = NULL;
+        int failed = 0;
+
+        if (!fp) {
+            fprintf(stderr, "Can't open ");
+            perror(fn);
+            return 0;
+        }
+        if ((reader = oakpark_open_reader(fp)) != NULL) {
+            read_coll_block(reader, &bench->coll, (size_t)-1,
+                            &failed);
+            oakpark_close_reader(reader);
+            result = !failed &&
+                     (strcmp(algo, "pioi") == 0 ||
+                      (bench->seeds =
+                       create_seed_idx(&bench->coll)) != NULL);
+        }
+        fclose(fp);
+    } else {
+        fprintf(stderr, "Invalid algo: %s\n", algo);
+        return 0;
+    }
+    if (result) {
+        printf("load: %s %s, %.3f s\n", algo, fn, elapsed(&start));
+    }
+    return result;
+}
+
+/*
+ * function: query
+ * return: 1 on success
+ *         0 on failure
+ * purpose: measures a searcher with each number of threads
+ *          listed in FNM_BENCH_THREADS
+ */
+static int query(const char *algo, const char *fn,
+                 const char *query_fn)
+{
+    const char *threads = getenv("FNM_BENCH_THREADS");
+    struct bench bench;
+    size_t q;
+    int result = 0;
+
+    if (!threads || !*threads) {
+        threads = DEFAULT_THREADS;
+    }
+    memset(&bench, 0, sizeof bench);
+    pthread_mutex_init(&bench.lock, NULL);
+    if (load_searcher(&bench, algo, fn) &&
+        load_queries(&bench, query_fn)) {
+        const char *p = threads;
+
+        printf("%-6s %7s %8s %10s %9s %9s %9s\n", "algo",
+               "threads", "queries", "qps", "p50 ms", "p95 ms",
+               "p99 ms");
+        result = 1;
+        while (result && *p) {
+            char *end = NULL;
+            unsigned long n = strtoul(p, &end, 10);
+
+            if (end == p) {
+                ++p;
+                continue;
+            }
+            p = end;
+            if (n > 0) {
+                result = run(&bench, n);
+            }
+        }
+    }
+
+    for (q = 0; q < bench.num_of_queries; ++q) {
+        free(bench.queries[q].line);
+        destroy_answers(bench.queries[q].answers);
+    }
+    free(bench.queries);
+    free(bench.latencies);
+    ngr5_close(bench.idx);
+    destroy_seed_idx(bench.seeds);
+    destroy_coll_block(&bench.coll);
+    pthread_mutex_destroy(&bench.lock);
+    return result;
+}
+
+/* fill seq with len symbols drawn from symbols */
+static void random_seq(unsigned long *state, char *seq, size_t len,
+                       const char *symbols)
+{
+    size_t nos = strlen(symbols);
+    size_t n;
+
+    for (n = 0; n < len; ++n) {
+        seq[n] = symbols[random_below(state, nos)];
+    }
+    seq[len] = '\0';
+}
+
+/*
+ * function: check_kernels
+ * param: state: random generator state
+ *        num_of_pairs: number of pairs to align
+ * return: 1 if every kernel agrees with the reference
+ *         0 otherwise
+ * purpose: aligns random pairs of sequences, mostly short and
+ *          some long, with every kernel. The symbols include
+ *          some outside both alphabets.
+ */
+static int check_kernels(unsigned long *state,
+                         unsigned long num_of_pairs)
+{
+    static const char symbols[] = P_DM12_ALPHABET IOI_SYMBOLS
+                                  "*-0~";
+    char *seqs = malloc(4 * (MAX_NUM_OF_NOTES + 1));
+    unsigned long p;
+    int result = 1;
+
+    if (!seqs) {
+        return 0;
+    }
+    for (p = 0; result && p < num_of_pairs; ++p) {
+        char *pitch_seq_1 = seqs;
+        char *pitch_seq_2 = pitch_seq_1 + MAX_NUM_OF_NOTES + 1;
+        char *ioi_seq_1 = pitch_seq_2 + MAX_NUM_OF_NOTES + 1;
+        char *ioi_seq_2 = ioi_seq_1 + MAX_NUM_OF_NOTES + 1;
+        size_t len_1 = 1 + random_below(state, 64);
+        size_t len_2 = 1 + random_below(state, 32);
+        long ref_pitch_sim = 0;
+        long ref_ioi_sim = 0;
+        const struct sim_kernel *k = sim_kernels;
+
+        if (random_below(state, 8) == 0) {
+            len_1 = 1 + random_below(state, MAX_NUM_OF_NOTES);
+        }
+        random_seq(state, pitch_seq_1, len_1, symbols);
+        random_seq(state, pitch_seq_2, len_2, symbols);
+        random_seq(state, ioi_seq_1, len_1, IOI_SYMBOLS);
+        random_seq(state, ioi_seq_2, len_2, IOI_SYMBOLS);
+        for (; result && k->name; ++k) {
+            long pitch_sim = 0;
+            long ioi_sim = 0;
+
+            if (!k->align(&pitch_sim, &ioi_sim,
+                          pitch_seq_1, pitch_seq_2,
+                          ioi_seq_1, ioi_seq_2, len_1, len_2)) {
+                result = 0;
+            } else if (k == sim_kernels) {
+                ref_pitch_sim = pitch_sim;
+                ref_ioi_sim = ioi_sim;
+            } else if (pitch_sim != ref_pitch_sim ||
+                       ioi_sim != ref_ioi_sim) {
+                fprintf(stderr,
+                        "%s: pitch %ld IOI %ld, %s: pitch %ld "
+                        "IOI %ld\n%s %s\n%s %s\n",
+                        sim_kernels->name, ref_pitch_sim,
+                        ref_ioi_sim, k->name, pitch_sim, ioi_sim,
+                        pitch_seq_1, ioi_seq_1,
+                        pitch_seq_2, ioi_seq_2);
+                result = 0;
+            }
+        }
+    }
+    free(seqs);
+    if (result) {
+        printf("sim: %lu random pairs, all kernels agree\n",
+               num_of_pairs);
+    }
+    return result;
+}
+
+/*
+ * function: time_kernel
+ * param: state: random generator state
+ *        k: kernel
+ *        len_1, len_2: lengths of the sequences
+ *        num_of_cells: number of cells to compute
+ * return: nanoseconds per cell
+ *         negative value on failure
+ */
+static double time_kernel(unsigned long *state,
+                          const struct sim_kernel *k,
+                          size_t len_1, size_t len_2,
+                          double num_of_cells)
+{
+    static const char symbols[] = P_DM12_ALPHABET;
+    char pitch_seq_1[MAX_NUM_OF_NOTES + 1];
+    char pitch_seq_2[MAX_NUM_OF_NOTES + 1];
+    char ioi_seq_1[MAX_NUM_OF_NOTES + 1];
+    char ioi_seq_2[MAX_NUM_OF_NOTES + 1];
+    struct timespec start;
+    double cells = 0;
+    double t;
+
+    random_seq(state, pitch_seq_1, len_1, symbols);
+    random_seq(state, pitch_seq_2, len_2, symbols);
+    random_seq(state, ioi_seq_1, len_1, IOI_SYMBOLS);
+    random_seq(state, ioi_seq_2, len_2, IOI_SYMBOLS);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (cells < num_of_cells) {
+        long pitch_sim = 0;
+        long ioi_sim = 0;
+
+        if (!k->align(&pitch_sim, &ioi_sim, pitch_seq_1, pitch_seq_2,
+                      ioi_seq_1, ioi_seq_2, len_1, len_2)) {
+            return -1;
+        }
+        /* a pitch and an IOI alignment */
+        cells += 2.0 * len_1 * len_2;
+    }
+    t = elapsed(&start);
+    return 1e9 * t / cells;
+}
+
+/*
+ * function: sim
+ * return: 1 on success
+ *         0 on failure
+ * purpose: cross-checks the alignment kernels against the
+ *          reference on FNM_BENCH_SIM_PAIRS random pairs, then
+ *          reports the time each takes per cell for documents and
+ *          queries of various lengths
+ */
+static int sim(void)
+{
+    static const size_t doc_lens[] = { 16, 64, 256, 400 };
+    static const size_t query_lens[] = { 8, 16, 32 };
+    unsigned long seed = oakpark_get_env_ulong("FNM_BENCH_SEED",
+                                               DEFAULT_SEED);
+    unsigned long state = (seed & 0xffffffffUL) | 1;
+    double num_of_cells = oakpark_get_env_ulong("FNM_BENCH_SIM_CELLS",
+                                                DEFAULT_SIM_CELLS);
+    size_t d;
+    size_t q;
+
+    if (!check_kernels(&state,
+                       oakpark_get_env_ulong("FNM_BENCH_SIM_PAIRS",
+                                             DEFAULT_SIM_PAIRS))) {
+        return 0;
+    }
+    printf("%-8s %7s %9s %9s\n", "kernel", "doc-len",
+           "query-len", "ns/cell");
+    for (d = 0; d < sizeof doc_lens / sizeof *doc_lens; ++d) {
+        for (q = 0; q < sizeof query_lens / sizeof *query_lens;
+             ++q) {
+            const struct sim_kernel *k = sim_kernels;
+
+            for (; k->name; ++k) {
+                double ns = time_kernel(&state, k, doc_lens[d],
+                                        query_lens[q],
+                                        num_of_cells);
+
+                if (ns < 0) {
+                    return 0;
+                }
+                printf("%-8s %7lu %9lu %9.3f\n", k->name,
+                       (unsigned long)doc_lens[d],
+                       (unsigned long)query_lens[q], ns);
+            }
+        }
+    }
+    return 1;
+}
+
+/* program entry point */
+int main(int argc, char **argv)
+{
+    int result = 0;
+
+    init_wavefront();
+    if (argc == 4 && strcmp(argv[1], "gen") == 0) {
+        result = gen(argv[2], argv[3]);
+    } else if (argc == 4 && strcmp(argv[1], "build") == 0) {
+        result = build(argv[2], argv[3]);
+    } else if (argc == 5 && strcmp(argv[1], "query") == 0) {
+        result = query(argv[2], argv[3], argv[4]);
+    } else if (argc == 2 && strcmp(argv[1], "sim") == 0) {
+        result = sim();
+    } else {
+        fprintf(stderr,
+                "Fanimae " FANIMAE_VERSION "\n"
+                "Benchmarks\n\n"
+                "Usage:\n"
+                "%s gen coll-seq query-seq\n"
+                "%s build idx coll-seq\n"
+                "%s query {ngr5|lsh|exact|pioi|seed} "
+                "idx-or-coll-seq query-seq\n"
+                "%s sim\n\n"
+                "gen writes FNM_BENCH_NUM_OF_TRACKS tracks and\n"
+                "FNM_BENCH_NUM_OF_QUERIES queries generated from\n"
+                "FNM_BENCH_SEED. build times FNM_BENCH_FNMIB.\n"
+                "query runs the queries with each number of threads\n"
+                "in FNM_BENCH_THREADS. sim checks the alignment\n"
+                "kernels against the reference on\n"
+                "FNM_BENCH_SIM_PAIRS random pairs and times them.\n\n",
+                argv[0], argv[0], argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (fflush(stdout) != 0) {
+        result = 0;
+    }
+    return result ? EXIT_SUCCESS : EXIT_FAILURE;
+}
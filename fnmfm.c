@@ -0,0 +1,247 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * FM-index of pitch sequences
+ *
+ * Copyright 2010 by RMIT MIRT Project.
+ * Copyright 2010 by Iman S. H. Suyoto.
+ *
+ * The index is built by fnmib. It finds the occurrences of a
+ * pitch substring of any length in time proportional to its
+ * length rather than to the size of the collection.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fanimae.h"
+#include "fnmfm.h"
+
+#define FM_HDR_SIZE (4 * 4)
+
+/* read a 4-byte little-endian integer */
+#define GET4(p) \
+    ((unsigned long)(p)[0] | ((unsigned long)(p)[1] << 8) | \
+     ((unsigned long)(p)[2] << 16) | ((unsigned long)(p)[3] << 24))
+
+/* number of set bits of every byte */
+static unsigned char popcounts[256];
+
+static void init_popcounts(void)
+{
+    unsigned i;
+
+    for (i = 1; i < 256; ++i) {
+        popcounts[i] = (unsigned char)((i & 1) + popcounts[i / 2]);
+    }
+}
+
+/* number of occurrences of code in rows [0, row) */
+static unsigned long occ(const struct fm_index *fm, unsigned char code,
+                         unsigned long row)
+{
+    unsigned long block = row / FM_BLOCK;
+    unsigned long result = GET4(fm->occ +
+                                (block * FM_NUM_OF_CODES + code) * 4);
+    const unsigned char *p = fm->bwt + block * FM_BLOCK;
+    const unsigned char *end = fm->bwt + row;
+
+    while (p < end) {
+        result += *p++ == code;
+    }
+    return result;
+}
+
+/* number of sampled rows in [0, row) */
+static unsigned long mark_rank(const struct fm_index *fm,
+                               unsigned long row)
+{
+    unsigned long block = row / FM_BLOCK;
+    unsigned long result = GET4(fm->mark_ranks + block * 4);
+    unsigned long i = block * (FM_BLOCK / 8);
+
+    for (; i < row / 8; ++i) {
+        result += popcounts[fm->marks[i]];
+    }
+    if (row % 8) {
+        result += popcounts[fm->marks[i] & ((1U << (row % 8)) - 1)];
+    }
+    return result;
+}
+
+struct fm_index *fm_open(const char *fn)
+{
+    struct fm_index *fm = calloc(1, sizeof *fm);
+    FILE *fp = fopen(fn, "rb");
+    const unsigned char *p = NULL;
+    unsigned long num_of_blocks;
+    unsigned long num_of_samples;
+    unsigned long sum;
+    unsigned long prev;
+    unsigned long i;
+    unsigned c;
+    doc_num_t d;
+
+    if (!fm || !fp) {
+        fprintf(stderr, "Can't open %s\n", fn);
+        goto bail_out;
+    }
+    {
+        long size = 0;
+
+        if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 ||
+            fseek(fp, 0, SEEK_SET) != 0 ||
+            !(fm->buf = malloc(size ? size : 1)) ||
+            fread(fm->buf, 1, size, fp) != (size_t)size) {
+            fprintf(stderr, "Can't read %s\n", fn);
+            goto bail_out;
+        }
+        fm->size = size;
+    }
+    fclose(fp);
+    fp = NULL;
+    p = fm->buf;
+
+    if (fm->size < FM_HDR_SIZE ||
+        memcmp(p, FM_MAGIC, FM_MAGIC_LEN) != 0) {
+        goto inconsistent;
+    }
+    fm->text_len = GET4(p + 4);
+    fm->num_of_docs = GET4(p + 8);
+    fm->sample_rate = GET4(p + 12);
+    p += FM_HDR_SIZE;
+    if (fm->text_len == 0 || fm->sample_rate == 0) {
+        goto inconsistent;
+    }
+    num_of_blocks = fm->text_len / FM_BLOCK + 1;
+    num_of_samples = (fm->text_len - 1) / fm->sample_rate + 1;
+    if (fm->size != FM_HDR_SIZE + (fm->num_of_docs + 1) * 4 +
+                    fm->text_len +
+                    num_of_blocks * FM_NUM_OF_CODES * 4 +
+                    (fm->text_len + 7) / 8 + num_of_blocks * 4 +
+                    num_of_samples * 4) {
+        goto inconsistent;
+    }
+    fm->doc_starts = p;
+    p += (fm->num_of_docs + 1) * 4;
+    fm->bwt = p;
+    p += fm->text_len;
+    fm->occ = p;
+    p += num_of_blocks * FM_NUM_OF_CODES * 4;
+    fm->marks = p;
+    p += (fm->text_len + 7) / 8;
+    fm->mark_ranks = p;
+    p += num_of_blocks * 4;
+    fm->samples = p;
+
+    prev = 0;
+    for (d = 0; d <= fm->num_of_docs; ++d) {
+        unsigned long start = GET4(fm->doc_starts + d * 4);
+
+        if (start < prev || start > fm->text_len) {
+            goto inconsistent;
+        }
+        prev = start;
+    }
+    if (prev != fm->text_len) {
+        goto inconsistent;
+    }
+    for (i = 0; i < fm->text_len; ++i) {
+        if (fm->bwt[i] >= FM_NUM_OF_CODES) {
+            goto inconsistent;
+        }
+    }
+    if (!popcounts[1]) {
+        init_popcounts();
+    }
+    sum = 0;
+    for (c = 0; c < FM_NUM_OF_CODES; ++c) {
+        fm->c[c] = sum;
+        sum += occ(fm, (unsigned char)c, fm->text_len);
+    }
+    if (sum != fm->text_len ||
+        mark_rank(fm, fm->text_len) != num_of_samples) {
+        goto inconsistent;
+    }
+    return fm;
+
+inconsistent:
+    fprintf(stderr, "Inconsistent FM-index %s\n", fn);
+bail_out:
+    if (fp) {
+        fclose(fp);
+    }
+    fm_close(fm);
+    return NULL;
+}
+
+void fm_close(struct fm_index *fm)
+{
+    if (fm) {
+        free(fm->buf);
+        free(fm);
+    }
+}
+
+void fm_all(const struct fm_index *fm, struct fm_range *range)
+{
+    range->lo = 0;
+    range->hi = fm->text_len;
+}
+
+unsigned long fm_prepend(const struct fm_index *fm,
+                         struct fm_range *range,
+                         unsigned char code)
+{
+    unsigned char c = (unsigned char)FM_CODE(code);
+
+    if (range->lo < range->hi) {
+        range->lo = fm->c[c] + occ(fm, c, range->lo);
+        range->hi = fm->c[c] + occ(fm, c, range->hi);
+    }
+    return range->hi - range->lo;
+}
+
+unsigned long fm_count(const struct fm_index *fm,
+                       const unsigned char *codes, size_t len,
+                       struct fm_range *range)
+{
+    fm_all(fm, range);
+    while (len > 0 && range->lo < range->hi) {
+        fm_prepend(fm, range, codes[--len]);
+    }
+    return range->hi - range->lo;
+}
+
+void fm_locate(const struct fm_index *fm, unsigned long row,
+               doc_num_t *doc, unsigned long *offset)
+{
+    unsigned long steps = 0;
+    unsigned long pos;
+    doc_num_t lo = 0;
+    doc_num_t hi = fm->num_of_docs;
+
+    /* walk the text backwards until a sampled position */
+    while (!(fm->marks[row / 8] & (1U << (row % 8)))) {
+        unsigned char c = fm->bwt[row];
+
+        row = fm->c[c] + occ(fm, c, row);
+        ++steps;
+    }
+    pos = GET4(fm->samples + mark_rank(fm, row) * 4) + steps;
+
+    /* the last document starting at or before the position */
+    while (hi - lo > 1) {
+        doc_num_t mid = lo + (hi - lo) / 2;
+
+        if (GET4(fm->doc_starts + mid * 4) <= pos) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    *doc = lo;
+    *offset = pos - GET4(fm->doc_starts + lo * 4);
+}
@@ -0,0 +1,137 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * FM-index of pitch sequences
+ *
+ * Copyright 2010 by RMIT MIRT Project.
+ * Copyright 2010 by Iman S. H. Suyoto.
+ */
+
+#ifndef H__FNMFM_
+#define H__FNMFM_
+
+#include <stddef.h>
+
+#include "fanimae.h"
+
+#define FM_SUFFIX ".ffm"
+#define FM_MAGIC "FFMI"
+#define FM_MAGIC_LEN (sizeof FM_MAGIC - 1)
+#define DEFAULT_FM_SAMPLE_RATE 32
+/* rows per occurrence count checkpoint */
+#define FM_BLOCK 64
+/* the codes of the text: the end of the text, the end of a
+ * document, and the symbols of P_DM12_ALPHABET
+ */
+#define FM_NUM_OF_CODES (sizeof P_DM12_ALPHABET + 1)
+#define FM_END 0
+#define FM_SEPARATOR 1
+#define FM_CODE(c) ((c) + 2)
+
+/*
+ * The text is the pitch sequences of all the documents, in
+ * document order, each followed by FM_SEPARATOR, and FM_END. A
+ * symbol outside the alphabet is indexed as FM_SEPARATOR. The
+ * file holds, as 4-byte little-endian integers unless stated
+ * otherwise:
+ * - FM_MAGIC, the length of the text, the number of documents
+ *   and the suffix array sampling rate
+ * - for every document, the position of its first symbol in the
+ *   text, and the length of the text
+ * - the Burrows-Wheeler transform of the text, a byte per code
+ * - for every FM_BLOCK rows of the transform, the number of
+ *   occurrences of every code before them
+ * - a bit per row, set if its suffix array value is sampled,
+ *   i.e. a multiple of the sampling rate, least significant bit
+ *   first
+ * - for every FM_BLOCK rows, the number of set bits before them
+ * - the sampled suffix array values, in row order
+ */
+
+/* an FM-index loaded in memory */
+struct fm_index {
+    unsigned char *buf;
+    size_t size;
+    unsigned long text_len;
+    doc_num_t num_of_docs;
+    unsigned long sample_rate;
+    const unsigned char *doc_starts;
+    const unsigned char *bwt;
+    const unsigned char *occ;
+    const unsigned char *marks;
+    const unsigned char *mark_ranks;
+    const unsigned char *samples;
+    /* number of codes smaller than each code */
+    unsigned long c[FM_NUM_OF_CODES];
+};
+
+/* the rows of the suffixes starting with a pattern */
+struct fm_range {
+    unsigned long lo;
+    unsigned long hi;
+};
+
+/*
+ * function: fm_open
+ * param: fn: FM-index filename
+ * return: NULL on failure, including an inconsistent file
+ *         pointer to the loaded index on success
+ */
+struct fm_index *fm_open(const char *fn);
+
+/*
+ * function: fm_close
+ * purpose: releases an index loaded by fm_open()
+ */
+void fm_close(struct fm_index *fm);
+
+/*
+ * function: fm_all
+ * param: range: pointer to the object to store the rows of the
+ *               empty pattern, i.e. all of them
+ */
+void fm_all(const struct fm_index *fm, struct fm_range *range);
+
+/*
+ * function: fm_prepend
+ * param: fm: index
+ *        range: rows of a pattern, replaced by those of the
+ *               pattern preceded by the symbol
+ *        code: position of the symbol in P_DM12_ALPHABET
+ * return: the number of occurrences of the longer pattern
+ * purpose: a step of backward search, in constant time
+ */
+unsigned long fm_prepend(const struct fm_index *fm,
+                         struct fm_range *range,
+                         unsigned char code);
+
+/*
+ * function: fm_count
+ * param: fm: index
+ *        codes: positions of the pattern symbols in
+ *               P_DM12_ALPHABET, as by encode_pitch_seq()
+ *        len: length of the pattern
+ *        range: pointer to the object to store the rows of the
+ *               pattern
+ * return: the number of occurrences of the pattern in the
+ *         sequences, in time proportional to its length
+ */
+unsigned long fm_count(const struct fm_index *fm,
+                       const unsigned char *codes, size_t len,
+                       struct fm_range *range);
+
+/*
+ * function: fm_locate
+ * param: fm: index
+ *        row: row of an occurrence
+ *        doc: pointer to the object to store the document number
+ *        offset: pointer to the object to store the position of
+ *                the occurrence in the pitch sequence of the
+ *                document
+ * purpose: locates an occurrence in fewer than sample_rate steps
+ */
+void fm_locate(const struct fm_index *fm, unsigned long row,
+               doc_num_t *doc, unsigned long *offset);
+
+#endif
@@ -11,6 +11,10 @@
 
 #include "fanimae.h"
 #include "oakpark.h"
+#include "fnmingest.h"
+#include "fnmseq.h"
+#include "fnmlsh.h"
+#include "fnmfm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,6 +25,17 @@
 #define ARGI_IDX_FN 1
 #define ARGI_SEQ_FN 2
 #define MIN_ARGC 3
+/* fnmib -d idxfn mididir [seqfn] */
+#define DIR_OPT "-d"
+#define ARGI_DIR_IDX_FN 2
+#define ARGI_DIR_MIDI_DIR 3
+#define ARGI_DIR_SEQ_FN 4
+#define MIN_DIR_ARGC 4
+/* fnmib --merge idxfn in-idxfn... */
+#define MERGE_OPT "--merge"
+#define ARGI_MERGE_IDX_FN 2
+#define ARGI_MERGE_IN_IDX_FN 3
+#define MIN_MERGE_ARGC 4
 #define SIZE_T_MAX_ ((size_t)-1)
 
 /* build status */
@@ -41,7 +56,15 @@ typedef enum bld_stat {
     /* erronous sequence file */
     BLD_STAT_ERR_SEQ,
     /* error adding to index */
-    BLD_STAT_ERR_ADD_IDX
+    BLD_STAT_ERR_ADD_IDX,
+    /* error writing to sequence file */
+    BLD_STAT_ERR_WRITE_SEQ,
+    /* error reading an index to merge */
+    BLD_STAT_ERR_READ_IDX,
+    /* error writing to sketch index file */
+    BLD_STAT_ERR_WRITE_LSH,
+    /* error writing to FM-index file */
+    BLD_STAT_ERR_WRITE_FM
 } bld_stat_t;
 
 #define STR(x) #x
@@ -65,9 +88,17 @@ static void show_usage(char *argv0)
             "Fanimae " FANIMAE_VERSION "\n"
             "Index Builder\n\n"
             "Usage:\n"
-            "%s idxfn seqfn\n\n"
+            "%s idxfn seqfn\n"
+            "%s " DIR_OPT " idxfn mididir [seqfn]\n"
+            "%s " MERGE_OPT " idxfn in-idxfn...\n\n"
+            "With " DIR_OPT ", the MIDI files in mididir are converted\n"
+            "and indexed in a single pass. The sequences are also\n"
+            "written to seqfn if given.\n\n"
+            "With " MERGE_OPT ", the indexes in-idxfn are merged into\n"
+            "the index of their sequence files concatenated in that\n"
+            "order.\n\n"
             "If idxfn.* exist, they will be overwritten\n\n",
-            argv0);
+            argv0, argv0, argv0);
 }
 
 /*
@@ -165,41 +196,6 @@ static unsigned long ulpow(unsigned long x, unsigned long y)
     return result;
 }
 
-/*
- * function: get_entry_num
- * parameter: ng_idx_t *: index
- *            char *: n-gram
- *            size_t *: pointer to result placeholder
- * return: 0 on failure
- *         1 on success
- * purpose: find the entry number of the n-gram in index
- */
-static int get_entry_num(char * ng, size_t * num)
-{
-    num_of_grams_t n;
-    const num_of_symbols_t nos = P_DM12_ALPHABET_SIZE;
-    const num_of_grams_t nog = NUM_OF_GRAMS;
-    const char *symbols = P_DM12_ALPHABET;
-
-    assert(!!ng && !!num);
-    assert(strlen(ng) >= nog);
-    *num = 0;
-    for (n = 0; n < nog; n++) {
-        ptrdiff_t d;
-        char *p;
-
-        /* find ng[n] in symbol list */
-        p = strchr(symbols, ng[n]);
-        if (p) {  /* if found */
-            d = p - symbols;
-            *num = nos * *num + d;
-        } else {  /* if not found */
-            return 0;    /* bail out */
-        }
-    }
-    return 1;
-}
-
 /*
  * function: ng_init
  * parameter: nog: number of grams
@@ -272,20 +268,18 @@ static void ng_destroy(ng_idx_t *idx)
 /*
  * function: ng_put
  * parameter: idx: pointer to index entries
- *            item: item to be put
+ *            entry_num: entry number of the item to be put
  *            doc_num: document number
  * return: 1 on success
  *         0 on failure
  * purpose: puts an item to index
  */
 static int ng_put
-           (ng_idx_t *idx, char *item, doc_num_t doc_num)
+           (ng_idx_t *idx, size_t entry_num, doc_num_t doc_num)
 {
-    int result;
-    size_t entry_num;
+    int result = 1;
 
-    assert(!!idx && !!item);
-    result = get_entry_num(item, &entry_num);
+    assert(!!idx);
     if (result) {
         ng_idx_entry_t * entry = &(idx->entries[entry_num]);
         doc_num_t d;
@@ -386,71 +380,834 @@ static int ng_save(ng_idx_t *idx, FILE *ng_fp, FILE *il_fp)
     return (result + 1) / 2;
 }
 
+/* an entry of a band of the sketch index */
+struct lsh_entry {
+    unsigned long key;
+    unsigned long doc_num;
+};
+
+/* the sketch index being built */
+struct lsh_builder {
+    struct lsh_params params;
+    doc_num_t num_of_docs;
+    /* position of the n-grams of every document in codes */
+    unsigned long *doc_ptrs;
+    size_t max_num_of_docs;
+    unsigned long *codes;
+    size_t num_of_codes;
+    size_t max_num_of_codes;
+    /* entries of every band */
+    struct lsh_entry **bands;
+    size_t *band_sizes;
+    size_t *max_band_sizes;
+    unsigned long *keys;
+    size_t max_num_of_keys;
+};
+
+/*
+ * function: grow
+ * parameter: buf: buffer of *size elements, may be NULL
+ *            size: pointer to the number of elements of the buffer
+ *            len: number of elements needed
+ *            elem_size: size of an element
+ * return: NULL on failure
+ *         pointer to the buffer, grown if needed, on success
+ */
+static void *grow(void *buf, size_t *size, size_t len,
+                  size_t elem_size)
+{
+    size_t n = *size ? *size : 256;
+
+    if (buf && len <= *size) {
+        return buf;
+    }
+    while (n < len) {
+        n *= 2;
+    }
+    if (!(buf = realloc(buf, n * elem_size))) {
+        return NULL;
+    }
+    *size = n;
+    return buf;
+}
+
+/*
+ * function: codecmp
+ * (for use by qsort())
+ */
+static int codecmp(const void *x, const void *y)
+{
+    const unsigned long *c1 = x;
+    const unsigned long *c2 = y;
+
+    return (*c1 > *c2) ?
+           1 : (*c1 < *c2) ?
+               -1 : 0;
+}
+
+/*
+ * function: lsh_create
+ * return: NULL on failure
+ *         pointer to an empty sketch index on success
+ */
+static struct lsh_builder *lsh_create(void)
+{
+    struct lsh_builder *lsh = calloc(1, sizeof *lsh);
+
+    if (!lsh) {
+        return NULL;
+    }
+    lsh_get_params(&lsh->params);
+    if (!(lsh->bands = calloc(lsh->params.num_of_bands,
+                              sizeof *lsh->bands)) ||
+        !(lsh->band_sizes = calloc(lsh->params.num_of_bands,
+                                   sizeof *lsh->band_sizes)) ||
+        !(lsh->max_band_sizes =
+          calloc(lsh->params.num_of_bands,
+                 sizeof *lsh->max_band_sizes))) {
+        free(lsh->bands);
+        free(lsh->band_sizes);
+        free(lsh);
+        return NULL;
+    }
+    return lsh;
+}
+
+/*
+ * function: lsh_destroy
+ * parameter: lsh: sketch index, may be NULL
+ */
+static void lsh_destroy(struct lsh_builder *lsh)
+{
+    unsigned long b;
+
+    if (!lsh) {
+        return;
+    }
+    for (b = 0; b < lsh->params.num_of_bands; b++) {
+        free(lsh->bands[b]);
+    }
+    free(lsh->bands);
+    free(lsh->band_sizes);
+    free(lsh->max_band_sizes);
+    free(lsh->doc_ptrs);
+    free(lsh->codes);
+    free(lsh->keys);
+    free(lsh);
+}
+
+/*
+ * function: lsh_end_docs
+ * parameter: lsh: sketch index
+ *            num_of_docs: number of documents so far
+ * return: 1 on success
+ *         0 on failure
+ * purpose: records the documents up to num_of_docs not recorded
+ *          yet as starting at the current end of the n-grams
+ */
+static int lsh_end_docs(struct lsh_builder *lsh,
+                        doc_num_t num_of_docs)
+{
+    unsigned long *tmp = grow(lsh->doc_ptrs, &lsh->max_num_of_docs,
+                              num_of_docs, sizeof *lsh->doc_ptrs);
+
+    if (!tmp) {
+        return 0;
+    }
+    lsh->doc_ptrs = tmp;
+    while (lsh->num_of_docs < num_of_docs) {
+        lsh->doc_ptrs[lsh->num_of_docs++] = lsh->num_of_codes;
+    }
+    return 1;
+}
+
+/*
+ * function: lsh_add
+ * parameter: lsh: sketch index
+ *            grams: n-gram codes of a document, in sequence order
+ *            num_of_grams: number of n-grams, at least 1
+ *            doc_num: document number, greater than those added
+ *                     before
+ * return: 1 on success
+ *         0 on failure
+ * purpose: adds the n-grams of a document and their sketches
+ */
+static int lsh_add(struct lsh_builder *lsh,
+                   const unsigned long *grams, size_t num_of_grams,
+                   doc_num_t doc_num)
+{
+    const unsigned long nob = lsh->params.num_of_bands;
+    size_t num_of_keys = lsh_num_of_windows(&lsh->params,
+                                            num_of_grams) * nob;
+    unsigned long *codes = NULL;
+    void *tmp = NULL;
+    size_t n = 0;
+    size_t g;
+    size_t k;
+
+    /* the documents without n-grams before it, then itself */
+    if (!lsh_end_docs(lsh, doc_num) ||
+        !lsh_end_docs(lsh, doc_num + 1)) {
+        return 0;
+    }
+    if (!(tmp = grow(lsh->codes, &lsh->max_num_of_codes,
+                     lsh->num_of_codes + num_of_grams,
+                     sizeof *lsh->codes))) {
+        return 0;
+    }
+    lsh->codes = tmp;
+    if (!(tmp = grow(lsh->keys, &lsh->max_num_of_keys, num_of_keys,
+                     sizeof *lsh->keys))) {
+        return 0;
+    }
+    lsh->keys = tmp;
+
+    /* the distinct n-grams, ascending */
+    codes = lsh->codes + lsh->num_of_codes;
+    memcpy(codes, grams, num_of_grams * sizeof *codes);
+    qsort(codes, num_of_grams, sizeof *codes, codecmp);
+    for (g = 0; g < num_of_grams; g++) {
+        if (n == 0 || codes[g] != codes[n - 1]) {
+            codes[n++] = codes[g];
+        }
+    }
+    lsh->num_of_codes += n;
+
+    lsh_band_keys(&lsh->params, grams, num_of_grams, lsh->keys);
+    for (k = 0; k < num_of_keys; k++) {
+        unsigned long b = k % nob;
+
+        if (!(tmp = grow(lsh->bands[b], &lsh->max_band_sizes[b],
+                         lsh->band_sizes[b] + 1,
+                         sizeof *lsh->bands[b]))) {
+            return 0;
+        }
+        lsh->bands[b] = tmp;
+        lsh->bands[b][lsh->band_sizes[b]].key = lsh->keys[k];
+        lsh->bands[b][lsh->band_sizes[b]].doc_num = doc_num;
+        lsh->band_sizes[b]++;
+    }
+    return 1;
+}
+
+/*
+ * function: lsh_entrycmp
+ * (for use by qsort())
+ */
+static int lsh_entrycmp(const void *x, const void *y)
+{
+    const struct lsh_entry *e1 = x;
+    const struct lsh_entry *e2 = y;
+
+    if (e1->key != e2->key) {
+        return (e1->key > e2->key) ? 1 : -1;
+    }
+    return (e1->doc_num > e2->doc_num) ?
+           1 : (e1->doc_num < e2->doc_num) ?
+               -1 : 0;
+}
+
+/*
+ * function: lsh_save
+ * parameter: lsh: sketch index
+ *            num_of_docs: number of documents indexed
+ *            lsh_fp: output (binary) stream
+ * return: 1 on success
+ *         0 on failure
+ * purpose: outputs a sketch index in the format of fnmlsh.h
+ */
+static int lsh_save(struct lsh_builder *lsh, doc_num_t num_of_docs,
+                    FILE *lsh_fp)
+{
+    doc_num_t d;
+    size_t c;
+    unsigned long b;
+    int failed = 0;
+
+    if (!lsh_end_docs(lsh, num_of_docs) ||
+        (fwrite(LSH_MAGIC, 1, LSH_MAGIC_LEN, lsh_fp) !=
+         LSH_MAGIC_LEN)) {
+        return 0;
+    }
+    failed |= write_uint(lsh_fp, lsh->params.num_of_bands,
+                         POS_SIZE) < 0;
+    failed |= write_uint(lsh_fp, lsh->params.num_of_rows,
+                         POS_SIZE) < 0;
+    failed |= write_uint(lsh_fp, lsh->params.window, POS_SIZE) < 0;
+    failed |= write_uint(lsh_fp, num_of_docs, POS_SIZE) < 0;
+    for (d = 0; d < num_of_docs; d++) {
+        failed |= write_uint(lsh_fp, lsh->doc_ptrs[d], POS_SIZE) < 0;
+    }
+    failed |= write_uint(lsh_fp, lsh->num_of_codes, POS_SIZE) < 0;
+    for (c = 0; c < lsh->num_of_codes; c++) {
+        failed |= write_uint(lsh_fp, lsh->codes[c], POS_SIZE) < 0;
+    }
+    for (b = 0; b < lsh->params.num_of_bands; b++) {
+        struct lsh_entry *entries = lsh->bands[b];
+        size_t n = 0;
+        size_t e;
+
+        /* a document is in a bucket once, however many of its
+         * windows fall in it
+         */
+        if (lsh->band_sizes[b] > 1) {
+            qsort(entries, lsh->band_sizes[b], sizeof *entries,
+                  lsh_entrycmp);
+        }
+        for (e = 0; e < lsh->band_sizes[b]; e++) {
+            if (n == 0 || lsh_entrycmp(entries + e,
+                                       entries + n - 1) != 0) {
+                entries[n++] = entries[e];
+            }
+        }
+        failed |= write_uint(lsh_fp, n, POS_SIZE) < 0;
+        for (e = 0; e < n; e++) {
+            failed |= write_uint(lsh_fp, entries[e].key,
+                                 POS_SIZE) < 0;
+            failed |= write_uint(lsh_fp, entries[e].doc_num,
+                                 POS_SIZE) < 0;
+        }
+    }
+    return !failed;
+}
+
+/* the FM-index being built */
+struct fm_builder {
+    unsigned long sample_rate;
+    /* text of fnmfm.h, without FM_END */
+    unsigned char *text;
+    size_t text_len;
+    size_t max_text_len;
+    /* position of the pitch sequence of every document in text */
+    unsigned long *doc_starts;
+    doc_num_t num_of_docs;
+    size_t max_num_of_docs;
+};
+
+/*
+ * function: fm_create
+ * return: NULL on failure
+ *         pointer to an empty FM-index sampling the positions set
+ *         by FNM_FM_SAMPLE_RATE on success
+ */
+static struct fm_builder *fm_create(void)
+{
+    struct fm_builder *fm = calloc(1, sizeof *fm);
+    const char *s = getenv("FNM_FM_SAMPLE_RATE");
+
+    if (fm) {
+        fm->sample_rate = s ? strtoul(s, NULL, 10) : 0;
+        if (fm->sample_rate == 0) {
+            fm->sample_rate = DEFAULT_FM_SAMPLE_RATE;
+        }
+    }
+    return fm;
+}
+
+/*
+ * function: fm_destroy
+ * parameter: fm: FM-index, may be NULL
+ */
+static void fm_destroy(struct fm_builder *fm)
+{
+    if (fm) {
+        free(fm->text);
+        free(fm->doc_starts);
+        free(fm);
+    }
+}
+
+/*
+ * function: fm_add
+ * parameter: fm: FM-index
+ *            seq: pitch sequence of the next document, or NULL
+ *            seq_len: length of seq
+ * return: 1 on success
+ *         0 on failure
+ * purpose: appends the whole pitch sequence of a document to the
+ *          text
+ */
+static int fm_add(struct fm_builder *fm, const char *seq,
+                  size_t seq_len)
+{
+    void *tmp = NULL;
+    size_t i;
+
+    /* positions are stored in 32 bits */
+    if (fm->text_len + seq_len + 2 > 0xffffffffUL) {
+        fprintf(stderr, "\nFM-index text too long " IN_LOC);
+        return 0;
+    }
+    if (!(tmp = grow(fm->doc_starts, &fm->max_num_of_docs,
+                     fm->num_of_docs + 1,
+                     sizeof *fm->doc_starts))) {
+        return 0;
+    }
+    fm->doc_starts = tmp;
+    if (!(tmp = grow(fm->text, &fm->max_text_len,
+                     fm->text_len + seq_len + 1,
+                     sizeof *fm->text))) {
+        return 0;
+    }
+    fm->text = tmp;
+    fm->doc_starts[fm->num_of_docs++] = fm->text_len;
+    for (i = 0; i < seq_len; i++) {
+        const char *p = memchr(P_DM12_ALPHABET, seq[i],
+                               sizeof P_DM12_ALPHABET - 1);
+
+        fm->text[fm->text_len++] = (unsigned char)
+                                   (p ? FM_CODE(p - P_DM12_ALPHABET) :
+                                        FM_SEPARATOR);
+    }
+    fm->text[fm->text_len++] = FM_SEPARATOR;
+    return 1;
+}
+
+/*
+ * function: sort_suffixes
+ * parameter: text: text ending with a symbol found nowhere else
+ *                  and smaller than the others
+ *            n: length of text
+ * return: NULL on failure
+ *         the suffix array of text on success, to be freed by the
+ *         caller
+ * purpose: sorts the suffixes of text by prefix doubling: once
+ *          they are ordered by their first k symbols, the ranks of
+ *          suffixes i and i + k order them by their first 2k, with
+ *          two counting sorts
+ */
+static unsigned long *sort_suffixes(const unsigned char *text,
+                                    size_t n)
+{
+    size_t count_len = n > FM_NUM_OF_CODES ? n : FM_NUM_OF_CODES;
+    unsigned long *sa = malloc(n * sizeof *sa);
+    unsigned long *rank = malloc(n * sizeof *rank);
+    unsigned long *tmp = malloc(n * sizeof *tmp);
+    unsigned long *count = malloc(count_len * sizeof *count);
+    unsigned long num_of_ranks = 0;
+    unsigned long sum = 0;
+    size_t k;
+    size_t i;
+
+    if (!sa || !rank || !tmp || !count) {
+        free(sa);
+        sa = NULL;
+        goto BAILOUT;
+    }
+    memset(count, 0, FM_NUM_OF_CODES * sizeof *count);
+    for (i = 0; i < n; i++) {
+        count[text[i]]++;
+    }
+    for (i = 0; i < FM_NUM_OF_CODES; i++) {
+        unsigned long c = count[i];
+
+        count[i] = sum;
+        sum += c;
+    }
+    for (i = 0; i < n; i++) {
+        sa[count[text[i]]++] = i;
+    }
+    for (i = 0; i < n; i++) {
+        if (i == 0 || text[sa[i]] != text[sa[i - 1]]) {
+            num_of_ranks++;
+        }
+        rank[sa[i]] = num_of_ranks - 1;
+    }
+
+    for (k = 1; num_of_ranks < n; k *= 2) {
+        unsigned long *swap = NULL;
+        size_t m = 0;
+
+        /* by the rank of suffix i + k, the suffixes without one
+         * first
+         */
+        for (i = n > k ? n - k : 0; i < n; i++) {
+            tmp[m++] = i;
+        }
+        for (i = 0; i < n; i++) {
+            if (sa[i] >= k) {
+                tmp[m++] = sa[i] - k;
+            }
+        }
+        /* then stably by their own rank */
+        memset(count, 0, num_of_ranks * sizeof *count);
+        for (i = 0; i < n; i++) {
+            count[rank[i]]++;
+        }
+        sum = 0;
+        for (i = 0; i < num_of_ranks; i++) {
+            unsigned long c = count[i];
+
+            count[i] = sum;
+            sum += c;
+        }
+        for (i = 0; i < n; i++) {
+            sa[count[rank[tmp[i]]]++] = tmp[i];
+        }
+        num_of_ranks = 0;
+        for (i = 0; i < n; i++) {
+            if (i == 0 || rank[sa[i]] != rank[sa[i - 1]] ||
+                (sa[i] + k < n ? rank[sa[i] + k] : n) !=
+                (sa[i - 1] + k < n ? rank[sa[i - 1] + k] : n)) {
+                num_of_ranks++;
+            }
+            tmp[sa[i]] = num_of_ranks - 1;
+        }
+        swap = rank;
+        rank = tmp;
+        tmp = swap;
+    }
+BAILOUT:
+    free(count);
+    free(tmp);
+    free(rank);
+    return sa;
+}
+
+/*
+ * function: fm_save
+ * parameter: fm: FM-index
+ *            num_of_docs: number of documents indexed
+ *            fm_fp: output (binary) stream
+ * return: 1 on success
+ *         0 on failure
+ * purpose: outputs an FM-index in the format of fnmfm.h
+ */
+static int fm_save(struct fm_builder *fm, doc_num_t num_of_docs,
+                   FILE *fm_fp)
+{
+    unsigned long counts[FM_NUM_OF_CODES];
+    unsigned long *sa = NULL;
+    size_t n;
+    size_t i;
+    doc_num_t d;
+    unsigned long num_of_marks = 0;
+    void *tmp = NULL;
+    int failed = 0;
+
+    assert(fm->num_of_docs == num_of_docs);
+    if (!(tmp = grow(fm->text, &fm->max_text_len, fm->text_len + 1,
+                     sizeof *fm->text))) {
+        return 0;
+    }
+    fm->text = tmp;
+    fm->text[fm->text_len] = FM_END;
+    n = fm->text_len + 1;
+    if (!(sa = sort_suffixes(fm->text, n)) ||
+        (fwrite(FM_MAGIC, 1, FM_MAGIC_LEN, fm_fp) != FM_MAGIC_LEN)) {
+        free(sa);
+        return 0;
+    }
+    failed |= write_uint(fm_fp, n, POS_SIZE) < 0;
+    failed |= write_uint(fm_fp, num_of_docs, POS_SIZE) < 0;
+    failed |= write_uint(fm_fp, fm->sample_rate, POS_SIZE) < 0;
+    for (d = 0; d < num_of_docs; d++) {
+        failed |= write_uint(fm_fp, fm->doc_starts[d], POS_SIZE) < 0;
+    }
+    failed |= write_uint(fm_fp, n, POS_SIZE) < 0;
+    /* the symbol before every suffix, that before the first being
+     * FM_END
+     */
+    for (i = 0; i < n; i++) {
+        failed |= putc(fm->text[sa[i] ? sa[i] - 1 : n - 1],
+                       fm_fp) == EOF;
+    }
+    memset(counts, 0, sizeof counts);
+    for (i = 0; i <= n; i++) {
+        if (i % FM_BLOCK == 0) {
+            unsigned c;
+
+            for (c = 0; c < FM_NUM_OF_CODES; c++) {
+                failed |= write_uint(fm_fp, counts[c], POS_SIZE) < 0;
+            }
+        }
+        if (i < n) {
+            counts[fm->text[sa[i] ? sa[i] - 1 : n - 1]]++;
+        }
+    }
+    for (i = 0; i < n; i += 8) {
+        size_t j;
+        int byte = 0;
+
+        for (j = 0; j < 8 && i + j < n; j++) {
+            if (sa[i + j] % fm->sample_rate == 0) {
+                byte |= 1 << j;
+            }
+        }
+        failed |= putc(byte, fm_fp) == EOF;
+    }
+    for (i = 0; i <= n; i++) {
+        if (i % FM_BLOCK == 0) {
+            failed |= write_uint(fm_fp, num_of_marks, POS_SIZE) < 0;
+        }
+        if (i < n && sa[i] % fm->sample_rate == 0) {
+            num_of_marks++;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (sa[i] % fm->sample_rate == 0) {
+            failed |= write_uint(fm_fp, sa[i], POS_SIZE) < 0;
+        }
+    }
+    free(sa);
+    return !failed;
+}
+
 /*
  * function: index_sequence
  * parameter: idx: pointer to index entries
+ *            lsh: sketch index, or NULL
+ *            codes: buffers for the symbol and n-gram codes
  *            seq: sequence to be indexed
+ *            seq_len: length of seq
  *            song_num: song number
- * return: 0 on failure
+ * return: 0 on failure, including symbols not in the alphabet
  *         1 on success
  * purpose: indexes a sequence
  */
 static int index_sequence
-           (ng_idx_t *idx, char *seq, doc_num_t song_num)
+           (ng_idx_t *idx, struct lsh_builder *lsh,
+            struct seq_codes *codes,
+            const char *seq, size_t seq_len, doc_num_t song_num)
 {
     int result = 1;
-    size_t seq_len;
-    size_t sc;
-    char ngram[NUM_OF_GRAMS + 1];
+    size_t num_of_grams = 0;
+    size_t g;
+    const unsigned long *grams = NULL;
 
     assert(!!idx && !!seq);
-    seq_len = strlen(seq);
-    if (seq_len < NUM_OF_GRAMS) {
+    if (seq_len <= NUM_OF_GRAMS) {
         return 1;
     }
-    ngram[NUM_OF_GRAMS] = '\0';
-    for (sc = 0;
-         result && (sc < seq_len - NUM_OF_GRAMS);
-         ++sc) {
-        memcpy(ngram, &(seq[sc]), NUM_OF_GRAMS);
-        result = ng_put(idx, ngram, song_num);
+    /* the n-gram ending at the last symbol isn't indexed, so
+     * that symbol is neither encoded nor validated
+     */
+    if (!(grams = encode_grams(codes, seq, seq_len - 1,
+                               &num_of_grams))) {
+        return 0;
+    }
+    for (g = 0; result && (g < num_of_grams); ++g) {
+        result = ng_put(idx, grams[g], song_num);
+    }
+    if (result && lsh) {
+        result = lsh_add(lsh, grams, num_of_grams, song_num);
+    }
+    return result;
+}
+
+/* the titles of the documents being indexed */
+struct doc_lookup {
+    /* document name lookup file pointer */
+    FILE *dl_fp;
+    /* duplicate document file pointer */
+    FILE *dd_fp;
+    /* the pitch sequences indexed so far */
+    struct seq_dedup *dedup;
+};
+
+/*
+ * function: index_line
+ * parameter: p_idx: pitch index
+ *            lsh: sketch index, or NULL
+ *            fm: FM-index, or NULL
+ *            codes: buffers for the symbol and n-gram codes
+ *            buf: sequence line, including its ending '\n'.
+ *                 It is modified.
+ *            buf_len: length of buf
+ *            dl: document lookup
+ *            song_num: pointer to the number of the next song
+ * return: build status
+ * purpose: indexes a line of a sequence file. Every index
+ *          depends on the pitch sequences alone, so a song with
+ *          the pitch sequence of an earlier one is only recorded
+ *          as its duplicate.
+ */
+static bld_stat_t index_line
+                  (ng_idx_t *p_idx, struct lsh_builder *lsh,
+                   struct fm_builder *fm, struct seq_codes *codes,
+                   char *buf, size_t buf_len,
+                   struct doc_lookup *dl, doc_num_t *song_num)
+{
+    bld_stat_t result = BLD_STAT_OK;
+    struct seq_line parts;
+    unsigned long orig = 0;
+
+    /* get rid of the ending '\n' */
+    buf[--buf_len] = '\0';
+    if (!split_seq_line(buf, buf_len, &parts)) {
+        return result;
+    }
+
+    if (parts.pitch_seq) {
+        if (!dedup_seq(dl->dedup, parts.pitch_seq,
+                       parts.pitch_seq_len, NULL, 0, *song_num,
+                       &orig)) {
+            fprintf(stderr, "\nMemory allocation error " IN_LOC);
+            return BLD_STAT_ERR_INIT_IDX_STRUCT;
+        }
+        if (orig != *song_num) {
+            fprintf(dl->dd_fp, "%lu %s\n", orig, parts.title);
+            return result;
+        }
+    }
+    if (parts.pitch_seq &&
+        !index_sequence(p_idx, lsh, codes, parts.pitch_seq,
+                        parts.pitch_seq_len, *song_num)) {
+        result = BLD_STAT_ERR_ADD_IDX;
+        fprintf
+        (stderr, "\nError when inserting song %s\n",
+         parts.title);
+    } else if (fm && !fm_add(fm, parts.pitch_seq,
+                             parts.pitch_seq ?
+                             parts.pitch_seq_len : 0)) {
+        result = BLD_STAT_ERR_ADD_IDX;
+        fprintf
+        (stderr, "\nError when inserting song %s\n",
+         parts.title);
+    }
+    fprintf(dl->dl_fp, "%s\n", parts.title);
+    if (((*song_num)++ % 100) == 0) {
+        fprintf(stderr, "#");
+        fflush(stderr);
     }
     return result;
 }
 
+/*
+ * function: index_seq_file
+ * parameter: p_idx: pitch index
+ *            lsh: sketch index, or NULL
+ *            fm: FM-index, or NULL
+ *            seq_fp: sequence file pointer
+ *            dl: document lookup
+ *            num_of_docs: pointer to the object to store the
+ *                         number of documents
+ * return: build status
+ * purpose: indexes the lines of a sequence file
+ */
+static bld_stat_t index_seq_file
+                  (ng_idx_t *p_idx, struct lsh_builder *lsh,
+                   struct fm_builder *fm, FILE *seq_fp,
+                   struct doc_lookup *dl, doc_num_t *num_of_docs)
+{
+    bld_stat_t result = BLD_STAT_OK;
+    struct oakpark_reader *seq_reader = oakpark_open_reader(seq_fp);
+    char *buf;
+    size_t buf_len;
+    doc_num_t song_num = 0;
+    struct seq_codes codes = { NULL, 0, NULL, 0 };
+
+    if (!seq_reader) {
+        return BLD_STAT_ERR_READ_SEQ;
+    }
+    while ((result == BLD_STAT_OK) &&
+           (buf = oakpark_read_line(seq_reader, &buf_len))) {
+        result = index_line(p_idx, lsh, fm, &codes, buf, buf_len,
+                            dl, &song_num);
+    }
+    *num_of_docs = song_num;
+    free_seq_codes(&codes);
+    oakpark_close_reader(seq_reader);
+    return result;
+}
+
+/*
+ * function: index_ingest
+ * parameter: p_idx: pitch index
+ *            lsh: sketch index, or NULL
+ *            fm: FM-index, or NULL
+ *            ingest: MIDI files being converted
+ *            seq_fp: sequence file pointer to copy the lines to,
+ *                    or NULL
+ *            dl: document lookup
+ *            num_of_docs: pointer to the object to store the
+ *                         number of documents
+ * return: build status
+ * purpose: indexes the lines of MIDI files as they are
+ *          converted, in the order fnmmp would write them
+ */
+static bld_stat_t index_ingest
+                  (ng_idx_t *p_idx, struct lsh_builder *lsh,
+                   struct fm_builder *fm, struct ingest *ingest,
+                   FILE *seq_fp, struct doc_lookup *dl,
+                   doc_num_t *num_of_docs)
+{
+    bld_stat_t result = BLD_STAT_OK;
+    struct seq_buf out = { NULL, 0, 0 };
+    doc_num_t song_num = 0;
+    struct seq_codes codes = { NULL, 0, NULL, 0 };
+
+    while ((result == BLD_STAT_OK) && ingest_next(ingest, &out)) {
+        char *line = out.s;
+        char *end = out.s + out.len;
+
+        if (seq_fp && out.len > 0 &&
+            fwrite(out.s, 1, out.len, seq_fp) != out.len) {
+            result = BLD_STAT_ERR_WRITE_SEQ;
+        }
+        while ((result == BLD_STAT_OK) && line < end) {
+            char *nl = memchr(line, '\n', end - line);
+            size_t line_len;
+
+            if (!nl) {
+                break;
+            }
+            line_len = nl - line + 1;
+
+            result = index_line(p_idx, lsh, fm, &codes, line,
+                                line_len, dl, &song_num);
+            line += line_len;
+        }
+    }
+    *num_of_docs = song_num;
+    free_seq_codes(&codes);
+    seq_buf_free(&out);
+    return result;
+}
+
 /*
  * function: build_index
- * parameter: seq_fp: sequence file pointer
+ * parameter: seq_fp: sequence file pointer. If ingest is given,
+ *                    the sequence file to write, or NULL.
+ *            ingest: MIDI files being converted, or NULL to
+ *                    read the sequences from seq_fp
  *            p_ilp_fp: pointers to inverted list file pointer
  *            p_il_fp: inverted list file pointer
  *            dl_fp: document name lookup file pointer
+ *            dd_fp: duplicate document file pointer
+ *            lsh_fp: sketch index file pointer, or NULL not to
+ *                    build a sketch index
+ *            fm_fp: FM-index file pointer, or NULL not to build an
+ *                   FM-index
  * return: build status
- * purpose: build sequences in seq_fp
+ * purpose: build sequences in seq_fp or converted by ingest
  */
 static bld_stat_t build_index
-                  (FILE *seq_fp,
+                  (FILE *seq_fp, struct ingest *ingest,
                    FILE *p_ilp_fp, FILE *p_il_fp,
-                   FILE *dl_fp)
+                   FILE *dl_fp, FILE *dd_fp, FILE *lsh_fp, FILE *fm_fp)
 {
     bld_stat_t result = BLD_STAT_OK;
-    char *buf;
     size_t buf_len;
     ng_idx_t *p_idx;
-    doc_num_t song_num = 0;
+    struct lsh_builder *lsh = NULL;
+    struct fm_builder *fm = NULL;
+    struct doc_lookup dl;
+    doc_num_t num_of_docs = 0;
     void *tmp = NULL;
     char *ilp_buf = NULL;
     char *il_buf = NULL;
-    static const char *pitch_prefix = "pi:";
-    const size_t pitch_prefix_len = strlen(pitch_prefix);
-    static const char *seq_prefix = "***";
-    const size_t seq_prefix_len = strlen(seq_prefix);
 
-    assert(!!seq_fp &&
+    assert((!!seq_fp || !!ingest) &&
            !!p_ilp_fp && !!p_il_fp &&
-           !!dl_fp);
+           !!dl_fp && !!dd_fp);
     fprintf(stderr, "Initializing index structure...\n");
+    dl.dl_fp = dl_fp;
+    dl.dd_fp = dd_fp;
+    dl.dedup = create_seq_dedup();
     p_idx = ng_init();
-    if (!p_idx) {
+    if (!p_idx || !dl.dedup || (lsh_fp && !(lsh = lsh_create())) ||
+        (fm_fp && !(fm = fm_create()))) {
         result = BLD_STAT_ERR_INIT_IDX_STRUCT;
     }
     if (result != BLD_STAT_OK) {
@@ -458,48 +1215,14 @@ static bld_stat_t build_index
     }
     fprintf(stderr, "Indexing...");
     fflush(stderr);
-    while ((result == BLD_STAT_OK) &&
-           (buf = oakpark_get_line(seq_fp, &buf_len))) {
-        char *title = NULL;
-        char *p_seq = NULL;
-
-        if (strncmp(buf, pitch_prefix, pitch_prefix_len) !=
-            0) {
-            free(buf);
-            continue;
-        }
-        /* get rid of the ending '\n' */
-        title = buf + pitch_prefix_len;
-        buf[--buf_len] = '\0';
-
-        p_seq = strstr(title, seq_prefix);
-        if (p_seq) {
-            char *p_seq_end = NULL;
-
-            *p_seq = '\0'; 
-            p_seq += seq_prefix_len;
-            p_seq_end = strstr(p_seq, seq_prefix);
-            if (p_seq_end) {
-                *p_seq_end = '\0';
-            }
-
-            if (!index_sequence(p_idx, p_seq, song_num)) {
-                result = BLD_STAT_ERR_ADD_IDX;
-                fprintf
-                (stderr, "\nError when inserting song %s\n",
-                 title);
-            }
-        }
-        fprintf(dl_fp, "%s\n", title);
-        if ((song_num++ % 100) == 0) {
-            fprintf(stderr, "#");
-            fflush(stderr);
-        }
-        free(buf);
-    }
+    result = ingest ?
+             index_ingest(p_idx, lsh, fm, ingest, seq_fp, &dl,
+                          &num_of_docs) :
+             index_seq_file(p_idx, lsh, fm, seq_fp, &dl,
+                            &num_of_docs);
     if (result != BLD_STAT_OK) {
         fprintf(stderr, "FAILED\n");
-        return result;
+        goto BAILOUT;
     }
     fprintf(stderr, "\nDONE!\n"
                     "Writing pitch index to file... ");
@@ -540,8 +1263,28 @@ static bld_stat_t build_index
         result = BLD_STAT_ERR_WRITE_P_ILP;
         goto BAILOUT;
     }
-    fprintf(stderr, "DONE!\n"
-                    "Destroying in-memory pitch index... ");
+    fprintf(stderr, "DONE!\n");
+    if (lsh) {
+        fprintf(stderr, "Writing sketch index to file... ");
+        fflush(stderr);
+        if (!lsh_save(lsh, num_of_docs, lsh_fp)) {
+            fprintf(stderr, "FAILED\n");
+            result = BLD_STAT_ERR_WRITE_LSH;
+            goto BAILOUT;
+        }
+        fprintf(stderr, "DONE!\n");
+    }
+    if (fm) {
+        fprintf(stderr, "Writing FM-index to file... ");
+        fflush(stderr);
+        if (!fm_save(fm, num_of_docs, fm_fp)) {
+            fprintf(stderr, "FAILED\n");
+            result = BLD_STAT_ERR_WRITE_FM;
+            goto BAILOUT;
+        }
+        fprintf(stderr, "DONE!\n");
+    }
+    fprintf(stderr, "Destroying in-memory pitch index... ");
     fflush(stderr);
     fprintf(stderr, "DONE!\n");
 BAILOUT:
@@ -551,6 +1294,474 @@ BAILOUT:
     free(il_buf);
     free(ilp_buf);
     ng_destroy(p_idx);
+    lsh_destroy(lsh);
+    fm_destroy(fm);
+    destroy_seq_dedup(dl.dedup);
+    return result;
+}
+
+/*
+ * function: read_uint
+ * parameter: istream: input (binary) stream
+ *            x: pointer to the result placeholder
+ * return: number of bytes read on success
+ *         0 on end of stream or inconsistent data
+ * purpose: inputs a variable-nibble compressed integer as
+ *          written by write_uint()
+ */
+static size_t read_uint(FILE *istream, unsigned long *x)
+{
+    size_t result = 0;
+    unsigned b = 0;
+    int ib;  /* input byte */
+
+    assert(!!istream);
+    *x = 0;
+    while ((ib = getc(istream)) != EOF) {
+        ++result;
+        *x |= (unsigned long)(ib & 0x07) << (6 * b);  /* ?... */
+        if (!(ib & 0x08)) {  /* 0... */
+            return result;
+        }
+        /* ?... 1... */
+        *x |= (unsigned long)((ib & 0x70) >> 4) << (6 * b + 3);
+        if (!(ib & 0x80)) {  /* 0... 1... */
+            return result;
+        }
+        ++b;  /* 1... 1... */
+    }
+    return 0;
+}
+
+/* an index being merged */
+struct merge_input {
+    const char *idx_fn;
+    FILE *p_ilp_fp;
+    FILE *p_il_fp;
+    /* position in p_il_fp */
+    unsigned long pos;
+    /* number of the first document of the index in the merged
+     * index
+     */
+    doc_num_t first_doc_num;
+};
+
+/*
+ * function: open_idx_file
+ * parameter: idx_fn: index filename
+ *            suffix: index file suffix
+ *            mode: fopen() mode
+ * return: NULL on failure
+ *         stream on success
+ */
+static FILE *open_idx_file(const char *idx_fn, const char *suffix,
+                           const char *mode)
+{
+    char *fn = malloc(strlen(idx_fn) + strlen(suffix) + 1);
+    FILE *fp = NULL;
+
+    if (!fn) {
+        fprintf(stderr, "Memory allocation error " IN_LOC);
+        return NULL;
+    }
+    sprintf(fn, "%s%s", idx_fn, suffix);
+    if (!(fp = fopen(fn, mode))) {
+        fprintf(stderr, "Failed opening %s " IN_LOC, fn);
+    }
+    free(fn);
+    return fp;
+}
+
+/*
+ * function: append_doc_lookup
+ * parameter: in_fp: document name lookup file of an index
+ *            dl_fp: merged document name lookup file
+ *            num_of_docs: pointer to the number of documents
+ *                         appended so far
+ * return: 1 on success
+ *         0 on failure
+ * purpose: appends the titles of an index to the merged ones
+ */
+static int append_doc_lookup(FILE *in_fp, FILE *dl_fp,
+                             doc_num_t *num_of_docs)
+{
+    char buf[BUFSIZ];
+    size_t n;
+
+    while ((n = fread(buf, 1, sizeof buf, in_fp)) > 0) {
+        const char *nl = buf;
+
+        while ((nl = memchr(nl, '\n', buf + n - nl)) != NULL) {
+            ++*num_of_docs;
+            ++nl;
+        }
+        if (fwrite(buf, 1, n, dl_fp) != n) {
+            return 0;
+        }
+    }
+    return !ferror(in_fp);
+}
+
+/*
+ * function: write_doc_titles
+ * parameter: idx_fn: index filename, its document lookup
+ *                    written
+ * return: build status
+ * purpose: writes the titles of the document lookup with their
+ *          positions, so that a searcher can look a title up
+ *          without reading the others
+ */
+static bld_stat_t write_doc_titles(const char *idx_fn)
+{
+    FILE *dl_fp = open_idx_file(idx_fn, DOCLOOKUP_SUFFIX, "r");
+    FILE *dt_fp = NULL;
+    struct oakpark_reader *reader = NULL;
+    const char *span;
+    size_t len;
+    unsigned long num_of_docs = 0;
+    unsigned long pos;
+    int failed = 1;
+
+    if (!dl_fp ||
+        !(dt_fp = open_idx_file(idx_fn, DOCTITLES_SUFFIX, "wb")) ||
+        !(reader = oakpark_open_reader(dl_fp))) {
+        goto BAILOUT;
+    }
+    while (oakpark_read_span(reader, &len) != NULL) {
+        ++num_of_docs;
+    }
+    if (ferror(dl_fp) || !oakpark_rewind_reader(reader)) {
+        goto BAILOUT;
+    }
+    failed = fwrite(DOCTITLES_MAGIC, 1, sizeof DOCTITLES_MAGIC - 1,
+                    dt_fp) != sizeof DOCTITLES_MAGIC - 1;
+    failed |= write_uint(dt_fp, num_of_docs, POS_SIZE) < 0;
+    /* the titles follow the positions */
+    pos = DOCTITLES_HDR_SIZE + (num_of_docs + 1) * POS_SIZE;
+    while (!failed && (span = oakpark_read_span(reader, &len))) {
+        failed |= write_uint(dt_fp, pos, POS_SIZE) < 0;
+        pos += len - (span[len - 1] == '\n') + 1;
+        failed |= pos > 0xffffffffUL;
+    }
+    failed |= write_uint(dt_fp, pos, POS_SIZE) < 0 ||
+              ferror(dl_fp) || !oakpark_rewind_reader(reader);
+    while (!failed && (span = oakpark_read_span(reader, &len))) {
+        len -= span[len - 1] == '\n';
+        failed |= fwrite(span, 1, len, dt_fp) != len ||
+                  fputc('\0', dt_fp) == EOF;
+    }
+    failed |= ferror(dl_fp);
+
+BAILOUT:
+    oakpark_close_reader(reader);
+    close_file(dl_fp);
+    if (dt_fp && fclose(dt_fp) != 0) {
+        failed = 1;
+    }
+    return failed ? BLD_STAT_ERR_WRITE_DL : BLD_STAT_OK;
+}
+
+/*
+ * function: append_doc_dups
+ * parameter: in_fp: duplicate document file of an index
+ *            dd_fp: merged duplicate document file
+ *            first_doc_num: number of the first document of the
+ *                           index in the merged index
+ *            num_of_docs: number of documents of the index
+ * return: build status
+ * purpose: appends the duplicates of an index to the merged
+ *          ones, renumbering the documents they duplicate
+ */
+static bld_stat_t append_doc_dups(FILE *in_fp, FILE *dd_fp,
+                                  doc_num_t first_doc_num,
+                                  doc_num_t num_of_docs)
+{
+    struct oakpark_reader *reader = oakpark_open_reader(in_fp);
+    bld_stat_t result = BLD_STAT_OK;
+    char *line;
+    size_t len;
+
+    if (!reader) {
+        return BLD_STAT_ERR_INIT_IDX_STRUCT;
+    }
+    while ((line = oakpark_read_line(reader, &len)) != NULL) {
+        char *title = NULL;
+        unsigned long doc_num = strtoul(line, &title, 10);
+
+        if (title == line || *title != ' ' ||
+            doc_num >= num_of_docs) {
+            result = BLD_STAT_ERR_READ_IDX;
+            break;
+        }
+        if (fprintf(dd_fp, "%lu%s", first_doc_num + doc_num,
+                    title) < 0) {
+            result = BLD_STAT_ERR_WRITE_DL;
+            break;
+        }
+    }
+    if (result == BLD_STAT_OK && ferror(in_fp)) {
+        result = BLD_STAT_ERR_READ_IDX;
+    }
+    oakpark_close_reader(reader);
+    return result;
+}
+
+/*
+ * function: merge_postings
+ * parameter: inputs: indexes being merged, in document order
+ *            num_of_inputs: number of indexes
+ *            p_ilp_fp: merged pointers to inverted list file
+ *                      pointer
+ *            p_il_fp: merged inverted list file pointer
+ * return: build status
+ * purpose: writes the inverted list of every n-gram as that of
+ *          the first index followed by those of the others, with
+ *          their documents renumbered after the documents of the
+ *          indexes before them. The lists of an index are stored in
+ *          n-gram order and each is sorted, so all the files are
+ *          read and written once, in order, and the merged lists
+ *          come out sorted.
+ */
+static bld_stat_t merge_postings(struct merge_input *inputs,
+                                 size_t num_of_inputs,
+                                 FILE *p_ilp_fp, FILE *p_il_fp)
+{
+    const size_t num_of_entries = ulpow(P_DM12_ALPHABET_SIZE,
+                                        NUM_OF_GRAMS);
+    ng_idx_entry_t entry = { 0, NULL };
+    doc_num_t max_num_of_docs = 0;
+    bld_stat_t result = BLD_STAT_OK;
+    size_t ec;
+    size_t i;
+
+    for (ec = 0; (result == BLD_STAT_OK) && (ec < num_of_entries);
+         ec++) {
+        long pos = ftell(p_il_fp);
+        doc_num_t dc;
+
+        entry.num_of_docs = 0;
+        for (i = 0; (result == BLD_STAT_OK) && (i < num_of_inputs);
+             i++) {
+            struct merge_input *in = inputs + i;
+            unsigned long in_pos = 0;
+            unsigned long num_of_docs = 0;
+            size_t n = 0;
+            int b;
+
+            /* the pointer to the list must be where the previous
+             * list ended
+             */
+            for (b = 0; b < POS_SIZE; b++) {
+                int ib = getc(in->p_ilp_fp);
+
+                if (ib == EOF) {
+                    result = BLD_STAT_ERR_READ_IDX;
+                    break;
+                }
+                in_pos |= (unsigned long)ib << (8 * b);
+            }
+            if ((result != BLD_STAT_OK) ||
+                (in_pos != (in->pos & 0xffffffff)) ||
+                !(n = read_uint(in->p_il_fp, &num_of_docs))) {
+                fprintf(stderr, "Inconsistent index %s " IN_LOC,
+                        in->idx_fn);
+                result = BLD_STAT_ERR_READ_IDX;
+                break;
+            }
+            in->pos += n;
+            if (entry.num_of_docs + num_of_docs > max_num_of_docs) {
+                doc_num_t *tmp = NULL;
+
+                max_num_of_docs = entry.num_of_docs + num_of_docs;
+                if (!(tmp = realloc(entry.doc_nums,
+                                    max_num_of_docs *
+                                    sizeof *entry.doc_nums))) {
+                    fprintf(stderr, "Memory allocation error "
+                                    IN_LOC);
+                    result = BLD_STAT_ERR_INIT_IDX_STRUCT;
+                    break;
+                }
+                entry.doc_nums = tmp;
+            }
+            for (; num_of_docs > 0; num_of_docs--) {
+                unsigned long doc_num = 0;
+
+                if (!(n = read_uint(in->p_il_fp, &doc_num))) {
+                    fprintf(stderr, "Inconsistent index %s "
+                                    IN_LOC, in->idx_fn);
+                    result = BLD_STAT_ERR_READ_IDX;
+                    break;
+                }
+                in->pos += n;
+                entry.doc_nums[entry.num_of_docs++] =
+                in->first_doc_num + doc_num;
+            }
+        }
+        if (result != BLD_STAT_OK) {
+            break;
+        }
+
+        if ((pos < 0) ||
+            (write_uint(p_ilp_fp, (pos & 0xffffffff), POS_SIZE) < 0)) {
+            result = BLD_STAT_ERR_WRITE_P_ILP;
+            break;
+        }
+        if (write_uint(p_il_fp, entry.num_of_docs, 0) < 0) {
+            result = BLD_STAT_ERR_WRITE_P_IL;
+            break;
+        }
+        for (dc = 0; dc < entry.num_of_docs; dc++) {
+            if (write_uint(p_il_fp, entry.doc_nums[dc], 0) < 0) {
+                result = BLD_STAT_ERR_WRITE_P_IL;
+                break;
+            }
+        }
+    }
+    /* every input must have exactly one list per n-gram */
+    for (i = 0; (result == BLD_STAT_OK) && (i < num_of_inputs);
+         i++) {
+        if ((getc(inputs[i].p_ilp_fp) != EOF) ||
+            (getc(inputs[i].p_il_fp) != EOF)) {
+            fprintf(stderr, "Inconsistent index %s " IN_LOC,
+                    inputs[i].idx_fn);
+            result = BLD_STAT_ERR_READ_IDX;
+        }
+    }
+    free(entry.doc_nums);
+    return result;
+}
+
+/*
+ * function: merge_indexes
+ * parameter: idx_fn: merged index filename
+ *            in_idx_fns: filenames of the indexes to merge
+ *            num_of_inputs: number of indexes to merge
+ * return: build status
+ * purpose: merges indexes built by fnmib into the index fnmib
+ *          would build from their sequence files concatenated in
+ *          the order given, without reading any sequence
+ */
+static bld_stat_t merge_indexes(const char *idx_fn,
+                                char **in_idx_fns,
+                                size_t num_of_inputs)
+{
+    bld_stat_t result = BLD_STAT_OK;
+    struct merge_input *inputs = calloc(num_of_inputs,
+                                        sizeof *inputs);
+    FILE *p_ilp_fp = NULL;
+    FILE *p_il_fp = NULL;
+    FILE *dl_fp = NULL;
+    FILE *dd_fp = NULL;
+    doc_num_t num_of_docs = 0;
+    char *lsh_fn = NULL;
+    char *fm_fn = NULL;
+    size_t i;
+
+    if (!inputs) {
+        fprintf(stderr, "Memory allocation error " IN_LOC);
+        return BLD_STAT_ERR_INIT_IDX_STRUCT;
+    }
+    /* sketch indexes and FM-indexes aren't merged, and those of
+     * a previous build would no longer match
+     */
+    if ((lsh_fn = malloc(strlen(idx_fn) + sizeof LSH_SUFFIX))) {
+        sprintf(lsh_fn, "%s" LSH_SUFFIX, idx_fn);
+        remove(lsh_fn);
+        free(lsh_fn);
+    }
+    if ((fm_fn = malloc(strlen(idx_fn) + sizeof FM_SUFFIX))) {
+        sprintf(fm_fn, "%s" FM_SUFFIX, idx_fn);
+        remove(fm_fn);
+        free(fm_fn);
+    }
+    if (!(p_ilp_fp = open_idx_file(idx_fn, P_INVLISTPTR_SUFFIX,
+                                   "wb")) ||
+        !(p_il_fp = open_idx_file(idx_fn, P_INVLIST_SUFFIX, "wb")) ||
+        !(dl_fp = open_idx_file(idx_fn, DOCLOOKUP_SUFFIX, "w")) ||
+        !(dd_fp = open_idx_file(idx_fn, DOCDUPS_SUFFIX, "w"))) {
+        result = BLD_STAT_ERR_WRITE_P_ILP;
+        goto BAILOUT;
+    }
+
+    fprintf(stderr, "Merging document lookups...\n");
+    for (i = 0; i < num_of_inputs; i++) {
+        FILE *in_dl_fp = NULL;
+
+        inputs[i].idx_fn = in_idx_fns[i];
+        inputs[i].first_doc_num = num_of_docs;
+        if (!(inputs[i].p_ilp_fp =
+              open_idx_file(in_idx_fns[i], P_INVLISTPTR_SUFFIX,
+                            "rb")) ||
+            !(inputs[i].p_il_fp =
+              open_idx_file(in_idx_fns[i], P_INVLIST_SUFFIX,
+                            "rb")) ||
+            !(in_dl_fp =
+              open_idx_file(in_idx_fns[i], DOCLOOKUP_SUFFIX, "r"))) {
+            result = BLD_STAT_ERR_READ_IDX;
+            goto BAILOUT;
+        }
+        if (!append_doc_lookup(in_dl_fp, dl_fp, &num_of_docs)) {
+            fprintf(stderr, "Error merging %s" DOCLOOKUP_SUFFIX
+                            " " IN_LOC, in_idx_fns[i]);
+            result = BLD_STAT_ERR_WRITE_DL;
+        }
+        fclose(in_dl_fp);
+        if (result != BLD_STAT_OK) {
+            goto BAILOUT;
+        }
+        /* indexes built before duplicates were recorded have
+         * none
+         */
+        if ((in_dl_fp = open_idx_file(in_idx_fns[i], DOCDUPS_SUFFIX,
+                                      "r")) != NULL) {
+            result = append_doc_dups(in_dl_fp, dd_fp,
+                                     inputs[i].first_doc_num,
+                                     num_of_docs -
+                                     inputs[i].first_doc_num);
+            fclose(in_dl_fp);
+            if (result != BLD_STAT_OK) {
+                fprintf(stderr, "Error merging %s" DOCDUPS_SUFFIX
+                                " " IN_LOC, in_idx_fns[i]);
+                goto BAILOUT;
+            }
+        }
+    }
+
+    fprintf(stderr, "Merging inverted lists of %lu documents...\n",
+            (unsigned long)num_of_docs);
+    result = merge_postings(inputs, num_of_inputs,
+                            p_ilp_fp, p_il_fp);
+    if (result == BLD_STAT_ERR_WRITE_P_ILP ||
+        result == BLD_STAT_ERR_WRITE_P_IL) {
+        fprintf(stderr, "Error writing %s " IN_LOC, idx_fn);
+    }
+BAILOUT:
+    for (i = 0; i < num_of_inputs; i++) {
+        close_file(inputs[i].p_il_fp);
+        close_file(inputs[i].p_ilp_fp);
+    }
+    free(inputs);
+    if (dl_fp && fclose(dl_fp) != 0 && result == BLD_STAT_OK) {
+        result = BLD_STAT_ERR_WRITE_DL;
+    }
+    if (dd_fp && fclose(dd_fp) != 0 && result == BLD_STAT_OK) {
+        result = BLD_STAT_ERR_WRITE_DL;
+    }
+    if (p_il_fp && fclose(p_il_fp) != 0 && result == BLD_STAT_OK) {
+        result = BLD_STAT_ERR_WRITE_P_IL;
+    }
+    if (p_ilp_fp && fclose(p_ilp_fp) != 0 &&
+        result == BLD_STAT_OK) {
+        result = BLD_STAT_ERR_WRITE_P_ILP;
+    }
+    if (result == BLD_STAT_OK &&
+        (result = write_doc_titles(idx_fn)) != BLD_STAT_OK) {
+        fprintf(stderr, "Error writing %s" DOCTITLES_SUFFIX " " IN_LOC,
+                idx_fn);
+    }
+    if (result == BLD_STAT_OK) {
+        fprintf(stderr, "DONE!\n");
+    }
     return result;
 }
 
@@ -559,21 +1770,56 @@ BAILOUT:
 int main(int argc, char **argv)
 {
     int result = EXIT_SUCCESS;
+    int is_dir_mode = argc > 1 && strcmp(argv[1], DIR_OPT) == 0;
 
-    if (argc >= MIN_ARGC) {  /* are there enough arguments? */
-        char *idx_fn = argv[ARGI_IDX_FN];
+    if (argc > 1 && strcmp(argv[1], MERGE_OPT) == 0) {
+        if (argc < MIN_MERGE_ARGC) {
+            show_usage(argv[0]);
+            return EXIT_SUCCESS;
+        }
+        fprintf(stderr, "Merging %d indexes into %s...\n",
+                argc - ARGI_MERGE_IN_IDX_FN,
+                argv[ARGI_MERGE_IDX_FN]);
+        return merge_indexes(argv[ARGI_MERGE_IDX_FN],
+                             argv + ARGI_MERGE_IN_IDX_FN,
+                             argc - ARGI_MERGE_IN_IDX_FN) ==
+               BLD_STAT_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    /* are there enough arguments? */
+    if (is_dir_mode ? argc >= MIN_DIR_ARGC : argc >= MIN_ARGC) {
+        char *idx_fn = argv[is_dir_mode ?
+                            ARGI_DIR_IDX_FN : ARGI_IDX_FN];
         size_t idx_fn_len = strlen(idx_fn);
         /* pitch inverted list pointer filename */
         char *p_ilp_fn = NULL;
         char *p_il_fn = NULL;  /* pitch inverted list filename */
         /* duration inverted list pointer filename */
         char *dl_fn = NULL;  /* document lookup filename */
+        char *dd_fn = NULL;  /* duplicate document filename */
+        char *lsh_fn = NULL;  /* sketch index filename */
+        char *fm_fn = NULL;  /* FM-index filename */
         FILE *p_ilp_fp = NULL;
         FILE *p_il_fp = NULL;
         FILE *dl_fp = NULL;
-        char *seq_fn = argv[ARGI_SEQ_FN];
+        FILE *dd_fp = NULL;
+        FILE *lsh_fp = NULL;
+        FILE *fm_fp = NULL;
+        /* the sketch index and the FM-index are only built if
+         * asked for
+         */
+        const char *lsh_opt = getenv("FNM_LSH_BANDS");
+        int is_lsh = lsh_opt && strtoul(lsh_opt, NULL, 10) > 0;
+        const char *fm_opt = getenv("FNM_FM_SAMPLE_RATE");
+        int is_fm = fm_opt && strtoul(fm_opt, NULL, 10) > 0;
+        char *seq_fn = is_dir_mode ?
+                       (argc > ARGI_DIR_SEQ_FN ?
+                        argv[ARGI_DIR_SEQ_FN] : NULL) :
+                       argv[ARGI_SEQ_FN];
         FILE *seq_fp = NULL;
-        bld_stat_t build_status;
+        char *midi_dir = is_dir_mode ? argv[ARGI_DIR_MIDI_DIR] : NULL;
+        struct ingest *ingest = NULL;
+        bld_stat_t build_status = BLD_STAT_ERR_INIT_IDX_STRUCT;
 
         /* allocate spaces for filenames */
         if ((p_ilp_fn =
@@ -582,42 +1828,99 @@ int main(int argc, char **argv)
             (p_il_fn =
              malloc(idx_fn_len + P_INVLIST_SUFFIX_LEN + 1)) &&
             (dl_fn =
-             malloc(idx_fn_len + DOCLOOKUP_SUFFIX_LEN + 1))) {
+             malloc(idx_fn_len + DOCLOOKUP_SUFFIX_LEN + 1)) &&
+            (dd_fn =
+             malloc(idx_fn_len + DOCDUPS_SUFFIX_LEN + 1)) &&
+            (lsh_fn =
+             malloc(idx_fn_len + sizeof LSH_SUFFIX)) &&
+            (fm_fn =
+             malloc(idx_fn_len + sizeof FM_SUFFIX))) {
             sprintf(p_ilp_fn,
                     "%s" P_INVLISTPTR_SUFFIX, idx_fn);
             sprintf(p_il_fn,
                     "%s" P_INVLIST_SUFFIX, idx_fn);
             sprintf(dl_fn,
                     "%s" DOCLOOKUP_SUFFIX, idx_fn);
+            sprintf(dd_fn,
+                    "%s" DOCDUPS_SUFFIX, idx_fn);
+            sprintf(lsh_fn,
+                    "%s" LSH_SUFFIX, idx_fn);
+            sprintf(fm_fn,
+                    "%s" FM_SUFFIX, idx_fn);
         } else {
             fprintf(stderr, "Memory allocation error " IN_LOC);
+            result = EXIT_FAILURE;
+            goto BAIL_OUT;
+        }
+        /* an unreadable directory mustn't truncate the index of a
+         * previous build
+         */
+        if (midi_dir &&
+            !(ingest = ingest_start(midi_dir,
+                                    ingest_num_of_threads(),
+                                    NULL))) {
+            fprintf(stderr, "Failed reading %s " IN_LOC,
+                    midi_dir);
+            result = EXIT_FAILURE;
             goto BAIL_OUT;
         }
         if (!(p_ilp_fp = fopen(p_ilp_fn, "wb"))) {
             fprintf(stderr, "Failed opening %s " IN_LOC,
                     p_ilp_fn);
+            result = EXIT_FAILURE;
             goto BAIL_OUT;
         }
         if (!(p_il_fp = fopen(p_il_fn, "wb"))) {
             fprintf(stderr, "Failed opening %s " IN_LOC,
                     p_il_fn);
+            result = EXIT_FAILURE;
             goto BAIL_OUT;
         }
         if (!(dl_fp = fopen(dl_fn, "w"))) {
             fprintf(stderr, "Failed opening %s " IN_LOC,
                     dl_fn);
+            result = EXIT_FAILURE;
             goto BAIL_OUT;
         }
-        if (!(seq_fp = fopen(seq_fn, "r"))) {
+        if (!(dd_fp = fopen(dd_fn, "w"))) {
+            fprintf(stderr, "Failed opening %s " IN_LOC,
+                    dd_fn);
+            result = EXIT_FAILURE;
+            goto BAIL_OUT;
+        }
+        /* a sketch index of a previous build would no longer
+         * match
+         */
+        if (!is_lsh) {
+            remove(lsh_fn);
+        } else if (!(lsh_fp = fopen(lsh_fn, "wb"))) {
+            fprintf(stderr, "Failed opening %s " IN_LOC,
+                    lsh_fn);
+            result = EXIT_FAILURE;
+            goto BAIL_OUT;
+        }
+        if (!is_fm) {
+            remove(fm_fn);
+        } else if (!(fm_fp = fopen(fm_fn, "wb"))) {
+            fprintf(stderr, "Failed opening %s " IN_LOC,
+                    fm_fn);
+            result = EXIT_FAILURE;
+            goto BAIL_OUT;
+        }
+        if (seq_fn &&
+            !(seq_fp = fopen(seq_fn, is_dir_mode ? "w" : "r"))) {
             fprintf(stderr, "Failed opening %s " IN_LOC,
                     seq_fn);
+            result = EXIT_FAILURE;
             goto BAIL_OUT;
         }
 
-        fprintf(stderr, "Indexing %s...\n", seq_fn);
+        fprintf(stderr, "Indexing %s...\n",
+                midi_dir ? midi_dir : seq_fn);
         fflush(stderr);
         build_status = build_index
-                       (seq_fp, p_ilp_fp, p_il_fp, dl_fp);
+                       (seq_fp, ingest, p_ilp_fp, p_il_fp, dl_fp,
+                        dd_fp, lsh_fp, fm_fp);
         switch (build_status) {
             case BLD_STAT_OK:
                 fprintf(stderr, " DONE!\n");
@@ -634,10 +1937,22 @@ int main(int argc, char **argv)
                 fprintf(stderr, "Error writing %s " IN_LOC,
                         p_il_fn);
                 break;
+            case BLD_STAT_ERR_WRITE_SEQ:
+                fprintf(stderr, "Error writing %s " IN_LOC,
+                        seq_fn);
+                break;
             case BLD_STAT_ERR_WRITE_DL:
                 fprintf(stderr, "Error writing %s " IN_LOC,
                         dl_fn);
                 break;
+            case BLD_STAT_ERR_WRITE_LSH:
+                fprintf(stderr, "Error writing %s " IN_LOC,
+                        lsh_fn);
+                break;
+            case BLD_STAT_ERR_WRITE_FM:
+                fprintf(stderr, "Error writing %s " IN_LOC,
+                        fm_fn);
+                break;
             case BLD_STAT_ERR_INIT_IDX_STRUCT:
                 fprintf(stderr, "Error initializing index "
                                 "structure " IN_LOC);
@@ -646,17 +1961,53 @@ int main(int argc, char **argv)
                 fprintf(stderr, "\nInvalid build_status: %d "
                                 IN_LOC, build_status);
         }
-        close_file(seq_fp);
+        if (seq_fp && fclose(seq_fp) != 0 && is_dir_mode) {
+            fprintf(stderr, "Error writing %s " IN_LOC, seq_fn);
+            build_status = BLD_STAT_ERR_WRITE_SEQ;
+        }
+        seq_fp = NULL;
         if (build_status != BLD_STAT_OK) {
             result = EXIT_FAILURE;
         }
 BAIL_OUT:
+        ingest_finish(ingest);
         close_file(seq_fp);
-        close_file(dl_fp);
+        if (lsh_fp && fclose(lsh_fp) != 0 && result == EXIT_SUCCESS) {
+            fprintf(stderr, "Error writing %s " IN_LOC, lsh_fn);
+            result = EXIT_FAILURE;
+        }
+        lsh_fp = NULL;
+        if (fm_fp && fclose(fm_fp) != 0 && result == EXIT_SUCCESS) {
+            fprintf(stderr, "Error writing %s " IN_LOC, fm_fn);
+            result = EXIT_FAILURE;
+        }
+        fm_fp = NULL;
+        if (dd_fp && fclose(dd_fp) != 0 && result == EXIT_SUCCESS) {
+            fprintf(stderr, "Error writing %s " IN_LOC, dd_fn);
+            result = EXIT_FAILURE;
+        }
+        dd_fp = NULL;
+        if (dl_fp && fclose(dl_fp) != 0 && result == EXIT_SUCCESS) {
+            fprintf(stderr, "Error writing %s " IN_LOC, dl_fn);
+            result = EXIT_FAILURE;
+        }
+        dl_fp = NULL;
+        /* titles of an aborted build would go along with partial or
+         * stale index files
+         */
+        if (build_status == BLD_STAT_OK && result == EXIT_SUCCESS &&
+            write_doc_titles(idx_fn) != BLD_STAT_OK) {
+            fprintf(stderr, "Error writing %s" DOCTITLES_SUFFIX " "
+                            IN_LOC, idx_fn);
+            result = EXIT_FAILURE;
+        }
         close_file(p_il_fp);
         close_file(p_ilp_fp);
 
         /* release spaces used by filenames */
+        free(fm_fn);
+        free(lsh_fn);
+        free(dd_fn);
         free(dl_fn);
         free(p_il_fn);
         free(p_ilp_fn);
@@ -0,0 +1,355 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * Parallel MIDI directory ingest
+ *
+ * Copyright (C) 2004--2010 by RMIT MIRT Project.
+ * Copyright (C) 2010 by Iman S. H. Suyoto
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "fnmmidi.h"
+#include "fnmingest.h"
+
+#define DEFAULT_NUM_OF_THREADS 4
+
+/* a converted file waiting to be delivered */
+struct ingest_slot {
+    int is_ready;
+    struct seq_buf buf;
+};
+
+struct ingest {
+    struct ingest_file *files;
+    size_t num_of_files;
+    size_t max_num_of_files;
+    size_t rel_path_offset;
+    const struct manifest *cache;
+
+    pthread_mutex_t lock;
+    pthread_cond_t has_room;
+    pthread_cond_t has_result;
+    /* next file to be claimed by a worker */
+    size_t next_file;
+    /* next file to be delivered */
+    size_t next_out;
+    int is_cancelled;
+
+    struct ingest_slot *slots;
+    size_t window;
+    pthread_t *threads;
+    size_t num_of_threads;
+};
+
+size_t ingest_num_of_threads(void)
+{
+    const char *s = getenv("FNM_NUM_OF_THREADS");
+    unsigned long n = s ? strtoul(s, NULL, 10) : 0;
+
+    if (n > 0) {
+        return n;
+    }
+#ifdef _SC_NPROCESSORS_ONLN
+    {
+        long p = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (p > 0) {
+            return p;
+        }
+    }
+#endif
+    return DEFAULT_NUM_OF_THREADS;
+}
+
+/*
+ * function: add_file
+ * return: 1 on success
+ *         0 on failure
+ * purpose: appends a file to the list of files to convert
+ */
+static int add_file(struct ingest *ingest, char *path,
+                    size_t name_offset)
+{
+    struct ingest_file *file = NULL;
+
+    if (ingest->num_of_files == ingest->max_num_of_files) {
+        size_t n = ingest->max_num_of_files ?
+                   ingest->max_num_of_files * 2 : 256;
+        void *tmp = realloc(ingest->files, n * sizeof *ingest->files);
+
+        if (!tmp) {
+            return 0;
+        }
+        ingest->files = tmp;
+        ingest->max_num_of_files = n;
+    }
+    file = ingest->files + ingest->num_of_files++;
+    memset(file, 0, sizeof *file);
+    file->path = path;
+    file->name = path + name_offset;
+    file->rel_path = path + ingest->rel_path_offset;
+    return 1;
+}
+
+/*
+ * function: collect_files
+ * return: 1 on success
+ *         0 on failure
+ * purpose: lists the files of a directory and its
+ *          subdirectories in the order fnmmp.pl visits them
+ */
+static int collect_files(struct ingest *ingest,
+                         const char *dir_name)
+{
+    DIR *dir = opendir(dir_name);
+    struct dirent *entry = NULL;
+    size_t dir_name_len = strlen(dir_name);
+    int result = 1;
+
+    /* unreadable subdirectories are skipped like fnmmp.pl does,
+     * but there is nothing to ingest without the top directory
+     */
+    if (!dir) {
+        return dir_name_len + 1 != ingest->rel_path_offset;
+    }
+    while (result && (entry = readdir(dir)) != NULL) {
+        const char *filename = entry->d_name;
+        char *full_filename = NULL;
+        struct stat st;
+
+        if (strcmp(filename, ".") == 0 ||
+            strcmp(filename, "..") == 0 ||
+            strcmp(filename, "TRANS.TBL") == 0) {
+            continue;
+        }
+        if (!(full_filename =
+              malloc(dir_name_len + strlen(filename) + 2))) {
+            result = 0;
+            break;
+        }
+        sprintf(full_filename, "%s/%s", dir_name, filename);
+
+        if (stat(full_filename, &st) == 0 && S_ISDIR(st.st_mode)) {
+            result = collect_files(ingest, full_filename);
+            free(full_filename);
+        } else if (!add_file(ingest, full_filename,
+                             dir_name_len + 1)) {
+            free(full_filename);
+            result = 0;
+        }
+    }
+    closedir(dir);
+    return result;
+}
+
+/*
+ * function: convert_file
+ * param: file: file to convert
+ *        cache: manifest of a previous run, or NULL
+ *        out: buffer to receive the sequence lines
+ * purpose: converts a MIDI file mapped in memory, unless the
+ *          cache has its lines. Files that can't be read or parsed
+ *          produce no lines.
+ */
+static void convert_file(struct ingest_file *file,
+                         const struct manifest *cache,
+                         struct seq_buf *out)
+{
+    struct stat st;
+    void *data = MAP_FAILED;
+    const struct manifest_entry *entry = NULL;
+    int fd = open(file->path, O_RDONLY);
+
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return;
+    }
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+    entry = manifest_find(cache, file->rel_path);
+    if (entry &&
+        manifest_is_unchanged(cache, entry, file->size,
+                              file->mtime)) {
+        close(fd);
+        file->hash = entry->hash;
+        file->is_readable = 1;
+        seq_buf_append(out, entry->lines, entry->lines_len);
+        return;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        calc_content_hash(NULL, 0, &file->hash);
+        file->is_readable = 1;
+        return;
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return;
+    }
+    calc_content_hash(data, st.st_size, &file->hash);
+    file->is_readable = 1;
+    if (entry && entry->size == file->size &&
+        entry->hash.h1 == file->hash.h1 &&
+        entry->hash.h2 == file->hash.h2) {
+        seq_buf_append(out, entry->lines, entry->lines_len);
+    } else {
+        midi_to_seq(data, st.st_size, file->name, out);
+    }
+    munmap(data, st.st_size);
+}
+
+/* worker thread: convert files as long as the window has room */
+static void *convert_files(void *arg)
+{
+    struct ingest *ingest = arg;
+
+    for (;;) {
+        struct ingest_slot *slot = NULL;
+        size_t f;
+
+        pthread_mutex_lock(&ingest->lock);
+        while (!ingest->is_cancelled &&
+               ingest->next_file < ingest->num_of_files &&
+               ingest->next_file >=
+               ingest->next_out + ingest->window) {
+            pthread_cond_wait(&ingest->has_room, &ingest->lock);
+        }
+        if (ingest->is_cancelled ||
+            ingest->next_file >= ingest->num_of_files) {
+            pthread_mutex_unlock(&ingest->lock);
+            break;
+        }
+        f = ingest->next_file++;
+        slot = ingest->slots + f % ingest->window;
+        pthread_mutex_unlock(&ingest->lock);
+
+        slot->buf.len = 0;
+        convert_file(ingest->files + f, ingest->cache, &slot->buf);
+
+        pthread_mutex_lock(&ingest->lock);
+        slot->is_ready = 1;
+        pthread_cond_broadcast(&ingest->has_result);
+        pthread_mutex_unlock(&ingest->lock);
+    }
+    return NULL;
+}
+
+struct ingest *ingest_start(const char *dir_name,
+                            size_t num_of_threads,
+                            const struct manifest *cache)
+{
+    struct ingest *ingest = calloc(1, sizeof *ingest);
+    size_t t;
+
+    if (!ingest) {
+        return NULL;
+    }
+    pthread_mutex_init(&ingest->lock, NULL);
+    pthread_cond_init(&ingest->has_room, NULL);
+    pthread_cond_init(&ingest->has_result, NULL);
+    ingest->cache = cache;
+    ingest->rel_path_offset = strlen(dir_name) + 1;
+    if (!collect_files(ingest, dir_name)) {
+        ingest_finish(ingest);
+        return NULL;
+    }
+
+    if (num_of_threads == 0) {
+        num_of_threads = 1;
+    }
+    ingest->window = num_of_threads * INGEST_WINDOW_PER_THREAD;
+    if (!(ingest->slots = calloc(ingest->window,
+                                 sizeof *ingest->slots)) ||
+        !(ingest->threads = malloc(num_of_threads *
+                                   sizeof *ingest->threads))) {
+        ingest_finish(ingest);
+        return NULL;
+    }
+    for (t = 0; t < num_of_threads; ++t) {
+        if (pthread_create(ingest->threads + t, NULL,
+                           convert_files, ingest) != 0) {
+            break;
+        }
+        ingest->num_of_threads++;
+    }
+    if (ingest->num_of_threads == 0) {
+        ingest_finish(ingest);
+        return NULL;
+    }
+    return ingest;
+}
+
+const struct ingest_file *ingest_next(struct ingest *ingest,
+                                      struct seq_buf *out)
+{
+    struct ingest_slot *slot = NULL;
+    struct seq_buf tmp;
+    const struct ingest_file *file = NULL;
+
+    if (ingest->next_out >= ingest->num_of_files) {
+        return NULL;
+    }
+    slot = ingest->slots + ingest->next_out % ingest->window;
+
+    pthread_mutex_lock(&ingest->lock);
+    while (!slot->is_ready) {
+        pthread_cond_wait(&ingest->has_result, &ingest->lock);
+    }
+    /* hand over the converted lines, and recycle the caller's
+     * buffer for a later file
+     */
+    tmp = *out;
+    *out = slot->buf;
+    slot->buf = tmp;
+    slot->is_ready = 0;
+    file = ingest->files + ingest->next_out++;
+    pthread_cond_broadcast(&ingest->has_room);
+    pthread_mutex_unlock(&ingest->lock);
+    return file;
+}
+
+void ingest_finish(struct ingest *ingest)
+{
+    size_t c;
+
+    if (!ingest) {
+        return;
+    }
+    pthread_mutex_lock(&ingest->lock);
+    ingest->is_cancelled = 1;
+    pthread_cond_broadcast(&ingest->has_room);
+    pthread_mutex_unlock(&ingest->lock);
+    for (c = 0; c < ingest->num_of_threads; ++c) {
+        pthread_join(ingest->threads[c], NULL);
+    }
+    for (c = 0; ingest->slots && c < ingest->window; ++c) {
+        seq_buf_free(&ingest->slots[c].buf);
+    }
+    for (c = 0; c < ingest->num_of_files; ++c) {
+        free(ingest->files[c].path);
+    }
+    pthread_cond_destroy(&ingest->has_result);
+    pthread_cond_destroy(&ingest->has_room);
+    pthread_mutex_destroy(&ingest->lock);
+    free(ingest->threads);
+    free(ingest->slots);
+    free(ingest->files);
+    free(ingest);
+}
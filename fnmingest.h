@@ -0,0 +1,86 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * Parallel MIDI directory ingest
+ *
+ * Copyright (C) 2004--2010 by RMIT MIRT Project.
+ * Copyright (C) 2010 by Iman S. H. Suyoto
+ */
+
+#ifndef H__FNMINGEST_
+#define H__FNMINGEST_
+
+#include <stddef.h>
+
+#include "fnmmidi.h"
+#include "fnmmanifest.h"
+
+/* converted files kept ahead of the consumer, per worker */
+#define INGEST_WINDOW_PER_THREAD 16
+
+struct ingest;
+
+/* a file found in the directory walk */
+struct ingest_file {
+    char *path;
+    /* short filename, within path */
+    const char *name;
+    /* path relative to the walked directory, within path */
+    const char *rel_path;
+    /* the following are set once the file has been converted */
+    int is_readable;
+    unsigned long size;
+    unsigned long mtime;
+    struct content_hash hash;
+};
+
+/*
+ * function: ingest_num_of_threads
+ * return: the number of worker threads set by
+ *         FNM_NUM_OF_THREADS, or the number of online processors
+ */
+size_t ingest_num_of_threads(void);
+
+/*
+ * function: ingest_start
+ * param: dir_name: directory containing MIDI files
+ *        num_of_threads: number of worker threads
+ *        cache: manifest of a previous run, or NULL
+ * return: NULL on failure
+ *         pointer to the ingest on success
+ * purpose: walks dir_name and its subdirectories once, the way
+ *          fnmmp.pl does, and starts converting the files found
+ *          on a pool of worker threads. Files whose size and
+ *          content hash are those recorded in cache aren't
+ *          converted again: their cached lines are used instead.
+ *          Files whose size and mtime are unchanged aren't even
+ *          read. Fails if dir_name itself can't be read.
+ */
+struct ingest *ingest_start(const char *dir_name,
+                            size_t num_of_threads,
+                            const struct manifest *cache);
+
+/*
+ * function: ingest_next
+ * param: ingest: ingest
+ *        out: buffer to receive the sequence lines of the next
+ *             file, replacing its contents
+ * return: NULL when all files have been delivered
+ *         pointer to the next file otherwise, valid until
+ *         ingest_finish()
+ * purpose: delivers converted files in directory walk order, so
+ *          that document numbers don't depend on the number of
+ *          threads
+ */
+const struct ingest_file *ingest_next(struct ingest *ingest,
+                                      struct seq_buf *out);
+
+/*
+ * function: ingest_finish
+ * param: ingest: ingest
+ * purpose: stops the workers and releases the ingest
+ */
+void ingest_finish(struct ingest *ingest);
+
+#endif
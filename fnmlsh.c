@@ -0,0 +1,340 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * MinHash sketches of pitch n-grams
+ *
+ * Copyright 2010 by RMIT MIRT Project.
+ * Copyright 2010 by Iman S. H. Suyoto.
+ *
+ * The sketches are built by fnmib and probed by the lsh search,
+ * which share the hash functions defined here.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "fanimae.h"
+#include "oakpark.h"
+#include "fnmlsh.h"
+
+#define LSH_HDR_SIZE (5 * 4)
+#define MASK_32 0xffffffffUL
+/* average number of entries per directory slot */
+#define LSH_DIR_LOAD 4
+
+void lsh_get_params(struct lsh_params *params)
+{
+    params->num_of_bands =
+    oakpark_get_env_ulong("FNM_LSH_BANDS", DEFAULT_LSH_NUM_OF_BANDS);
+    params->num_of_rows =
+    oakpark_get_env_ulong("FNM_LSH_ROWS", DEFAULT_LSH_NUM_OF_ROWS);
+    params->window =
+    oakpark_get_env_ulong("FNM_LSH_WINDOW", DEFAULT_LSH_WINDOW);
+}
+
+/* 32-bit finalizer of MurmurHash3: every input bit affects every
+ * output bit
+ */
+static unsigned long mix(unsigned long h)
+{
+    h &= MASK_32;
+    h ^= h >> 16;
+    h = (h * 0x85ebca6bUL) & MASK_32;
+    h ^= h >> 13;
+    h = (h * 0xc2b2ae35UL) & MASK_32;
+    h ^= h >> 16;
+    return h;
+}
+
+size_t lsh_num_of_windows(const struct lsh_params *params,
+                          size_t num_of_grams)
+{
+    size_t stride = (params->window + 1) / 2;
+
+    if (num_of_grams <= params->window) {
+        return 1;
+    }
+    /* the last window ends at the last n-gram */
+    return (num_of_grams - params->window + stride - 1) / stride + 1;
+}
+
+void lsh_band_keys(const struct lsh_params *params,
+                   const unsigned long *grams, size_t num_of_grams,
+                   unsigned long *keys)
+{
+    size_t stride = (params->window + 1) / 2;
+    size_t num_of_windows = lsh_num_of_windows(params,
+                                               num_of_grams);
+    size_t len = num_of_grams < params->window ?
+                 num_of_grams : params->window;
+    size_t w;
+
+    assert(num_of_grams > 0);
+    for (w = 0; w < num_of_windows; ++w) {
+        size_t first = (w + 1 < num_of_windows) ?
+                       w * stride : num_of_grams - len;
+        unsigned long b;
+
+        for (b = 0; b < params->num_of_bands; ++b) {
+            unsigned long key = mix(b + 1);
+            unsigned long r;
+
+            for (r = 0; r < params->num_of_rows; ++r) {
+                /* every row of every band is a hash function of
+                 * its own
+                 */
+                unsigned long seed = mix(b * params->num_of_rows +
+                                         r + 0x9e3779b9UL);
+                unsigned long min = MASK_32;
+                size_t g;
+
+                for (g = first; g < first + len; ++g) {
+                    unsigned long h = mix(grams[g] ^ seed);
+
+                    if (h < min) {
+                        min = h;
+                    }
+                }
+                key = mix(key * 31 + min);
+            }
+            *keys++ = key;
+        }
+    }
+}
+
+/*
+ * function: build_dir
+ * param: sketch: sketch
+ *        b: band number
+ * return: 1 on success
+ *         0 if out of memory (sketch->dirs[b] is NULL) or if the
+ *           entries of the band aren't sorted
+ * purpose: builds the directory of the entries of a band
+ */
+static int build_dir(struct lsh_sketch *sketch, unsigned long b)
+{
+    const unsigned char *entries = sketch->bands[b];
+    unsigned long n = sketch->band_sizes[b];
+    unsigned bits = 0;
+    unsigned long *dir = NULL;
+    unsigned long prefix = 0;
+    unsigned long e;
+
+    while (bits < 24 && (n >> bits) > LSH_DIR_LOAD) {
+        ++bits;
+    }
+    if (!(dir = malloc(((1UL << bits) + 1) * sizeof *dir))) {
+        return 0;
+    }
+    sketch->dirs[b] = dir;
+    sketch->dir_bits[b] = bits;
+    for (e = 0; e < n; ++e) {
+        unsigned long p = bits ? LSH_GET(entries + e * 8) >>
+                                 (32 - bits) : 0;
+
+        if (p + 1 < prefix) {
+            return 0;
+        }
+        while (prefix <= p) {
+            dir[prefix++] = e;
+        }
+    }
+    while (prefix <= (1UL << bits)) {
+        dir[prefix++] = n;
+    }
+    return 1;
+}
+
+struct lsh_sketch *lsh_open(const char *fn)
+{
+    struct lsh_sketch *sketch = calloc(1, sizeof *sketch);
+    FILE *fp = fopen(fn, "rb");
+    const unsigned char *p = NULL;
+    const unsigned char *end = NULL;
+    long size = 0;
+    unsigned long b;
+
+    if (!sketch || !fp) {
+        fprintf(stderr, "Can't open %s\n", fn);
+        goto bail_out;
+    }
+    if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) < 0 ||
+        fseek(fp, 0, SEEK_SET) != 0 ||
+        !(sketch->buf = malloc(size ? size : 1)) ||
+        fread(sketch->buf, 1, size, fp) != (size_t)size) {
+        fprintf(stderr, "Can't read %s\n", fn);
+        goto bail_out;
+    }
+    fclose(fp);
+    fp = NULL;
+    sketch->size = size;
+    p = sketch->buf;
+    end = sketch->buf + sketch->size;
+
+    if (sketch->size < LSH_HDR_SIZE ||
+        memcmp(p, LSH_MAGIC, LSH_MAGIC_LEN) != 0) {
+        goto inconsistent;
+    }
+    sketch->params.num_of_bands = LSH_GET(p + 4);
+    sketch->params.num_of_rows = LSH_GET(p + 8);
+    sketch->params.window = LSH_GET(p + 12);
+    sketch->num_of_docs = LSH_GET(p + 16);
+    p += LSH_HDR_SIZE;
+    if (sketch->params.num_of_bands == 0 ||
+        sketch->params.num_of_rows == 0 ||
+        sketch->params.window == 0 ||
+        (size_t)(end - p) / 4 < sketch->num_of_docs + 1) {
+        goto inconsistent;
+    }
+    sketch->doc_ptrs = p;
+    p += (sketch->num_of_docs + 1) * 4;
+    sketch->num_of_codes = LSH_GET(p - 4);
+    if ((size_t)(end - p) / 4 < sketch->num_of_codes) {
+        goto inconsistent;
+    }
+    sketch->codes = p;
+    p += sketch->num_of_codes * 4;
+
+    if (!(sketch->bands = malloc(sketch->params.num_of_bands *
+                                 sizeof *sketch->bands)) ||
+        !(sketch->band_sizes =
+          malloc(sketch->params.num_of_bands *
+                 sizeof *sketch->band_sizes))) {
+        fprintf(stderr, "Can't allocate memory for %s\n", fn);
+        goto bail_out;
+    }
+    for (b = 0; b < sketch->params.num_of_bands; ++b) {
+        if (end - p < 4) {
+            goto inconsistent;
+        }
+        sketch->band_sizes[b] = LSH_GET(p);
+        p += 4;
+        if ((size_t)(end - p) / 8 < sketch->band_sizes[b]) {
+            goto inconsistent;
+        }
+        sketch->bands[b] = p;
+        p += sketch->band_sizes[b] * 8;
+    }
+    if (p != end) {
+        goto inconsistent;
+    }
+    if (!(sketch->dirs = calloc(sketch->params.num_of_bands,
+                                sizeof *sketch->dirs)) ||
+        !(sketch->dir_bits = calloc(sketch->params.num_of_bands,
+                                    sizeof *sketch->dir_bits))) {
+        fprintf(stderr, "Can't allocate memory for %s\n", fn);
+        goto bail_out;
+    }
+    for (b = 0; b < sketch->params.num_of_bands; ++b) {
+        if (!build_dir(sketch, b)) {
+            if (sketch->dirs[b]) {
+                goto inconsistent;
+            }
+            fprintf(stderr, "Can't allocate memory for %s\n", fn);
+            goto bail_out;
+        }
+    }
+    sketch->max_num_of_candidates =
+    oakpark_get_env_ulong("FNM_LSH_MAX_CANDIDATES",
+                          DEFAULT_LSH_MAX_NUM_OF_CANDIDATES);
+    return sketch;
+
+inconsistent:
+    fprintf(stderr, "Inconsistent sketch %s\n", fn);
+bail_out:
+    if (fp) {
+        fclose(fp);
+    }
+    lsh_close(sketch);
+    return NULL;
+}
+
+void lsh_close(struct lsh_sketch *sketch)
+{
+    unsigned long b;
+
+    if (sketch) {
+        for (b = 0; sketch->dirs && b < sketch->params.num_of_bands;
+             ++b) {
+            free(sketch->dirs[b]);
+        }
+        free(sketch->dirs);
+        free(sketch->dir_bits);
+        free(sketch->buf);
+        free(sketch->bands);
+        free(sketch->band_sizes);
+        free(sketch);
+    }
+}
+
+const unsigned char *lsh_bucket(const struct lsh_sketch *sketch,
+                                unsigned long band,
+                                unsigned long key,
+                                size_t *num_of_entries)
+{
+    const unsigned char *entries = sketch->bands[band];
+    unsigned bits = sketch->dir_bits[band];
+    unsigned long prefix = bits ? key >> (32 - bits) : 0;
+    size_t lo = sketch->dirs[band][prefix];
+    size_t hi = sketch->dirs[band][prefix + 1];
+    size_t first;
+
+    /* the first entry with the key or a greater one */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (LSH_GET(entries + mid * 8) < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    first = lo;
+    hi = sketch->band_sizes[band];
+    while (lo < hi && LSH_GET(entries + lo * 8) == key) {
+        ++lo;
+    }
+    *num_of_entries = lo - first;
+    return entries + first * 8;
+}
+
+unsigned long lsh_count_common(const struct lsh_sketch *sketch,
+                               doc_num_t d,
+                               const unsigned long *grams,
+                               size_t num_of_grams)
+{
+    unsigned long first = LSH_GET(sketch->doc_ptrs + d * 4);
+    unsigned long last = LSH_GET(sketch->doc_ptrs + (d + 1) * 4);
+    unsigned long result = 0;
+    size_t g;
+
+    if (first > last || last > sketch->num_of_codes) {
+        return 0;
+    }
+    for (g = 0; g < num_of_grams && first < last; ++g) {
+        /* both lists are ascending, so the search for the next
+         * n-gram starts where the previous one ended
+         */
+        unsigned long lo = first;
+        unsigned long hi = last;
+
+        while (lo < hi) {
+            unsigned long mid = lo + (hi - lo) / 2;
+
+            if (LSH_GET(sketch->codes + mid * 4) < grams[g]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo < last && LSH_GET(sketch->codes + lo * 4) == grams[g]) {
+            ++result;
+            ++lo;
+        }
+        first = lo;
+    }
+    return result;
+}
@@ -0,0 +1,150 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * MinHash sketches of pitch n-grams
+ *
+ * Copyright 2010 by RMIT MIRT Project.
+ * Copyright 2010 by Iman S. H. Suyoto.
+ */
+
+#ifndef H__FNMLSH_
+#define H__FNMLSH_
+
+#include <stddef.h>
+
+#include "fanimae.h"
+
+#define LSH_SUFFIX ".flsh"
+#define LSH_MAGIC "FLSH"
+#define LSH_MAGIC_LEN (sizeof LSH_MAGIC - 1)
+#define DEFAULT_LSH_NUM_OF_BANDS 32
+#define DEFAULT_LSH_NUM_OF_ROWS 2
+#define DEFAULT_LSH_WINDOW 16
+#define DEFAULT_LSH_MAX_NUM_OF_CANDIDATES 1000
+
+/*
+ * A track is sketched as the n-gram sets of its windows of
+ * window n-grams overlapping by half, since a query is an excerpt
+ * of a track rather than a whole one. A window is summarized by
+ * num_of_bands * num_of_rows MinHash values, and each band of
+ * num_of_rows values by a single key. Two windows share the key of
+ * a band with a probability of about J ^ num_of_rows, where J is
+ * the Jaccard similarity of their n-gram sets.
+ *
+ * A sketch file holds, as 4-byte little-endian integers:
+ * - LSH_MAGIC, num_of_bands, num_of_rows, window and the
+ *   number of documents
+ * - for every document, the position of its n-grams in the
+ *   n-grams, and the number of n-grams after the last document
+ * - the distinct n-gram codes of every document, ascending
+ * - for every band, the number of entries and the entries, each
+ *   a key and a document number, ascending
+ */
+struct lsh_params {
+    unsigned long num_of_bands;
+    unsigned long num_of_rows;
+    unsigned long window;
+};
+
+/* a sketch file loaded in memory */
+struct lsh_sketch {
+    unsigned char *buf;
+    size_t size;
+    struct lsh_params params;
+    doc_num_t num_of_docs;
+    const unsigned char *doc_ptrs;
+    const unsigned char *codes;
+    unsigned long num_of_codes;
+    /* entries and number of entries of every band */
+    const unsigned char **bands;
+    unsigned long *band_sizes;
+    /* for every band, the first entry whose key starts with each
+     * of the dir_bits-bit prefixes, and the number of entries
+     * after the last one. Keys are hash values, so buckets are
+     * found in a few entries rather than by a binary search of the
+     * band.
+     */
+    unsigned long **dirs;
+    unsigned *dir_bits;
+    /* candidates verified per query */
+    size_t max_num_of_candidates;
+};
+
+/* read a 4-byte little-endian integer */
+#define LSH_GET(p) \
+    ((unsigned long)(p)[0] | ((unsigned long)(p)[1] << 8) | \
+     ((unsigned long)(p)[2] << 16) | ((unsigned long)(p)[3] << 24))
+
+/*
+ * function: lsh_get_params
+ * param: params: pointer to the object to store the parameters
+ * purpose: reads the sketch parameters from FNM_LSH_BANDS,
+ *          FNM_LSH_ROWS and FNM_LSH_WINDOW
+ */
+void lsh_get_params(struct lsh_params *params);
+
+/*
+ * function: lsh_num_of_windows
+ * return: the number of windows of num_of_grams n-grams
+ */
+size_t lsh_num_of_windows(const struct lsh_params *params,
+                          size_t num_of_grams);
+
+/*
+ * function: lsh_band_keys
+ * param: params: sketch parameters
+ *        grams: n-gram codes, in sequence order
+ *        num_of_grams: number of n-grams, at least 1
+ *        keys: array of lsh_num_of_windows() * num_of_bands
+ *              elements to store the band keys of every window,
+ *              window by window
+ */
+void lsh_band_keys(const struct lsh_params *params,
+                   const unsigned long *grams, size_t num_of_grams,
+                   unsigned long *keys);
+
+/*
+ * function: lsh_open
+ * param: fn: sketch filename
+ * return: NULL on failure, including an inconsistent file
+ *         pointer to the loaded sketch on success
+ */
+struct lsh_sketch *lsh_open(const char *fn);
+
+/*
+ * function: lsh_close
+ * purpose: releases a sketch loaded by lsh_open()
+ */
+void lsh_close(struct lsh_sketch *sketch);
+
+/*
+ * function: lsh_bucket
+ * param: sketch: sketch
+ *        band: band number
+ *        key: band key
+ *        num_of_entries: pointer to the object to store the
+ *                        number of entries with the key
+ * return: the first entry of the band with the key. The document
+ *         number of an entry e is LSH_GET(e + 4), and entries are
+ *         8 bytes apart.
+ */
+const unsigned char *lsh_bucket(const struct lsh_sketch *sketch,
+                                unsigned long band,
+                                unsigned long key,
+                                size_t *num_of_entries);
+
+/*
+ * function: lsh_count_common
+ * param: sketch: sketch
+ *        d: document number
+ *        grams: distinct n-gram codes, ascending
+ *        num_of_grams: number of n-grams
+ * return: the number of the n-grams in document d
+ */
+unsigned long lsh_count_common(const struct lsh_sketch *sketch,
+                               doc_num_t d,
+                               const unsigned long *grams,
+                               size_t num_of_grams);
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * Ingest manifest: per-file cache of sequence lines
+ *
+ * Copyright (C) 2004--2010 by RMIT MIRT Project.
+ * Copyright (C) 2010 by Iman S. H. Suyoto
+ *
+ * A manifest is a header line
+ *
+ *   fnmmp-manifest 1 start-time
+ *
+ * followed by one record per file, in directory walk order:
+ *
+ *   size mtime hash lines-length relative-path
+ *   lines
+ *
+ * where lines are the lines-length bytes of sequence lines the
+ * file was converted to.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fnmmanifest.h"
+
+#define HASH_MASK 0xffffffffUL
+#define FNV_OFFSET_BASIS 2166136261UL
+#define FNV_PRIME 16777619UL
+
+void calc_content_hash(const unsigned char *data, size_t size,
+                       struct content_hash *hash)
+{
+    /* FNV-1a and Jenkins' one-at-a-time hash */
+    unsigned long h1 = FNV_OFFSET_BASIS;
+    unsigned long h2 = 0;
+    size_t i;
+
+    for (i = 0; i < size; ++i) {
+        h1 = ((h1 ^ data[i]) * FNV_PRIME) & HASH_MASK;
+        h2 = (h2 + data[i]) & HASH_MASK;
+        h2 = (h2 + (h2 << 10)) & HASH_MASK;
+        h2 ^= h2 >> 6;
+    }
+    h2 = (h2 + (h2 << 3)) & HASH_MASK;
+    h2 ^= h2 >> 11;
+    h2 = (h2 + (h2 << 15)) & HASH_MASK;
+    hash->h1 = h1;
+    hash->h2 = h2;
+}
+
+/*
+ * function: read_whole_file
+ * return: NULL on failure
+ *         pointer to the NUL-terminated file contents on success.
+ *         This pointer should be free()'d later.
+ */
+static char *read_whole_file(const char *fn, size_t *size)
+{
+    FILE *fp = fopen(fn, "rb");
+    char *buf = NULL;
+    size_t buf_size = 0;
+    size_t len = 0;
+
+    if (!fp) {
+        return NULL;
+    }
+    for (;;) {
+        size_t n;
+
+        if (len + 1 >= buf_size) {
+            size_t new_size = buf_size ? buf_size * 2 : BUFSIZ;
+            void *tmp = realloc(buf, new_size);
+
+            if (!tmp) {
+                free(buf);
+                fclose(fp);
+                return NULL;
+            }
+            buf = tmp;
+            buf_size = new_size;
+        }
+        n = fread(buf + len, 1, buf_size - len - 1, fp);
+        len += n;
+        if (n == 0) {
+            break;
+        }
+    }
+    if (ferror(fp)) {
+        free(buf);
+        fclose(fp);
+        return NULL;
+    }
+    fclose(fp);
+    buf[len] = '\0';
+    *size = len;
+    return buf;
+}
+
+/*
+ * function: parse_hex32
+ * return: 1 on success
+ *         0 if s doesn't start with 8 hexadecimal digits
+ */
+static int parse_hex32(const char *s, unsigned long *val)
+{
+    char digits[9];
+    char *end = NULL;
+
+    memcpy(digits, s, 8);
+    digits[8] = '\0';
+    *val = strtoul(digits, &end, 16);
+    return end == digits + 8;
+}
+
+/*
+ * function: parse_entry
+ * param: p: start of the record
+ *        end: end of the manifest
+ *        entry: pointer to the object to store the record
+ * return: NULL if the record is malformed
+ *         pointer to the next record otherwise
+ * purpose: parses a record, NUL-terminating its path in place
+ */
+static char *parse_entry(char *p, const char *end,
+                         struct manifest_entry *entry)
+{
+    char *nl = memchr(p, '\n', end - p);
+    char *q = NULL;
+    unsigned long lines_len;
+
+    if (!nl) {
+        return NULL;
+    }
+    *nl = '\0';
+    entry->size = strtoul(p, &q, 10);
+    if (*q != ' ') {
+        return NULL;
+    }
+    entry->mtime = strtoul(q + 1, &q, 10);
+    if (*q != ' ' || nl - q < 18 ||
+        !parse_hex32(q + 1, &entry->hash.h1) ||
+        !parse_hex32(q + 9, &entry->hash.h2) || q[17] != ' ') {
+        return NULL;
+    }
+    lines_len = strtoul(q + 18, &q, 10);
+    if (*q != ' ' || !q[1] ||
+        lines_len > (unsigned long)(end - (nl + 1))) {
+        return NULL;
+    }
+    entry->rel_path = q + 1;
+    entry->lines = nl + 1;
+    entry->lines_len = lines_len;
+    return nl + 1 + lines_len;
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+    return strcmp(((const struct manifest_entry *)a)->rel_path,
+                  ((const struct manifest_entry *)b)->rel_path);
+}
+
+struct manifest *manifest_load(const char *fn)
+{
+    struct manifest *manifest = NULL;
+    size_t size = 0;
+    size_t max_num_of_entries = 0;
+    char *p = NULL;
+    char *end = NULL;
+    char *buf = read_whole_file(fn, &size);
+
+    if (!buf) {
+        return NULL;
+    }
+    if (strncmp(buf, MANIFEST_MAGIC " ",
+                sizeof MANIFEST_MAGIC) != 0 ||
+        !(manifest = calloc(1, sizeof *manifest))) {
+        free(buf);
+        return NULL;
+    }
+    manifest->buf = buf;
+    end = buf + size;
+    manifest->start_time = strtoul(buf + sizeof MANIFEST_MAGIC,
+                                   &p, 10);
+    if (*p != '\n') {
+        manifest_free(manifest);
+        return NULL;
+    }
+    ++p;
+    while (p < end) {
+        if (manifest->num_of_entries == max_num_of_entries) {
+            size_t n = max_num_of_entries ?
+                       max_num_of_entries * 2 : 256;
+            void *tmp = realloc(manifest->entries,
+                                n * sizeof *manifest->entries);
+
+            if (!tmp) {
+                manifest_free(manifest);
+                return NULL;
+            }
+            manifest->entries = tmp;
+            max_num_of_entries = n;
+        }
+        if (!(p = parse_entry(p, end, manifest->entries +
+                                      manifest->num_of_entries))) {
+            manifest_free(manifest);
+            return NULL;
+        }
+        manifest->num_of_entries++;
+    }
+    qsort(manifest->entries, manifest->num_of_entries,
+          sizeof *manifest->entries, cmp_entry);
+    return manifest;
+}
+
+const struct manifest_entry *manifest_find
+                             (const struct manifest *manifest,
+                              const char *rel_path)
+{
+    struct manifest_entry key;
+
+    if (!manifest || manifest->num_of_entries == 0) {
+        return NULL;
+    }
+    key.rel_path = rel_path;
+    return bsearch(&key, manifest->entries,
+                   manifest->num_of_entries,
+                   sizeof *manifest->entries, cmp_entry);
+}
+
+int manifest_is_unchanged(const struct manifest *manifest,
+                          const struct manifest_entry *entry,
+                          unsigned long size, unsigned long mtime)
+{
+    /* a file modified in the second the previous run started may
+     * have been modified again after it was read, without its mtime
+     * changing
+     */
+    return entry->size == size && entry->mtime == mtime &&
+           mtime < manifest->start_time;
+}
+
+void manifest_free(struct manifest *manifest)
+{
+    if (!manifest) {
+        return;
+    }
+    free(manifest->entries);
+    free(manifest->buf);
+    free(manifest);
+}
+
+int manifest_write_header(FILE *fp, unsigned long start_time)
+{
+    return fprintf(fp, MANIFEST_MAGIC " %lu\n", start_time) > 0;
+}
+
+int manifest_write_entry(FILE *fp,
+                         const struct manifest_entry *entry)
+{
+    if (fprintf(fp, "%lu %lu %08lx%08lx %lu %s\n",
+                entry->size, entry->mtime,
+                entry->hash.h1, entry->hash.h2,
+                (unsigned long)entry->lines_len,
+                entry->rel_path) < 0) {
+        return 0;
+    }
+    return entry->lines_len == 0 ||
+           fwrite(entry->lines, 1, entry->lines_len, fp) ==
+           entry->lines_len;
+}
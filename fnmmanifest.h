@@ -0,0 +1,113 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * Ingest manifest: per-file cache of sequence lines
+ *
+ * Copyright (C) 2004--2010 by RMIT MIRT Project.
+ * Copyright (C) 2010 by Iman S. H. Suyoto
+ */
+
+#ifndef H__FNMMANIFEST_
+#define H__FNMMANIFEST_
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define MANIFEST_MAGIC "fnmmp-manifest 1"
+
+/* content hash of a file: two independent 32-bit hashes */
+struct content_hash {
+    unsigned long h1;
+    unsigned long h2;
+};
+
+/* what a previous run recorded about a file */
+struct manifest_entry {
+    /* path relative to the collection directory */
+    const char *rel_path;
+    unsigned long size;
+    unsigned long mtime;
+    struct content_hash hash;
+    /* sequence lines the file was converted to */
+    const char *lines;
+    size_t lines_len;
+};
+
+struct manifest {
+    char *buf;
+    /* time the run that wrote the manifest started */
+    unsigned long start_time;
+    struct manifest_entry *entries;
+    size_t num_of_entries;
+};
+
+/*
+ * function: calc_content_hash
+ * param: data: file contents
+ *        size: size of data
+ *        hash: pointer to the object to store the hash
+ */
+void calc_content_hash(const unsigned char *data, size_t size,
+                       struct content_hash *hash);
+
+/*
+ * function: manifest_load
+ * param: fn: manifest filename
+ * return: NULL if the manifest doesn't exist or can't be read
+ *         pointer to the manifest on success
+ */
+struct manifest *manifest_load(const char *fn);
+
+/*
+ * function: manifest_find
+ * param: manifest: manifest, may be NULL
+ *        rel_path: path relative to the collection directory
+ * return: NULL if the file isn't in the manifest
+ *         pointer to the entry of the file otherwise
+ */
+const struct manifest_entry *manifest_find
+                             (const struct manifest *manifest,
+                              const char *rel_path);
+
+/*
+ * function: manifest_is_unchanged
+ * param: manifest: manifest the entry belongs to
+ *        entry: entry
+ *        size: current size of the file
+ *        mtime: current modification time of the file
+ * return: 1 if the file can be assumed unchanged without reading
+ *         it, i.e. its size and mtime are the recorded ones and it
+ *         wasn't modified while the manifest was being written
+ *         0 otherwise
+ */
+int manifest_is_unchanged(const struct manifest *manifest,
+                          const struct manifest_entry *entry,
+                          unsigned long size, unsigned long mtime);
+
+/*
+ * function: manifest_free
+ * param: manifest: manifest, may be NULL
+ */
+void manifest_free(struct manifest *manifest);
+
+/*
+ * function: manifest_write_header
+ * param: fp: output stream
+ *        start_time: time the run started
+ * return: 1 on success
+ *         0 on failure
+ */
+int manifest_write_header(FILE *fp, unsigned long start_time);
+
+/*
+ * function: manifest_write_entry
+ * param: fp: output stream
+ *        entry: entry to write
+ * return: 1 on success
+ *         0 on failure
+ */
+int manifest_write_entry(FILE *fp,
+                         const struct manifest_entry *entry);
+
+#endif
@@ -0,0 +1,518 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * MIDI to sequence conversion
+ *
+ * Copyright (C) 2004--2010 by RMIT MIRT Project.
+ * Copyright (C) 2010 by Iman S. H. Suyoto
+ *
+ * This is a port of fnmmp.pl. Standard MIDI Files are decoded
+ * the way the CPAN MIDI modules used by fnmmp.pl decode them,
+ * quirks included, so that the output is byte-identical.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "fnmmidi.h"
+
+#define MIDI_HEADER_SIZE 14
+#define CHUNK_HEADER_SIZE 8
+#define NUM_OF_CHANNELS 16
+#define NUM_OF_KEYS 256
+#define PERCUSSION_CHANNEL 9
+#define NO_NOTE -1L
+
+/* a note as found in an MIDI::Score score */
+struct note {
+    long start;
+    long duration;
+    int channel;
+    int pitch;
+    /* previous note still sounding on the same key */
+    long prev_pending;
+};
+
+/* decoded file: notes of all tracks */
+struct score {
+    struct note *notes;
+    size_t num_of_notes;
+    size_t max_num_of_notes;
+    size_t *track_ends;
+    size_t num_of_tracks;
+    size_t max_num_of_tracks;
+    /* most recent note still sounding on each channel and key */
+    long pending[NUM_OF_CHANNELS * NUM_OF_KEYS];
+};
+
+int seq_buf_append(struct seq_buf *buf, const char *s, size_t len)
+{
+    if (len == 0) {
+        return 1;
+    }
+    if (buf->len + len + 1 > buf->size) {
+        size_t size = buf->size ? buf->size : 1024;
+        void *tmp = NULL;
+
+        while (buf->len + len + 1 > size) {
+            size *= 2;
+        }
+        if (!(tmp = realloc(buf->s, size))) {
+            return 0;
+        }
+        buf->s = tmp;
+        buf->size = size;
+    }
+    memcpy(buf->s + buf->len, s, len);
+    buf->len += len;
+    buf->s[buf->len] = '\0';
+    return 1;
+}
+
+void seq_buf_free(struct seq_buf *buf)
+{
+    free(buf->s);
+    buf->s = NULL;
+    buf->len = 0;
+    buf->size = 0;
+}
+
+/*
+ * function: read_ber
+ * param: p: data
+ *        avail: number of bytes available
+ *        x: pointer to the result placeholder
+ *        used: pointer to the number of bytes read
+ * return: 1 on success or if no bytes are available (*x is then
+ *         0)
+ *         0 on an unterminated compressed integer
+ * purpose: reads a BER compressed integer as Perl's
+ *          unpack("w") does
+ */
+static int read_ber(const unsigned char *p, size_t avail,
+                    unsigned long *x, size_t *used)
+{
+    size_t c;
+
+    *x = 0;
+    *used = 0;
+    for (c = 0; c < avail; ++c) {
+        *x = (*x << 7) | (p[c] & 0x7f);
+        if (!(p[c] & 0x80)) {
+            *used = c + 1;
+            return 1;
+        }
+    }
+    return avail == 0;
+}
+
+/*
+ * function: ber_len
+ * return: number of bytes of the shortest BER encoding of x
+ */
+static size_t ber_len(unsigned long x)
+{
+    size_t n = 1;
+
+    while (x >>= 7) {
+        ++n;
+    }
+    return n;
+}
+
+static unsigned long read_be32(const unsigned char *p)
+{
+    return ((unsigned long)p[0] << 24) |
+           ((unsigned long)p[1] << 16) |
+           ((unsigned long)p[2] << 8) |
+           (unsigned long)p[3];
+}
+
+/* add a note to the score */
+static int start_note(struct score *score, long time,
+                      int channel, int pitch)
+{
+    long *pending = score->pending +
+                    channel * NUM_OF_KEYS + pitch;
+    struct note *note = NULL;
+
+    if (score->num_of_notes == score->max_num_of_notes) {
+        size_t n = score->max_num_of_notes ?
+                   score->max_num_of_notes * 2 : 256;
+        void *tmp = realloc(score->notes, n * sizeof *score->notes);
+
+        if (!tmp) {
+            return 0;
+        }
+        score->notes = tmp;
+        score->max_num_of_notes = n;
+    }
+    note = score->notes + score->num_of_notes;
+    note->start = time;
+    /* the end time is added when the note ends */
+    note->duration = -time;
+    note->channel = channel;
+    note->pitch = pitch;
+    note->prev_pending = *pending;
+    *pending = score->num_of_notes++;
+    return 1;
+}
+
+/* end the most recent note still sounding on a key */
+static void end_note(struct score *score, long time,
+                     int channel, int pitch)
+{
+    long *pending = score->pending +
+                    channel * NUM_OF_KEYS + pitch;
+
+    if (*pending != NO_NOTE) {
+        struct note *note = score->notes + *pending;
+
+        note->duration += time;
+        *pending = note->prev_pending;
+    }
+}
+
+/*
+ * function: decode_track
+ * param: score: score the notes are added to
+ *        data: MTrk chunk data
+ *        len: length of data
+ * return: 1 on success
+ *         0 if the track can't be decoded
+ * purpose: decodes the notes of a track. A track is silently cut
+ *          short at an event that can't be interpreted.
+ */
+static int decode_track(struct score *score,
+                        const unsigned char *data, size_t len)
+{
+    size_t ptr = 0;
+    int event_code = -1;
+    long time = 0;
+    size_t c;
+
+    for (c = 0; c < NUM_OF_CHANNELS * NUM_OF_KEYS; ++c) {
+        score->pending[c] = NO_NOTE;
+    }
+
+    while (ptr + 1 < len) {
+        unsigned long delta = 0;
+        unsigned long length = 0;
+        size_t used = 0;
+        size_t window = 0;
+        int first_byte;
+
+        if (!read_ber(data + ptr, len - ptr < 4 ? len - ptr : 4,
+                      &delta, &used)) {
+            return 0;
+        }
+        ptr += ber_len(delta);
+        first_byte = ptr < len ? data[ptr] : 0;
+
+        if (first_byte < 0xf0) {  /* MIDI event */
+            int command;
+            int channel;
+            size_t num_of_params;
+            int param_1 = -1;
+            int param_2 = -1;
+
+            if (first_byte >= 0x80) {
+                ++ptr;
+                event_code = first_byte;
+            } else if (event_code == -1) {
+                /* running status without a status: abort */
+                break;
+            }
+            command = event_code & 0xf0;
+            channel = event_code & 0x0f;
+            num_of_params =
+                (command == 0xc0 || command == 0xd0) ? 1 : 2;
+            if (ptr < len) {
+                param_1 = data[ptr];
+            }
+            if (num_of_params > 1 && ptr + 1 < len) {
+                param_2 = data[ptr + 1];
+            }
+            ptr += num_of_params;
+            time += delta;
+
+            if (param_1 < 0) {
+                continue;
+            }
+            if (command == 0x80 ||
+                (command == 0x90 && param_2 <= 0)) {
+                end_note(score, time, channel, param_1);
+            } else if (command == 0x90) {
+                if (!start_note(score, time, channel, param_1)) {
+                    return 0;
+                }
+            }
+        } else if (first_byte == 0xff) {  /* meta-event */
+            /* type and length are read from a 6-byte window and
+             * the pointer is moved past the whole window minus
+             * what is left of it
+             */
+            window = len - ptr < 6 ? len - ptr : 6;
+            if (!read_ber(data + ptr + 2,
+                          window > 2 ? window - 2 : 0,
+                          &length, &used)) {
+                return 0;
+            }
+            ptr += 6 - (window > 2 + used ?
+                        window - (2 + used) : 0);
+            ptr += length;
+            time += delta;
+        } else if (first_byte == 0xf0 ||
+                   first_byte == 0xf7) {  /* sysex */
+            window = len - ptr < 5 ? len - ptr : 5;
+            if (!read_ber(data + ptr + 1, window - 1,
+                          &length, &used)) {
+                return 0;
+            }
+            ptr += 5 - (window > 1 + used ?
+                        window - (1 + used) : 0);
+            ptr += length;
+            time += delta;
+        } else if (first_byte == 0xf2) {  /* song position */
+            ptr += 3;
+            time += delta;
+        } else if (first_byte == 0xf3) {  /* song select */
+            ptr += 2;
+            time += delta;
+        } else if (first_byte == 0xf6) {  /* tune request */
+            ++ptr;
+            time += delta;
+        } else {
+            /* anything else aborts the track */
+            break;
+        }
+    }
+    return 1;
+}
+
+/* mark the end of the notes of a track */
+static int end_track(struct score *score)
+{
+    if (score->num_of_tracks == score->max_num_of_tracks) {
+        size_t n = score->max_num_of_tracks ?
+                   score->max_num_of_tracks * 2 : 16;
+        void *tmp = realloc(score->track_ends,
+                            n * sizeof *score->track_ends);
+
+        if (!tmp) {
+            return 0;
+        }
+        score->track_ends = tmp;
+        score->max_num_of_tracks = n;
+    }
+    score->track_ends[score->num_of_tracks++] =
+        score->num_of_notes;
+    return 1;
+}
+
+/*
+ * function: decode_file
+ * return: 1 on success
+ *         0 if the file can't be decoded
+ * purpose: decodes all tracks of a file. Chunks other than MTrk
+ *          are tracks without notes.
+ */
+static int decode_file(struct score *score,
+                       const unsigned char *data, size_t size)
+{
+    size_t pos = MIDI_HEADER_SIZE;
+
+    if (size < MIDI_HEADER_SIZE ||
+        memcmp(data, "MThd", 4) != 0 ||
+        read_be32(data + 4) != 6) {
+        return 0;
+    }
+    while (pos < size) {
+        char type[5];
+        unsigned long chunk_len;
+        int t;
+
+        if (size - pos < CHUNK_HEADER_SIZE) {
+            return 0;
+        }
+        /* chunk types lose trailing blanks and nulls */
+        memcpy(type, data + pos, 4);
+        type[4] = '\0';
+        for (t = 3; t >= 0 &&
+                    (type[t] == '\0' || type[t] == ' ' ||
+                     type[t] == '\t' || type[t] == '\n' ||
+                     type[t] == '\r' || type[t] == '\f');
+             --t) {
+            type[t] = '\0';
+        }
+        chunk_len = read_be32(data + pos + 4);
+        pos += CHUNK_HEADER_SIZE;
+        if (size - pos < chunk_len) {
+            return 0;
+        }
+        if (strcmp(type, "MTrk") == 0 &&
+            !decode_track(score, data + pos, chunk_len)) {
+            return 0;
+        }
+        if (!end_track(score)) {
+            return 0;
+        }
+        pos += chunk_len;
+    }
+    return 1;
+}
+
+char directed_mod_12(long prev, long now)
+{
+    static const char symbols[] = "abcdefghijklmnopqrstuvwxy";
+    long interval = now - prev;
+    int d = (now > prev) - (now < prev);
+
+    interval *= d;
+    return d == 0 ? symbols[12] :
+                    symbols[12 + d * (1 + (interval - 1) % 12)];
+}
+
+char ioi_ext_contour(long prev, long now)
+{
+    double ratio;
+
+    if (prev <= 0) {
+        return 'S';
+    }
+    ratio = log((double)now / (double)prev) / log(2.0);
+    return (fabs(ratio) < 1) ? 'R' :
+           (1 <= ratio && ratio < 2) ? 'l' :
+           (2 <= ratio) ? 'L' :
+           (-2 < ratio && ratio <= -1) ? 's' : 'S';
+}
+
+/*
+ * function: convert_track
+ * param: notes: notes of the track
+ *        num_of_notes: number of notes
+ *        pitches: space for num_of_notes pitches
+ *        iois: space for num_of_notes IOIs
+ *        num_of_pitches: pointer to the number of pitches
+ *                        extracted
+ * return: 1 on success
+ *         0 where fnmmp.pl would die
+ * purpose: extracts the melody of a track: the first note of
+ *          every onset, percussion skipped
+ */
+static int convert_track(const struct note *notes,
+                         size_t num_of_notes,
+                         long *pitches, long *iois,
+                         size_t *num_of_pitches)
+{
+    const struct note *prev = NULL;
+    size_t n = 0;
+    size_t c;
+
+    for (c = 0; c < num_of_notes; ++c) {
+        const struct note *note = notes + c;
+
+        if (note->channel == PERCUSSION_CHANNEL ||
+            note->duration == -note->start ||
+            note->start < 0) {
+            continue;
+        }
+        if (prev && note->start == prev->start) {
+            /* simultaneous onset: the previous note is replaced
+             * but the pitch already taken is kept
+             */
+        } else if (prev) {
+            if (n == 0) {
+                /* fnmmp.pl can't replace the last IOI of an empty
+                 * list
+                 */
+                return 0;
+            }
+            iois[n - 1] = note->start - prev->start;
+            if (note->duration > 0) {
+                pitches[n] = note->pitch;
+                iois[n++] = note->duration;
+            }
+        } else if (note->duration > 0) {
+            pitches[n] = note->pitch;
+            iois[n++] = note->duration;
+        }
+        prev = note;
+    }
+    *num_of_pitches = n;
+    return 1;
+}
+
+int midi_to_seq(const unsigned char *data, size_t size,
+                const char *name, struct seq_buf *out)
+{
+    struct score *score = calloc(1, sizeof *score);
+    long *pitches = NULL;
+    long *iois = NULL;
+    char *symbols = NULL;
+    char track_num[32];
+    size_t t;
+    size_t first_note = 0;
+    int result = 0;
+
+    if (!score || !decode_file(score, data, size)) {
+        goto bail_out;
+    }
+    if (score->num_of_notes > 0 &&
+        (!(pitches = malloc(score->num_of_notes *
+                            sizeof *pitches)) ||
+         !(iois = malloc(score->num_of_notes * sizeof *iois)) ||
+         !(symbols = malloc(score->num_of_notes)))) {
+        goto bail_out;
+    }
+
+    for (t = 0; t < score->num_of_tracks; ++t) {
+        size_t num_of_pitches = 0;
+        size_t c;
+
+        if (!convert_track(score->notes + first_note,
+                           score->track_ends[t] - first_note,
+                           pitches, iois, &num_of_pitches)) {
+            goto bail_out;
+        }
+        first_note = score->track_ends[t];
+
+        sprintf(track_num, "|%lu***", (unsigned long)t);
+        if (!seq_buf_append(out, "pi:", 3) ||
+            !seq_buf_append(out, name, strlen(name)) ||
+            !seq_buf_append(out, track_num, strlen(track_num))) {
+            goto bail_out;
+        }
+        for (c = 0; c + 1 < num_of_pitches; ++c) {
+            symbols[c] = directed_mod_12(pitches[c],
+                                         pitches[c + 1]);
+        }
+        if (!seq_buf_append(out, symbols, c) ||
+            !seq_buf_append(out, "***", 3)) {
+            goto bail_out;
+        }
+        for (c = 0; c + 1 < num_of_pitches; ++c) {
+            symbols[c] = ioi_ext_contour(iois[c], iois[c + 1]);
+        }
+        if (!seq_buf_append(out, symbols, c) ||
+            !seq_buf_append(out, "\n", 1)) {
+            goto bail_out;
+        }
+    }
+    result = 1;
+
+bail_out:
+    if (score) {
+        free(score->notes);
+        free(score->track_ends);
+    }
+    free(score);
+    free(pitches);
+    free(iois);
+    free(symbols);
+    return result;
+}
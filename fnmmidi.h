@@ -0,0 +1,72 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * MIDI to sequence conversion
+ *
+ * Copyright (C) 2004--2010 by RMIT MIRT Project.
+ * Copyright (C) 2010 by Iman S. H. Suyoto
+ */
+
+#ifndef H__FNMMIDI_
+#define H__FNMMIDI_
+
+#include <stddef.h>
+
+/* a growable output buffer */
+struct seq_buf {
+    char *s;
+    size_t len;
+    size_t size;
+};
+
+/*
+ * function: seq_buf_append
+ * param: buf: buffer
+ *        s: bytes to append
+ *        len: number of bytes to append
+ * return: 1 on success
+ *         0 on failure
+ */
+int seq_buf_append(struct seq_buf *buf, const char *s, size_t len);
+
+/*
+ * function: seq_buf_free
+ * param: buf: buffer
+ * purpose: releases the memory held by a buffer
+ */
+void seq_buf_free(struct seq_buf *buf);
+
+/*
+ * function: directed_mod_12
+ * param: prev: previous pitch
+ *        now: current pitch
+ * return: the directed modulo-12 pitch interval symbol
+ */
+char directed_mod_12(long prev, long now);
+
+/*
+ * function: ioi_ext_contour
+ * param: prev: previous inter-onset interval
+ *        now: current inter-onset interval
+ * return: the extended IOI contour symbol
+ */
+char ioi_ext_contour(long prev, long now);
+
+/*
+ * function: midi_to_seq
+ * param: data: contents of a Standard MIDI File
+ *        size: size of data
+ *        name: name used as the title of the sequences
+ *        out: buffer the sequence lines are appended to
+ * return: 1 on success
+ *         0 if data can't be converted (lines of the tracks
+ *           converted before the failure stay in out) or on
+ *           memory allocation failure
+ * purpose: appends one "pi:name|track***pitch***ioi" line per
+ *          track, exactly as fnmmp.pl does
+ */
+int midi_to_seq(const unsigned char *data, size_t size,
+                const char *name, struct seq_buf *out);
+
+#endif
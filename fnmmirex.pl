@@ -6,15 +6,31 @@ use strict;
 use File::Spec;
 use File::Copy;
 use File::Path;
+use File::Compare;
 use IPC::Run qw(run);
+use IO::Socket::UNIX;
 
 my $MIN_EXPECTED_ARGC = 2;
 my $FNM_DIR = '.fnm';
 my $SEQUENCE_FN = 'sequence';
 my $INDEX_FN = 'index';
+my $MANIFEST_FN = 'manifest';
+# the published index generation, a symbolic link to a
+# generation directory
+my $CURRENT_GEN = 'current';
+my $GEN_PREFIX = 'gen.';
 my $MAX_NUM_OF_ANSWERS = ($ENV{'FNM_NUM_OF_ANSWERS'} or 10);
+my $QUERY_BLOCK_SIZE = ($ENV{'FNM_QUERY_BLOCK_SIZE'} or 64);
+my $DAEMON_SOCKET = $ENV{'FNM_DAEMON_SOCKET'};
 my $CURR_DIR = File::Spec->curdir();
-my $FNMMP_PATH = File::Spec->catfile($CURR_DIR, 'fnmmp.pl');
+# prefer the compiled MIDI parser, which keeps a manifest of the
+# collection files
+my $FNMMP_PATH = File::Spec->catfile($CURR_DIR, 'fnmmp');
+my $USE_MANIFEST = -x $FNMMP_PATH;
+$FNMMP_PATH = File::Spec->catfile($CURR_DIR, 'fnmmp.pl')
+    unless $USE_MANIFEST;
+# converts and answers queries without temporary files
+my $FNMQUERY_PATH = File::Spec->catfile($CURR_DIR, 'fnmquery');
 
 main();
 
@@ -23,11 +39,16 @@ sub query($$$) {
     my $query_fn = shift;
     my $coll_dir = shift;
     my $index_dir = File::Spec->catdir($coll_dir, $FNM_DIR);
+    my $gen_dir = File::Spec->catdir($index_dir, $CURRENT_GEN);
     my $tmp_dir = File::Spec->catdir($index_dir, "query");
     my $answer;
     my @cmd;
     my $result;
 
+    if (!$DAEMON_SOCKET && -x $FNMQUERY_PATH) {
+        return query_batch($algo, $query_fn, $gen_dir);
+    }
+
     # copy the query MIDI file to Fanimae working directory
     # to prevent all the files in the directory containing the
     # MIDI file to be used as queries
@@ -64,17 +85,27 @@ sub query($$$) {
     # query
     my $n = 0;
 
+    if ($DAEMON_SOCKET) {
+        $answer = query_daemon($algo, $temp_seq_fn);
+        File::Path->remove_tree($tmp_dir);
+        unlink $temp_seq_fn;
+        return $answer;
+    }
+
     if ($algo eq 'ngr5') {
         @cmd = (File::Spec->catfile($CURR_DIR, 'fnmsngr5.pl'),
-                File::Spec->catfile($index_dir, $INDEX_FN),
+                File::Spec->catfile($gen_dir, $INDEX_FN),
                 'q');
     } elsif ($algo eq 'pioi') {
         @cmd = (File::Spec->catfile($CURR_DIR, 'fnmspioi'),
-                File::Spec->catfile($index_dir, $SEQUENCE_FN),
+                File::Spec->catfile($gen_dir, $SEQUENCE_FN),
                 'q');
     } else {
         die "Invalid algo\n";
     }
+    # answer all the tracks of the query in a single pass over
+    # the collection
+    local $ENV{'FNM_QUERY_BLOCK_SIZE'} = $QUERY_BLOCK_SIZE;
     open QFH, "<$temp_seq_fn"
     or die "Can't open $temp_seq_fn\n";
     $result = run \@cmd, \*QFH, \$answer;
@@ -90,9 +121,71 @@ sub query($$$) {
     return $answer;
 }
 
-sub create_index($) {
+# answer a query MIDI file, or a directory of them, with a
+# single fnmquery
+sub query_batch($$$) {
+    my $algo = shift;
+    my $query_fn = shift;
+    my $gen_dir = shift;
+    my $answer;
+    my @cmd;
+
+    if ($algo eq 'ngr5') {
+        @cmd = ($FNMQUERY_PATH, $algo,
+                File::Spec->catfile($gen_dir, $INDEX_FN),
+                $query_fn);
+    } elsif ($algo eq 'pioi') {
+        @cmd = ($FNMQUERY_PATH, $algo,
+                File::Spec->catfile($gen_dir, $SEQUENCE_FN),
+                $query_fn);
+    } else {
+        die "Invalid algo\n";
+    }
+    local $ENV{'FNM_QUERY_BLOCK_SIZE'} = $QUERY_BLOCK_SIZE;
+    run \@cmd, undef, \$answer or return undef;
+    chomp($answer);
+    return $answer;
+}
+
+# send every sequence line of a query sequence file to fanimaed
+# and collect the answers
+sub query_daemon($$) {
+    my $algo = shift;
+    my $seq_fn = shift;
+    my @answers = ();
+    my $sock = IO::Socket::UNIX->new(Type => SOCK_STREAM(),
+                                     Peer => $DAEMON_SOCKET)
+    or die "Can't connect to $DAEMON_SOCKET\n";
+
+    open SFH, "<$seq_fn" or die "Can't open $seq_fn\n";
+    while (my $line = <SFH>) {
+        my $payload;
+        my $len;
+
+        chomp($line);
+        $payload = "$algo $line";
+        print $sock pack('N', length($payload)) . $payload;
+        read($sock, $len, 4) == 4 or return undef;
+        $len = unpack('N', $len);
+        read($sock, $payload, $len) == $len or return undef;
+        return undef if $payload =~ /^!/;
+        push @answers, $payload;
+    }
+    close SFH;
+    close $sock;
+    return join("\n", @answers);
+}
+
+# build the index in a new generation directory and publish it
+# by atomically replacing the current generation link, so that
+# searchers never see a half-written index
+sub create_index($$) {
     my $coll_dir = shift;
+    my $force = shift;
     my $index_dir = File::Spec->catdir($coll_dir, $FNM_DIR);
+    my $curr_gen_dir = File::Spec->catdir($index_dir, $CURRENT_GEN);
+    my $gen = $GEN_PREFIX . time() . ".$$";
+    my $gen_dir = File::Spec->catdir($index_dir, $gen);
     my @cmd;
     my $result;
     my $output;
@@ -101,43 +194,202 @@ sub create_index($) {
     unless (-d $index_dir) {
         mkdir $index_dir or die "Can't create $index_dir\n";
     }
+    mkdir $gen_dir or die "Can't create $gen_dir\n";
 
-    # parse collection files and generate sequence file
-    my $temp_seq_fn = File::Spec->catfile($index_dir,
-                                          $SEQUENCE_FN);
-    @cmd = ($FNMMP_PATH, $coll_dir, $temp_seq_fn);
+    # parse collection files and generate sequence file, reusing
+    # the sequences of the files unchanged since the last time
+    my $seq_fn = File::Spec->catfile($gen_dir, $SEQUENCE_FN);
+    my $manifest_fn = File::Spec->catfile($index_dir, $MANIFEST_FN);
+
+    @cmd = ($FNMMP_PATH, $coll_dir, $seq_fn);
+    if ($USE_MANIFEST) {
+        unlink $manifest_fn if $force;
+        push @cmd, $manifest_fn;
+    }
     $result = run \@cmd, undef, \$output;
 
-    if (!$result || !(-f $temp_seq_fn)) {
+    if (!$result || !(-f $seq_fn)) {
+        File::Path->remove_tree($gen_dir);
         return 0;
     }
 
-    # index the sequences in the sequence file
-    my $index_name =
-       File::Spec->catfile($index_dir, $INDEX_FN);
+    # index the sequences in the sequence file, unless they're
+    # those of the current generation
+    my $curr_seq_fn = File::Spec->catfile($curr_gen_dir,
+                                          $SEQUENCE_FN);
+
+    if (!$force &&
+        index_files_exist(File::Spec->catfile($curr_gen_dir,
+                                              $INDEX_FN)) &&
+        -f $curr_seq_fn && compare($seq_fn, $curr_seq_fn) == 0) {
+        File::Path->remove_tree($gen_dir);
+        return 1;
+    }
+
+    my $index_name = File::Spec->catfile($gen_dir, $INDEX_FN);
+
     @cmd = (File::Spec->catfile($CURR_DIR, 'fnmib'),
-            $index_name, $temp_seq_fn);
+            $index_name, $seq_fn);
     $result = run \@cmd, undef, \$output;
 
-    if (!$result ||
-        !(-f "$index_name.fdl") ||
-        !(-f "$index_name.filp") ||
-        !(-f "$index_name.fipp")) {
+    if (!$result || !index_files_exist($index_name)) {
+        File::Path->remove_tree($gen_dir);
         return 0;
     }
 
+    publish_generation($index_dir, $gen);
     return 1;
 }
 
+# make a generation current, then remove the generations older
+# than the one it replaces, which searchers started just before
+# may still be opening
+sub publish_generation($$) {
+    my $index_dir = shift;
+    my $gen = shift;
+    my $curr_link = File::Spec->catfile($index_dir, $CURRENT_GEN);
+    my $new_link = "$curr_link.$$";
+    my $prev_gen = readlink $curr_link;
+
+    unlink $new_link;
+    symlink($gen, $new_link)
+    or die "Can't create $new_link\n";
+    rename($new_link, $curr_link)
+    or die "Can't rename $new_link to $curr_link\n";
+
+    opendir GENDH, $index_dir
+    or die "Can't open $index_dir\n";
+    my @old_gens = grep {
+        /^\Q$GEN_PREFIX\E/ && $_ ne $gen &&
+        !(defined $prev_gen && $_ eq $prev_gen)
+    } readdir GENDH;
+    closedir GENDH;
+    foreach my $old_gen (@old_gens) {
+        File::Path->remove_tree(File::Spec->catdir($index_dir,
+                                                   $old_gen));
+    }
+
+    # files of the index layout predating generations
+    unlink(File::Spec->catfile($index_dir, $SEQUENCE_FN),
+           map {
+               File::Spec->catfile($index_dir, "$INDEX_FN.$_")
+           } qw(fdl filp fipp));
+}
+
+sub index_files_exist($) {
+    my $index_name = shift;
+
+    return -f "$index_name.fdl" &&
+           -f "$index_name.filp" &&
+           -f "$index_name.fipp";
+}
+
+# read the size and modification time the manifest records for
+# each collection file, skipping the converted sequences, which
+# aren't needed to tell whether a file changed
+sub load_manifest($) {
+    my $manifest_fn = shift;
+    my %files;
+    my $start_time;
+
+    open MANIFESTFH, '<', $manifest_fn or return undef;
+    binmode MANIFESTFH;
+    my $header = <MANIFESTFH>;
+    if (defined $header && $header =~ /^fnmmp-manifest 1 (\d+)\n$/) {
+        $start_time = $1;
+        while (my $record = <MANIFESTFH>) {
+            unless ($record =~
+                    /^(\d+) (\d+) [0-9a-f]{16} (\d+) (.+)\n$/) {
+                undef $start_time;
+                last;
+            }
+            $files{$4} = [$1, $2];
+            seek(MANIFESTFH, $3, 1) or do {
+                undef $start_time;
+                last;
+            };
+        }
+    }
+    close MANIFESTFH;
+    return defined $start_time ? ($start_time, \%files) : undef;
+}
+
+# tell whether the files of a directory and its subdirectories
+# are those recorded in the manifest, looking only at their size
+# and modification time. Files are checked the way fnmmp decides
+# whether to read them again. The index directory itself is
+# skipped.
+sub manifest_up_to_date($$) {
+    my $coll_dir = shift;
+    my $manifest_fn = shift;
+    my ($start_time, $files) = load_manifest($manifest_fn);
+    my @dirs = ([$coll_dir, '']);
+
+    return 0 unless defined $start_time;
+    delete @$files{grep { m{^\Q$FNM_DIR\E/} } keys %$files};
+
+    while (my $dir = shift @dirs) {
+        my ($dir_name, $rel_dir) = @$dir;
+
+        opendir COLLDH, $dir_name or do {
+            return 0 if $rel_dir eq '';
+            next;
+        };
+        my @names = grep {
+            $_ ne '.' && $_ ne '..' && $_ ne 'TRANS.TBL' &&
+            !($rel_dir eq '' && $_ eq $FNM_DIR)
+        } readdir COLLDH;
+        closedir COLLDH;
+
+        foreach my $name (@names) {
+            my $fn = "$dir_name/$name";
+            my $rel_fn = "$rel_dir$name";
+            my @st = stat $fn;
+
+            if (@st && -d _) {
+                push @dirs, [$fn, "$rel_fn/"];
+                next;
+            }
+            # fnmmp records only the files it could open
+            next unless @st && -r _;
+            my $entry = delete $files->{$rel_fn};
+            return 0 unless $entry &&
+                            $entry->[0] == $st[7] &&
+                            $entry->[1] == $st[9] &&
+                            $st[9] < $start_time;
+        }
+    }
+    # files removed since
+    return !%$files;
+}
+
 sub index_up_to_date($) {
     my $coll_dir = shift;
+
     my $index_dir = File::Spec->catdir($coll_dir, $FNM_DIR);
+
+    # with a manifest, every file is checked, not just the
+    # collection directory
+    if ($USE_MANIFEST) {
+        return index_files_exist(File::Spec->catfile($index_dir,
+                                                     $CURRENT_GEN,
+                                                     $INDEX_FN)) &&
+               manifest_up_to_date($coll_dir,
+                                   File::Spec->catfile($index_dir,
+                                                       $MANIFEST_FN));
+    }
+
     my $coll_dir_modif_time = (stat($coll_dir))[9];
     my $index_dir_modif_time = (stat($index_dir))[9];
 
     unless (-d $index_dir) {
         return 0;
     }
+    unless (index_files_exist(File::Spec->catfile($index_dir,
+                                                  $CURRENT_GEN,
+                                                  $INDEX_FN))) {
+        return 0;
+    }
     if ($coll_dir_modif_time > $index_dir_modif_time) {
         return 0;
     }
@@ -150,6 +402,7 @@ Fanimae wrapper for MIREX 2010
 
 Usage:
 fnmmirex.pl {!|algo} /coll/files/dir/ query.mid
+fnmmirex.pl algo /coll/files/dir/ /query/files/dir/
 
 algo is either "ngr5" or "pioi".
 Use "-" to index or force reindex only without searching. Using
@@ -157,6 +410,13 @@ Use "-" to index or force reindex only without searching. Using
 cached if no cached up-to-date index is found.
 
 The collection files must be in MIDI format.
+
+If fnmquery has been built, a directory of query MIDI files can
+be given instead of query.mid to answer all of them against a
+single loaded index or collection.
+
+If FNM_DAEMON_SOCKET is set, queries are answered by the
+fanimaed listening on that socket instead of a new searcher.
 EOT
 
     exit 1;
@@ -198,16 +458,16 @@ sub main {
         unless (-e $query_fn) {
             die "File not found: $query_fn\n";
         }
+        if (-d $query_fn && ($DAEMON_SOCKET || !-x $FNMQUERY_PATH)) {
+            die "A query directory requires fnmquery\n";
+        }
     }
     unless (-d $coll_dir) {
         die "Directory not found: $coll_dir\n";
     }
 
-    if (!$rebuild_index) {
-        $rebuild_index = !index_up_to_date($coll_dir);
-    }
-    if ($rebuild_index) {
-        create_index($coll_dir);
+    if ($rebuild_index || !index_up_to_date($coll_dir)) {
+        create_index($coll_dir, $rebuild_index);
     }
 
     if ($search) {
@@ -0,0 +1,184 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * MIDI Parser
+ *
+ * Copyright (C) 2004--2010 by RMIT MIRT Project.
+ * Copyright (C) 2010 by Iman S. H. Suyoto
+ *
+ * A compiled fnmmp.pl. The output is byte-identical to that of
+ * fnmmp.pl.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "fanimae.h"
+#include "fnmmidi.h"
+#include "fnmingest.h"
+#include "fnmmanifest.h"
+
+#define MANIFEST_TMP_SUFFIX ".new"
+
+/*
+ * function: write_manifest_entry
+ * return: 1 on success
+ *         0 on failure
+ * purpose: records a converted file and its lines in the manifest
+ */
+static int write_manifest_entry(FILE *fp,
+                                const struct ingest_file *file,
+                                const struct seq_buf *lines)
+{
+    struct manifest_entry entry;
+
+    if (!file->is_readable) {
+        return 1;
+    }
+    entry.rel_path = file->rel_path;
+    entry.size = file->size;
+    entry.mtime = file->mtime;
+    entry.hash = file->hash;
+    entry.lines = lines->s;
+    entry.lines_len = lines->len;
+    return manifest_write_entry(fp, &entry);
+}
+
+/*
+ * function: process_dir
+ * param: dir_name: directory name containing MIDI files
+ *        out_fp: output stream
+ *        cache: manifest of a previous run, or NULL
+ *        manifest_fp: stream to write the new manifest to, or NULL
+ * return: 1 on success
+ *         0 on failure
+ * purpose: converts the MIDI files of a directory and its
+ *          subdirectories on a pool of FNM_NUM_OF_THREADS
+ *          threads. Sequence lines are written in directory walk
+ *          order whatever the number of threads.
+ */
+static int process_dir(const char *dir_name, FILE *out_fp,
+                       const struct manifest *cache,
+                       FILE *manifest_fp)
+{
+    struct ingest *ingest = ingest_start(dir_name,
+                                         ingest_num_of_threads(),
+                                         cache);
+    struct seq_buf out = { NULL, 0, 0 };
+    const struct ingest_file *file = NULL;
+    int result = 1;
+
+    if (!ingest) {
+        return 0;
+    }
+    while (result && (file = ingest_next(ingest, &out)) != NULL) {
+        fprintf(stderr, "%s\n", file->name);
+        if (out.len > 0 &&
+            fwrite(out.s, 1, out.len, out_fp) != out.len) {
+            result = 0;
+        }
+        if (manifest_fp &&
+            !write_manifest_entry(manifest_fp, file, &out)) {
+            result = 0;
+        }
+    }
+    ingest_finish(ingest);
+    seq_buf_free(&out);
+    return result;
+}
+
+/*
+ * function: process_dir_with_manifest
+ * param: dir_name: directory name containing MIDI files
+ *        out_fp: output stream
+ *        manifest_fn: manifest filename
+ * return: 1 on success
+ *         0 on failure
+ * purpose: converts the MIDI files of a directory reusing the
+ *          lines cached in a manifest, then replaces the manifest
+ *          with one describing the directory as it was converted
+ */
+static int process_dir_with_manifest(const char *dir_name,
+                                     FILE *out_fp,
+                                     const char *manifest_fn)
+{
+    unsigned long start_time = (unsigned long)time(NULL);
+    struct manifest *cache = manifest_load(manifest_fn);
+    char *tmp_fn = malloc(strlen(manifest_fn) +
+                          sizeof MANIFEST_TMP_SUFFIX);
+    FILE *manifest_fp = NULL;
+    int result = 0;
+
+    if (!tmp_fn) {
+        manifest_free(cache);
+        return 0;
+    }
+    sprintf(tmp_fn, "%s" MANIFEST_TMP_SUFFIX, manifest_fn);
+    if (!(manifest_fp = fopen(tmp_fn, "wb"))) {
+        fprintf(stderr, "Failed creating handle: %s\n",
+                strerror(errno));
+    } else {
+        result = manifest_write_header(manifest_fp, start_time) &&
+                 process_dir(dir_name, out_fp, cache, manifest_fp);
+        if (fclose(manifest_fp) != 0) {
+            result = 0;
+        }
+        if (result && rename(tmp_fn, manifest_fn) != 0) {
+            result = 0;
+        }
+        if (!result) {
+            remove(tmp_fn);
+        }
+    }
+    manifest_free(cache);
+    free(tmp_fn);
+    return result;
+}
+
+/* program entry point */
+int main(int argc, char **argv)
+{
+    struct stat st;
+    FILE *out_fp = NULL;
+
+    if (argc < 3 || !*argv[1] || !*argv[2]) {
+        fprintf(stderr,
+                "Fanimae " FANIMAE_VERSION "\n"
+                "MIDI Parser\n\n"
+                "Usage: %s directory output [manifest]\n\n"
+                "If manifest is given, files unchanged since it was\n"
+                "written aren't converted again.\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (stat(argv[1], &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return EXIT_SUCCESS;
+    }
+
+    if (!(out_fp = fopen(argv[2], "w"))) {
+        fprintf(stderr, "Failed creating handle: %s\n",
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (!(argc > 3 && *argv[3] ?
+          process_dir_with_manifest(argv[1], out_fp, argv[3]) :
+          process_dir(argv[1], out_fp, NULL, NULL))) {
+        fprintf(stderr, "Failed converting %s to %s\n",
+                argv[1], argv[2]);
+        fclose(out_fp);
+        return EXIT_FAILURE;
+    }
+    if (fclose(out_fp) != 0) {
+        fprintf(stderr, "Failed writing %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,834 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * 5-gram coordinate matching
+ *
+ * Copyright 2004--2010 by RMIT MIRT Project.
+ * Copyright 2010 by Iman S. H. Suyoto.
+ */
+
+#ifdef NGR5_USE_MMAP
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifdef NGR5_USE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include "fanimae.h"
+#include "fnmpioi.h"
+#include "fnmngr5.h"
+
+/* read a 4-byte little-endian integer */
+#define GET4(p) \
+    ((unsigned long)(p)[0] | ((unsigned long)(p)[1] << 8) | \
+     ((unsigned long)(p)[2] << 16) | ((unsigned long)(p)[3] << 24))
+
+/*
+ * function: read_file
+ * param: fn: filename
+ *        size: pointer to the object to store the file size
+ * return: NULL on failure
+ *         pointer to the file contents on success. This pointer
+ *         should be free()'d later.
+ * purpose: reads a whole file in memory
+ */
+static unsigned char *read_file(const char *fn, size_t *size)
+{
+    FILE *fp = fopen(fn, "rb");
+    unsigned char *buf = NULL;
+    size_t buf_size = 0;
+    size_t len = 0;
+
+    if (!fp) {
+        fprintf(stderr, "Can't open %s\n", fn);
+        return NULL;
+    }
+    for (;;) {
+        size_t n;
+
+        if (len == buf_size) {
+            void *tmp = realloc(buf, buf_size ?
+                                     buf_size * 2 : BUFSIZ);
+
+            if (!tmp) {
+                fprintf(stderr, "Can't allocate memory for %s\n",
+                        fn);
+                free(buf);
+                fclose(fp);
+                return NULL;
+            }
+            buf = tmp;
+            buf_size = buf_size ? buf_size * 2 : BUFSIZ;
+        }
+        n = fread(buf + len, 1, buf_size - len, fp);
+        len += n;
+        if (n == 0) {
+            break;
+        }
+    }
+    if (ferror(fp)) {
+        fprintf(stderr, "Can't read %s\n", fn);
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+    *size = len;
+    return buf;
+}
+
+/*
+ * function: idx_fn_with_suffix
+ * return: NULL on failure
+ *         idx_fn followed by suffix, to be free()'d later
+ */
+static char *idx_fn_with_suffix(const char *idx_fn,
+                                const char *suffix)
+{
+    char *fn = malloc(strlen(idx_fn) + strlen(suffix) + 1);
+
+    if (fn) {
+        sprintf(fn, "%s%s", idx_fn, suffix);
+    }
+    return fn;
+}
+
+/*
+ * function: load_titles
+ * param: idx: index
+ *        dl_fn: document lookup filename
+ * return: 1 on success
+ *         0 on failure
+ * purpose: loads the document lookup, one title per line
+ */
+static int load_titles(struct ngr5_idx *idx, const char *dl_fn)
+{
+    size_t size = 0;
+    size_t c;
+    doc_num_t d = 0;
+    char *buf = (char *)read_file(dl_fn, &size);
+    void *tmp = NULL;
+
+    if (!buf) {
+        return 0;
+    }
+    if (!(tmp = realloc(buf, size + 1))) {
+        free(buf);
+        return 0;
+    }
+    idx->titles_buf = buf = tmp;
+    buf[size] = '\0';
+
+    idx->num_of_docs = 0;
+    for (c = 0; c < size; ++c) {
+        if (buf[c] == '\n') {
+            idx->num_of_docs++;
+        }
+    }
+    if (size > 0 && buf[size - 1] != '\n') {
+        idx->num_of_docs++;
+    }
+
+    if (!(idx->titles = malloc((idx->num_of_docs + 1) *
+                               sizeof *idx->titles))) {
+        return 0;
+    }
+    for (c = 0; c < size && d < idx->num_of_docs; ++d) {
+        idx->titles[d] = buf + c;
+        while (c < size && buf[c] != '\n') {
+            ++c;
+        }
+        buf[c++] = '\0';
+    }
+    return 1;
+}
+
+#ifdef NGR5_USE_MMAP
+/* what an empty file maps to, as mmap() can't map nothing */
+static unsigned char empty_file[1];
+#endif
+
+/*
+ * function: map_file
+ * param: fn: filename
+ *        size: pointer to the object to store the file size
+ * return: NULL on failure
+ *         pointer to the file contents on success. This pointer
+ *         should be released by unmap_file() later.
+ * purpose: maps a whole file in memory without reading it, or
+ *          reads it if mapping isn't enabled
+ */
+static unsigned char *map_file(const char *fn, size_t *size)
+{
+#ifdef NGR5_USE_MMAP
+    struct stat st;
+    int fd = open(fn, O_RDONLY);
+    void *map = MAP_FAILED;
+
+    if (fd < 0) {
+        fprintf(stderr, "Can't open %s\n", fn);
+        return NULL;
+    }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        (size_t)st.st_size == (unsigned long)st.st_size) {
+        map = st.st_size == 0 ?
+              empty_file :
+              mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Can't map %s\n", fn);
+        return NULL;
+    }
+    *size = st.st_size;
+    return map;
+#else
+    return read_file(fn, size);
+#endif
+}
+
+/* release a file of map_file() */
+static void unmap_file(unsigned char *buf, size_t size)
+{
+#ifdef NGR5_USE_MMAP
+    if (buf && buf != empty_file) {
+        munmap(buf, size);
+    }
+#else
+    (void)size;
+    free(buf);
+#endif
+}
+
+/*
+ * function: load_doc_titles
+ * param: idx: index
+ *        dt_fn: document titles filename
+ *        dl_fn: document lookup filename
+ * return: 1 on success
+ *         0 if the titles can't be used
+ * purpose: maps the document titles, in time independent of the
+ *          number of documents. Only the header is checked, and
+ *          that the titles take as many bytes as the document
+ *          lookup, so that those of an earlier build aren't used.
+ */
+static int load_doc_titles(struct ngr5_idx *idx, const char *dt_fn,
+                           const char *dl_fn)
+{
+    FILE *fp = fopen(dl_fn, "rb");
+    long dl_size = -1;
+    const unsigned char *p = NULL;
+    unsigned long num_of_docs;
+    unsigned long first;
+
+    if (fp) {
+        if (fseek(fp, 0, SEEK_END) == 0) {
+            dl_size = ftell(fp);
+        }
+        fclose(fp);
+    }
+    if (dl_size < 0 || !(fp = fopen(dt_fn, "rb"))) {
+        return 0;
+    }
+    fclose(fp);
+    if (!(idx->doc_titles = map_file(dt_fn,
+                                     &idx->doc_titles_size))) {
+        return 0;
+    }
+    p = idx->doc_titles;
+    if (idx->doc_titles_size < DOCTITLES_HDR_SIZE + 4 ||
+        memcmp(p, DOCTITLES_MAGIC, sizeof DOCTITLES_MAGIC - 1) != 0) {
+        goto unusable;
+    }
+    num_of_docs = GET4(p + 4);
+    first = DOCTITLES_HDR_SIZE + (num_of_docs + 1) * 4;
+    /* the last line of the lookup may lack its '\n' */
+    if ((idx->doc_titles_size - DOCTITLES_HDR_SIZE) / 4 <
+        num_of_docs + 1 ||
+        GET4(p + DOCTITLES_HDR_SIZE) != first ||
+        GET4(p + first - 4) != idx->doc_titles_size ||
+        (idx->doc_titles_size - first != (unsigned long)dl_size &&
+         idx->doc_titles_size - first != (unsigned long)dl_size + 1)) {
+        goto unusable;
+    }
+    idx->num_of_docs = num_of_docs;
+    return 1;
+
+unusable:
+    unmap_file(idx->doc_titles, idx->doc_titles_size);
+    idx->doc_titles = NULL;
+    return 0;
+}
+
+/*
+ * function: doc_title
+ * return: NULL on inconsistent document titles
+ *         the title of a document
+ */
+static const char *doc_title(const struct ngr5_idx *idx,
+                             doc_num_t d)
+{
+    const unsigned char *p = NULL;
+    unsigned long first;
+    unsigned long last;
+
+    if (!idx->doc_titles) {
+        return idx->titles[d];
+    }
+    p = idx->doc_titles + DOCTITLES_HDR_SIZE + d * 4;
+    first = GET4(p);
+    last = GET4(p + 4);
+    /* a title is only used if it ends before the next one */
+    if (first >= last || last > idx->doc_titles_size ||
+        idx->doc_titles[last - 1] != '\0') {
+        fprintf(stderr, "Inconsistent title of document %lu\n",
+                (unsigned long)d);
+        return NULL;
+    }
+    return (const char *)idx->doc_titles + first;
+}
+
+/*
+ * function: load_dups
+ * param: idx: index, its titles loaded
+ *        dd_fn: duplicate document filename
+ * return: 1 on success
+ *         0 on failure
+ * purpose: loads the titles of the duplicates of every document,
+ *          one "number title" line per duplicate
+ */
+static int load_dups(struct ngr5_idx *idx, const char *dd_fn)
+{
+    size_t size = 0;
+    size_t num_of_dups = 0;
+    size_t c;
+    doc_num_t d;
+    char *buf = (char *)read_file(dd_fn, &size);
+    void *tmp = NULL;
+
+    if (!buf) {
+        return 0;
+    }
+    if (!(tmp = realloc(buf, size + 1))) {
+        free(buf);
+        return 0;
+    }
+    idx->dup_titles_buf = buf = tmp;
+    buf[size] = '\0';
+
+    /* count the duplicates of every document, then place their
+     * titles
+     */
+    if (!(idx->dup_starts = calloc(idx->num_of_docs + 1,
+                                   sizeof *idx->dup_starts))) {
+        return 0;
+    }
+    for (c = 0; c < size; ++num_of_dups) {
+        char *title = NULL;
+        unsigned long doc_num = strtoul(buf + c, &title, 10);
+
+        if (title == buf + c || *title != ' ' ||
+            doc_num >= idx->num_of_docs) {
+            fprintf(stderr, "Inconsistent duplicates %s\n", dd_fn);
+            return 0;
+        }
+        idx->dup_starts[doc_num + 1]++;
+        c = title + 1 - buf;
+        while (c < size && buf[c] != '\n') {
+            ++c;
+        }
+        buf[c++] = '\0';
+    }
+    for (d = 0; d < idx->num_of_docs; ++d) {
+        idx->dup_starts[d + 1] += idx->dup_starts[d];
+    }
+    if (!(idx->dup_titles = malloc((num_of_dups + 1) *
+                                   sizeof *idx->dup_titles))) {
+        return 0;
+    }
+    for (c = 0; c < size; c += strlen(buf + c) + 1) {
+        char *title = NULL;
+        unsigned long doc_num = strtoul(buf + c, &title, 10);
+
+        idx->dup_titles[idx->dup_starts[doc_num]++] = title + 1;
+    }
+    /* placing moved every start to the next document's */
+    for (d = idx->num_of_docs; d > 0; --d) {
+        idx->dup_starts[d] = idx->dup_starts[d - 1];
+    }
+    idx->dup_starts[0] = 0;
+    return 1;
+}
+
+/*
+ * function: insert_doc_answer
+ * return: 1 on success
+ *         0 on failure
+ * purpose: inserts a document and the tracks identical to it as
+ *          answers with the same score
+ */
+static int insert_doc_answer(const struct ngr5_idx *idx,
+                             struct answers *answers, doc_num_t t,
+                             double score)
+{
+    const char *title = doc_title(idx, t);
+    size_t i;
+
+    if (!title || !insert_answer(answers, title, score)) {
+        return 0;
+    }
+    if (idx->dup_starts) {
+        for (i = idx->dup_starts[t]; i < idx->dup_starts[t + 1];
+             ++i) {
+            if (!insert_answer(answers, idx->dup_titles[i], score)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+struct ngr5_idx *ngr5_open(const char *idx_fn)
+{
+    struct ngr5_idx *idx = calloc(1, sizeof *idx);
+    char *fn = NULL;
+    char *dt_fn = NULL;
+    FILE *fp = NULL;
+
+    if (!idx) {
+        return NULL;
+    }
+
+    if (!(fn = idx_fn_with_suffix(idx_fn, P_INVLISTPTR_SUFFIX)) ||
+        !(idx->ilp = map_file(fn, &idx->ilp_size))) {
+        goto bail_out;
+    }
+    free(fn);
+    if (!(fn = idx_fn_with_suffix(idx_fn, P_INVLIST_SUFFIX)) ||
+        !(idx->il = map_file(fn, &idx->il_size))) {
+        goto bail_out;
+    }
+    free(fn);
+    if (!(fn = idx_fn_with_suffix(idx_fn, DOCLOOKUP_SUFFIX)) ||
+        !(dt_fn = idx_fn_with_suffix(idx_fn, DOCTITLES_SUFFIX))) {
+        goto bail_out;
+    }
+    /* indexes built before the titles were written, or by a
+     * build that didn't write them, only have the lookup
+     */
+    if (!load_doc_titles(idx, dt_fn, fn) && !load_titles(idx, fn)) {
+        goto bail_out;
+    }
+    free(dt_fn);
+    dt_fn = NULL;
+    free(fn);
+    if (!(fn = idx_fn_with_suffix(idx_fn, DOCDUPS_SUFFIX))) {
+        goto bail_out;
+    }
+    /* indexes built before fnmib dropped duplicates have none */
+    if ((fp = fopen(fn, "rb")) != NULL) {
+        fclose(fp);
+        if (!load_dups(idx, fn)) {
+            goto bail_out;
+        }
+    }
+    free(fn);
+    if (!(fn = idx_fn_with_suffix(idx_fn, LSH_SUFFIX))) {
+        goto bail_out;
+    }
+    /* the sketch index is optional */
+    if ((fp = fopen(fn, "rb")) != NULL) {
+        fclose(fp);
+        if (!(idx->sketch = lsh_open(fn))) {
+            goto bail_out;
+        }
+        if (idx->sketch->num_of_docs != idx->num_of_docs) {
+            fprintf(stderr, "Sketch %s doesn't match the index\n",
+                    fn);
+            goto bail_out;
+        }
+    }
+    free(fn);
+    if (!(fn = idx_fn_with_suffix(idx_fn, FM_SUFFIX))) {
+        goto bail_out;
+    }
+    /* so is the FM-index */
+    if ((fp = fopen(fn, "rb")) != NULL) {
+        fclose(fp);
+        if (!(idx->fm = fm_open(fn))) {
+            goto bail_out;
+        }
+        if (idx->fm->num_of_docs != idx->num_of_docs) {
+            fprintf(stderr, "FM-index %s doesn't match the index\n",
+                    fn);
+            goto bail_out;
+        }
+    }
+    free(fn);
+    return idx;
+
+bail_out:
+    free(dt_fn);
+    free(fn);
+    ngr5_close(idx);
+    return NULL;
+}
+
+void ngr5_close(struct ngr5_idx *idx)
+{
+    if (idx) {
+        unmap_file(idx->ilp, idx->ilp_size);
+        unmap_file(idx->il, idx->il_size);
+        unmap_file(idx->doc_titles, idx->doc_titles_size);
+        free(idx->titles);
+        free(idx->titles_buf);
+        free(idx->dup_titles);
+        free(idx->dup_starts);
+        free(idx->dup_titles_buf);
+        lsh_close(idx->sketch);
+        fm_close(idx->fm);
+        free(idx);
+    }
+}
+
+struct ngr5_scratch *ngr5_create_scratch
+                     (const struct ngr5_idx *idx)
+{
+    struct ngr5_scratch *scratch = malloc(sizeof *scratch);
+    size_t n = idx->num_of_docs ? idx->num_of_docs : 1;
+
+    if (!scratch) {
+        return NULL;
+    }
+    scratch->num_of_docs = idx->num_of_docs;
+    scratch->counts = calloc(n, sizeof *scratch->counts);
+    scratch->touched = malloc(n * sizeof *scratch->touched);
+    memset(&scratch->codes, 0, sizeof scratch->codes);
+    scratch->keys = NULL;
+    scratch->max_num_of_keys = 0;
+    if (!scratch->counts || !scratch->touched) {
+        ngr5_destroy_scratch(scratch);
+        return NULL;
+    }
+    return scratch;
+}
+
+void ngr5_destroy_scratch(struct ngr5_scratch *scratch)
+{
+    if (scratch) {
+        free(scratch->counts);
+        free(scratch->touched);
+        free_seq_codes(&scratch->codes);
+        free(scratch->keys);
+        free(scratch);
+    }
+}
+
+/*
+ * function: read_uint
+ * param: p: pointer to the current position, moved past the
+ *           integer read
+ *        end: end of data
+ *        x: pointer to the result placeholder
+ * return: 1 on success
+ *         0 on inconsistent data
+ * purpose: reads a variable-nibble compressed integer as
+ *          written by fnmib
+ */
+static int read_uint(const unsigned char **p,
+                     const unsigned char *end, unsigned long *x)
+{
+    unsigned b = 0;
+
+    *x = 0;
+    for (;;) {
+        unsigned o;
+
+        if (*p >= end) {
+            return 0;
+        }
+        o = *(*p)++;
+        *x |= (unsigned long)(o & 0x07) << (6 * b);  /* ?... */
+        if (!(o & 0x08)) {  /* 0... */
+            return 1;
+        }
+        /* ?... 1... */
+        *x |= (unsigned long)((o & 0x70) >> 4) << (6 * b + 3);
+        if (!(o & 0x80)) {  /* 0... 1... */
+            return 1;
+        }
+        ++b;  /* 1... 1... */
+    }
+}
+
+/* n-gram code comparison function for qsort() */
+static int cmp_code(const void *a_v, const void *b_v)
+{
+    const unsigned long *a = a_v;
+    const unsigned long *b = b_v;
+
+    return *a > *b ? 1 : *a < *b ? -1 : 0;
+}
+
+/*
+ * function: count_postings
+ * return: 1 on success
+ *         0 on inconsistent index
+ * purpose: adds one to the counter of every document in the
+ *          postings of an n-gram
+ */
+static int count_postings(const struct ngr5_idx *idx,
+                          struct ngr5_scratch *scratch,
+                          doc_num_t *num_of_touched,
+                          unsigned long code)
+{
+    const unsigned char *ilp = idx->ilp + code * POS_SIZE;
+    const unsigned char *p = NULL;
+    const unsigned char *end = idx->il + idx->il_size;
+    unsigned long pos = 0;
+    unsigned long nod = 0;
+    unsigned long dc;
+    int c;
+
+    if ((code + 1) * POS_SIZE > idx->ilp_size) {
+        return 0;
+    }
+    for (c = POS_SIZE - 1; c >= 0; --c) {
+        pos = (pos << 8) | ilp[c];
+    }
+    if (pos >= idx->il_size) {
+        return 0;
+    }
+    p = idx->il + pos;
+    if (!read_uint(&p, end, &nod)) {
+        return 0;
+    }
+    for (dc = 0; dc < nod; ++dc) {
+        unsigned long d;
+
+        if (!read_uint(&p, end, &d) || d >= idx->num_of_docs) {
+            return 0;
+        }
+        if (scratch->counts[d]++ == 0) {
+            scratch->touched[(*num_of_touched)++] = d;
+        }
+    }
+    return 1;
+}
+
+int ngr5_query(const struct ngr5_idx *idx,
+               struct ngr5_scratch *scratch,
+               const char *pitch_seq, struct answers *answers)
+{
+    size_t seq_len = strlen(pitch_seq);
+    size_t num_of_grams = 0;
+    size_t g;
+    doc_num_t num_of_touched = 0;
+    doc_num_t d;
+    unsigned long *codes = NULL;
+    int result = 0;
+
+    assert(scratch->num_of_docs == idx->num_of_docs);
+    if (seq_len < NUM_OF_GRAMS) {
+        return 1;
+    }
+
+    /* encode the n-grams of the query */
+    if (!(codes = encode_grams(&scratch->codes, pitch_seq, seq_len,
+                               &num_of_grams))) {
+        return 0;
+    }
+
+    /* count each distinct n-gram once */
+    qsort(codes, num_of_grams, sizeof *codes, cmp_code);
+    for (g = 0; g < num_of_grams; ++g) {
+        if (g > 0 && codes[g] == codes[g - 1]) {
+            continue;
+        }
+        if (!count_postings(idx, scratch, &num_of_touched,
+                            codes[g])) {
+            fprintf(stderr, "Inconsistent index entry %lu\n",
+                    codes[g]);
+            goto bail_out;
+        }
+    }
+
+    /* rank answers */
+    result = 1;
+    for (d = 0; d < num_of_touched; ++d) {
+        doc_num_t t = scratch->touched[d];
+
+        if (result &&
+            !insert_doc_answer(idx, answers, t,
+                               scratch->counts[t])) {
+            result = 0;
+        }
+    }
+    sort_answers(answers);
+
+bail_out:
+    for (d = 0; d < num_of_touched; ++d) {
+        scratch->counts[scratch->touched[d]] = 0;
+    }
+    return result;
+}
+
+int ngr5_lsh_query(const struct ngr5_idx *idx,
+                   struct ngr5_scratch *scratch,
+                   const char *pitch_seq, struct answers *answers)
+{
+    const struct lsh_sketch *sketch = idx->sketch;
+    size_t seq_len = strlen(pitch_seq);
+    size_t num_of_grams = 0;
+    size_t num_of_keys = 0;
+    size_t num_of_distinct = 0;
+    size_t k;
+    size_t g;
+    doc_num_t num_of_touched = 0;
+    doc_num_t num_of_candidates = 0;
+    doc_num_t d;
+    unsigned long *codes = NULL;
+    unsigned long *hist = NULL;
+    unsigned long min_count = 1;
+    unsigned long c;
+
+    assert(scratch->num_of_docs == idx->num_of_docs && sketch);
+    if (seq_len < NUM_OF_GRAMS) {
+        return 1;
+    }
+    if (!(codes = encode_grams(&scratch->codes, pitch_seq, seq_len,
+                               &num_of_grams))) {
+        return 0;
+    }
+    num_of_keys = lsh_num_of_windows(&sketch->params, num_of_grams) *
+                  sketch->params.num_of_bands;
+    /* one more key's room for the histogram below */
+    if (num_of_keys + 1 > scratch->max_num_of_keys) {
+        void *tmp = realloc(scratch->keys,
+                            (num_of_keys + 1) * sizeof *scratch->keys);
+
+        if (!tmp) {
+            return 0;
+        }
+        scratch->keys = tmp;
+        scratch->max_num_of_keys = num_of_keys + 1;
+    }
+    lsh_band_keys(&sketch->params, codes, num_of_grams,
+                  scratch->keys);
+
+    /* count the buckets every document shares with the query */
+    for (k = 0; k < num_of_keys; ++k) {
+        size_t n = 0;
+        const unsigned char *e =
+        lsh_bucket(sketch, k % sketch->params.num_of_bands,
+                   scratch->keys[k], &n);
+
+        for (; n > 0; --n, e += 8) {
+            doc_num_t t = LSH_GET(e + 4);
+
+            if (t >= idx->num_of_docs) {
+                continue;
+            }
+            if (scratch->counts[t]++ == 0) {
+                scratch->touched[num_of_touched++] = t;
+            }
+        }
+    }
+
+    /* keep the documents sharing the most buckets: find the
+     * smallest count the candidates need. The keys are no longer
+     * needed, so they hold the number of documents per count.
+     */
+    hist = scratch->keys;
+    memset(hist, 0, (num_of_keys + 1) * sizeof *hist);
+    for (d = 0; d < num_of_touched; ++d) {
+        c = scratch->counts[scratch->touched[d]];
+        hist[c < num_of_keys ? c : num_of_keys]++;
+    }
+    for (c = num_of_keys; c > 0; --c) {
+        if (num_of_candidates + hist[c] >
+            sketch->max_num_of_candidates) {
+            min_count = c + 1;
+            break;
+        }
+        num_of_candidates += hist[c];
+    }
+
+    /* verify the candidates with the exact ngr5 score */
+    qsort(codes, num_of_grams, sizeof *codes, cmp_code);
+    for (g = 0; g < num_of_grams; ++g) {
+        if (g == 0 || codes[g] != codes[num_of_distinct - 1]) {
+            codes[num_of_distinct++] = codes[g];
+        }
+    }
+    for (d = 0; d < num_of_touched; ++d) {
+        doc_num_t t = scratch->touched[d];
+        unsigned long score = 0;
+
+        if (scratch->counts[t] >= min_count &&
+            (score = lsh_count_common(sketch, t, codes,
+                                      num_of_distinct)) > 0 &&
+            !insert_doc_answer(idx, answers, t, score)) {
+            break;
+        }
+    }
+    for (g = 0; g < num_of_touched; ++g) {
+        scratch->counts[scratch->touched[g]] = 0;
+    }
+    sort_answers(answers);
+    return d == num_of_touched;
+}
+
+int ngr5_exact_query(const struct ngr5_idx *idx,
+                     struct ngr5_scratch *scratch,
+                     const char *pitch_seq, struct answers *answers)
+{
+    const struct fm_index *fm = idx->fm;
+    size_t seq_len = strlen(pitch_seq);
+    size_t num_of_grams = 0;
+    struct fm_range range;
+    unsigned long row;
+    doc_num_t num_of_touched = 0;
+    doc_num_t d;
+    int result = 1;
+
+    assert(scratch->num_of_docs == idx->num_of_docs && fm);
+    if (seq_len == 0) {
+        return 1;
+    }
+    if (!encode_grams(&scratch->codes, pitch_seq, seq_len,
+                      &num_of_grams)) {
+        return 0;
+    }
+    fm_count(fm, scratch->codes.codes, seq_len, &range);
+    for (row = range.lo; row < range.hi; ++row) {
+        doc_num_t t = 0;
+        unsigned long offset = 0;
+
+        fm_locate(fm, row, &t, &offset);
+        if (scratch->counts[t]++ == 0) {
+            scratch->touched[num_of_touched++] = t;
+        }
+    }
+    for (d = 0; d < num_of_touched; ++d) {
+        doc_num_t t = scratch->touched[d];
+
+        if (result &&
+            !insert_doc_answer(idx, answers, t,
+                               scratch->counts[t])) {
+            result = 0;
+        }
+        scratch->counts[t] = 0;
+    }
+    sort_answers(answers);
+    return result;
+}
@@ -0,0 +1,155 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * 5-gram coordinate matching
+ *
+ * Copyright 2004--2010 by RMIT MIRT Project.
+ * Copyright 2010 by Iman S. H. Suyoto.
+ */
+
+#ifndef H__FNMNGR5_
+#define H__FNMNGR5_
+
+#include <stddef.h>
+
+#include "fanimae.h"
+#include "fnmpioi.h"
+#include "fnmseq.h"
+#include "fnmlsh.h"
+#include "fnmfm.h"
+
+/* an index built by fnmib, loaded in memory */
+struct ngr5_idx {
+    /* the inverted lists and their pointers, mapped from idx.filp
+     * and idx.fipp rather than read
+     */
+    unsigned char *ilp;
+    size_t ilp_size;
+    unsigned char *il;
+    size_t il_size;
+    /* the titles of the documents, mapped from idx.fdt and looked
+     * up as needed, or NULL if the index has none: the document
+     * lookup is then split in titles
+     */
+    unsigned char *doc_titles;
+    size_t doc_titles_size;
+    char *titles_buf;
+    char **titles;
+    doc_num_t num_of_docs;
+    /* titles of the tracks fnmib found identical to a document and
+     * didn't index: those of document d are dup_titles[i] for
+     * dup_starts[d] <= i < dup_starts[d + 1]. NULL if there are
+     * none.
+     */
+    char *dup_titles_buf;
+    size_t *dup_starts;
+    char **dup_titles;
+    /* sketch index, NULL if fnmib didn't build one */
+    struct lsh_sketch *sketch;
+    /* FM-index, NULL if fnmib didn't build one */
+    struct fm_index *fm;
+};
+
+/* per-searcher working space: one counter per document, the
+ * documents whose counters were touched, the codes of the query
+ * n-grams, and the band keys of their sketches
+ */
+struct ngr5_scratch {
+    doc_num_t num_of_docs;
+    unsigned long *counts;
+    doc_num_t *touched;
+    struct seq_codes codes;
+    unsigned long *keys;
+    size_t max_num_of_keys;
+};
+
+/*
+ * function: ngr5_open
+ * param: idx_fn: index name given to fnmib
+ * return: NULL on failure
+ *         pointer to the loaded index on success
+ */
+struct ngr5_idx *ngr5_open(const char *idx_fn);
+
+/*
+ * function: ngr5_close
+ * param: idx: index
+ * purpose: releases an index
+ */
+void ngr5_close(struct ngr5_idx *idx);
+
+/*
+ * function: ngr5_create_scratch
+ * param: idx: index the scratch space will be used with
+ * return: NULL on failure
+ */
+struct ngr5_scratch *ngr5_create_scratch
+                     (const struct ngr5_idx *idx);
+
+/*
+ * function: ngr5_destroy_scratch
+ * param: scratch: scratch space
+ */
+void ngr5_destroy_scratch(struct ngr5_scratch *scratch);
+
+/*
+ * function: ngr5_query
+ * param: idx: index
+ *        scratch: working space created for idx
+ *        pitch_seq: query pitch sequence
+ *        answers: answers, cleared by the caller
+ * return: 1 on success
+ *         0 if the query contains a symbol outside the
+ *           alphabet or on failure
+ * purpose: ranks documents by the number of distinct query
+ *          5-grams they contain. Answers are left sorted in
+ *          ascending score order. A track fnmib didn't index
+ *          because it is identical to a document is answered
+ *          with the score of the document, here and by the other
+ *          searches.
+ */
+int ngr5_query(const struct ngr5_idx *idx,
+               struct ngr5_scratch *scratch,
+               const char *pitch_seq, struct answers *answers);
+
+/*
+ * function: ngr5_lsh_query
+ * param: idx: index with a sketch index
+ *        scratch: working space created for idx
+ *        pitch_seq: query pitch sequence
+ *        answers: answers, cleared by the caller
+ * return: 1 on success
+ *         0 if the query contains a symbol outside the
+ *           alphabet or on failure
+ * purpose: ranks like ngr5_query() only the documents sharing the
+ *          most LSH buckets with the query, at most
+ *          FNM_LSH_MAX_CANDIDATES of them, so that the work done
+ *          depends on the sizes of the buckets rather than on
+ *          the number of documents containing the query
+ *          n-grams. Documents similar to the query may be missed.
+ */
+int ngr5_lsh_query(const struct ngr5_idx *idx,
+                   struct ngr5_scratch *scratch,
+                   const char *pitch_seq, struct answers *answers);
+
+/*
+ * function: ngr5_exact_query
+ * param: idx: index with an FM-index
+ *        scratch: working space created for idx
+ *        pitch_seq: query pitch sequence
+ *        answers: answers, cleared by the caller
+ * return: 1 on success
+ *         0 if the query contains a symbol outside the
+ *           alphabet or on failure
+ * purpose: ranks the documents whose pitch sequences contain the
+ *          whole query pitch sequence by its number of
+ *          occurrences in them. The occurrences are counted in
+ *          time proportional to the query length, and located in
+ *          time proportional to their number.
+ */
+int ngr5_exact_query(const struct ngr5_idx *idx,
+                     struct ngr5_scratch *scratch,
+                     const char *pitch_seq, struct answers *answers);
+
+#endif
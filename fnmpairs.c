@@ -0,0 +1,133 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * All-pairs similarity (Pitch and IOI)
+ *
+ * Copyright 2010 by RMIT MIRT Project.
+ * Copyright 2010 by Iman S. H. Suyoto.
+ *
+ * Loads a collection once and finds the tracks most similar to
+ * every track of it, instead of querying the collection with
+ * each of its own tracks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fanimae.h"
+#include "fnmpioi.h"
+
+#define DEFAULT_NUM_OF_NEIGHBOURS 10
+#define DEFAULT_NUM_OF_THREADS 4
+
+/*
+ * function: load_coll
+ * return: 1 on success
+ *         0 on failure
+ * purpose: loads a whole collection sequence file in a block
+ */
+static int load_coll(struct coll_block *block, const char *coll_fn)
+{
+    FILE *coll_fp = fopen(coll_fn, "r");
+    struct oakpark_reader *coll_reader = NULL;
+    int failed = 0;
+
+    fprintf(stderr, "Loading collection %s...\n", coll_fn);
+    if (!coll_fp) {
+        fprintf(stderr, "Can't open ");
+        perror(coll_fn);
+        return 0;
+    }
+    if (!(coll_reader = oakpark_open_reader(coll_fp))) {
+        fclose(coll_fp);
+        return 0;
+    }
+    read_coll_block(coll_reader, block, (size_t)-1, &failed);
+    oakpark_close_reader(coll_reader);
+    fclose(coll_fp);
+    return !failed;
+}
+
+/* print the edges of the similarity graph, the neighbours of
+ * every track best first
+ */
+static void output_pairs(const struct coll_block *block,
+                         const struct coll_pairs *pairs)
+{
+    size_t d;
+    size_t i;
+
+    for (d = 0; d < block->num_of_docs; ++d) {
+        const struct neighbour *neighbours =
+        pairs->neighbours + d * pairs->max_num_of_neighbours;
+
+        for (i = 0; i < pairs->num_of_neighbours[d]; ++i) {
+            printf("%s %s %.0f\n", block->docs[d].title,
+                   block->docs[neighbours[i].doc].title,
+                   neighbours[i].score);
+        }
+    }
+}
+
+/* program entry point */
+int main(int argc, char **argv)
+{
+    int result = EXIT_FAILURE;
+    struct coll_block block;
+    struct coll_pairs pairs;
+    struct seed_idx *seeds = NULL;
+    unsigned long num_of_threads =
+    oakpark_get_env_ulong("FNM_NUM_OF_THREADS",
+                          DEFAULT_NUM_OF_THREADS);
+    double start = 0;
+
+    memset(&block, 0, sizeof block);
+    memset(&pairs, 0, sizeof pairs);
+    if (argc < 2) {
+        fprintf(stderr,
+                "Fanimae " FANIMAE_VERSION "\n"
+                "All-pairs similarity\n\n"
+                "Usage:\n"
+                "%s coll-seq\n\n"
+                "Every track of the collection sequence file is "
+                "printed with\neach of its most similar tracks "
+                "and their pioi score, a\npair per line.\n\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (!load_coll(&block, argv[1])) {
+        goto bail_out;
+    }
+    /* like fanimaed, align only the pairs seeded by either track
+     * if asked to
+     */
+    if (getenv("FNM_SEED_LEN") &&
+        !(seeds = create_seed_idx(&block))) {
+        goto bail_out;
+    }
+    pairs.max_num_of_neighbours =
+    oakpark_get_env_ulong("FNM_NUM_OF_ANSWERS",
+                          DEFAULT_NUM_OF_NEIGHBOURS);
+    start = stats_clock();
+    if (!pair_coll_block(&block, seeds, num_of_threads, &pairs)) {
+        goto bail_out;
+    }
+    fprintf(stderr, "pairs-stats docs=%lu aligned=%lu cut=%lu "
+                    "cells=%.0f secs=%.3f\n",
+            (unsigned long)block.num_of_docs, pairs.num_of_aligned,
+            pairs.num_of_cut, pairs.num_of_cells,
+            stats_clock() - start);
+    output_pairs(&block, &pairs);
+    if (fflush(stdout) == 0) {
+        result = EXIT_SUCCESS;
+    }
+
+bail_out:
+    free_coll_pairs(&pairs);
+    destroy_seed_idx(seeds);
+    destroy_coll_block(&block);
+    return result;
+}
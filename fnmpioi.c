@@ -0,0 +1,2282 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * Pitch and IOI matching
+ *
+ * Copyright 2010 by RMIT MIRT Project.
+ * Copyright 2010 by Iman S. H. Suyoto.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "fanimae.h"
+#include "oakpark.h"
+#include "fnmpioi.h"
+#include "fnmseq.h"
+
+/* current time in seconds, for query_stats */
+double stats_clock(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* clear a list of answers */
+void clear_answers(struct answers *answers)
+{
+    unsigned short c = 0;
+
+    answers->num_of_answers = 0;
+    do {
+        /* the title buffers are kept for the next answers */
+        answers->items[c].score = 0.0;
+    } while (++c < answers->max_num_of_answers);
+}
+
+/* create a list of answers */
+struct answers *create_answers
+                (unsigned short max_num_of_answers)
+{
+    struct answers *answers = malloc(sizeof *answers);
+    unsigned short c = 0;
+
+    if (!answers) {
+        goto bail_out;
+    }
+    if (!(answers->items =
+          malloc(max_num_of_answers *
+                 sizeof *answers->items))) {
+        free(answers);
+        goto bail_out;
+    }
+
+    answers->max_num_of_answers = max_num_of_answers;
+    answers->num_of_answers = 0;
+    do {
+        answers->items[c].title = NULL;
+        answers->items[c].title_size = 0;
+    } while (++c < max_num_of_answers);
+    clear_answers(answers);
+bail_out:
+    return answers;
+}
+
+void swap_answers(struct answer *a, struct answer *b)
+{
+    struct answer tmp = *a;
+
+    *a = *b;
+    *b = tmp;
+}
+
+/* the score a document must reach to enter the answers, or -1
+ * if there is still room for any
+ */
+static double min_answer_score(const struct answers *answers)
+{
+    return answers->num_of_answers == answers->max_num_of_answers ?
+           answers->items[0].score : -1.0;
+}
+
+/* copy a title in the buffer of an answer */
+static int set_answer_title(struct answer *a, const char *title)
+{
+    size_t title_size = strlen(title) + 1;
+
+    if (title_size > a->title_size) {
+        void *tmp = realloc(a->title, title_size);
+
+        if (!tmp) {
+            return 0;
+        }
+        a->title = tmp;
+        a->title_size = title_size;
+    }
+    memcpy(a->title, title, title_size);
+    return 1;
+}
+
+/* insert an answer */
+int insert_answer(struct answers *answers, const char *title,
+                  double score)
+{
+    unsigned short n = answers->num_of_answers;
+    unsigned short curr = 0;
+    struct answer *a = answers->items;
+    struct answer *root = a;
+
+    /* if the heap is already full, replace the answer with
+     * minimum score, i.e. the root, with the new answer, and
+     * top-down min-heapify
+     */
+    if (n == answers->max_num_of_answers) {
+        if (root->score > score) {
+            return 1;
+        }
+
+        /* replace root */
+        if (!set_answer_title(root, title)) {
+            return 0;
+        }
+        root->score = score;
+
+        /* top-down min-heapify */
+        while (curr < n) {
+            unsigned short left = curr * 2 + 1;
+            unsigned short right = left + 1;
+            unsigned short min = curr;
+
+            if (left < n && a[left].score < a[min].score) {
+                min = left;
+            }
+            if (right < n && a[right].score < a[min].score) {
+                min = right;
+            }
+            if (min == curr) {
+                return 1;
+            }
+
+            swap_answers(a + min, a + curr);
+            curr = min;
+        }
+    } else {
+        /* the heap isn't full, so put the new answer at the
+         * tail
+         */
+        if (!set_answer_title(a + n, title)) {
+            return 0;
+        }
+        a[n].score = score;
+
+        /* bottom-up min-heapify to put the new answer at the
+         * right place
+         */
+        curr = n;
+        while (curr > 0) {
+            unsigned short parent = curr / 2;
+
+            if (a[parent].score <= score) {
+                break;
+            }
+
+            swap_answers(a + parent, a + curr);
+            curr = parent;
+        };
+        answers->num_of_answers++;
+    }
+    return 1;
+}
+
+/* answer comparison function for qsort() */
+int cmp_answer(const void *a_v, const void *b_v)
+{
+    const struct answer *a = a_v;
+    const struct answer *b = b_v;
+
+    return a->score > b->score ? 1 :
+           a->score < b->score ? -1 : 0;
+}
+
+/* sort answers in ascending score order */
+void sort_answers(struct answers *answers)
+{
+    qsort(answers->items, answers->num_of_answers,
+          sizeof *answers->items, cmp_answer);
+}
+
+/* destroy a list of answers */
+void destroy_answers(struct answers *answers)
+{
+    if (answers) {
+        unsigned short c;
+
+        for (c = 0; c < answers->max_num_of_answers; ++c) {
+            free(answers->items[c].title);
+        }
+        free(answers->items);
+        free(answers);
+    }
+}
+
+/* validate and parse a sequence line */
+int parse_seq(char *seq_line, char **title,
+              char **pitch_seq, char **ioi_seq)
+{
+    struct seq_line parts;
+
+    if (!split_seq_line(seq_line, strlen(seq_line), &parts) ||
+        !parts.ioi_seq) {
+        return 0;
+    }
+    *title = parts.title;
+    *pitch_seq = parts.pitch_seq;
+    *ioi_seq = parts.ioi_seq;
+    return 1;
+}
+
+long lmax(long a, long b)
+{
+    return a > b ? a : b;
+}
+
+static long lmin(long a, long b)
+{
+    return a < b ? a : b;
+}
+
+static int sym_map(const char a)
+{
+    static const char symbols[] = IOI_SYMBOLS;
+    char *p = strchr(symbols, a);
+
+    if (!p) {
+        return -1;
+    }
+
+    return p - symbols;
+}
+
+static int mx(const char a, const char b)
+{
+    static const char symbols[] = IOI_SYMBOLS;
+    static const int match_matrix
+                     [sizeof symbols - 1]
+                     [sizeof symbols - 1] = {
+        { +1,  0, -3, -3, -3 },
+        {  0, +2, -2, -3, -3 },
+        { -3, -2, +3, -2, -3 },
+        { -3, -3, -2, +2,  0 },
+        { -3, -3, -3,  0, +1 }
+    };
+    int a_m = sym_map(a);
+    int b_m = sym_map(b);
+
+    if (a_m < 0 || b_m < 0 ||
+        a_m > sizeof symbols - 1 ||
+        b_m > sizeof symbols - 1) {
+        return INT_MIN;
+    }
+
+    return match_matrix[a_m][b_m];
+}
+
+/* reference alignment kernel: full matrices, scored through
+ * mx()
+ */
+static int align_ref(long *pitch_sim, long *ioi_sim,
+                     const char *pitch_seq_1,
+                     const char *pitch_seq_2,
+                     const char *ioi_seq_1,
+                     const char *ioi_seq_2,
+                     size_t pitch_seq_1_len,
+                     size_t pitch_seq_2_len)
+{
+    int result = 0;
+    long max = 0;
+    size_t r = 0;
+    size_t c = 0;
+    const size_t ioi_seq_1_len = pitch_seq_1_len;
+    const size_t ioi_seq_2_len = pitch_seq_2_len;
+    long **matrix =
+           malloc((pitch_seq_1_len + 1) * sizeof *matrix);
+
+    (void)ioi_seq_1;
+    (void)ioi_seq_2;
+    if (!matrix) {
+        fprintf(stderr, "Can't allocate matrix in %s:%d\n",
+                        __FILE__, __LINE__);
+        goto bailout;
+    }
+
+    /* allocate memory */
+    for (r = 0; r < pitch_seq_1_len + 1; ++r) {
+        matrix[r] = calloc(pitch_seq_2_len + 1,
+                           sizeof *(matrix[r]));
+    }
+    for (r = 0; r < pitch_seq_1_len + 1; ++r) {
+        if (!matrix[r]) {
+            fprintf(stderr,
+                    "Can't allocate matrix in %s:%d\n",
+                    __FILE__, __LINE__);
+            goto bailout;
+        }
+    }
+
+    /* align pitch sequences */
+    for(r = 1; r < pitch_seq_1_len + 1; ++r) {
+        for(c = 1; c < pitch_seq_2_len + 1; ++c) {
+            static const int m = 1;
+            static const int x = -1;
+            static const int i = -2;
+            long m_score = matrix[r - 1][c - 1] + 
+                           (pitch_seq_1[r - 1] ==
+                            pitch_seq_2[c - 1] ? m : x);
+            long i_score = lmax
+                           (matrix[r - 1][c] + i, 
+                            matrix[r][c - 1] + i);
+
+            matrix[r][c] = lmax(0, lmax(m_score, i_score));
+            max = lmax(max, matrix[r][c]);
+        }
+    }
+    *pitch_sim = max;
+
+    /* clear matrix */
+    for (r = 0; r < pitch_seq_1_len + 1; ++r) {
+        for (c = 0; c < pitch_seq_2_len + 1; ++c) {
+            matrix[r][c] = 0;
+        }
+    }
+
+    /* align IOI sequences */
+    max = 0;
+    for(r = 1; r < ioi_seq_1_len + 1; ++r) {
+        for(c = 1; c < ioi_seq_2_len + 1; ++c) {
+            static const int i = -2;
+            long m_score = matrix[r - 1][c - 1] +
+                           mx(pitch_seq_1[r - 1],
+                              pitch_seq_2[c - 1]);
+            long i_score = lmax
+                           (matrix[r - 1][c] + i, 
+                            matrix[r][c - 1] + i);
+
+            matrix[r][c] = lmax(0, lmax(m_score, i_score));
+            max = lmax(max, matrix[r][c]);
+        }
+    }
+    *ioi_sim = max;
+    result = 1;
+bailout:
+    if (matrix) {
+        for (r = 0; r < pitch_seq_1_len + 1; ++r) {
+            free(matrix[r]);
+        }
+    }
+    free(matrix);
+    return result;
+}
+
+/* the symbols of IOI_SYMBOLS, and one class for any other
+ * symbol
+ */
+#define NUM_OF_IOI_CLASSES 6
+
+/* best match scores of the pitch and the IOI alignments */
+#define MAX_PITCH_MATCH 1
+#define MAX_IOI_MATCH 3
+
+/* the class of a symbol is its sym_map() value, with
+ * NUM_OF_IOI_CLASSES - 1 standing for -1. mx() scores INT_MIN for
+ * any pair involving the latter. Fills the IOI match scores of
+ * every pair of classes, and the classes of a sequence.
+ */
+static void init_ioi_classes
+            (long ioi_scores[NUM_OF_IOI_CLASSES][NUM_OF_IOI_CLASSES],
+             unsigned char *classes, const char *pitch_seq,
+             size_t len)
+{
+    size_t r;
+    size_t c;
+
+    for (r = 0; r < NUM_OF_IOI_CLASSES; ++r) {
+        for (c = 0; c < NUM_OF_IOI_CLASSES; ++c) {
+            ioi_scores[r][c] =
+            mx(r < NUM_OF_IOI_CLASSES - 1 ? IOI_SYMBOLS[r] : '\1',
+               c < NUM_OF_IOI_CLASSES - 1 ? IOI_SYMBOLS[c] : '\1');
+        }
+    }
+    for (c = 0; c < len; ++c) {
+        int m = sym_map(pitch_seq[c]);
+
+        classes[c] = m < 0 ? NUM_OF_IOI_CLASSES - 1 : m;
+    }
+}
+
+/* the IOI class of a symbol */
+static int ioi_class(const char a)
+{
+    int m = sym_map(a);
+
+    return m < 0 ? NUM_OF_IOI_CLASSES - 1 : m;
+}
+
+/*
+ * rolling-row alignment kernel: both alignments are computed in a
+ * single pass, each keeping only the previous row of its matrix,
+ * and the IOI match scores are looked up by symbol class instead
+ * of searched for every cell.
+ *
+ * A cell scores at most MAX_PITCH_MATCH (or MAX_IOI_MATCH) more
+ * than the best cell of the row above, and an alignment pairs at
+ * most as many symbols as the shorter sequence has, so after each
+ * row the best score the remaining rows could reach is bounded,
+ * and so is the score before the first one. Once the
+ * resultant of the bounds is below min_score, the alignment stops
+ * with *pitch_sim and *ioi_sim set to -1. *num_of_rows, if not
+ * NULL, is set to the number of rows computed.
+ */
+static int align_rolling_cutoff(long *pitch_sim, long *ioi_sim,
+                                const char *pitch_seq_1,
+                                const char *pitch_seq_2,
+                                const char *ioi_seq_1,
+                                const char *ioi_seq_2,
+                                size_t len_1, size_t len_2,
+                                double min_score,
+                                size_t *num_of_rows)
+{
+    static const long i = -2;
+    long ioi_scores[NUM_OF_IOI_CLASSES][NUM_OF_IOI_CLASSES];
+    long pitch_max = 0;
+    long ioi_max = 0;
+    long *rows = NULL;
+    long *pitch_prev = NULL;
+    long *pitch_curr = NULL;
+    long *ioi_prev = NULL;
+    long *ioi_curr = NULL;
+    unsigned char *classes_2 = NULL;
+    long cap = (long)(len_1 < len_2 ? len_1 : len_2);
+    size_t r = 0;
+    size_t c;
+
+    (void)ioi_seq_1;
+    (void)ioi_seq_2;
+    if (R2 * MAX_PITCH_MATCH * MAX_PITCH_MATCH * cap * cap +
+        (double)MAX_IOI_MATCH * MAX_IOI_MATCH * cap * cap < min_score) {
+        pitch_max = -1;
+        ioi_max = -1;
+        goto done;
+    }
+    if (!(rows = malloc(4 * (len_2 + 1) * sizeof *rows +
+                        len_2 * sizeof *classes_2))) {
+        fprintf(stderr, "Can't allocate matrix in %s:%d\n",
+                        __FILE__, __LINE__);
+        return 0;
+    }
+    pitch_prev = rows;
+    pitch_curr = pitch_prev + len_2 + 1;
+    ioi_prev = pitch_curr + len_2 + 1;
+    ioi_curr = ioi_prev + len_2 + 1;
+    classes_2 = (unsigned char *)(ioi_curr + len_2 + 1);
+
+    init_ioi_classes(ioi_scores, classes_2, pitch_seq_2, len_2);
+    for (c = 0; c <= len_2; ++c) {
+        pitch_prev[c] = 0;
+        ioi_prev[c] = 0;
+    }
+    pitch_curr[0] = 0;
+    ioi_curr[0] = 0;
+
+    for (r = 0; r < len_1; ++r) {
+        const char a = pitch_seq_1[r];
+        const long *ioi_row = ioi_scores[ioi_class(a)];
+        long *tmp = NULL;
+        long pitch_row_max = 0;
+        long ioi_row_max = 0;
+        long rem = (long)(len_1 - r - 1);
+        double pitch_bound;
+        double ioi_bound;
+
+        for (c = 1; c <= len_2; ++c) {
+            long m_score = pitch_prev[c - 1] +
+                           (a == pitch_seq_2[c - 1] ? 1 : -1);
+            long i_score = lmax(pitch_prev[c] + i,
+                                pitch_curr[c - 1] + i);
+            long h = lmax(0, lmax(m_score, i_score));
+
+            pitch_curr[c] = h;
+            pitch_row_max = lmax(pitch_row_max, h);
+
+            m_score = ioi_prev[c - 1] + ioi_row[classes_2[c - 1]];
+            i_score = lmax(ioi_prev[c] + i, ioi_curr[c - 1] + i);
+            h = lmax(0, lmax(m_score, i_score));
+            ioi_curr[c] = h;
+            ioi_row_max = lmax(ioi_row_max, h);
+        }
+        pitch_max = lmax(pitch_max, pitch_row_max);
+        ioi_max = lmax(ioi_max, ioi_row_max);
+        pitch_bound = lmax(pitch_max,
+                           lmin(pitch_row_max + MAX_PITCH_MATCH * rem,
+                                MAX_PITCH_MATCH * cap));
+        ioi_bound = lmax(ioi_max,
+                         lmin(ioi_row_max + MAX_IOI_MATCH * rem,
+                              MAX_IOI_MATCH * cap));
+        if (R2 * pitch_bound * pitch_bound + ioi_bound * ioi_bound <
+            min_score) {
+            pitch_max = -1;
+            ioi_max = -1;
+            ++r;
+            break;
+        }
+        tmp = pitch_prev;
+        pitch_prev = pitch_curr;
+        pitch_curr = tmp;
+        tmp = ioi_prev;
+        ioi_prev = ioi_curr;
+        ioi_curr = tmp;
+    }
+    free(rows);
+done:
+    *pitch_sim = pitch_max;
+    *ioi_sim = ioi_max;
+    if (num_of_rows) {
+        *num_of_rows = r;
+    }
+    return 1;
+}
+
+/* rolling-row alignment kernel without a cutoff */
+static int align_rolling(long *pitch_sim, long *ioi_sim,
+                         const char *pitch_seq_1,
+                         const char *pitch_seq_2,
+                         const char *ioi_seq_1,
+                         const char *ioi_seq_2,
+                         size_t len_1, size_t len_2)
+{
+    return align_rolling_cutoff(pitch_sim, ioi_sim,
+                                pitch_seq_1, pitch_seq_2,
+                                ioi_seq_1, ioi_seq_2,
+                                len_1, len_2, -1.0, NULL);
+}
+
+/* rolling-row alignment kernel with the sequences swapped, as
+ * calc_sim_cutoff() runs it: both alignments are symmetric
+ */
+static int align_swapped(long *pitch_sim, long *ioi_sim,
+                         const char *pitch_seq_1,
+                         const char *pitch_seq_2,
+                         const char *ioi_seq_1,
+                         const char *ioi_seq_2,
+                         size_t len_1, size_t len_2)
+{
+    return align_rolling_cutoff(pitch_sim, ioi_sim,
+                                pitch_seq_2, pitch_seq_1,
+                                ioi_seq_2, ioi_seq_1,
+                                len_2, len_1, -1.0, NULL);
+}
+
+/* rows of matrix cells aligned per thread at a time by
+ * align_wavefront(): at most WAVEFRONT_TILE_ROWS rows of
+ * WAVEFRONT_TILE_COLS columns
+ */
+#define WAVEFRONT_TILE_ROWS 64
+#define WAVEFRONT_TILE_COLS 256
+
+static unsigned long wavefront_threads = 1;
+static double wavefront_min_cells = DEFAULT_WAVEFRONT_MIN_CELLS;
+
+void init_wavefront(void)
+{
+    wavefront_threads = oakpark_get_env_ulong("FNM_WAVEFRONT_THREADS",
+                                              1);
+    wavefront_min_cells =
+    oakpark_get_env_ulong("FNM_WAVEFRONT_CELLS",
+                          DEFAULT_WAVEFRONT_MIN_CELLS);
+}
+
+/* an alignment shared by the threads of align_wavefront() */
+struct wavefront {
+    const char *pitch_seq_1;
+    const char *pitch_seq_2;
+    size_t len_1;
+    size_t len_2;
+    size_t tile_rows;
+    size_t tile_cols;
+    size_t num_of_tile_rows;
+    size_t num_of_tile_cols;
+    long ioi_scores[NUM_OF_IOI_CLASSES][NUM_OF_IOI_CLASSES];
+    const unsigned char *classes_2;
+    /* the last pitch and IOI rows of num_of_bounds tile rows, each
+     * len_2 + 1 cells long. Tile row i reads bounds i % num_of_bounds
+     * and writes the next one.
+     */
+    long *bounds;
+    size_t num_of_bounds;
+    /* tiles done per tile row */
+    size_t *done;
+    /* next tile row to claim */
+    size_t next_tile_row;
+    pthread_mutex_t lock;
+    pthread_cond_t progress;
+};
+
+struct wavefront_worker {
+    struct wavefront *wf;
+    /* two pitch and two IOI rows of tile_cols + 1 cells, and the
+     * pitch and IOI cells left of the tile in each of its rows
+     */
+    long *scratch;
+    long pitch_max;
+    long ioi_max;
+};
+
+/* align a tile row, a tile at a time, each once the tile above it
+ * is done
+ */
+static void align_tile_row(struct wavefront_worker *worker, size_t i)
+{
+    static const long g = -2;
+    struct wavefront *wf = worker->wf;
+    size_t w = wf->tile_cols;
+    size_t r0 = i * wf->tile_rows;
+    size_t nr = wf->len_1 - r0 < wf->tile_rows ?
+                wf->len_1 - r0 : wf->tile_rows;
+    const long *in = wf->bounds + 2 * (wf->len_2 + 1) *
+                                  (i % wf->num_of_bounds);
+    long *out = wf->bounds + 2 * (wf->len_2 + 1) *
+                             ((i + 1) % wf->num_of_bounds);
+    long *pitch_prev = worker->scratch;
+    long *pitch_curr = pitch_prev + w + 1;
+    long *ioi_prev = pitch_curr + w + 1;
+    long *ioi_curr = ioi_prev + w + 1;
+    long *pitch_left = ioi_curr + w + 1;
+    long *ioi_left = pitch_left + wf->tile_rows;
+    size_t j;
+    size_t k;
+
+    for (k = 0; k < nr; ++k) {
+        pitch_left[k] = 0;
+        ioi_left[k] = 0;
+    }
+    out[0] = 0;
+    out[wf->len_2 + 1] = 0;
+    for (j = 0; j < wf->num_of_tile_cols; ++j) {
+        size_t c0 = j * w + 1;
+        size_t nc = wf->len_2 + 1 - c0 < w ? wf->len_2 + 1 - c0 : w;
+        size_t x;
+
+        if (i > 0) {
+            pthread_mutex_lock(&wf->lock);
+            while (wf->done[i - 1] <= j) {
+                pthread_cond_wait(&wf->progress, &wf->lock);
+            }
+            pthread_mutex_unlock(&wf->lock);
+        }
+        memcpy(pitch_prev, in + c0 - 1, (nc + 1) * sizeof *in);
+        memcpy(ioi_prev, in + wf->len_2 + c0, (nc + 1) * sizeof *in);
+
+        for (k = 0; k < nr; ++k) {
+            const char a = wf->pitch_seq_1[r0 + k];
+            const long *ioi_row = wf->ioi_scores[ioi_class(a)];
+            long *tmp = NULL;
+
+            pitch_curr[0] = pitch_left[k];
+            ioi_curr[0] = ioi_left[k];
+            for (x = 1; x <= nc; ++x) {
+                size_t c = c0 + x - 1;
+                long m_score = pitch_prev[x - 1] +
+                               (a == wf->pitch_seq_2[c - 1] ? 1 : -1);
+                long i_score = lmax(pitch_prev[x] + g,
+                                    pitch_curr[x - 1] + g);
+                long h = lmax(0, lmax(m_score, i_score));
+
+                pitch_curr[x] = h;
+                worker->pitch_max = lmax(worker->pitch_max, h);
+
+                m_score = ioi_prev[x - 1] +
+                          ioi_row[wf->classes_2[c - 1]];
+                i_score = lmax(ioi_prev[x] + g, ioi_curr[x - 1] + g);
+                h = lmax(0, lmax(m_score, i_score));
+                ioi_curr[x] = h;
+                worker->ioi_max = lmax(worker->ioi_max, h);
+            }
+            pitch_left[k] = pitch_curr[nc];
+            ioi_left[k] = ioi_curr[nc];
+            tmp = pitch_prev;
+            pitch_prev = pitch_curr;
+            pitch_curr = tmp;
+            tmp = ioi_prev;
+            ioi_prev = ioi_curr;
+            ioi_curr = tmp;
+        }
+        memcpy(out + c0, pitch_prev + 1, nc * sizeof *out);
+        memcpy(out + wf->len_2 + 1 + c0, ioi_prev + 1,
+               nc * sizeof *out);
+
+        pthread_mutex_lock(&wf->lock);
+        wf->done[i] = j + 1;
+        pthread_cond_broadcast(&wf->progress);
+        pthread_mutex_unlock(&wf->lock);
+    }
+}
+
+/* claim and align tile rows until none is left */
+static void *run_wavefront_worker(void *arg)
+{
+    struct wavefront_worker *worker = arg;
+    struct wavefront *wf = worker->wf;
+
+    for (;;) {
+        size_t i;
+
+        pthread_mutex_lock(&wf->lock);
+        i = wf->next_tile_row++;
+        pthread_mutex_unlock(&wf->lock);
+        if (i >= wf->num_of_tile_rows) {
+            return NULL;
+        }
+        align_tile_row(worker, i);
+    }
+}
+
+/*
+ * wavefront alignment kernel: the matrices are split into tiles,
+ * and up to num_of_threads threads align a row of tiles each. A
+ * tile is aligned once the one above it is done, so the tiles of
+ * an anti-diagonal are aligned at the same time.
+ *
+ * Tile rows are claimed in order and are done in order, so while
+ * tile row i is aligned, tile row i - num_of_threads is done: the
+ * last rows of num_of_threads + 1 tile rows are enough to pass the
+ * scores down. Every allocation is made before the threads start,
+ * and the calling thread aligns too, so the alignment finishes
+ * even if no thread can be created.
+ */
+static int align_wavefront(long *pitch_sim, long *ioi_sim,
+                           const char *pitch_seq_1,
+                           const char *pitch_seq_2,
+                           size_t len_1, size_t len_2,
+                           unsigned long num_of_threads,
+                           size_t tile_rows, size_t tile_cols)
+{
+    struct wavefront wf;
+    struct wavefront_worker *workers = NULL;
+    pthread_t *threads = NULL;
+    unsigned char *classes_2 = NULL;
+    long *scratch = NULL;
+    unsigned long num_of_created = 0;
+    size_t scratch_size = 4 * (tile_cols + 1) + 2 * tile_rows;
+    unsigned long t;
+    int result = 0;
+
+    memset(&wf, 0, sizeof wf);
+    wf.pitch_seq_1 = pitch_seq_1;
+    wf.pitch_seq_2 = pitch_seq_2;
+    wf.len_1 = len_1;
+    wf.len_2 = len_2;
+    wf.tile_rows = tile_rows;
+    wf.tile_cols = tile_cols;
+    wf.num_of_tile_rows = (len_1 + tile_rows - 1) / tile_rows;
+    wf.num_of_tile_cols = (len_2 + tile_cols - 1) / tile_cols;
+    if (num_of_threads > wf.num_of_tile_rows) {
+        num_of_threads = wf.num_of_tile_rows;
+    }
+    wf.num_of_bounds = num_of_threads + 1;
+
+    if (!(classes_2 = malloc(len_2)) ||
+        !(wf.bounds = calloc(2 * (len_2 + 1) * wf.num_of_bounds,
+                             sizeof *wf.bounds)) ||
+        !(wf.done = calloc(wf.num_of_tile_rows, sizeof *wf.done)) ||
+        !(workers = calloc(num_of_threads, sizeof *workers)) ||
+        !(threads = malloc(num_of_threads * sizeof *threads)) ||
+        !(scratch = malloc(num_of_threads * scratch_size *
+                           sizeof *scratch))) {
+        fprintf(stderr, "Can't allocate matrix in %s:%d\n",
+                        __FILE__, __LINE__);
+        goto bail_out;
+    }
+    init_ioi_classes(wf.ioi_scores, classes_2, pitch_seq_2, len_2);
+    wf.classes_2 = classes_2;
+    pthread_mutex_init(&wf.lock, NULL);
+    pthread_cond_init(&wf.progress, NULL);
+
+    for (t = 0; t < num_of_threads; ++t) {
+        workers[t].wf = &wf;
+        workers[t].scratch = scratch + t * scratch_size;
+    }
+    for (t = 1; t < num_of_threads; ++t) {
+        if (pthread_create(threads + num_of_created, NULL,
+                           run_wavefront_worker, workers + t) != 0) {
+            break;
+        }
+        ++num_of_created;
+    }
+    run_wavefront_worker(workers);
+    for (t = 0; t < num_of_created; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_cond_destroy(&wf.progress);
+    pthread_mutex_destroy(&wf.lock);
+
+    *pitch_sim = 0;
+    *ioi_sim = 0;
+    for (t = 0; t < num_of_threads; ++t) {
+        *pitch_sim = lmax(*pitch_sim, workers[t].pitch_max);
+        *ioi_sim = lmax(*ioi_sim, workers[t].ioi_max);
+    }
+    result = 1;
+
+bail_out:
+    free(scratch);
+    free(workers);
+    free(threads);
+    free(wf.done);
+    free(wf.bounds);
+    free(classes_2);
+    return result;
+}
+
+/* wavefront alignment kernel with tiles small enough for the
+ * checks of random pairs to cross their edges
+ */
+static int align_tiled(long *pitch_sim, long *ioi_sim,
+                       const char *pitch_seq_1,
+                       const char *pitch_seq_2,
+                       const char *ioi_seq_1,
+                       const char *ioi_seq_2,
+                       size_t len_1, size_t len_2)
+{
+    (void)ioi_seq_1;
+    (void)ioi_seq_2;
+    return align_wavefront(pitch_sim, ioi_sim, pitch_seq_1,
+                           pitch_seq_2, len_1, len_2,
+                           wavefront_threads > 1 ?
+                           wavefront_threads : 2, 3, 7);
+}
+
+const struct sim_kernel sim_kernels[] = {
+    { "ref", align_ref },
+    { "rolling", align_rolling },
+    { "swapped", align_swapped },
+    { "tiled", align_tiled },
+    { NULL, NULL }
+};
+
+/* calculate similarity */
+int calc_sim(double *sim_score,
+             const char *pitch_seq_1,
+             const char *pitch_seq_2,
+             const char *ioi_seq_1,
+             const char *ioi_seq_2)
+{
+    return calc_sim_cutoff(sim_score, pitch_seq_1, pitch_seq_2,
+                           ioi_seq_1, ioi_seq_2, -1.0, NULL);
+}
+
+/* calculate similarity, unless it is certainly below min_score */
+int calc_sim_cutoff(double *sim_score,
+                    const char *pitch_seq_1,
+                    const char *pitch_seq_2,
+                    const char *ioi_seq_1,
+                    const char *ioi_seq_2,
+                    double min_score, size_t *num_of_rows)
+{
+    long pitch_sim = 0;
+    long ioi_sim = 0;
+    const size_t pitch_seq_1_len = strlen(pitch_seq_1);
+    const size_t pitch_seq_2_len = strlen(pitch_seq_2);
+    const size_t ioi_seq_1_len = strlen(ioi_seq_1);
+    const size_t ioi_seq_2_len = strlen(ioi_seq_2);
+
+    if (pitch_seq_1_len != ioi_seq_1_len ||
+        pitch_seq_2_len != ioi_seq_2_len ||
+        pitch_seq_1_len == 0 ||
+        pitch_seq_2_len == 0) {
+        fprintf(stderr, "Invalid parameters. "
+                        "Pitch and IOI sequences must have "
+                        "the same length.\n");
+        return 0;
+    }
+    /* both alignments are symmetric, so the second sequence, a
+     * query, runs along the rows: it is the shorter one, and the
+     * bound of the cutoff tightens with every row
+     */
+    if (wavefront_threads > 1 &&
+        (double)pitch_seq_1_len * pitch_seq_2_len >=
+        wavefront_min_cells) {
+        /* a long alignment is shared by threads instead, without
+         * a cutoff
+         */
+        size_t tile_rows = (pitch_seq_2_len +
+                            2 * wavefront_threads - 1) /
+                           (2 * wavefront_threads);
+
+        if (tile_rows > WAVEFRONT_TILE_ROWS) {
+            tile_rows = WAVEFRONT_TILE_ROWS;
+        }
+        if (!align_wavefront(&pitch_sim, &ioi_sim,
+                             pitch_seq_2, pitch_seq_1,
+                             pitch_seq_2_len, pitch_seq_1_len,
+                             wavefront_threads, tile_rows,
+                             WAVEFRONT_TILE_COLS)) {
+            return 0;
+        }
+        if (num_of_rows) {
+            *num_of_rows = pitch_seq_2_len;
+        }
+    } else if (!align_rolling_cutoff(&pitch_sim, &ioi_sim,
+                              pitch_seq_2, pitch_seq_1,
+                              ioi_seq_2, ioi_seq_1,
+                              pitch_seq_2_len, pitch_seq_1_len,
+                              min_score, num_of_rows)) {
+        return 0;
+    }
+    if (pitch_sim < 0) {
+        *sim_score = -1.0;
+        return 1;
+    }
+
+    /* calculate the resultant */
+    *sim_score = R2 * pitch_sim * pitch_sim +
+                 ioi_sim * ioi_sim;
+    return 1;
+}
+
+/* can a pitch sequence and its IOI sequence be aligned by
+ * calc_sim()?
+ */
+int is_alignable(const char *pitch_seq, const char *ioi_seq)
+{
+    size_t pitch_seq_len = strlen(pitch_seq);
+
+    return pitch_seq_len > 0 &&
+           pitch_seq_len == strlen(ioi_seq);
+}
+
+/* release the sequences and titles held by a collection
+ * block
+ */
+void clear_coll_block(struct coll_block *block)
+{
+    if (block->seqs) {
+        oakpark_reset_arena(block->seqs);
+    }
+    if (block->titles) {
+        oakpark_reset_intern(block->titles);
+    }
+    if (block->dedup) {
+        clear_seq_dedup(block->dedup);
+    }
+    block->num_of_docs = 0;
+    block->num_of_dup_slots = 0;
+}
+
+/* destroy a collection block */
+void destroy_coll_block(struct coll_block *block)
+{
+    oakpark_destroy_arena(block->seqs);
+    oakpark_destroy_intern(block->titles);
+    destroy_seq_dedup(block->dedup);
+    free(block->docs);
+    block->seqs = NULL;
+    block->titles = NULL;
+    block->dedup = NULL;
+    block->docs = NULL;
+    block->num_of_docs = 0;
+    block->max_num_of_docs = 0;
+}
+
+/* read the next block of at least block_size bytes (or up to
+ * the end of the collection) and parse it. Use a block_size of
+ * (size_t)-1 to load the whole collection.
+ * return: number of documents read, 0 at the end of the
+ *         collection or on failure
+ */
+size_t read_coll_block(struct oakpark_reader *coll_reader,
+                       struct coll_block *block,
+                       size_t block_size, int *failed)
+{
+    const char *span = NULL;
+    char *coll_line = NULL;
+    struct seq_line parts;
+    size_t coll_line_len = 0;
+    size_t bytes_read = 0;
+
+    clear_coll_block(block);
+    *failed = 0;
+    if ((!block->seqs &&
+         !(block->seqs = oakpark_create_arena(0))) ||
+        (!block->titles &&
+         !(block->titles = oakpark_create_intern())) ||
+        (!block->dedup &&
+         !(block->dedup = create_seq_dedup()))) {
+        *failed = 1;
+        return 0;
+    }
+    while (bytes_read < block_size &&
+           (span = oakpark_read_span(coll_reader,
+                                     &coll_line_len)) != NULL) {
+        struct coll_doc *doc = NULL;
+        unsigned long orig = 0;
+
+        if (block->num_of_docs == block->max_num_of_docs) {
+            size_t n = block->max_num_of_docs ?
+                       block->max_num_of_docs * 2 : 64;
+            void *tmp = NULL;
+
+            if (!(tmp = realloc(block->docs,
+                                n * sizeof *block->docs))) {
+                *failed = 1;
+                break;
+            }
+            block->docs = tmp;
+            block->max_num_of_docs = n;
+        }
+
+        /* the sequences are parsed in a copy of the line in the
+         * arena of the block
+         */
+        if (!(coll_line = oakpark_arena_dup_mem(block->seqs, span,
+                                                coll_line_len))) {
+            *failed = 1;
+            break;
+        }
+        bytes_read += coll_line_len;
+        if (coll_line[coll_line_len - 1] == '\n') {
+            coll_line[--coll_line_len] = '\0';
+        }
+        doc = block->docs + block->num_of_docs;
+        /* validate and parse collection answer */
+        if (!split_seq_line(coll_line, coll_line_len, &parts) ||
+            !parts.ioi_seq) {
+            fprintf(stderr,
+                    "Collection sequence parse failed: %s\n",
+                    coll_line);
+            *failed = 1;
+            break;
+        }
+        doc->pitch_seq = parts.pitch_seq;
+        doc->ioi_seq = parts.ioi_seq;
+        doc->is_alignable = parts.pitch_seq_len > 0 &&
+                            parts.pitch_seq_len == parts.ioi_seq_len;
+        if (!(doc->title = oakpark_intern_str(block->titles,
+                                              parts.title))) {
+            *failed = 1;
+            break;
+        }
+
+        /* link a document to the first identical one */
+        if (!dedup_seq(block->dedup,
+                       parts.pitch_seq, parts.pitch_seq_len,
+                       parts.ioi_seq, parts.ioi_seq_len,
+                       block->num_of_docs, &orig)) {
+            *failed = 1;
+            break;
+        }
+        doc->orig = orig;
+        doc->next_dup = 0;
+        doc->dup_slot = NO_DUP_SLOT;
+        if (orig != block->num_of_docs) {
+            struct coll_doc *first = block->docs + orig;
+
+            if (first->dup_slot == NO_DUP_SLOT) {
+                first->dup_slot = block->num_of_dup_slots++;
+            }
+            doc->next_dup = first->next_dup;
+            first->next_dup = block->num_of_docs;
+        }
+        block->num_of_docs++;
+    }
+
+    return block->num_of_docs;
+}
+
+/*
+ * function: insert_dup_answer
+ * param: query: query
+ *        doc: a document with the same sequences as one aligned
+ *             before it
+ *        sim_score: score of the latter, -1 if it was below the
+ *                   answers
+ * return: 1 on success
+ *         0 on failure
+ * purpose: answers a duplicate without aligning it. Its score
+ *          would have been the same, and is still below the
+ *          answers if that one's was, so they keep the answers an
+ *          alignment would.
+ */
+static int insert_dup_answer(struct query *query,
+                             const struct coll_doc *doc,
+                             double sim_score)
+{
+    if (sim_score >= 0 &&
+        !insert_answer(query->answers, doc->title, sim_score)) {
+        fprintf(stderr, "Can't insert answer %s.\n", doc->title);
+        return 0;
+    }
+    return 1;
+}
+
+/* align every document of a collection block against a block
+ * of queries, keeping the best answers of each query in its own
+ * heap
+ */
+int align_coll_block(const struct coll_block *block,
+                     struct query *queries, size_t num_of_queries)
+{
+    size_t d = 0;
+    size_t q = 0;
+    /* the scores of the documents with duplicates, a row per
+     * document
+     */
+    double *dup_scores = NULL;
+    int result = 0;
+
+    if (block->num_of_dup_slots > 0 &&
+        !(dup_scores = malloc(block->num_of_dup_slots *
+                              num_of_queries *
+                              sizeof *dup_scores))) {
+        fprintf(stderr, "Can't allocate scores in %s:%d\n",
+                __FILE__, __LINE__);
+        return 0;
+    }
+    for (; q < num_of_queries; ++q) {
+        if (queries[q].stats) {
+            queries[q].stats->num_of_docs += block->num_of_docs;
+        }
+    }
+
+    for (; d < block->num_of_docs; ++d) {
+        struct coll_doc *doc = block->docs + d;
+
+        /* tracks with fewer than two notes have nothing to
+         * align
+         */
+        if (!doc->is_alignable) {
+            continue;
+        }
+
+        for (q = 0; q < num_of_queries; ++q) {
+            struct query *query = queries + q;
+            struct query_stats *stats = query->stats;
+            double sim_score = 0;
+            double start = 0;
+            double aligned = 0;
+            size_t num_of_rows = 0;
+
+            if (!is_alignable(query->pitch_seq,
+                              query->ioi_seq)) {
+                continue;
+            }
+            if (doc->orig != d) {
+                if (!insert_dup_answer
+                     (query, doc,
+                      dup_scores[block->docs[doc->orig].dup_slot *
+                                 num_of_queries + q])) {
+                    goto bail_out;
+                }
+                continue;
+            }
+
+            if (stats) {
+                start = stats_clock();
+            }
+            if (!calc_sim_cutoff(&sim_score,
+                                 doc->pitch_seq, query->pitch_seq,
+                                 doc->ioi_seq, query->ioi_seq,
+                                 min_answer_score(query->answers),
+                                 &num_of_rows)) {
+                goto bail_out;
+            }
+            if (stats) {
+                aligned = stats_clock();
+            }
+            if (doc->dup_slot != NO_DUP_SLOT) {
+                dup_scores[doc->dup_slot * num_of_queries + q] =
+                sim_score;
+            }
+
+            if (sim_score >= 0 &&
+                !insert_answer(query->answers, doc->title,
+                               sim_score)) {
+                fprintf(stderr, "Can't insert answer %s.\n",
+                                doc->title);
+                goto bail_out;
+            }
+            if (stats) {
+                /* a pitch and an IOI alignment of the rows
+                 * computed
+                 */
+                stats->num_of_cells += 2.0 *
+                                       strlen(doc->pitch_seq) *
+                                       num_of_rows;
+                stats->num_of_docs_scanned++;
+                stats->dp_time += aligned - start;
+                stats->rank_time += stats_clock() - aligned;
+            }
+        }
+    }
+    result = 1;
+bail_out:
+    free(dup_scores);
+    return result;
+}
+
+/*
+ * function: add_seed_hits
+ * param: idx: index being built
+ *        codes: buffer of at least len elements
+ *        seq: pitch sequence of a document
+ *        len: length of seq
+ *        pos: position of seq in the concatenation
+ *        is_counting: 1 to count the hits of every k-mer code in
+ *                     idx->heads[code + 1], 0 to store them at
+ *                     idx->heads[code], moved past them
+ */
+static void add_seed_hits(struct seed_idx *idx, unsigned char *codes,
+                          const char *seq, size_t len,
+                          unsigned long pos, int is_counting)
+{
+    const unsigned long nos = P_DM12_ALPHABET_SIZE;
+    unsigned long code = 0;
+    size_t run = 0;
+    size_t i;
+
+    /* symbols outside the alphabet are in no k-mer */
+    encode_pitch_seq(seq, len, codes);
+    for (i = 0; i < len; ++i) {
+        if (codes[i] >= nos) {
+            run = 0;
+            code = 0;
+            continue;
+        }
+        code = (code * nos + codes[i]) % idx->num_of_codes;
+        if (++run < idx->seed_len) {
+            continue;
+        }
+        if (is_counting) {
+            idx->heads[code + 1]++;
+        } else {
+            idx->hits[idx->heads[code]++] = pos + i + 1 -
+                                             idx->seed_len;
+        }
+    }
+}
+
+/* build the positional index of the pitch k-mers of a collection
+ * block
+ */
+struct seed_idx *create_seed_idx(const struct coll_block *block)
+{
+    struct seed_idx *idx = calloc(1, sizeof *idx);
+    unsigned char *codes = NULL;
+    size_t max_len = 0;
+    unsigned long pos = 0;
+    unsigned long c;
+    size_t d;
+    int pass;
+
+    if (!idx) {
+        return NULL;
+    }
+    idx->block = block;
+    idx->seed_len = oakpark_get_env_ulong("FNM_SEED_LEN",
+                                          DEFAULT_SEED_LEN);
+    if (idx->seed_len > NUM_OF_GRAMS) {
+        idx->seed_len = NUM_OF_GRAMS;
+    }
+    idx->x_drop = oakpark_get_env_ulong("FNM_SEED_X_DROP",
+                                        DEFAULT_SEED_X_DROP);
+    idx->min_score = oakpark_get_env_ulong("FNM_SEED_MIN_SCORE",
+                                           DEFAULT_SEED_MIN_SCORE);
+    idx->num_of_codes = 1;
+    for (c = 0; c < idx->seed_len; ++c) {
+        idx->num_of_codes *= P_DM12_ALPHABET_SIZE;
+    }
+    for (d = 0; d < block->num_of_docs; ++d) {
+        size_t len = strlen(block->docs[d].pitch_seq);
+
+        max_len = len > max_len ? len : max_len;
+    }
+    if (!(idx->doc_starts = malloc((block->num_of_docs + 1) *
+                                   sizeof *idx->doc_starts)) ||
+        !(idx->heads = calloc(idx->num_of_codes + 1,
+                              sizeof *idx->heads)) ||
+        !(codes = malloc(max_len ? max_len : 1))) {
+        goto bail_out;
+    }
+
+    /* count the hits of every k-mer, then store them in the
+     * space counted
+     */
+    for (pass = 0; pass < 2; ++pass) {
+        pos = 0;
+        for (d = 0; d < block->num_of_docs; ++d) {
+            const struct coll_doc *doc = block->docs + d;
+            size_t len = strlen(doc->pitch_seq);
+
+            idx->doc_starts[d] = pos;
+            /* duplicates are found through the first of them */
+            if (doc->is_alignable && doc->orig == d) {
+                add_seed_hits(idx, codes, doc->pitch_seq, len, pos,
+                              pass == 0);
+            }
+            pos += len + 1;
+        }
+        idx->doc_starts[d] = pos;
+        if (pass == 0) {
+            for (c = 0; c < idx->num_of_codes; ++c) {
+                idx->heads[c + 1] += idx->heads[c];
+            }
+            if (!(idx->hits = malloc((idx->heads[c] ?
+                                      idx->heads[c] : 1) *
+                                     sizeof *idx->hits))) {
+                goto bail_out;
+            }
+        }
+    }
+    /* every head has moved to the next one */
+    for (c = idx->num_of_codes; c > 0; --c) {
+        idx->heads[c] = idx->heads[c - 1];
+    }
+    idx->heads[0] = 0;
+    free(codes);
+    return idx;
+
+bail_out:
+    fprintf(stderr, "Can't allocate the positional index in %s:%d\n",
+            __FILE__, __LINE__);
+    free(codes);
+    destroy_seed_idx(idx);
+    return NULL;
+}
+
+/* destroy a positional index */
+void destroy_seed_idx(struct seed_idx *idx)
+{
+    if (idx) {
+        free(idx->doc_starts);
+        free(idx->heads);
+        free(idx->hits);
+        free(idx);
+    }
+}
+
+/*
+ * function: extend_seed
+ * param: doc: pitch sequence of a document
+ *        p: position of a seed in doc
+ *        query: query pitch sequence
+ *        q: position of the seed in query
+ *        len: length of the seed
+ *        x_drop: X-drop
+ * return: the score of the seed extended without gaps both ways
+ *         as long as it doesn't drop x_drop below its best, with
+ *         the match and mismatch scores of the pitch alignment of
+ *         calc_sim()
+ */
+static long extend_seed(const char *doc, size_t p,
+                        const char *query, size_t q, size_t len,
+                        long x_drop)
+{
+    long result = (long)len;
+    long score = 0;
+    long best = 0;
+    size_t i;
+
+    doc += p + len;
+    query += q + len;
+    for (i = 0; doc[i] && query[i]; ++i) {
+        score += doc[i] == query[i] ? 1 : -1;
+        if (score > best) {
+            best = score;
+        } else if (best - score > x_drop) {
+            break;
+        }
+    }
+    result += best;
+    doc -= len + 1;
+    query -= len + 1;
+    score = best = 0;
+    for (i = 0; i < p && i < q; ++i) {
+        score += *(doc - i) == *(query - i) ? 1 : -1;
+        if (score > best) {
+            best = score;
+        } else if (best - score > x_drop) {
+            break;
+        }
+    }
+    return result + best;
+}
+
+/* number of the document at a position of the concatenation */
+static size_t seed_doc_num(const struct seed_idx *idx,
+                           unsigned long pos)
+{
+    size_t lo = 0;
+    size_t hi = idx->block->num_of_docs;
+
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (idx->doc_starts[mid] <= pos) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* document number comparison function for qsort() */
+static int cmp_doc_num(const void *a_v, const void *b_v)
+{
+    const size_t *a = a_v;
+    const size_t *b = b_v;
+
+    return *a > *b ? 1 : *a < *b ? -1 : 0;
+}
+
+/*
+ * function: find_seeded_docs
+ * param: idx: positional index
+ *        query: query
+ *        codes: buffer of at least strlen(query->pitch_seq)
+ *               elements
+ *        is_kept: a zero per document, left so
+ *        kept: array to store the numbers of the documents kept
+ * return: the number of documents kept, in ascending order
+ */
+static size_t find_seeded_docs(const struct seed_idx *idx,
+                               const struct query *query,
+                               unsigned char *codes,
+                               unsigned char *is_kept, size_t *kept)
+{
+    const unsigned long nos = P_DM12_ALPHABET_SIZE;
+    const char *seq = query->pitch_seq;
+    size_t len = strlen(seq);
+    long min_score = idx->min_score < (long)len ?
+                     idx->min_score : (long)len;
+    unsigned long code = 0;
+    size_t num_of_kept = 0;
+    size_t run = 0;
+    size_t i;
+    size_t d;
+
+    encode_pitch_seq(seq, len, codes);
+    for (i = 0; i < len; ++i) {
+        size_t q = i + 1 - idx->seed_len;
+        unsigned long h;
+
+        if (codes[i] >= nos) {
+            run = 0;
+            code = 0;
+            continue;
+        }
+        code = (code * nos + codes[i]) % idx->num_of_codes;
+        if (++run < idx->seed_len) {
+            continue;
+        }
+        for (h = idx->heads[code]; h < idx->heads[code + 1]; ++h) {
+            size_t n = seed_doc_num(idx, idx->hits[h]);
+            const struct coll_doc *doc = idx->block->docs + n;
+
+            if (!is_kept[n] &&
+                extend_seed(doc->pitch_seq,
+                            idx->hits[h] - idx->doc_starts[n],
+                            seq, q, idx->seed_len, idx->x_drop) >=
+                min_score) {
+                is_kept[n] = 1;
+                kept[num_of_kept++] = n;
+            }
+        }
+    }
+    for (d = 0; d < num_of_kept; ++d) {
+        is_kept[kept[d]] = 0;
+    }
+    /* answers with equal scores are then kept as
+     * align_coll_block() would
+     */
+    qsort(kept, num_of_kept, sizeof *kept, cmp_doc_num);
+    return num_of_kept;
+}
+
+/* answer a block of queries against the block of a positional
+ * index, aligning only the documents seeded by the query
+ */
+int seed_coll_block(const struct seed_idx *idx,
+                    struct query *queries, size_t num_of_queries)
+{
+    const struct coll_block *block = idx->block;
+    size_t n = block->num_of_docs ? block->num_of_docs : 1;
+    unsigned char *is_kept = calloc(n, 1);
+    size_t *kept = malloc(n * sizeof *kept);
+    /* the scores of the documents with duplicates */
+    double *dup_scores = malloc((block->num_of_dup_slots ?
+                                 block->num_of_dup_slots : 1) *
+                                sizeof *dup_scores);
+    unsigned char *codes = NULL;
+    size_t max_len = 0;
+    int result = 0;
+    size_t q;
+
+    if (!is_kept || !kept || !dup_scores) {
+        fprintf(stderr, "Can't allocate seeds in %s:%d\n",
+                __FILE__, __LINE__);
+        goto bail_out;
+    }
+    for (q = 0; q < num_of_queries; ++q) {
+        struct query *query = queries + q;
+        struct query_stats *stats = query->stats;
+        size_t len = strlen(query->pitch_seq);
+        size_t num_of_kept;
+        size_t k;
+
+        /* a query shorter than a seed is aligned against every
+         * document
+         */
+        if (len < idx->seed_len) {
+            if (!align_coll_block(block, query, 1)) {
+                goto bail_out;
+            }
+            continue;
+        }
+        if (stats) {
+            stats->num_of_docs += block->num_of_docs;
+        }
+        if (!is_alignable(query->pitch_seq, query->ioi_seq)) {
+            continue;
+        }
+        if (len > max_len) {
+            void *tmp = realloc(codes, len);
+
+            if (!tmp) {
+                fprintf(stderr, "Can't allocate seeds in %s:%d\n",
+                        __FILE__, __LINE__);
+                goto bail_out;
+            }
+            codes = tmp;
+            max_len = len;
+        }
+
+        num_of_kept = find_seeded_docs(idx, query, codes, is_kept,
+                                       kept);
+        /* the duplicates of the documents kept are answered in
+         * document order too
+         */
+        k = num_of_kept;
+        while (k-- > 0) {
+            size_t dup = block->docs[kept[k]].next_dup;
+
+            for (; dup; dup = block->docs[dup].next_dup) {
+                kept[num_of_kept++] = dup;
+            }
+        }
+        qsort(kept, num_of_kept, sizeof *kept, cmp_doc_num);
+        for (k = 0; k < num_of_kept; ++k) {
+            const struct coll_doc *doc = block->docs + kept[k];
+            double sim_score = 0;
+            double start = 0;
+            double aligned = 0;
+            size_t num_of_rows = 0;
+
+            if (doc->orig != kept[k]) {
+                if (!insert_dup_answer
+                     (query, doc,
+                      dup_scores[block->docs[doc->orig].dup_slot])) {
+                    goto bail_out;
+                }
+                continue;
+            }
+            if (stats) {
+                start = stats_clock();
+            }
+            if (!calc_sim_cutoff(&sim_score,
+                                 doc->pitch_seq, query->pitch_seq,
+                                 doc->ioi_seq, query->ioi_seq,
+                                 min_answer_score(query->answers),
+                                 &num_of_rows)) {
+                goto bail_out;
+            }
+            if (stats) {
+                aligned = stats_clock();
+            }
+            if (doc->dup_slot != NO_DUP_SLOT) {
+                dup_scores[doc->dup_slot] = sim_score;
+            }
+            if (sim_score >= 0 &&
+                !insert_answer(query->answers, doc->title,
+                               sim_score)) {
+                fprintf(stderr, "Can't insert answer %s.\n",
+                                doc->title);
+                goto bail_out;
+            }
+            if (stats) {
+                stats->num_of_cells += 2.0 *
+                                       strlen(doc->pitch_seq) *
+                                       num_of_rows;
+                stats->num_of_docs_scanned++;
+                stats->dp_time += aligned - start;
+                stats->rank_time += stats_clock() - aligned;
+            }
+        }
+    }
+    result = 1;
+bail_out:
+    free(codes);
+    free(dup_scores);
+    free(kept);
+    free(is_kept);
+    return result;
+}
+
+/* documents per side of the tiles of pair_coll_block(), and
+ * locks sharing the guard of the neighbours of the documents
+ */
+#define PAIRS_TILE_DOCS 64
+#define PAIRS_NUM_OF_LOCKS 64
+
+/* the work shared by the threads of pair_coll_block() */
+struct pair_job {
+    const struct coll_block *block;
+    const struct seed_idx *seeds;
+    struct coll_pairs *pairs;
+    /* the documents each document seeds as a query, while
+     * seeding
+     */
+    size_t **seeded;
+    size_t *num_of_seeded;
+    /* the candidates e > d of every document d, ascending:
+     * cands[i] for cand_starts[d] <= i < cand_starts[d + 1]. A
+     * document shorter than a seed is a candidate of every other
+     * one, as it is always aligned as a query.
+     */
+    size_t *cand_starts;
+    size_t *cands;
+    unsigned char *is_short;
+    /* next document to seed, and next tile to align */
+    size_t next_doc;
+    size_t num_of_tiles;
+    size_t next_tile_1;
+    size_t next_tile_2;
+    int failed;
+    pthread_mutex_t lock;
+    /* the neighbours of document d are guarded by lock
+     * d % PAIRS_NUM_OF_LOCKS
+     */
+    pthread_mutex_t neighbour_locks[PAIRS_NUM_OF_LOCKS];
+};
+
+struct pair_worker {
+    struct pair_job *job;
+    /* the lowest neighbour scores of the documents of the second
+     * side of a tile
+     */
+    double min_scores[PAIRS_TILE_DOCS];
+    unsigned long num_of_aligned;
+    unsigned long num_of_cut;
+    double num_of_cells;
+};
+
+/* is a document aligned with the others: alignable, and the first
+ * of identical ones
+ */
+static int is_pair_doc(const struct coll_block *block, size_t d)
+{
+    return block->docs[d].is_alignable && block->docs[d].orig == d;
+}
+
+/* is neighbour a worse than b: a lower score, or the same one and
+ * a later document
+ */
+static int is_worse_neighbour(const struct neighbour *a,
+                              const struct neighbour *b)
+{
+    return a->score < b->score ||
+           (a->score == b->score && a->doc > b->doc);
+}
+
+/* neighbour comparison function for qsort(), best first */
+static int cmp_neighbour(const void *a_v, const void *b_v)
+{
+    const struct neighbour *a = a_v;
+    const struct neighbour *b = b_v;
+
+    return is_worse_neighbour(a, b) ? 1 :
+           is_worse_neighbour(b, a) ? -1 : 0;
+}
+
+/* the lowest neighbour score of a document and the documents
+ * identical to it, -1 while any of them has room for more
+ */
+static double pair_min_score(struct pair_job *job, size_t d)
+{
+    const struct coll_doc *docs = job->block->docs;
+    const struct coll_pairs *pairs = job->pairs;
+    double result = -1;
+    size_t m = d;
+
+    do {
+        pthread_mutex_t *lock = job->neighbour_locks +
+                                m % PAIRS_NUM_OF_LOCKS;
+        double score = -1;
+
+        pthread_mutex_lock(lock);
+        if (pairs->num_of_neighbours[m] ==
+            pairs->max_num_of_neighbours) {
+            score = pairs->neighbours[m *
+                                      pairs->max_num_of_neighbours].
+                    score;
+        }
+        pthread_mutex_unlock(lock);
+        if (score < 0) {
+            return -1;
+        }
+        if (m == d || score < result) {
+            result = score;
+        }
+    } while ((m = docs[m].next_dup) != 0);
+    return result;
+}
+
+/* make document e a neighbour of document d if it is better than
+ * the worst one, which is kept at the root of a min-heap
+ */
+static void add_neighbour(struct pair_job *job, size_t d, size_t e,
+                          double score)
+{
+    struct coll_pairs *pairs = job->pairs;
+    size_t k = pairs->max_num_of_neighbours;
+    struct neighbour *heap = pairs->neighbours + d * k;
+    size_t *num = pairs->num_of_neighbours + d;
+    pthread_mutex_t *lock = job->neighbour_locks +
+                            d % PAIRS_NUM_OF_LOCKS;
+    struct neighbour item;
+    size_t i;
+
+    item.doc = e;
+    item.score = score;
+    pthread_mutex_lock(lock);
+    if (*num < k) {
+        for (i = (*num)++;
+             i > 0 && is_worse_neighbour(&item, heap + (i - 1) / 2);
+             i = (i - 1) / 2) {
+            heap[i] = heap[(i - 1) / 2];
+        }
+        heap[i] = item;
+    } else if (k > 0 && is_worse_neighbour(heap, &item)) {
+        for (i = 0; 2 * i + 1 < k;) {
+            size_t c = 2 * i + 1;
+
+            if (c + 1 < k &&
+                is_worse_neighbour(heap + c + 1, heap + c)) {
+                ++c;
+            }
+            if (!is_worse_neighbour(heap + c, &item)) {
+                break;
+            }
+            heap[i] = heap[c];
+            i = c;
+        }
+        heap[i] = item;
+    }
+    pthread_mutex_unlock(lock);
+}
+
+/* make every document identical to d and every document identical
+ * to e neighbours with the score of d and e, which may be the same
+ * document
+ */
+static void add_pair(struct pair_job *job, size_t d, size_t e,
+                     double score)
+{
+    const struct coll_doc *docs = job->block->docs;
+    size_t m = d;
+
+    do {
+        size_t x = e;
+
+        do {
+            if (m != x) {
+                add_neighbour(job, m, x, score);
+                if (d != e) {
+                    add_neighbour(job, x, m, score);
+                }
+            }
+        } while ((x = docs[x].next_dup) != 0);
+    } while ((m = docs[m].next_dup) != 0);
+}
+
+/* claim documents and find the documents they seed until none is
+ * left
+ */
+static void *run_seed_worker(void *arg)
+{
+    struct pair_worker *worker = arg;
+    struct pair_job *job = worker->job;
+    const struct coll_block *block = job->block;
+    size_t n = block->num_of_docs;
+    unsigned char *is_kept = calloc(n, 1);
+    size_t *kept = malloc(n * sizeof *kept);
+    unsigned char *codes = NULL;
+    size_t max_len = 0;
+    struct query query;
+    int failed = !is_kept || !kept;
+
+    memset(&query, 0, sizeof query);
+    while (!failed) {
+        size_t d;
+        size_t len;
+        size_t num_of_kept;
+
+        pthread_mutex_lock(&job->lock);
+        d = job->next_doc++;
+        failed = job->failed;
+        pthread_mutex_unlock(&job->lock);
+        if (d >= n || failed) {
+            break;
+        }
+        if (!is_pair_doc(block, d)) {
+            continue;
+        }
+        len = strlen(block->docs[d].pitch_seq);
+        if (len < job->seeds->seed_len) {
+            job->is_short[d] = 1;
+            continue;
+        }
+        if (len > max_len) {
+            void *tmp = realloc(codes, len);
+
+            if (!tmp) {
+                failed = 1;
+                break;
+            }
+            codes = tmp;
+            max_len = len;
+        }
+        query.pitch_seq = block->docs[d].pitch_seq;
+        num_of_kept = find_seeded_docs(job->seeds, &query, codes,
+                                       is_kept, kept);
+        if (!(job->seeded[d] = malloc((num_of_kept ?
+                                       num_of_kept : 1) *
+                                      sizeof *job->seeded[d]))) {
+            failed = 1;
+            break;
+        }
+        memcpy(job->seeded[d], kept, num_of_kept * sizeof *kept);
+        job->num_of_seeded[d] = num_of_kept;
+    }
+    if (failed) {
+        fprintf(stderr, "Can't allocate seeds in %s:%d\n",
+                __FILE__, __LINE__);
+        pthread_mutex_lock(&job->lock);
+        job->failed = 1;
+        pthread_mutex_unlock(&job->lock);
+    }
+    free(codes);
+    free(kept);
+    free(is_kept);
+    return NULL;
+}
+
+/*
+ * function: build_pair_cands
+ * param: job: job whose documents have been seeded
+ * return: 1 on success
+ *         0 if out of memory
+ * purpose: turns the documents seeded by every document into
+ *          the candidates of the pairs, each pair once
+ */
+static int build_pair_cands(struct pair_job *job)
+{
+    size_t n = job->block->num_of_docs;
+    size_t *fill = malloc((n ? n : 1) * sizeof *fill);
+    size_t num_of_cands = 0;
+    size_t d;
+    size_t k;
+
+    if (!fill ||
+        !(job->cand_starts = calloc(n + 1,
+                                    sizeof *job->cand_starts))) {
+        free(fill);
+        return 0;
+    }
+    for (d = 0; d < n; ++d) {
+        for (k = 0; k < job->num_of_seeded[d]; ++k) {
+            size_t e = job->seeded[d][k];
+
+            if (e != d) {
+                job->cand_starts[(d < e ? d : e) + 1]++;
+            }
+        }
+    }
+    for (d = 0; d < n; ++d) {
+        fill[d] = job->cand_starts[d];
+        job->cand_starts[d + 1] += job->cand_starts[d];
+    }
+    if (!(job->cands = malloc((job->cand_starts[n] ?
+                               job->cand_starts[n] : 1) *
+                              sizeof *job->cands))) {
+        free(fill);
+        return 0;
+    }
+    for (d = 0; d < n; ++d) {
+        for (k = 0; k < job->num_of_seeded[d]; ++k) {
+            size_t e = job->seeded[d][k];
+
+            if (e != d) {
+                job->cands[fill[d < e ? d : e]++] = d < e ? e : d;
+            }
+        }
+    }
+    free(fill);
+
+    /* a pair seeded both ways is a candidate once */
+    for (d = 0; d < n; ++d) {
+        size_t first = job->cand_starts[d];
+        size_t last = job->cand_starts[d + 1];
+
+        qsort(job->cands + first, last - first, sizeof *job->cands,
+              cmp_doc_num);
+        job->cand_starts[d] = num_of_cands;
+        for (k = first; k < last; ++k) {
+            if (k == first || job->cands[k] != job->cands[k - 1]) {
+                job->cands[num_of_cands++] = job->cands[k];
+            }
+        }
+    }
+    job->cand_starts[n] = num_of_cands;
+    return 1;
+}
+
+/*
+ * function: align_pair_tile
+ * param: worker: worker
+ *        t1: tile of the first documents of the pairs
+ *        t2: tile of the second ones, not before t1
+ * return: 1 on success
+ *         0 on failure
+ * purpose: aligns the candidate pairs of a tile of the upper
+ *          triangle of the pairs of documents
+ */
+static int align_pair_tile(struct pair_worker *worker, size_t t1,
+                           size_t t2)
+{
+    struct pair_job *job = worker->job;
+    const struct coll_block *block = job->block;
+    const struct coll_doc *docs = block->docs;
+    size_t n = block->num_of_docs;
+    size_t first_1 = t1 * PAIRS_TILE_DOCS;
+    size_t last_1 = n - first_1 < PAIRS_TILE_DOCS ?
+                    n : first_1 + PAIRS_TILE_DOCS;
+    size_t first_2 = t2 * PAIRS_TILE_DOCS;
+    size_t last_2 = n - first_2 < PAIRS_TILE_DOCS ?
+                    n : first_2 + PAIRS_TILE_DOCS;
+    size_t d;
+    size_t e;
+
+    /* the neighbours only get better, so scores read once are
+     * still low enough to stop alignments at
+     */
+    for (e = first_2; e < last_2; ++e) {
+        worker->min_scores[e - first_2] =
+        is_pair_doc(block, e) ? pair_min_score(job, e) : -1;
+    }
+    for (d = first_1; d < last_1; ++d) {
+        int is_seeded = job->seeds && !job->is_short[d];
+        size_t c = 0;
+        size_t last_c = 0;
+        double min_score;
+
+        if (!is_pair_doc(block, d)) {
+            continue;
+        }
+        /* identical documents are neighbours with the score of
+         * the document against itself
+         */
+        if (t1 == t2 && docs[d].dup_slot != NO_DUP_SLOT) {
+            double sim_score = 0;
+
+            if (!calc_sim(&sim_score, docs[d].pitch_seq,
+                          docs[d].pitch_seq, docs[d].ioi_seq,
+                          docs[d].ioi_seq)) {
+                return 0;
+            }
+            add_pair(job, d, d, sim_score);
+        }
+        if (is_seeded) {
+            size_t hi = job->cand_starts[d + 1];
+
+            /* the first candidate in the tile */
+            c = job->cand_starts[d];
+            last_c = hi;
+            while (c < hi) {
+                size_t mid = c + (hi - c) / 2;
+
+                if (job->cands[mid] < first_2) {
+                    c = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+        }
+        min_score = pair_min_score(job, d);
+        for (e = d + 1 > first_2 ? d + 1 : first_2; e < last_2;
+             ++e) {
+            double sim_score = 0;
+            double e_min_score = worker->min_scores[e - first_2];
+            size_t num_of_rows = 0;
+
+            if (!is_pair_doc(block, e)) {
+                continue;
+            }
+            if (is_seeded && !job->is_short[e]) {
+                while (c < last_c && job->cands[c] < e) {
+                    ++c;
+                }
+                if (c == last_c || job->cands[c] != e) {
+                    continue;
+                }
+            }
+            if (!calc_sim_cutoff(&sim_score,
+                                 docs[e].pitch_seq, docs[d].pitch_seq,
+                                 docs[e].ioi_seq, docs[d].ioi_seq,
+                                 min_score < e_min_score ?
+                                 min_score : e_min_score,
+                                 &num_of_rows)) {
+                return 0;
+            }
+            worker->num_of_aligned++;
+            worker->num_of_cells += 2.0 * strlen(docs[e].pitch_seq) *
+                                    num_of_rows;
+            if (sim_score < 0) {
+                worker->num_of_cut++;
+                continue;
+            }
+            add_pair(job, d, e, sim_score);
+        }
+    }
+    return 1;
+}
+
+/* claim and align the tiles of the upper triangle, a row of tiles
+ * after another, until none is left
+ */
+static void *run_pair_worker(void *arg)
+{
+    struct pair_worker *worker = arg;
+    struct pair_job *job = worker->job;
+
+    for (;;) {
+        size_t t1;
+        size_t t2;
+        int failed;
+
+        pthread_mutex_lock(&job->lock);
+        t1 = job->next_tile_1;
+        t2 = job->next_tile_2;
+        failed = job->failed;
+        if (!failed && t1 < job->num_of_tiles &&
+            ++job->next_tile_2 == job->num_of_tiles) {
+            job->next_tile_2 = ++job->next_tile_1;
+        }
+        pthread_mutex_unlock(&job->lock);
+        if (failed || t1 >= job->num_of_tiles) {
+            return NULL;
+        }
+        if (!align_pair_tile(worker, t1, t2)) {
+            pthread_mutex_lock(&job->lock);
+            job->failed = 1;
+            pthread_mutex_unlock(&job->lock);
+            return NULL;
+        }
+    }
+}
+
+/* run a worker function on num_of_threads threads, the calling
+ * thread included, so that the work is done even if no thread can
+ * be created
+ */
+static void run_pair_threads(void *(*run)(void *),
+                             struct pair_worker *workers,
+                             pthread_t *threads,
+                             unsigned long num_of_threads)
+{
+    unsigned long num_of_created = 0;
+    unsigned long t;
+
+    for (t = 1; t < num_of_threads; ++t) {
+        if (pthread_create(threads + num_of_created, NULL, run,
+                           workers + t) != 0) {
+            break;
+        }
+        ++num_of_created;
+    }
+    run(workers);
+    for (t = 0; t < num_of_created; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+/* find the most similar documents of every document of a
+ * collection block
+ *
+ * The pairs (d, e), d < e, are split into square tiles of the
+ * upper triangle, claimed by the threads a row of tiles after
+ * another, and a pair's score is given to both of its documents.
+ * A document identical to an earlier one isn't aligned: its
+ * pairs are those of the earlier one. With seeds, every document
+ * is first looked up as a query in the positional index, by all
+ * the threads, and the pairs seeded either way are the only ones
+ * aligned.
+ */
+int pair_coll_block(const struct coll_block *block,
+                    const struct seed_idx *seeds,
+                    unsigned long num_of_threads,
+                    struct coll_pairs *pairs)
+{
+    struct pair_job job;
+    struct pair_worker *workers = NULL;
+    pthread_t *threads = NULL;
+    size_t n = block->num_of_docs;
+    size_t k = pairs->max_num_of_neighbours;
+    size_t d;
+    unsigned long t;
+    int result = 0;
+
+    if (num_of_threads == 0) {
+        num_of_threads = 1;
+    }
+    memset(&job, 0, sizeof job);
+    job.block = block;
+    job.seeds = seeds;
+    job.pairs = pairs;
+    job.num_of_tiles = (n + PAIRS_TILE_DOCS - 1) / PAIRS_TILE_DOCS;
+    pairs->num_of_aligned = 0;
+    pairs->num_of_cut = 0;
+    pairs->num_of_cells = 0;
+    if (!(pairs->num_of_neighbours =
+          calloc(n ? n : 1, sizeof *pairs->num_of_neighbours)) ||
+        !(pairs->neighbours = malloc((n * k > 0 ? n * k : 1) *
+                                     sizeof *pairs->neighbours)) ||
+        !(workers = calloc(num_of_threads, sizeof *workers)) ||
+        !(threads = malloc(num_of_threads * sizeof *threads)) ||
+        (seeds &&
+         (!(job.seeded = calloc(n ? n : 1, sizeof *job.seeded)) ||
+          !(job.num_of_seeded = calloc(n ? n : 1,
+                                       sizeof *job.num_of_seeded)) ||
+          !(job.is_short = calloc(n ? n : 1, 1))))) {
+        fprintf(stderr, "Can't allocate pairs in %s:%d\n",
+                __FILE__, __LINE__);
+        free(workers);
+        free(threads);
+        goto bail_out;
+    }
+    pthread_mutex_init(&job.lock, NULL);
+    for (t = 0; t < PAIRS_NUM_OF_LOCKS; ++t) {
+        pthread_mutex_init(job.neighbour_locks + t, NULL);
+    }
+    for (t = 0; t < num_of_threads; ++t) {
+        workers[t].job = &job;
+    }
+
+    if (seeds) {
+        run_pair_threads(run_seed_worker, workers, threads,
+                         num_of_threads);
+        if (!job.failed && !build_pair_cands(&job)) {
+            fprintf(stderr, "Can't allocate pairs in %s:%d\n",
+                    __FILE__, __LINE__);
+            job.failed = 1;
+        }
+        for (d = 0; d < n; ++d) {
+            free(job.seeded[d]);
+        }
+    }
+    if (!job.failed) {
+        run_pair_threads(run_pair_worker, workers, threads,
+                         num_of_threads);
+    }
+
+    for (t = 0; t < PAIRS_NUM_OF_LOCKS; ++t) {
+        pthread_mutex_destroy(job.neighbour_locks + t);
+    }
+    pthread_mutex_destroy(&job.lock);
+    for (t = 0; t < num_of_threads; ++t) {
+        pairs->num_of_aligned += workers[t].num_of_aligned;
+        pairs->num_of_cut += workers[t].num_of_cut;
+        pairs->num_of_cells += workers[t].num_of_cells;
+    }
+    free(workers);
+    free(threads);
+    if (job.failed) {
+        goto bail_out;
+    }
+    for (d = 0; d < n; ++d) {
+        qsort(pairs->neighbours + d * k, pairs->num_of_neighbours[d],
+              sizeof *pairs->neighbours, cmp_neighbour);
+    }
+    result = 1;
+
+bail_out:
+    free(job.seeded);
+    free(job.num_of_seeded);
+    free(job.is_short);
+    free(job.cand_starts);
+    free(job.cands);
+    if (!result) {
+        free_coll_pairs(pairs);
+    }
+    return result;
+}
+
+void free_coll_pairs(struct coll_pairs *pairs)
+{
+    free(pairs->num_of_neighbours);
+    free(pairs->neighbours);
+    pairs->num_of_neighbours = NULL;
+    pairs->neighbours = NULL;
+}
+
+/* query the collection with a block of queries
+ *
+ * The collection is streamed in blocks of coll_block_size
+ * bytes. Every block is aligned against all the queries while
+ * it is still hot in cache, so the collection is read only once
+ * per query block rather than once per query.
+ */
+int query_coll(struct oakpark_reader *coll_reader,
+               struct coll_block *block, size_t coll_block_size,
+               struct query *queries, size_t num_of_queries)
+{
+    int failed = 0;
+    int is_instrumented = 0;
+    double start = 0;
+    size_t q;
+
+    if (!(coll_reader && block && queries && num_of_queries > 0)) {
+        return 0;
+    }
+
+    for (q = 0; q < num_of_queries; ++q) {
+        if (queries[q].stats) {
+            is_instrumented = 1;
+        }
+    }
+    if (is_instrumented) {
+        start = stats_clock();
+    }
+    while (read_coll_block(coll_reader, block,
+                           coll_block_size, &failed) > 0 &&
+           !failed) {
+        if (is_instrumented) {
+            /* the queries of the block share the parsing */
+            double t = (stats_clock() - start) / num_of_queries;
+
+            for (q = 0; q < num_of_queries; ++q) {
+                if (queries[q].stats) {
+                    queries[q].stats->parse_time += t;
+                }
+            }
+        }
+        if (!align_coll_block(block, queries, num_of_queries)) {
+            return 0;
+        }
+        if (is_instrumented) {
+            start = stats_clock();
+        }
+    }
+    clear_coll_block(block);
+    /* answers from part of the collection aren't answers */
+    return !failed;
+}
+
@@ -0,0 +1,317 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * Pitch and IOI matching
+ *
+ * Copyright 2010 by RMIT MIRT Project.
+ * Copyright 2010 by Iman S. H. Suyoto.
+ */
+
+#ifndef H__FNMPIOI_
+#define H__FNMPIOI_
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "oakpark.h"
+
+#define IOI_SYMBOLS "SsRlL"
+#define R 38.0
+#define R2 ((R) * (R))
+
+/* answers are organized as min-heap. An answer copies its title
+ * when it enters the heap, in a buffer kept for the answers
+ * taking its place later, so titles needn't outlive the answers.
+ */
+struct answer {
+    double score;
+    char *title;
+    size_t title_size;
+};
+
+struct answers {
+    unsigned short max_num_of_answers;
+    unsigned short num_of_answers;
+    struct answer *items;
+};
+
+/* collection block: a run of parsed collection sequences. The
+ * sequences are kept in an arena and the titles are interned,
+ * both reset for every block.
+ */
+struct coll_doc {
+    const char *title;
+    char *pitch_seq;
+    char *ioi_seq;
+    /* result of is_alignable(), found while parsing */
+    int is_alignable;
+    /* number of the first document of the block with the same
+     * pitch and IOI sequences, the document's own if none. Only
+     * that one is aligned; the others get its score.
+     */
+    size_t orig;
+    /* for the first of identical documents, the next one, or 0 if
+     * none (a later one is never the first)
+     */
+    size_t next_dup;
+    /* for the first of identical documents, its number among
+     * them, or NO_DUP_SLOT if it has no duplicate
+     */
+    size_t dup_slot;
+};
+
+#define NO_DUP_SLOT ((size_t)-1)
+
+struct coll_block {
+    size_t num_of_docs;
+    size_t max_num_of_docs;
+    struct coll_doc *docs;
+    struct oakpark_arena *seqs;
+    struct oakpark_intern *titles;
+    /* the sequences of the block, for finding identical ones */
+    struct seq_dedup *dedup;
+    /* number of documents with duplicates */
+    size_t num_of_dup_slots;
+};
+
+/* positional index of the pitch k-mers of a collection block
+ * kept loaded, for seed-and-extend alignment
+ */
+#define DEFAULT_SEED_LEN 4
+#define DEFAULT_SEED_X_DROP 3
+#define DEFAULT_SEED_MIN_SCORE 5
+/* matrix cells from which an alignment is shared by
+ * FNM_WAVEFRONT_THREADS threads
+ */
+#define DEFAULT_WAVEFRONT_MIN_CELLS 1000000
+
+struct seed_idx {
+    const struct coll_block *block;
+    /* k, at most NUM_OF_GRAMS */
+    size_t seed_len;
+    /* an ungapped extension stops once its score is x_drop below
+     * the best one so far
+     */
+    long x_drop;
+    /* the smallest ungapped score, or query length, a document
+     * must reach to be aligned
+     */
+    long min_score;
+    unsigned long num_of_codes;
+    /* position of the pitch sequence of every document in their
+     * concatenation, each followed by a separator, and the length
+     * of the concatenation
+     */
+    unsigned long *doc_starts;
+    /* for every k-mer code, the first of its hits, and the number
+     * of hits after the last code
+     */
+    unsigned long *heads;
+    /* positions of the k-mers in the concatenation, ascending
+     * for every code
+     */
+    unsigned long *hits;
+};
+
+/* what answering a query took, accumulated over the collection
+ * blocks it was aligned against. Times are in seconds.
+ */
+struct query_stats {
+    /* collection documents seen */
+    unsigned long num_of_docs;
+    /* documents aligned; the others were skipped */
+    unsigned long num_of_docs_scanned;
+    /* dynamic programming cells computed. A double holds more than
+     * an unsigned long may.
+     */
+    double num_of_cells;
+    /* parsing the query, plus its share of parsing the
+     * collection
+     */
+    double parse_time;
+    double dp_time;
+    double rank_time;
+};
+
+/* a query and its own answer heap */
+struct query {
+    char *line;
+    char *title;
+    char *pitch_seq;
+    char *ioi_seq;
+    struct answers *answers;
+    /* NULL unless the query is instrumented */
+    struct query_stats *stats;
+};
+
+/* current time in seconds, for query_stats */
+double stats_clock(void);
+
+/* clear a list of answers */
+void clear_answers(struct answers *answers);
+
+/* create a list of answers */
+struct answers *create_answers
+                (unsigned short max_num_of_answers);
+
+/* insert an answer */
+int insert_answer(struct answers *answers, const char *title,
+                  double score);
+
+/* sort answers in ascending score order */
+void sort_answers(struct answers *answers);
+
+/* destroy a list of answers */
+void destroy_answers(struct answers *answers);
+
+/* validate and parse a sequence line */
+int parse_seq(char *seq_line, char **title,
+              char **pitch_seq, char **ioi_seq);
+
+/* an alignment kernel: computes the pitch and IOI similarities
+ * calc_sim() combines, for sequences of len_1 and len_2 (both
+ * greater than 0) symbols. Returns 0 on memory allocation
+ * failure.
+ */
+typedef int (*align_fn_t)(long *pitch_sim, long *ioi_sim,
+                          const char *pitch_seq_1,
+                          const char *pitch_seq_2,
+                          const char *ioi_seq_1,
+                          const char *ioi_seq_2,
+                          size_t len_1, size_t len_2);
+
+struct sim_kernel {
+    const char *name;
+    align_fn_t align;
+};
+
+/* the alignment kernels, ending with a NULL name. The first one
+ * is the reference the others must agree with.
+ */
+extern const struct sim_kernel sim_kernels[];
+
+/* read FNM_WAVEFRONT_THREADS and FNM_WAVEFRONT_CELLS. Unless
+ * called, and unless FNM_WAVEFRONT_THREADS is over 1, every
+ * alignment runs in the calling thread.
+ */
+void init_wavefront(void);
+
+/* calculate similarity */
+int calc_sim(double *sim_score,
+             const char *pitch_seq_1,
+             const char *pitch_seq_2,
+             const char *ioi_seq_1,
+             const char *ioi_seq_2);
+
+/* calculate similarity like calc_sim(), stopping as soon as it
+ * is certainly below min_score. *sim_score is then set to -1.
+ * *num_of_rows, if not NULL, is set to the number of rows of
+ * pitch_seq_2 aligned.
+ */
+int calc_sim_cutoff(double *sim_score,
+                    const char *pitch_seq_1,
+                    const char *pitch_seq_2,
+                    const char *ioi_seq_1,
+                    const char *ioi_seq_2,
+                    double min_score, size_t *num_of_rows);
+
+/* can a pitch sequence and its IOI sequence be aligned by
+ * calc_sim()?
+ */
+int is_alignable(const char *pitch_seq, const char *ioi_seq);
+
+/* release the sequences and titles held by a collection block */
+void clear_coll_block(struct coll_block *block);
+
+/* destroy a collection block */
+void destroy_coll_block(struct coll_block *block);
+
+/* read the next block of at least block_size bytes of a
+ * collection sequence file and parse it. Use a block_size of
+ * (size_t)-1 to load the whole collection.
+ * return: number of documents read, 0 at the end of the
+ *         collection or on failure (*failed is then set)
+ */
+size_t read_coll_block(struct oakpark_reader *coll_reader,
+                       struct coll_block *block,
+                       size_t block_size, int *failed);
+
+/* align every document of a collection block against a block
+ * of queries
+ */
+int align_coll_block(const struct coll_block *block,
+                     struct query *queries, size_t num_of_queries);
+
+/* build the positional index of the pitch k-mers of a collection
+ * block, with the parameters given by FNM_SEED_LEN,
+ * FNM_SEED_X_DROP and FNM_SEED_MIN_SCORE. The block must outlive
+ * the index and not change.
+ * return: NULL on failure
+ */
+struct seed_idx *create_seed_idx(const struct coll_block *block);
+
+/* destroy a positional index */
+void destroy_seed_idx(struct seed_idx *idx);
+
+/* answer a block of queries like align_coll_block() against the
+ * block of a positional index, aligning only the documents with a
+ * k-mer of the query that extends without gaps into a match of
+ * idx->min_score. The scores of the documents aligned are those
+ * of align_coll_block(); the others aren't answers.
+ */
+int seed_coll_block(const struct seed_idx *idx,
+                    struct query *queries, size_t num_of_queries);
+
+/* a document similar to another, found by pair_coll_block() */
+struct neighbour {
+    size_t doc;
+    double score;
+};
+
+/* the similarity graph of a collection block: the documents most
+ * similar to document d are the num_of_neighbours[d] first of
+ * neighbours + d * max_num_of_neighbours, best first, and those
+ * with equal scores in document order
+ */
+struct coll_pairs {
+    size_t max_num_of_neighbours;
+    size_t *num_of_neighbours;
+    struct neighbour *neighbours;
+    /* pairs aligned, those of them stopped early, and the cells
+     * computed
+     */
+    unsigned long num_of_aligned;
+    unsigned long num_of_cut;
+    double num_of_cells;
+};
+
+/* find, for every document of a collection block, the
+ * pairs->max_num_of_neighbours other documents most similar to
+ * it, scored as by align_coll_block(). Every pair of documents is
+ * aligned once, by one of num_of_threads threads, and stopped as
+ * soon as it can reach the neighbours of neither document. With
+ * seeds, a positional index of the block, only the pairs in which
+ * a document seeds the other as a query does in seed_coll_block()
+ * are aligned.
+ * return: 1 on success
+ *         0 on failure
+ */
+int pair_coll_block(const struct coll_block *block,
+                    const struct seed_idx *seeds,
+                    unsigned long num_of_threads,
+                    struct coll_pairs *pairs);
+
+/* release the graph found by pair_coll_block() */
+void free_coll_pairs(struct coll_pairs *pairs);
+
+/* query a collection sequence file with a block of queries,
+ * streaming the collection through block in blocks of
+ * coll_block_size bytes. Fails, leaving incomplete answers, if
+ * a collection line can't be parsed or stored.
+ */
+int query_coll(struct oakpark_reader *coll_reader,
+               struct coll_block *block, size_t coll_block_size,
+               struct query *queries, size_t num_of_queries);
+
+#endif
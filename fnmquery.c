@@ -0,0 +1,360 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * Batch query front end
+ *
+ * Copyright 2010 by RMIT MIRT Project.
+ * Copyright 2010 by Iman S. H. Suyoto.
+ *
+ * Converts query MIDI files in memory and answers all of them
+ * against a single loaded ngr5 index or pioi collection, instead
+ * of running fnmmp and a searcher per query.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "fanimae.h"
+#include "fnmpioi.h"
+#include "fnmngr5.h"
+#include "fnmmidi.h"
+#include "fnmingest.h"
+
+#define DEFAULT_NUM_OF_ANSWERS 10
+#define DEFAULT_QUERY_BLOCK_SIZE 64
+
+/* the loaded searcher and the queries waiting to be answered */
+struct batch {
+    struct ngr5_idx *idx;
+    struct ngr5_scratch *scratch;
+    /* ngr5_query(), or ngr5_lsh_query() or ngr5_exact_query()
+     * to search the sketch index or the FM-index of idx
+     */
+    int (*search)(const struct ngr5_idx *, struct ngr5_scratch *,
+                  const char *, struct answers *);
+    struct coll_block coll;
+    /* positional index of coll for seed, NULL for pioi */
+    struct seed_idx *seeds;
+    struct query *queries;
+    size_t num_of_queries;
+    size_t max_num_of_queries;
+};
+
+/* print a query title and its answers, best first */
+static void output_answers(const struct query *query)
+{
+    const struct answer *curr = query->answers->items +
+                                query->answers->num_of_answers;
+
+    printf("%s", query->title);
+    while (curr != query->answers->items) {
+        printf(" %s", (--curr)->title);
+    }
+    printf("\n");
+}
+
+/*
+ * function: answer_block
+ * param: batch: batch
+ * return: 1 on success
+ *         0 on failure
+ * purpose: answers the queries waiting in the batch, prints the
+ *          answers in query order, and releases the queries
+ */
+static int answer_block(struct batch *batch)
+{
+    size_t q;
+    int result = 1;
+
+    if (batch->idx) {
+        for (q = 0; q < batch->num_of_queries; ++q) {
+            struct query *query = batch->queries + q;
+
+            if (!batch->search(batch->idx, batch->scratch,
+                               query->pitch_seq, query->answers)) {
+                fprintf(stderr, "Erratic query: %s\n",
+                        query->title);
+            }
+        }
+    } else {
+        /* a single pass over the collection for the block */
+        result = batch->seeds ?
+                 seed_coll_block(batch->seeds, batch->queries,
+                                 batch->num_of_queries) :
+                 align_coll_block(&batch->coll, batch->queries,
+                                  batch->num_of_queries);
+    }
+    for (q = 0; q < batch->num_of_queries; ++q) {
+        if (result) {
+            output_answers(batch->queries + q);
+        }
+        free(batch->queries[q].line);
+        batch->queries[q].line = NULL;
+    }
+    batch->num_of_queries = 0;
+    return result;
+}
+
+/*
+ * function: add_queries
+ * param: batch: batch
+ *        lines: sequence lines of a query file
+ * return: 1 on success
+ *         0 on failure
+ * purpose: queues the tracks of a query file, answering the
+ *          queued queries whenever a block is full
+ */
+static int add_queries(struct batch *batch,
+                       const struct seq_buf *lines)
+{
+    const char *line = lines->s;
+    const char *end = lines->s + lines->len;
+
+    while (line < end) {
+        const char *nl = memchr(line, '\n', end - line);
+        size_t line_len = nl ? (size_t)(nl - line) :
+                               (size_t)(end - line);
+        struct query *query = batch->queries +
+                              batch->num_of_queries;
+
+        if (!(query->line = malloc(line_len + 1))) {
+            fprintf(stderr, "Can't allocate memory for query\n");
+            return 0;
+        }
+        memcpy(query->line, line, line_len);
+        query->line[line_len] = '\0';
+        line += line_len + 1;
+        if (!parse_seq(query->line, &query->title,
+                       &query->pitch_seq, &query->ioi_seq)) {
+            fprintf(stderr, "Invalid query: %s\n", query->line);
+            free(query->line);
+            query->line = NULL;
+            continue;
+        }
+        clear_answers(query->answers);
+        if (++batch->num_of_queries == batch->max_num_of_queries &&
+            !answer_block(batch)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * function: read_midi_file
+ * param: fn: MIDI filename
+ *        out: buffer to receive the sequence lines
+ * return: 1 on success
+ *         0 if the file can't be read
+ * purpose: converts a MIDI file the way fnmmp would, titling it
+ *          with its short filename
+ */
+static int read_midi_file(const char *fn, struct seq_buf *out)
+{
+    FILE *fp = fopen(fn, "rb");
+    const char *name = strrchr(fn, '/');
+    struct seq_buf data = { NULL, 0, 0 };
+    char chunk[BUFSIZ];
+    size_t n;
+    int result = 1;
+
+    if (!fp) {
+        fprintf(stderr, "Can't open ");
+        perror(fn);
+        return 0;
+    }
+    while (result && (n = fread(chunk, 1, sizeof chunk, fp)) > 0) {
+        result = seq_buf_append(&data, chunk, n);
+    }
+    if (ferror(fp)) {
+        fprintf(stderr, "Can't read %s\n", fn);
+        result = 0;
+    }
+    fclose(fp);
+    out->len = 0;
+    if (result && data.len > 0) {
+        midi_to_seq((const unsigned char *)data.s, data.len,
+                    name ? name + 1 : fn, out);
+    }
+    seq_buf_free(&data);
+    return result;
+}
+
+/*
+ * function: query_path
+ * param: batch: batch
+ *        path: a query MIDI file, or a directory of them
+ * return: 1 on success
+ *         0 on failure
+ */
+static int query_path(struct batch *batch, const char *path)
+{
+    struct stat st;
+    struct seq_buf lines = { NULL, 0, 0 };
+    int result = 1;
+
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        /* convert the directory on the ingest worker pool while
+         * answering the files already converted
+         */
+        struct ingest *ingest = ingest_start
+                                (path, ingest_num_of_threads(),
+                                 NULL);
+
+        if (!ingest) {
+            fprintf(stderr, "Can't read %s\n", path);
+            return 0;
+        }
+        while (result && ingest_next(ingest, &lines)) {
+            result = add_queries(batch, &lines);
+        }
+        ingest_finish(ingest);
+    } else if (read_midi_file(path, &lines)) {
+        result = add_queries(batch, &lines);
+    }
+    seq_buf_free(&lines);
+    return result;
+}
+
+/*
+ * function: load
+ * return: 1 on success
+ *         0 on failure
+ * purpose: loads the searcher for algo
+ */
+static int load(struct batch *batch, const char *algo,
+                const char *coll_fn)
+{
+    if (strcmp(algo, "ngr5") == 0 || strcmp(algo, "lsh") == 0 ||
+        strcmp(algo, "exact") == 0) {
+        batch->search = strcmp(algo, "lsh") == 0 ? ngr5_lsh_query :
+                        strcmp(algo, "exact") == 0 ?
+                        ngr5_exact_query : ngr5_query;
+        fprintf(stderr, "Loading index %s...\n", coll_fn);
+        if (!(batch->idx = ngr5_open(coll_fn))) {
+            return 0;
+        }
+        if (batch->search == ngr5_lsh_query && !batch->idx->sketch) {
+            fprintf(stderr, "No sketch index %s" LSH_SUFFIX "\n",
+                    coll_fn);
+            return 0;
+        }
+        if (batch->search == ngr5_exact_query && !batch->idx->fm) {
+            fprintf(stderr, "No FM-index %s" FM_SUFFIX "\n",
+                    coll_fn);
+            return 0;
+        }
+        return (batch->scratch =
+                ngr5_create_scratch(batch->idx)) != NULL;
+    }
+    if (strcmp(algo, "pioi") == 0 || strcmp(algo, "seed") == 0) {
+        FILE *coll_fp = fopen(coll_fn, "r");
+        struct oakpark_reader *coll_reader = NULL;
+        int failed = 0;
+
+        fprintf(stderr, "Loading collection %s...\n", coll_fn);
+        if (!coll_fp) {
+            fprintf(stderr, "Can't open ");
+            perror(coll_fn);
+            return 0;
+        }
+        if (!(coll_reader = oakpark_open_reader(coll_fp))) {
+            fclose(coll_fp);
+            return 0;
+        }
+        read_coll_block(coll_reader, &batch->coll, (size_t)-1,
+                        &failed);
+        oakpark_close_reader(coll_reader);
+        fclose(coll_fp);
+        if (failed) {
+            return 0;
+        }
+        return strcmp(algo, "pioi") == 0 ||
+               (batch->seeds = create_seed_idx(&batch->coll)) != NULL;
+    }
+    fprintf(stderr, "Invalid algo: %s\n", algo);
+    return 0;
+}
+
+/* program entry point */
+int main(int argc, char **argv)
+{
+    int result = EXIT_FAILURE;
+    unsigned long n = oakpark_get_env_ulong("FNM_NUM_OF_ANSWERS",
+                                            DEFAULT_NUM_OF_ANSWERS);
+    unsigned short num_of_answers = (n > USHRT_MAX) ? USHRT_MAX : n;
+    struct batch batch;
+    size_t q;
+    int a;
+
+    memset(&batch, 0, sizeof batch);
+    init_wavefront();
+    if (argc < 4) {
+        fprintf(stderr,
+                "Fanimae " FANIMAE_VERSION "\n"
+                "Batch query\n\n"
+                "Usage:\n"
+                "%s {ngr5|lsh|exact|pioi|seed} idx-or-coll-seq "
+                "query...\n\n"
+                "idx-or-coll-seq is an index built by fnmib for "
+                "ngr5, lsh or\nexact, or a "
+                "collection sequence file for pioi or seed. Each "
+                "query is "
+                "a MIDI\n"
+                "file or a directory of MIDI files.\n\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    batch.max_num_of_queries =
+    oakpark_get_env_ulong("FNM_QUERY_BLOCK_SIZE",
+                          DEFAULT_QUERY_BLOCK_SIZE);
+    if (!(batch.queries = calloc(batch.max_num_of_queries,
+                                 sizeof *batch.queries))) {
+        fprintf(stderr, "Can't allocate memory for queries\n");
+        goto bail_out;
+    }
+    for (q = 0; q < batch.max_num_of_queries; ++q) {
+        if (!(batch.queries[q].answers =
+              create_answers(num_of_answers))) {
+            fprintf(stderr, "Can't allocate memory for answers\n");
+            goto bail_out;
+        }
+    }
+    if (!load(&batch, argv[1], argv[2])) {
+        goto bail_out;
+    }
+
+    for (a = 3; a < argc; ++a) {
+        if (!query_path(&batch, argv[a])) {
+            goto bail_out;
+        }
+    }
+    if (batch.num_of_queries > 0 && !answer_block(&batch)) {
+        goto bail_out;
+    }
+    if (fflush(stdout) == 0) {
+        result = EXIT_SUCCESS;
+    }
+
+bail_out:
+    if (batch.queries) {
+        for (q = 0; q < batch.max_num_of_queries; ++q) {
+            free(batch.queries[q].line);
+            destroy_answers(batch.queries[q].answers);
+        }
+        free(batch.queries);
+    }
+    ngr5_destroy_scratch(batch.scratch);
+    ngr5_close(batch.idx);
+    destroy_seed_idx(batch.seeds);
+    destroy_coll_block(&batch.coll);
+    return result;
+}
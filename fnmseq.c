@@ -0,0 +1,342 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * Sequence line parsing
+ *
+ * Copyright 2010 by RMIT MIRT Project.
+ * Copyright 2010 by Iman S. H. Suyoto.
+ *
+ * Lines are split with memchr(), which the C library scans a
+ * machine word or vector at a time, and symbols are validated
+ * and translated by straight-line loops the compiler vectorises,
+ * so that parsing is bound by memory bandwidth rather than by
+ * per-character branches.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "fanimae.h"
+#include "oakpark.h"
+#include "fnmseq.h"
+
+#define MASK_32 0xffffffffUL
+
+/*
+ * function: find_sep
+ * return: NULL if there is no separator in [s, end)
+ *         pointer to the first separator otherwise
+ */
+static char *find_sep(char *s, const char *end)
+{
+    while ((size_t)(end - s) >= SEQ_SEP_LEN) {
+        /* a separator can only start where there is room for
+         * all of it
+         */
+        char *p = memchr(s, SEQ_SEP[0],
+                         (end - s) - (SEQ_SEP_LEN - 1));
+
+        if (!p) {
+            return NULL;
+        }
+        if (memcmp(p, SEQ_SEP, SEQ_SEP_LEN) == 0) {
+            return p;
+        }
+        s = p + 1;
+    }
+    return NULL;
+}
+
+int split_seq_line(char *line, size_t len, struct seq_line *parts)
+{
+    char *end = line + len;
+    char *sep = NULL;
+
+    if (len < SEQ_LINE_PREFIX_LEN ||
+        memcmp(line, SEQ_LINE_PREFIX, SEQ_LINE_PREFIX_LEN) != 0) {
+        return 0;
+    }
+    memset(parts, 0, sizeof *parts);
+    parts->title = line + SEQ_LINE_PREFIX_LEN;
+    if (!(sep = find_sep(parts->title, end))) {
+        parts->title_len = end - parts->title;
+        return 1;
+    }
+    *sep = '\0';
+    parts->title_len = sep - parts->title;
+
+    parts->pitch_seq = sep + SEQ_SEP_LEN;
+    if (!(sep = find_sep(parts->pitch_seq, end))) {
+        parts->pitch_seq_len = end - parts->pitch_seq;
+        return 1;
+    }
+    *sep = '\0';
+    parts->pitch_seq_len = sep - parts->pitch_seq;
+
+    parts->ioi_seq = sep + SEQ_SEP_LEN;
+    parts->ioi_seq_len = end - parts->ioi_seq;
+    return 1;
+}
+
+int encode_pitch_seq(const char *seq, size_t len,
+                     unsigned char *codes)
+{
+    static const char symbols[] = P_DM12_ALPHABET;
+    const unsigned char nos = sizeof symbols - 1;
+    const unsigned char first = symbols[0];
+    unsigned char is_invalid = 0;
+    size_t i;
+
+    /* the alphabet is a run of consecutive letters, so a symbol
+     * code is a subtraction and validation a single comparison
+     */
+    assert(symbols[nos - 1] - first == nos - 1);
+    for (i = 0; i < len; ++i) {
+        unsigned char code = (unsigned char)seq[i] - first;
+
+        codes[i] = code;
+        is_invalid |= (code >= nos);
+    }
+    return !is_invalid;
+}
+
+/*
+ * function: reserve
+ * param: buf: buffer of *size elements, may be NULL
+ *        size: pointer to the number of elements of the buffer
+ *        len: number of elements needed
+ *        elem_size: size of an element
+ * return: NULL on failure
+ *         pointer to the buffer, grown if needed, on success
+ */
+static void *reserve(void *buf, size_t *size, size_t len,
+                     size_t elem_size)
+{
+    size_t n = *size ? *size : 256;
+
+    if (buf && len <= *size) {
+        return buf;
+    }
+    while (n < len) {
+        n *= 2;
+    }
+    if (!(buf = realloc(buf, n * elem_size))) {
+        return NULL;
+    }
+    *size = n;
+    return buf;
+}
+
+unsigned long *encode_grams(struct seq_codes *codes,
+                            const char *seq, size_t len,
+                            size_t *num_of_grams)
+{
+    const unsigned long nos = P_DM12_ALPHABET_SIZE;
+    unsigned char *c = NULL;
+    unsigned long *grams = NULL;
+    unsigned long code = 0;
+    /* weight of the first symbol of an n-gram */
+    unsigned long top = 1;
+    size_t n;
+    size_t g;
+
+    *num_of_grams = len < NUM_OF_GRAMS ? 0 : len - NUM_OF_GRAMS + 1;
+    if (!(c = reserve(codes->codes, &codes->size, len,
+                      sizeof *c))) {
+        return NULL;
+    }
+    codes->codes = c;
+    if (!(grams = reserve(codes->grams, &codes->max_num_of_grams,
+                          *num_of_grams, sizeof *grams))) {
+        return NULL;
+    }
+    codes->grams = grams;
+    if (!encode_pitch_seq(seq, len, c)) {
+        return NULL;
+    }
+    if (*num_of_grams == 0) {
+        return grams;
+    }
+
+    for (n = 0; n < NUM_OF_GRAMS; ++n) {
+        code = nos * code + c[n];
+        if (n > 0) {
+            top *= nos;
+        }
+    }
+    grams[0] = code;
+    /* roll the window: drop the first symbol and append the
+     * next one
+     */
+    for (g = 1; g < *num_of_grams; ++g) {
+        code = nos * (code - top * c[g - 1]) +
+               c[g + NUM_OF_GRAMS - 1];
+        grams[g] = code;
+    }
+    return grams;
+}
+
+void free_seq_codes(struct seq_codes *codes)
+{
+    free(codes->codes);
+    free(codes->grams);
+    codes->codes = NULL;
+    codes->size = 0;
+    codes->grams = NULL;
+    codes->max_num_of_grams = 0;
+}
+
+/* a sequence put in a seq_dedup table */
+struct seq_dedup_entry {
+    /* the pitch sequence, '\0', and the IOI sequence */
+    const char *key;
+    size_t key_len;
+    unsigned long hash;
+    unsigned long num;
+};
+
+struct seq_dedup {
+    struct oakpark_arena *keys;
+    struct seq_dedup_entry *slots;
+    size_t num_of_slots;
+    size_t num_of_entries;
+};
+
+/* 32-bit FNV-1a hash of len bytes, continuing from h */
+static unsigned long fnv1a(unsigned long h, const char *s, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        h = ((h ^ (unsigned char)s[i]) * 16777619UL) & MASK_32;
+    }
+    return h;
+}
+
+struct seq_dedup *create_seq_dedup(void)
+{
+    struct seq_dedup *dedup = calloc(1, sizeof *dedup);
+
+    if (!dedup) {
+        return NULL;
+    }
+    dedup->num_of_slots = 64;
+    if (!(dedup->keys = oakpark_create_arena(0)) ||
+        !(dedup->slots = calloc(dedup->num_of_slots,
+                                sizeof *dedup->slots))) {
+        destroy_seq_dedup(dedup);
+        return NULL;
+    }
+    return dedup;
+}
+
+/* is the key of an entry the sequences given? */
+static int is_same_seq(const struct seq_dedup_entry *e,
+                       unsigned long hash,
+                       const char *pitch_seq, size_t pitch_seq_len,
+                       const char *ioi_seq, size_t ioi_seq_len)
+{
+    return e->hash == hash &&
+           e->key_len == pitch_seq_len + 1 + ioi_seq_len &&
+           memcmp(e->key, pitch_seq, pitch_seq_len) == 0 &&
+           e->key[pitch_seq_len] == '\0' &&
+           memcmp(e->key + pitch_seq_len + 1, ioi_seq,
+                  ioi_seq_len) == 0;
+}
+
+/* double the number of slots of a table */
+static int grow_seq_dedup(struct seq_dedup *dedup)
+{
+    size_t n = dedup->num_of_slots * 2;
+    struct seq_dedup_entry *slots = calloc(n, sizeof *slots);
+    size_t s;
+
+    if (!slots) {
+        return 0;
+    }
+    for (s = 0; s < dedup->num_of_slots; ++s) {
+        const struct seq_dedup_entry *e = dedup->slots + s;
+        size_t h;
+
+        if (!e->key) {
+            continue;
+        }
+        h = e->hash & (n - 1);
+        while (slots[h].key) {
+            h = (h + 1) & (n - 1);
+        }
+        slots[h] = *e;
+    }
+    free(dedup->slots);
+    dedup->slots = slots;
+    dedup->num_of_slots = n;
+    return 1;
+}
+
+int dedup_seq(struct seq_dedup *dedup,
+              const char *pitch_seq, size_t pitch_seq_len,
+              const char *ioi_seq, size_t ioi_seq_len,
+              unsigned long num, unsigned long *first)
+{
+    unsigned long hash = fnv1a(2166136261UL, pitch_seq,
+                               pitch_seq_len);
+    struct seq_dedup_entry *e = NULL;
+    char *key = NULL;
+    size_t h;
+
+    if (!ioi_seq) {
+        ioi_seq = "";
+        ioi_seq_len = 0;
+    }
+    hash = fnv1a(hash, "", 1);
+    hash = fnv1a(hash, ioi_seq, ioi_seq_len);
+    for (h = hash & (dedup->num_of_slots - 1); dedup->slots[h].key;
+         h = (h + 1) & (dedup->num_of_slots - 1)) {
+        if (is_same_seq(dedup->slots + h, hash,
+                        pitch_seq, pitch_seq_len,
+                        ioi_seq, ioi_seq_len)) {
+            *first = dedup->slots[h].num;
+            return 1;
+        }
+    }
+
+    /* a new one: the table is kept at most half full */
+    if (!(key = oakpark_arena_alloc(dedup->keys,
+                                    pitch_seq_len + 1 +
+                                    ioi_seq_len))) {
+        return 0;
+    }
+    memcpy(key, pitch_seq, pitch_seq_len);
+    key[pitch_seq_len] = '\0';
+    memcpy(key + pitch_seq_len + 1, ioi_seq, ioi_seq_len);
+    e = dedup->slots + h;
+    e->key = key;
+    e->key_len = pitch_seq_len + 1 + ioi_seq_len;
+    e->hash = hash;
+    e->num = num;
+    *first = num;
+    if (++dedup->num_of_entries * 2 > dedup->num_of_slots &&
+        !grow_seq_dedup(dedup)) {
+        return 0;
+    }
+    return 1;
+}
+
+void clear_seq_dedup(struct seq_dedup *dedup)
+{
+    memset(dedup->slots, 0,
+           dedup->num_of_slots * sizeof *dedup->slots);
+    dedup->num_of_entries = 0;
+    oakpark_reset_arena(dedup->keys);
+}
+
+void destroy_seq_dedup(struct seq_dedup *dedup)
+{
+    if (dedup) {
+        oakpark_destroy_arena(dedup->keys);
+        free(dedup->slots);
+        free(dedup);
+    }
+}
@@ -0,0 +1,136 @@
+/*
+ * $Id$
+ *
+ * Fanimae MIREX 2010 Edition
+ * Sequence line parsing
+ *
+ * Copyright 2010 by RMIT MIRT Project.
+ * Copyright 2010 by Iman S. H. Suyoto.
+ */
+
+#ifndef H__FNMSEQ_
+#define H__FNMSEQ_
+
+#include <stddef.h>
+
+#define SEQ_LINE_PREFIX "pi:"
+#define SEQ_LINE_PREFIX_LEN (sizeof SEQ_LINE_PREFIX - 1)
+#define SEQ_SEP "***"
+#define SEQ_SEP_LEN (sizeof SEQ_SEP - 1)
+
+/* the parts of a "pi:title***pitch***ioi" sequence line */
+struct seq_line {
+    char *title;
+    size_t title_len;
+    /* NULL if the line has no separator after the title */
+    char *pitch_seq;
+    size_t pitch_seq_len;
+    /* NULL if the line has no separator after the pitch
+     * sequence
+     */
+    char *ioi_seq;
+    size_t ioi_seq_len;
+};
+
+/* reusable buffers of symbol and n-gram codes */
+struct seq_codes {
+    unsigned char *codes;
+    size_t size;
+    unsigned long *grams;
+    size_t max_num_of_grams;
+};
+
+/*
+ * function: split_seq_line
+ * param: line: NUL-terminated sequence line without its ending
+ *              '\n'. The parts found are NUL-terminated in place.
+ *        len: length of line
+ *        parts: pointer to the object to store the parts
+ * return: 1 if line is a pitch line
+ *         0 otherwise
+ * purpose: splits a sequence line at the first two separators in
+ *          a single pass. Anything after the second separator,
+ *          including further separators, is the IOI sequence.
+ */
+int split_seq_line(char *line, size_t len, struct seq_line *parts);
+
+/*
+ * function: encode_pitch_seq
+ * param: seq: pitch sequence
+ *        len: number of symbols to encode
+ *        codes: array of at least len elements to store the
+ *               positions of the symbols in P_DM12_ALPHABET
+ * return: 1 if every symbol is in the alphabet
+ *         0 otherwise (codes then holds garbage)
+ */
+int encode_pitch_seq(const char *seq, size_t len,
+                     unsigned char *codes);
+
+/*
+ * function: encode_grams
+ * param: codes: buffers
+ *        seq: pitch sequence
+ *        len: number of symbols of seq to encode
+ *        num_of_grams: pointer to the object to store the number
+ *                      of n-grams
+ * return: NULL on failure, or if a symbol isn't in the alphabet
+ *         pointer to the codes of the n-grams of the first len
+ *         symbols of seq on success, in sequence order. These are
+ *         the entry numbers of the n-grams in an index, and are
+ *         valid until the next call. The symbol codes are left in
+ *         codes->codes, even if len < NUM_OF_GRAMS.
+ */
+unsigned long *encode_grams(struct seq_codes *codes,
+                            const char *seq, size_t len,
+                            size_t *num_of_grams);
+
+/*
+ * function: free_seq_codes
+ * param: codes: buffers
+ * purpose: releases the memory held by the buffers
+ */
+void free_seq_codes(struct seq_codes *codes);
+
+/* content-addressed table of sequences: identical sequences get
+ * the number of the first of them
+ */
+struct seq_dedup;
+
+/*
+ * function: create_seq_dedup
+ * return: NULL on failure
+ *         pointer to an empty table on success
+ */
+struct seq_dedup *create_seq_dedup(void);
+
+/*
+ * function: dedup_seq
+ * param: dedup: table
+ *        pitch_seq: pitch sequence of pitch_seq_len symbols
+ *        ioi_seq: IOI sequence of ioi_seq_len symbols, or NULL
+ *                 to look the pitch sequence up alone
+ *        num: number of the sequences
+ *        first: pointer to the object to store num if the
+ *               sequences are new, or the number of the first
+ *               identical ones otherwise
+ * return: 1 on success
+ *         0 if out of memory
+ */
+int dedup_seq(struct seq_dedup *dedup,
+              const char *pitch_seq, size_t pitch_seq_len,
+              const char *ioi_seq, size_t ioi_seq_len,
+              unsigned long num, unsigned long *first);
+
+/*
+ * function: clear_seq_dedup
+ * purpose: empties a table, keeping its memory
+ */
+void clear_seq_dedup(struct seq_dedup *dedup);
+
+/*
+ * function: destroy_seq_dedup
+ * param: dedup: table (can be NULL)
+ */
+void destroy_seq_dedup(struct seq_dedup *dedup);
+
+#endif
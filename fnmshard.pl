@@ -0,0 +1,78 @@
+#!/usr/bin/perl
+
+# $Id$
+#
+# Fanimae MIREX 2010 Edition
+# Collection sharding
+#
+# Copyright 2010 by RMIT MIRT Project.
+# Copyright 2010 by Iman S. H. Suyoto.
+#
+# Splits a collection sequence file into shards of about the
+# same number of symbols, and builds an ngr5 index of every
+# shard, for a fanimaed per shard behind a coordinating
+# fanimaed -c.
+#
+
+use strict;
+use File::Spec;
+
+my $CURR_DIR = File::Spec->curdir();
+my $FNMIB_PATH = File::Spec->catfile($CURR_DIR, 'fnmib');
+my $SEQ_SUFFIX = '.seq';
+
+my $ARGC = @ARGV;
+if ($ARGC < 3 || $ARGV[0] !~ /^[1-9][0-9]*$/) {
+    show_usage();
+    exit(1);
+}
+
+my $num_of_shards = $ARGV[0];
+my $coll_fn = $ARGV[1];
+my $shard_prefix = $ARGV[2];
+my @shard_fhs = ();
+my @shard_sizes = ();
+
+for my $s (0 .. $num_of_shards - 1) {
+    my $seq_fn = "$shard_prefix.$s$SEQ_SUFFIX";
+
+    open $shard_fhs[$s], ">$seq_fn" or die "Can't create $seq_fn\n";
+    $shard_sizes[$s] = 0;
+}
+
+# alignment and index sizes grow with the number of symbols, so
+# every track goes to the smallest shard so far
+open CFH, "<$coll_fn" or die "Can't open $coll_fn\n";
+while (my $line = <CFH>) {
+    my $smallest = 0;
+
+    for my $s (1 .. $num_of_shards - 1) {
+        $smallest = $s if $shard_sizes[$s] < $shard_sizes[$smallest];
+    }
+    print { $shard_fhs[$smallest] } $line
+    or die "Can't write $shard_prefix.$smallest$SEQ_SUFFIX\n";
+    $shard_sizes[$smallest] += length($line);
+}
+close CFH;
+
+for my $s (0 .. $num_of_shards - 1) {
+    close $shard_fhs[$s]
+    or die "Can't write $shard_prefix.$s$SEQ_SUFFIX\n";
+}
+
+if (!-x $FNMIB_PATH) {
+    print STDERR "$FNMIB_PATH not found, not building indexes\n";
+    exit(0);
+}
+for my $s (0 .. $num_of_shards - 1) {
+    system($FNMIB_PATH, "$shard_prefix.$s",
+           "$shard_prefix.$s$SEQ_SUFFIX") == 0
+    or die "Can't build index $shard_prefix.$s\n";
+}
+
+sub show_usage {
+    print STDERR "Usage:\n" .
+                 "fnmshard.pl num-of-shards coll-seq shard-prefix\n\n" .
+                 "Writes shard-prefix.N.seq and, with fnmib, the " .
+                 "index\nshard-prefix.N for N from 0\n\n";
+}
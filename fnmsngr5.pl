@@ -30,20 +30,56 @@ my $use_qid = ($ARGV[1] eq 'q');
 my $ilp_fn = "$idx_fn.fipp";
 my $il_fn = "$idx_fn.filp";
 my $dl_fn = "$idx_fn.fdl";
+my $dd_fn = "$idx_fn.fdd";
+my $dt_fn = "$idx_fn.fdt";
 sysopen ILP_FH, $ilp_fn, (O_RDONLY | O_BINARY) or
 die "Can't open $ilp_fn\n";
 sysopen IL_FH, $il_fn, (O_RDONLY | O_BINARY) or
 die "Can't open $il_fn\n";
-open DL_FH, "<$dl_fn" or
-die "Can't open $dl_fn\n";
-my @titles = <DL_FH>;
-chomp(@titles);
-close DL_FH;
+# with the document titles, only the titles printed are read.
+# Those not taking as many bytes as the lookup are of an earlier
+# build.
+my @titles = ();
+my $use_dt = 0;
+if (sysopen DT_FH, $dt_fn, (O_RDONLY | O_BINARY)) {
+    my $hdr = "";
+    my $last = "";
+    read DT_FH, $hdr, 12;
+    my ($magic, $num_of_docs, $first) = unpack "a4 V V", $hdr;
+    my $size = -s $dt_fn;
+    my $dl_size = -s $dl_fn;
+    if (defined $first && $magic eq 'FDTI' &&
+        $first == 8 + 4 * ($num_of_docs + 1) && defined $dl_size &&
+        ($size - $first == $dl_size ||
+         $size - $first == $dl_size + 1)) {
+        seek DT_FH, $first - 4, SEEK_SET;
+        read DT_FH, $last, 4;
+        $use_dt = (unpack "V", $last) == $size;
+    }
+    close DT_FH if !$use_dt;
+}
+if (!$use_dt) {
+    open DL_FH, "<$dl_fn" or
+    die "Can't open $dl_fn\n";
+    @titles = <DL_FH>;
+    chomp(@titles);
+    close DL_FH;
+}
+# titles of the tracks identical to each document, if any
+my %dups = ();
+if (open DD_FH, "<$dd_fn") {
+    while (my $line = <DD_FH>) {
+        chomp($line);
+        my ($doc_num, $title) = split / /, $line, 2;
+        push @{$dups{$doc_num}}, $title;
+    }
+    close DD_FH;
+}
 my $symbols = "abcdefghijklmnopqrstuvwxy";
+my $NUM_OF_SYMBOLS = length($symbols);
 QUERY_PROMPT:
 while (my $query = prompt()) {  # capture queries
     my %H = ();
-    my @ngrams = ();
     my $qid;
     my $ioi;
 
@@ -59,33 +95,24 @@ while (my $query = prompt()) {  # capture queries
         print "$qid";
     }
 
-    # get n-grams
-    for (my $ql = 0; $ql <= length($query) - $NUM_OF_GRAMS; ++$ql) {
-        my $t = substr($query, $ql, $NUM_OF_GRAMS);
-        push @ngrams, $t;
+    # get n-gram codes
+    my ($erratic_gram, @codes) = encode_grams($query);
+    if (defined $erratic_gram) {
+        print "Erratic query at position $erratic_gram\n";
+        next QUERY_PROMPT;
     }
     # remove duplicates
-    @ngrams = sort @ngrams;
-    $num_of_grams = @ngrams;
+    @codes = sort { $a <=> $b } @codes;
+    $num_of_grams = @codes;
     for (my $n = 1; $n < $num_of_grams; ++$n) {
-        if ($ngrams[$n] eq $ngrams[$n - 1]) {
-            splice @ngrams, $n--, 1;
+        if ($codes[$n] == $codes[$n - 1]) {
+            splice @codes, $n--, 1;
             --$num_of_grams;
         }
     }
     # query
-    for (my $ql = 0; $ql < @ngrams; ++$ql) {
-        my $t = $ngrams[$ql];
-        my $tune_num = 0;
-        # check query validity
-        for (my $n = 0; $n < $NUM_OF_GRAMS; ++$n) {
-            my $pos = index($symbols, substr($t, $n, 1));
-            if ($pos < 0) {
-                print "Erratic query at position $t\n";
-                next QUERY_PROMPT;
-            }
-            $tune_num = 25 * $tune_num + $pos;
-        }
+    for (my $ql = 0; $ql < @codes; ++$ql) {
+        my $tune_num = $codes[$ql];
         # fetch index entries
         seek ILP_FH, $tune_num * $POS_SIZE, SEEK_SET;
         my $pos_bytes = "";
@@ -104,20 +131,26 @@ while (my $query = prompt()) {  # capture queries
         }
     }
     # rank answers
-    my @answers = sort { $H{$b} <=> $H{$a} } keys %H;
+    my @ranked = sort { $H{$b} <=> $H{$a} } keys %H;
+    my @answers = ();
+    for (my $r = 0; $r < @ranked && @answers < $MAX_NUM_OF_ANSWERS;
+         $r++) {
+        push @answers, doc_title($ranked[$r]),
+                       @{$dups{$ranked[$r]} || []};
+    }
     # show only top 30 answers
     my $num_of_answers = (@answers > $MAX_NUM_OF_ANSWERS)?
                          $MAX_NUM_OF_ANSWERS : @answers;
     for (my $r = 0; $r < $num_of_answers; $r++) {
-        print " $titles[$answers[$r]]";
+        print " $answers[$r]";
     }
     print "\n";
-    undef @ngrams;
     undef %H;
     undef @answers;
 }
 close(IL_FH);
 close(ILP_FH);
+close(DT_FH) if $use_dt;
 
 #
 # sub: show_usage
@@ -131,6 +164,73 @@ sub show_usage {
                  "Use \"q\" to include query-ID\n\n";
 }
 
+#
+# sub: doc_title
+# param: $doc_num: document number
+# return: the title of the document
+# purpose: look a title up in the document titles, or in the
+#          document lookup if they aren't used
+#
+sub doc_title {
+    my $doc_num = shift;
+    my $offsets = "";
+    my $title = "";
+
+    if (!$use_dt) {
+        return $titles[$doc_num];
+    }
+    seek DT_FH, 8 + 4 * $doc_num, SEEK_SET;
+    read DT_FH, $offsets, 8;
+    my ($first, $last) = unpack "V2", $offsets;
+    seek DT_FH, $first, SEEK_SET;
+    read DT_FH, $title, $last - $first - 1;
+    return $title;
+}
+
+#
+# sub: encode_grams
+# param: $seq: pitch sequence
+# return: undef followed by the codes of the n-grams of $seq in
+#         sequence order, or, if a symbol isn't in the alphabet,
+#         the first n-gram containing one in sorted order
+# purpose: encode n-grams the way fnmib does, updating the code
+#          of a window from that of the previous one
+#
+sub encode_grams {
+    my ($seq) = @_;
+    my $len = length($seq);
+    my $top = $NUM_OF_SYMBOLS ** ($NUM_OF_GRAMS - 1);
+    my @syms;
+    my @codes = ();
+    my $code = 0;
+
+    if ($len < $NUM_OF_GRAMS) {
+        return (undef);
+    }
+    @syms = map { index($symbols, $_) } split //, $seq;
+    if (grep { $_ < 0 } @syms) {
+        my @erratic_grams = ();
+
+        for (my $g = 0; $g <= $len - $NUM_OF_GRAMS; ++$g) {
+            if (grep { $_ < 0 } @syms[$g .. $g + $NUM_OF_GRAMS - 1]) {
+                push @erratic_grams, substr($seq, $g, $NUM_OF_GRAMS);
+            }
+        }
+        @erratic_grams = sort @erratic_grams;
+        return ($erratic_grams[0]);
+    }
+    for (my $n = 0; $n < $NUM_OF_GRAMS; ++$n) {
+        $code = $NUM_OF_SYMBOLS * $code + $syms[$n];
+    }
+    push @codes, $code;
+    for (my $g = 1; $g <= $len - $NUM_OF_GRAMS; ++$g) {
+        $code = $NUM_OF_SYMBOLS * ($code - $top * $syms[$g - 1]) +
+                $syms[$g + $NUM_OF_GRAMS - 1];
+        push @codes, $code;
+    }
+    return (undef, @codes);
+}
+
 #
 # sub: prompt
 # param: none
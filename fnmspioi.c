@@ -16,418 +16,102 @@
 #include <assert.h>
 
 #include "oakpark.h"
+#include "fnmpioi.h"
 
 #define DEFAULT_NUM_OF_ANSWERS 10
-#define IOI_SYMBOLS "SsRlL"
-#define R 38.0
-#define R2 ((R) * (R))
+/* queries aligned per pass over the collection */
+#define DEFAULT_QUERY_BLOCK_SIZE 1
+/* bytes of collection aligned against a query block at a time */
+#define DEFAULT_COLL_BLOCK_SIZE (256 * 1024UL)
 
-/* answers are organized as min-heap */
-struct answer {
-    double score;
-    char *title;
-};
-
-struct answers {
-    unsigned short max_num_of_answers;
-    unsigned short num_of_answers;
-    struct answer *items;
-};
-
-/* clear a list of answers */
-void clear_answers(struct answers *answers)
-{
-    unsigned short c = 0;
-
-    answers->num_of_answers = 0;
-    do {
-        struct answer *a = answers->items + c;
-
-        free(a->title);
-        a->title = NULL;
-        a->score = 0.0;
-    } while (++c < answers->max_num_of_answers);
-}
-
-/* create a list of answers */
-struct answers *create_answers
-                (unsigned short max_num_of_answers)
-{
-    struct answers *answers = malloc(sizeof *answers);
-    unsigned short c = 0;
-
-    if (!answers) {
-        goto bail_out;
-    }
-    if (!(answers->items =
-          malloc(max_num_of_answers *
-                 sizeof *answers->items))) {
-        free(answers);
-        goto bail_out;
-    }
-
-    answers->max_num_of_answers = max_num_of_answers;
-    answers->num_of_answers = 0;
-    do {
-        answers->items[c].title = NULL;
-    } while (++c < max_num_of_answers);
-    clear_answers(answers);
-bail_out:
-    return answers;
-}
-
-void swap_answers(struct answer *a, struct answer *b)
-{
-    struct answer tmp = *a;
-
-    *a = *b;
-    *b = tmp;
-}
-
-/* insert an answer */
-int insert_answer(struct answers *answers, char *title,
-                  double score)
-{
-    unsigned short n = answers->num_of_answers;
-    unsigned short curr = 0;
-    struct answer *a = answers->items;
-    struct answer *root = a;
-    size_t title_len = strlen(title);
-
-    /* if the heap is already full, replace the answer with
-     * minimum score, i.e. the root, with the new answer, and
-     * top-down min-heapify
-     */
-    if (n == answers->max_num_of_answers) {
-        void *tmp = NULL;
-        
-        if (root->score > score) {
-            return 1;
-        }
-        
-        if (!(tmp = realloc(root->title, title_len + 1))) {
-            return 0;
-        }
-        /* replace root */
-        strcpy(root->title = tmp, title);
-        root->score = score;
-
-        /* top-down min-heapify */
-        while (curr < n) {
-            unsigned short left = curr * 2 + 1;
-            unsigned short right = left + 1;
-            unsigned short min = curr;
-
-            if (left < n && a[left].score < a[min].score) {
-                min = left;
-            }
-            if (right < n && a[right].score < a[min].score) {
-                min = right;
-            }
-            if (min == curr) {
-                return 1;
-            }
-
-            swap_answers(a + min, a + curr);
-            curr = min;
-        }
-    } else {
-        /* the heap isn't full, so put the new answer at the
-         * tail
-         */
-        if (!(a[n].title = malloc(title_len + 1))) {
-            return 0;
-        }
-        strcpy(a[n].title, title);
-        a[n].score = score;
-
-        /* bottom-up min-heapify to put the new answer at the
-         * right place
-         */
-        curr = n;
-        while (curr > 0) {
-            unsigned short parent = curr / 2;
-
-            if (a[parent].score <= score) {
-                break;
-            }
-
-            swap_answers(a + parent, a + curr);
-            curr = parent;
-        };
-        answers->num_of_answers++;
-    }
-    return 1;
-}
-
-/* answer comparison function for qsort() */
-int cmp_answer(const void *a_v, const void *b_v)
-{
-    const struct answer *a = a_v;
-    const struct answer *b = b_v;
-
-    return a->score > b->score ? 1 :
-           a->score < b->score ? -1 : 0;
-}
-
-/* sort answers in ascending score order */
-void sort_answers(struct answers *answers)
-{
-    qsort(answers->items, answers->num_of_answers,
-          sizeof *answers->items, cmp_answer);
-}
-
-/* destroy a list of answers */
-void destroy_answers(struct answers *answers)
-{
-    if (answers) {
-        unsigned short c = 0;
-
-        for (; c < answers->num_of_answers; ++c) {
-            free(answers->items[c].title);
-        }
-        free(answers->items);
-        free(answers);
-    }
-}
-
-/* validate and parse a sequence line */
-int parse_seq(char *seq_line, char **title,
-              char **pitch_seq, char **ioi_seq)
+/* output answers */
+void output_answers(struct answers *answers)
 {
-    const char *seq_line_prefix = "pi:";
-    const char *sep = "***";
-    const size_t seq_line_prefix_len = strlen(seq_line_prefix);
-
-    if (!(strstr(seq_line, seq_line_prefix) == seq_line)) {
-        return 0;
-    }
-    *title = seq_line + seq_line_prefix_len;
-
-    if (!(*pitch_seq =
-          oakpark_tokenize_str(*title, sep))) {
-        return 0;
-    }
+    struct answer *curr = answers->items +
+                          answers->num_of_answers;
 
-    if (!(*ioi_seq = 
-          oakpark_tokenize_str(*pitch_seq, sep))) {
-        return 0;
+    while (curr != answers->items) {
+        printf(" %s", (--curr)->title);
     }
-    return 1;
-}
-
-long lmax(long a, long b)
-{
-    return a > b ? a : b;
+    printf("\n");
 }
 
-static int sym_map(const char a)
-{
-    static const char symbols[] = IOI_SYMBOLS;
-    char *p = strchr(symbols, a);
-
-    if (!p) {
-        return -1;
-    }
+/* a histogram of log2 buckets: bucket b counts the values up to
+ * 2^b
+ */
+#define NUM_OF_BUCKETS 48
 
-    return p - symbols;
-}
+struct histogram {
+    const char *name;
+    unsigned long counts[NUM_OF_BUCKETS];
+};
 
-static int mx(const char a, const char b)
+/* count a value in a histogram */
+void add_to_histogram(struct histogram *h, double value)
 {
-    static const char symbols[] = IOI_SYMBOLS;
-    static const int match_matrix
-                     [sizeof symbols - 1]
-                     [sizeof symbols - 1] = {
-        { +1,  0, -3, -3, -3 },
-        {  0, +2, -2, -3, -3 },
-        { -3, -2, +3, -2, -3 },
-        { -3, -3, -2, +2,  0 },
-        { -3, -3, -3,  0, +1 }
-    };
-    int a_m = sym_map(a);
-    int b_m = sym_map(b);
+    size_t b = 0;
+    double bound = 1;
 
-    if (a_m < 0 || b_m < 0 ||
-        a_m > sizeof symbols - 1 ||
-        b_m > sizeof symbols - 1) {
-        return INT_MIN;
+    while (value > bound && b < NUM_OF_BUCKETS - 1) {
+        bound *= 2;
+        ++b;
     }
-
-    return match_matrix[a_m][b_m];
+    h->counts[b]++;
 }
 
-/* calculate similarity */
-int calc_sim(double *sim_score,
-             const char *pitch_seq_1,
-             const char *pitch_seq_2,
-             const char *ioi_seq_1,
-             const char *ioi_seq_2)
+/* output a cumulative histogram, from the first bucket counting
+ * a value to the last
+ */
+void output_histogram(FILE *fp, const struct histogram *h)
 {
-    int result = 0;
-    long pitch_sim = 0;
-    long ioi_sim = 0;
-    long max = 0;
-    size_t r = 0;
-    size_t c = 0;
-    const size_t pitch_seq_1_len = strlen(pitch_seq_1);
-    const size_t pitch_seq_2_len = strlen(pitch_seq_2);
-    const size_t ioi_seq_1_len = strlen(ioi_seq_1);
-    const size_t ioi_seq_2_len = strlen(ioi_seq_2);
-    long **matrix =
-           malloc((pitch_seq_1_len + 1) * sizeof *matrix);
-
-    if (!matrix) {
-        fprintf(stderr, "Can't allocate matrix in %s:%d\n",
-                        __FILE__, __LINE__);
-        goto bailout;
-    }
-    if (pitch_seq_1_len != ioi_seq_1_len ||
-        pitch_seq_2_len != ioi_seq_2_len ||
-        pitch_seq_1_len == 0 ||
-        pitch_seq_2_len == 0) {
-        fprintf(stderr, "Invalid parameters. "
-                        "Pitch and IOI sequences must have "
-                        "the same length.\n");
-        goto bailout;
-    }
-
-    /* allocate memory */
-    for (r = 0; r < pitch_seq_1_len + 1; ++r) {
-        matrix[r] = calloc(pitch_seq_2_len + 1,
-                           sizeof *(matrix[r]));
+    size_t first = 0;
+    size_t last = NUM_OF_BUCKETS;
+    unsigned long count = 0;
+    double bound = 1;
+    size_t b;
+
+    while (first < NUM_OF_BUCKETS && h->counts[first] == 0) {
+        ++first;
     }
-    for (r = 0; r < pitch_seq_1_len + 1; ++r) {
-        if (!matrix[r]) {
-            fprintf(stderr,
-                    "Can't allocate matrix in %s:%d\n",
-                    __FILE__, __LINE__);
-            goto bailout;
-        }
+    while (last > first && h->counts[last - 1] == 0) {
+        --last;
     }
-
-    /* align pitch sequences */
-    for(r = 1; r < pitch_seq_1_len + 1; ++r) {
-        for(c = 1; c < pitch_seq_2_len + 1; ++c) {
-            static const int m = 1;
-            static const int x = -1;
-            static const int i = -2;
-            long m_score = matrix[r - 1][c - 1] + 
-                           (pitch_seq_1[r - 1] ==
-                            pitch_seq_2[c - 1] ? m : x);
-            long i_score = lmax
-                           (matrix[r - 1][c] + i, 
-                            matrix[r][c - 1] + i);
-
-            matrix[r][c] = lmax(0, lmax(m_score, i_score));
-            max = lmax(max, matrix[r][c]);
+    for (b = 0; b < last; ++b) {
+        count += h->counts[b];
+        if (b >= first) {
+            fprintf(fp, "pioi-histogram %s le=%.0f count=%lu\n",
+                    h->name, bound, count);
         }
+        bound *= 2;
     }
-    pitch_sim = max;
-
-    /* clear matrix */
-    for (r = 0; r < pitch_seq_1_len + 1; ++r) {
-        for (c = 0; c < pitch_seq_2_len + 1; ++c) {
-            matrix[r][c] = 0;
-        }
-    }
-
-    /* align IOI sequences */
-    max = 0;
-    for(r = 1; r < ioi_seq_1_len + 1; ++r) {
-        for(c = 1; c < ioi_seq_2_len + 1; ++c) {
-            static const int i = -2;
-            long m_score = matrix[r - 1][c - 1] +
-                           mx(pitch_seq_1[r - 1],
-                              pitch_seq_2[c - 1]);
-            long i_score = lmax
-                           (matrix[r - 1][c] + i, 
-                            matrix[r][c - 1] + i);
-
-            matrix[r][c] = lmax(0, lmax(m_score, i_score));
-            max = lmax(max, matrix[r][c]);
-        }
-    }
-    ioi_sim = max;
-
-    /* calculate the resultant */
-    *sim_score = R2 * pitch_sim * pitch_sim +
-                 ioi_sim * ioi_sim;
-    result = 1;
-bailout:
-    if (matrix) {
-        for (r = 0; r < pitch_seq_1_len + 1; ++r) {
-            free(matrix[r]);
-        }
-    }
-    free(matrix);
-    return result;
 }
 
-/* query the collection */
-int query_coll(FILE *coll_fp, struct answers *answers,
-               char *query_pitch_seq, char *query_ioi_seq)
+/* output what answering a query took */
+void output_stats(FILE *fp, const struct query *query)
 {
-    int result = 0;
-    char *coll_line = NULL;
-    size_t coll_line_len = 0;
-
-    if (!(coll_fp && answers &&
-          query_pitch_seq && query_ioi_seq)) {
-        goto bail_out;
-    }
-
-    while ((coll_line =
-            oakpark_get_line(coll_fp, &coll_line_len)) !=
-           NULL) {
-        char *answer_title = NULL;
-        char *answer_pitch_seq = NULL;
-        char *answer_ioi_seq = NULL;
-        double sim_score = 0;
-
-        coll_line[coll_line_len - 1] = '\0';
-        /* validate and parse collection answer */
-        if (!parse_seq(coll_line, &answer_title,
-                       &answer_pitch_seq, &answer_ioi_seq)) {
-            fprintf(stderr,
-                    "Collection sequence parse failed: %s\n",
-                    coll_line);
-            break;
-        }
-
-        if (!calc_sim(&sim_score,
-                      answer_pitch_seq, query_pitch_seq,
-                      answer_ioi_seq, query_ioi_seq)) {
-            break;
-        }
-
-        if (!insert_answer(answers, answer_title, sim_score)) {
-            fprintf(stderr, "Can't insert answer %s.\n",
-                            answer_title);
-            break;
-        }
-
-        free(coll_line);
-    }
-    if (coll_line) {
-        free(coll_line);
-    }
-
-    result = 1;
-bail_out:
-    return result;
+    const struct query_stats *stats = query->stats;
+
+    fprintf(fp, "pioi-stats docs=%lu scanned=%lu skipped=%lu "
+                "cells=%.0f parse_ms=%.3f dp_ms=%.3f rank_ms=%.3f "
+                "gcups=%.3f title=%s\n",
+            stats->num_of_docs, stats->num_of_docs_scanned,
+            stats->num_of_docs - stats->num_of_docs_scanned,
+            stats->num_of_cells, 1000 * stats->parse_time,
+            1000 * stats->dp_time, 1000 * stats->rank_time,
+            stats->dp_time > 0 ?
+            stats->num_of_cells / stats->dp_time / 1e9 : 0.0,
+            query->title);
 }
 
-/* output answers */
-void output_answers(struct answers *answers)
+/* release a block of queries */
+void clear_queries(struct query *queries, size_t num_of_queries)
 {
-    struct answer *curr = answers->items +
-                          answers->num_of_answers;
+    size_t q = 0;
 
-    while (curr != answers->items) {
-        printf(" %s", (--curr)->title);
+    for (; q < num_of_queries; ++q) {
+        free(queries[q].line);
+        queries[q].line = NULL;
     }
-    printf("\n");
 }
 
 /* program entry point */
@@ -441,12 +125,35 @@ int main(int argc, char **argv)
                   num_of_answers_s ?
                   strtoul(num_of_answers_s, NULL, 10) :
                   DEFAULT_NUM_OF_ANSWERS;
-    struct answers *answers = NULL;
+    size_t query_block_size =
+           oakpark_get_env_ulong("FNM_QUERY_BLOCK_SIZE",
+                                 DEFAULT_QUERY_BLOCK_SIZE);
+    size_t coll_block_size =
+           oakpark_get_env_ulong("FNM_COLL_BLOCK_SIZE",
+                                 DEFAULT_COLL_BLOCK_SIZE);
+    struct query *queries = NULL;
+    size_t num_of_queries = 0;
+    size_t q = 0;
+    int is_eof = 0;
     FILE *coll_fp = NULL;
+    struct oakpark_reader *coll_reader = NULL;
+    struct oakpark_reader *query_reader = NULL;
+    struct coll_block coll_block;
     char *coll_fn = NULL;
     char *use_qid = NULL;
-    char *query = NULL;
-    size_t query_len = 0;
+    /* FNM_PIOI_STATS names a file to append a record per query
+     * to, or is "-" for stderr
+     */
+    const char *stats_fn = getenv("FNM_PIOI_STATS");
+    FILE *stats_fp = NULL;
+    struct query_stats *stats = NULL;
+    struct histogram time_histogram = { "time_us" };
+    struct histogram cells_histogram = { "cells" };
+    int has_histograms =
+        oakpark_get_env_ulong("FNM_PIOI_STATS_HISTOGRAMS", 0) > 0;
+
+    memset(&coll_block, 0, sizeof coll_block);
+    init_wavefront();
 
     /* validate command line argument */
     if (argc < 2) {
@@ -470,64 +177,174 @@ int main(int argc, char **argv)
         perror(coll_fn);
         goto bail_out;
     }
+    if (!(coll_reader = oakpark_open_reader(coll_fp)) ||
+        !(query_reader = oakpark_open_reader(stdin))) {
+        fprintf(stderr,
+                "Can't allocate memory for line readers in %s:%d",
+                __FILE__, __LINE__);
+        goto bail_out;
+    }
+
+    if (stats_fn && *stats_fn) {
+        if (strcmp(stats_fn, "-") == 0) {
+            stats_fp = stderr;
+        } else if (!(stats_fp = fopen(stats_fn, "a"))) {
+            fprintf(stderr, "Can't open ");
+            perror(stats_fn);
+            goto bail_out;
+        }
+    }
 
-    /* allocate memory to rank answers */
+    /* allocate memory to rank answers, one heap per query in
+     * a block
+     */
     if (n == 0) {
         n = DEFAULT_NUM_OF_ANSWERS;
     }
     num_of_answers = (n > USHRT_MAX) ? USHRT_MAX : n;
-    if (!(answers = create_answers(num_of_answers))) {
+    if (!(queries = calloc(query_block_size, sizeof *queries))) {
         fprintf(stderr,
-                "Can't allocate memory for answers in %s:%d",
+                "Can't allocate memory for queries in %s:%d",
                 __FILE__, __LINE__);
         goto bail_out;
     }
+    for (q = 0; q < query_block_size; ++q) {
+        if (!(queries[q].answers =
+              create_answers(num_of_answers))) {
+            fprintf(stderr,
+                    "Can't allocate memory for answers in %s:%d",
+                    __FILE__, __LINE__);
+            goto bail_out;
+        }
+    }
+    if (stats_fp) {
+        if (!(stats = calloc(query_block_size, sizeof *stats))) {
+            fprintf(stderr,
+                    "Can't allocate memory for stats in %s:%d",
+                    __FILE__, __LINE__);
+            goto bail_out;
+        }
+        for (q = 0; q < query_block_size; ++q) {
+            queries[q].stats = stats + q;
+        }
+    }
 
-    /* query the collection */
-    while (fprintf(stderr, "pi>\n"), fflush(stderr),
-           (query = oakpark_get_line(stdin, &query_len)) !=
-           NULL) {
-        char *pitch_seq = NULL;
-        char *ioi_seq = NULL;
-        char *query_title = NULL;
-
-        query[query_len - 1] = '\0';
-        /* validate and parse query */
-        if (!parse_seq(query, &query_title,
-                       &pitch_seq, &ioi_seq)) {
-            fprintf(stderr, "Invalid query: %s\n", query);
+    /* query the collection a block of queries at a time */
+    while (!is_eof) {
+        /* read a block of queries */
+        for (num_of_queries = 0;
+             num_of_queries < query_block_size;
+             ++num_of_queries) {
+            struct query *query = queries + num_of_queries;
+            const char *span = NULL;
+            size_t query_len = 0;
+            double start = 0;
+
+            fprintf(stderr, "pi>\n");
+            fflush(stderr);
+            if (!(span = oakpark_read_span(query_reader,
+                                           &query_len))) {
+                is_eof = 1;
+                break;
+            }
+            if (query->stats) {
+                memset(query->stats, 0, sizeof *query->stats);
+                start = stats_clock();
+            }
+            if (span[query_len - 1] == '\n') {
+                --query_len;
+            }
+            /* the query keeps its own copy of the line until its
+             * block is answered
+             */
+            if (!(query->line = malloc(query_len + 1))) {
+                fprintf(stderr,
+                        "Can't allocate memory for query in %s:%d",
+                        __FILE__, __LINE__);
+                is_eof = 1;
+                break;
+            }
+            memcpy(query->line, span, query_len);
+            query->line[query_len] = '\0';
+
+            /* validate and parse query */
+            if (!parse_seq(query->line, &query->title,
+                           &query->pitch_seq, &query->ioi_seq)) {
+                fprintf(stderr, "Invalid query: %s\n",
+                                query->line);
+                free(query->line);
+                query->line = NULL;
+                is_eof = 1;
+                break;
+            }
+            clear_answers(query->answers);
+            if (query->stats) {
+                query->stats->parse_time = stats_clock() - start;
+            }
+        }
+        if (num_of_queries == 0) {
             break;
         }
 
         /* query the collection */
-        rewind(coll_fp);
-        if (!(query_coll(coll_fp, answers,
-                         pitch_seq, ioi_seq))) {
-            fprintf(stderr, "Pitch query \"%s\" and "
-                            "IOI query \"%s\" failed\n",
-                            pitch_seq, ioi_seq);
-            break;
+        oakpark_rewind_reader(coll_reader);
+        if (!(query_coll(coll_reader, &coll_block, coll_block_size,
+                         queries, num_of_queries))) {
+            fprintf(stderr, "Query block of %lu queries "
+                            "failed\n",
+                            (unsigned long)num_of_queries);
+            clear_queries(queries, num_of_queries);
+            goto bail_out;
         }
 
         /* present answers */
-        if (use_qid) {
-            printf("%s", query_title);
+        for (q = 0; q < num_of_queries; ++q) {
+            if (use_qid) {
+                printf("%s", queries[q].title);
+            }
+            output_answers(queries[q].answers);
+        }
+        fflush(stdout);
+        for (q = 0; stats_fp && q < num_of_queries; ++q) {
+            const struct query_stats *st = queries[q].stats;
+
+            output_stats(stats_fp, queries + q);
+            add_to_histogram(&time_histogram,
+                             1e6 * (st->parse_time + st->dp_time +
+                                    st->rank_time));
+            add_to_histogram(&cells_histogram, st->num_of_cells);
+        }
+        if (stats_fp) {
+            fflush(stats_fp);
         }
-        output_answers(answers);
 
         /* clean up */
-        free(query);
+        clear_queries(queries, num_of_queries);
     }
-    if (query) {
-        free(query);
+
+    if (stats_fp && has_histograms) {
+        output_histogram(stats_fp, &time_histogram);
+        output_histogram(stats_fp, &cells_histogram);
     }
 
     /* no error, so exit with success status */
     result = EXIT_SUCCESS;
 bail_out:
+    if (stats_fp && stats_fp != stderr) {
+        fclose(stats_fp);
+    }
+    free(stats);
+    destroy_coll_block(&coll_block);
+    oakpark_close_reader(query_reader);
+    oakpark_close_reader(coll_reader);
     if (coll_fp) {
         fclose(coll_fp);
     }
-    destroy_answers(answers);
+    if (queries) {
+        for (q = 0; q < query_block_size; ++q) {
+            destroy_answers(queries[q].answers);
+        }
+    }
+    free(queries);
     return result;
 }
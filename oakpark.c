@@ -34,18 +34,48 @@ OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
 SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
+#ifdef OAKPARK_USE_MMAP
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <limits.h>
 #include <assert.h>
+#ifdef OAKPARK_USE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 #include "oakpark.h"
 
 #ifndef OAKPARK_BUF_SIZE
 #define OAKPARK_BUF_SIZE 1024
 #endif
 
+#ifndef OAKPARK_READER_BUF_SIZE
+#define OAKPARK_READER_BUF_SIZE 65536
+#endif
+
+struct oakpark_reader
+{ FILE * ins;
+  /* the stream mapped in memory, if any */
+  char * map;
+  size_t map_size;
+  size_t map_pos;
+  /* buffered bytes of the stream are buf[buf_start..buf_end) */
+  char * buf;
+  size_t buf_size;
+  size_t buf_start;
+  size_t buf_end;
+  int is_eof;
+  /* copy of the last line for oakpark_read_line() */
+  char * line;
+  size_t line_size;
+  };
+
 /*
 function: oakpark_get_line
 parameter: FILE *: input stream
@@ -451,3 +481,429 @@ s may be NULL. If it is, NULL is returned.
 char * oakpark_upperize_dup_str(char * s)
 { return dup_str(s, toupper);
   }
+
+/*
+function: map_stream
+parameter: r: reader
+purpose: maps the rest of a regular file in memory, leaving
+         r->map NULL if it can't be done
+*/
+static void map_stream(struct oakpark_reader * r)
+{
+#ifdef OAKPARK_USE_MMAP
+  struct stat st;
+  long pos = ftell(r->ins);
+  void * map;
+
+  if(pos < 0 || fstat(fileno(r->ins), &st) != 0 ||
+     !S_ISREG(st.st_mode) || st.st_size <= pos ||
+     (size_t)st.st_size != (unsigned long)st.st_size)
+  { return;
+    }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+             fileno(r->ins), 0);
+  if(map == MAP_FAILED)
+  { return;
+    }
+  r->map = map;
+  r->map_size = st.st_size;
+  r->map_pos = pos;
+#else
+  (void)r;
+#endif
+  }
+
+struct oakpark_reader * oakpark_open_reader(FILE * ins)
+{ struct oakpark_reader * r;
+
+  assert(ins != NULL);
+  r = calloc(1, sizeof *r);
+  if(!r)
+  { return NULL;
+    }
+  r->ins = ins;
+  map_stream(r);
+  return r;
+  }
+
+void oakpark_close_reader(struct oakpark_reader * r)
+{ if(!r)
+  { return;
+    }
+#ifdef OAKPARK_USE_MMAP
+  if(r->map)
+  { munmap(r->map, r->map_size);
+    }
+#endif
+  free(r->buf);
+  free(r->line);
+  free(r);
+  }
+
+int oakpark_rewind_reader(struct oakpark_reader * r)
+{ assert(r != NULL);
+  if(r->map)
+  { r->map_pos = 0;
+    return 1;
+    }
+  rewind(r->ins);
+  r->buf_start = r->buf_end = 0;
+  r->is_eof = 0;
+  return !ferror(r->ins);
+  }
+
+/*
+function: fill_buf
+parameter: r: reader
+return: 0 on failure or at the end of the stream
+        1 if more bytes have been buffered
+purpose: moves the buffered bytes to the start of the buffer,
+         doubling it if it is full, and reads more. fgets() is
+         used so that interactive streams are read a line at a
+         time.
+*/
+static int fill_buf(struct oakpark_reader * r)
+{ size_t n;
+
+  if(r->is_eof)
+  { return 0;
+    }
+  if(r->buf_start > 0)
+  { memmove(r->buf, r->buf + r->buf_start,
+            r->buf_end - r->buf_start);
+    r->buf_end -= r->buf_start;
+    r->buf_start = 0;
+    }
+  if(r->buf_size - r->buf_end < 2)
+  { size_t new_size = r->buf_size ?
+                      r->buf_size * 2 : OAKPARK_READER_BUF_SIZE;
+    char * temp;
+
+    if(new_size < r->buf_size || new_size > INT_MAX)
+    { return 0;
+      }
+    temp = realloc(r->buf, new_size);
+    if(!temp)
+    { return 0;
+      }
+    r->buf = temp;
+    r->buf_size = new_size;
+    }
+  if(!fgets(r->buf + r->buf_end, (int)(r->buf_size - r->buf_end),
+            r->ins))
+  { r->is_eof = 1;
+    return 0;
+    }
+  n = strlen(r->buf + r->buf_end);
+  r->buf_end += n;
+  return n > 0;
+  }
+
+const char * oakpark_read_span(struct oakpark_reader * r,
+                               size_t * len)
+{ const char * line;
+  const char * nl;
+
+  assert(r != NULL && len != NULL);
+  if(r->map)
+  { size_t remaining = r->map_size - r->map_pos;
+
+    if(remaining == 0)
+    { return NULL;
+      }
+    line = r->map + r->map_pos;
+    nl = memchr(line, '\n', remaining);
+    *len = nl ? (size_t)(nl - line) + 1 : remaining;
+    r->map_pos += *len;
+    return line;
+    }
+  /* look for the end of the line in the buffered bytes, reading
+     more of them until it is found
+   */
+  { size_t scanned = 0;
+
+    for(;;)
+    { size_t buffered = r->buf_end - r->buf_start;
+
+      nl = buffered > scanned ?
+           memchr(r->buf + r->buf_start + scanned, '\n',
+                  buffered - scanned) :
+           NULL;
+      if(nl)
+      { break;
+        }
+      scanned = buffered;
+      if(!fill_buf(r))
+      { break;
+        }
+      }
+    line = r->buf + r->buf_start;
+    if(nl)
+    { *len = (size_t)(nl - line) + 1;
+      }
+    else
+    { *len = r->buf_end - r->buf_start;
+      if(*len == 0)
+      { return NULL;
+        }
+      }
+    r->buf_start += *len;
+    return line;
+    }
+  }
+
+char * oakpark_read_line(struct oakpark_reader * r, size_t * len)
+{ size_t span_len;
+  const char * span = oakpark_read_span(r, &span_len);
+
+  if(!span)
+  { return NULL;
+    }
+  if(span_len + 1 > r->line_size)
+  { size_t new_size = r->line_size ?
+                      r->line_size : OAKPARK_BUF_SIZE + 1;
+    char * temp;
+
+    while(new_size < span_len + 1)
+    { new_size *= 2;
+      }
+    temp = realloc(r->line, new_size);
+    if(!temp)
+    { return NULL;
+      }
+    r->line = temp;
+    r->line_size = new_size;
+    }
+  memcpy(r->line, span, span_len);
+  r->line[span_len] = '\0';
+  if(len)
+  { *len = span_len;
+    }
+  return r->line;
+  }
+
+#ifndef OAKPARK_ARENA_CHUNK_SIZE
+#define OAKPARK_ARENA_CHUNK_SIZE 65536
+#endif
+
+#define OAKPARK_INTERN_SEED 5381UL
+#define OAKPARK_INTERN_MIN_SLOTS 256
+
+/* an object with the strictest alignment */
+union oakpark_align
+{ long l;
+  double d;
+  void * p;
+  void (*f)(void);
+  };
+
+struct oakpark_chunk
+{ struct oakpark_chunk * next;
+  size_t size;
+  /* the memory of the chunk starts here */
+  union oakpark_align data;
+  };
+
+struct oakpark_arena
+{ size_t chunk_size;
+  struct oakpark_chunk * head;
+  struct oakpark_chunk * curr;
+  size_t used;
+  };
+
+struct oakpark_intern
+{ struct oakpark_arena * arena;
+  const char ** slots;
+  size_t num_of_slots;
+  size_t num_of_strs;
+  };
+
+struct oakpark_arena * oakpark_create_arena(size_t chunk_size)
+{ struct oakpark_arena * a = calloc(1, sizeof *a);
+
+  if(!a)
+  { return NULL;
+    }
+  a->chunk_size = chunk_size ? chunk_size : OAKPARK_ARENA_CHUNK_SIZE;
+  return a;
+  }
+
+void * oakpark_arena_alloc(struct oakpark_arena * a, size_t size)
+{ const size_t align = sizeof(union oakpark_align);
+  struct oakpark_chunk * chunk;
+  size_t chunk_size;
+
+  assert(a != NULL);
+  /* round the size up to keep the next allocation aligned */
+  if(size == 0)
+  { size = 1;
+    }
+  if(size > (size_t)-1 - align)
+  { return NULL;
+    }
+  size = (size + align - 1) / align * align;
+  /* carve from the current chunk, or from the next one kept by
+     a reset
+   */
+  while(a->curr)
+  { if(a->curr->size - a->used >= size)
+    { void * p = (char *)&a->curr->data + a->used;
+
+      a->used += size;
+      return p;
+      }
+    if(!a->curr->next)
+    { break;
+      }
+    a->curr = a->curr->next;
+    a->used = 0;
+    }
+  chunk_size = size > a->chunk_size ? size : a->chunk_size;
+  if(chunk_size > (size_t)-1 - sizeof *chunk)
+  { return NULL;
+    }
+  chunk = malloc(sizeof *chunk - sizeof chunk->data + chunk_size);
+  if(!chunk)
+  { return NULL;
+    }
+  chunk->size = chunk_size;
+  chunk->next = NULL;
+  if(a->curr)
+  { a->curr->next = chunk;
+    }
+  else
+  { a->head = chunk;
+    }
+  a->curr = chunk;
+  a->used = size;
+  return &chunk->data;
+  }
+
+char * oakpark_arena_dup_mem(struct oakpark_arena * a,
+                             const char * s, size_t len)
+{ char * result;
+
+  if(len == (size_t)-1)
+  { return NULL;
+    }
+  result = oakpark_arena_alloc(a, len + 1);
+  if(result)
+  { memcpy(result, s, len);
+    result[len] = '\0';
+    }
+  return result;
+  }
+
+void oakpark_reset_arena(struct oakpark_arena * a)
+{ assert(a != NULL);
+  a->curr = a->head;
+  a->used = 0;
+  }
+
+void oakpark_destroy_arena(struct oakpark_arena * a)
+{ struct oakpark_chunk * chunk;
+
+  if(!a)
+  { return;
+    }
+  chunk = a->head;
+  while(chunk)
+  { struct oakpark_chunk * next = chunk->next;
+
+    free(chunk);
+    chunk = next;
+    }
+  free(a);
+  }
+
+struct oakpark_intern * oakpark_create_intern(void)
+{ struct oakpark_intern * t = calloc(1, sizeof *t);
+
+  if(!t)
+  { return NULL;
+    }
+  t->arena = oakpark_create_arena(0);
+  t->slots = calloc(OAKPARK_INTERN_MIN_SLOTS, sizeof *t->slots);
+  if(!t->arena || !t->slots)
+  { oakpark_destroy_intern(t);
+    return NULL;
+    }
+  t->num_of_slots = OAKPARK_INTERN_MIN_SLOTS;
+  return t;
+  }
+
+/*
+nonpublic function: find_slot
+return: pointer to the slot holding s, or to the empty slot where
+        s belongs
+notes:
+Slots are probed linearly. The number of slots is a power of 2.
+*/
+static const char ** find_slot(const char ** slots,
+                               size_t num_of_slots, const char * s)
+{ size_t h = oakpark_hash_str((char *)s, num_of_slots - 1,
+                              OAKPARK_INTERN_SEED);
+
+  while(slots[h] && strcmp(slots[h], s) != 0)
+  { h = (h + 1) & (num_of_slots - 1);
+    }
+  return slots + h;
+  }
+
+const char * oakpark_intern_str(struct oakpark_intern * t,
+                                const char * s)
+{ const char ** slot;
+
+  assert(t != NULL && s != NULL);
+  /* keep the table at most 3/4 full */
+  if((t->num_of_strs + 1) * 4 > t->num_of_slots * 3)
+  { size_t num_of_slots = t->num_of_slots * 2;
+    const char ** slots = calloc(num_of_slots, sizeof *slots);
+    size_t c;
+
+    if(!slots)
+    { return NULL;
+      }
+    for(c = 0; c < t->num_of_slots; c++)
+    { if(t->slots[c])
+      { *find_slot(slots, num_of_slots, t->slots[c]) =
+        t->slots[c];
+        }
+      }
+    free((void *)t->slots);
+    t->slots = slots;
+    t->num_of_slots = num_of_slots;
+    }
+  slot = find_slot(t->slots, t->num_of_slots, s);
+  if(!*slot)
+  { if(!(*slot = oakpark_arena_dup_mem(t->arena, s, strlen(s))))
+    { return NULL;
+      }
+    t->num_of_strs++;
+    }
+  return *slot;
+  }
+
+void oakpark_reset_intern(struct oakpark_intern * t)
+{ assert(t != NULL);
+  oakpark_reset_arena(t->arena);
+  memset((void *)t->slots, 0, t->num_of_slots * sizeof *t->slots);
+  t->num_of_strs = 0;
+  }
+
+void oakpark_destroy_intern(struct oakpark_intern * t)
+{ if(!t)
+  { return;
+    }
+  oakpark_destroy_arena(t->arena);
+  free((void *)t->slots);
+  free(t);
+  }
+
+unsigned long oakpark_get_env_ulong(const char * name,
+                                    unsigned long default_value)
+{ const char * s = getenv(name);
+  unsigned long n = s ? strtoul(s, NULL, 10) : 0;
+
+  return n > 0 ? n : default_value;
+  }
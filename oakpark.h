@@ -161,4 +161,171 @@ return: NULL on failure
 */
 char * oakpark_upperize_dup_str(char * s);
 
+/*
+line reader: reads the lines of a stream into one reusable
+buffer that grows geometrically. If oakpark is compiled with
+OAKPARK_USE_MMAP defined on a POSIX system, the lines of a
+regular file are handed out as spans of the file mapped in
+memory instead. The stream must not be read by other means
+while a reader is open on it.
+*/
+struct oakpark_reader;
+
+/*
+function: oakpark_open_reader
+parameter: ins: input stream, positioned at the first line to
+                read
+return: NULL: on failure
+        pointer to the reader on success. It should be closed
+        with oakpark_close_reader().
+*/
+struct oakpark_reader * oakpark_open_reader(FILE * ins);
+
+/*
+function: oakpark_close_reader
+parameter: r: reader (can be NULL)
+notes:
+The stream itself is not closed.
+*/
+void oakpark_close_reader(struct oakpark_reader * r);
+
+/*
+function: oakpark_rewind_reader
+parameter: r: reader
+return: 0 on failure
+        1 on success
+notes:
+Like rewind(), the next line read is the first line of the
+stream.
+*/
+int oakpark_rewind_reader(struct oakpark_reader * r);
+
+/*
+function: oakpark_read_span
+parameter: r: reader
+           len: pointer to the object to store the length of
+                the line, including its ending '\n' if any
+return: NULL: at the end of the stream or on failure
+        pointer to the line on success. The line is not
+        '\0'-terminated, must not be modified, and is only valid
+        until the next read from r.
+*/
+const char * oakpark_read_span(struct oakpark_reader * r,
+                               size_t * len);
+
+/*
+function: oakpark_read_line
+parameter: r: reader
+           len: pointer to the object to store the length of
+                of the line (can be NULL if not needed)
+return: NULL: at the end of the stream or on failure
+        pointer to the string on success, as returned by
+        oakpark_get_line(). It is owned by r and is only valid
+        until the next read from r, but may be modified.
+*/
+char * oakpark_read_line(struct oakpark_reader * r, size_t * len);
+
+/*
+arena: a bump allocator. Memory is carved out of large chunks
+and is only released all at once, by oakpark_reset_arena() or
+oakpark_destroy_arena().
+*/
+struct oakpark_arena;
+
+/*
+function: oakpark_create_arena
+parameter: chunk_size: size of the chunks memory is carved out
+                       of, 0 for the default
+return: NULL: on failure
+        pointer to the arena on success
+*/
+struct oakpark_arena * oakpark_create_arena(size_t chunk_size);
+
+/*
+function: oakpark_arena_alloc
+parameter: a: arena
+           size: number of bytes to allocate
+return: NULL: on failure
+        pointer to the memory on success, suitably aligned for
+        any object. It is valid until a is reset or destroyed.
+*/
+void * oakpark_arena_alloc(struct oakpark_arena * a, size_t size);
+
+/*
+function: oakpark_arena_dup_mem
+parameter: a: arena
+           s: bytes to copy
+           len: number of bytes to copy
+return: NULL: on failure
+        pointer to a '\0'-terminated copy of the len bytes of s
+        on success
+*/
+char * oakpark_arena_dup_mem(struct oakpark_arena * a,
+                             const char * s, size_t len);
+
+/*
+function: oakpark_reset_arena
+parameter: a: arena
+notes:
+Everything allocated from a is released at once. The chunks
+are kept to be reused.
+*/
+void oakpark_reset_arena(struct oakpark_arena * a);
+
+/*
+function: oakpark_destroy_arena
+parameter: a: arena (can be NULL)
+*/
+void oakpark_destroy_arena(struct oakpark_arena * a);
+
+/*
+interning table: keeps one copy of every distinct string put in
+it, hashed with oakpark_hash_str(), in an arena of its own
+*/
+struct oakpark_intern;
+
+/*
+function: oakpark_create_intern
+return: NULL: on failure
+        pointer to the table on success
+*/
+struct oakpark_intern * oakpark_create_intern(void);
+
+/*
+function: oakpark_intern_str
+parameter: t: table
+           s: string to intern
+return: NULL: on failure
+        pointer to the copy of s held by t on success. Equal
+        strings give the same pointer. It is valid until t is
+        reset or destroyed.
+*/
+const char * oakpark_intern_str(struct oakpark_intern * t,
+                                const char * s);
+
+/*
+function: oakpark_reset_intern
+parameter: t: table
+notes:
+Every string interned in t is released at once. The memory of
+the table is kept to be reused.
+*/
+void oakpark_reset_intern(struct oakpark_intern * t);
+
+/*
+function: oakpark_destroy_intern
+parameter: t: table (can be NULL)
+*/
+void oakpark_destroy_intern(struct oakpark_intern * t);
+
+/*
+function: oakpark_get_env_ulong
+parameter: name: name of the environment variable
+           default_value: value if the variable is unset, or not
+                          a positive number
+return: the value of the variable
+*/
+unsigned long oakpark_get_env_ulong(const char * name,
+                                    unsigned long default_value);
+
 #endif